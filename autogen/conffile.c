@@ -4,7 +4,9 @@
  * You may not use this file except in compliance with the License.
  */
 #include <uk/config.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <utime.h>
@@ -21,10 +23,21 @@
  */
 long uk_syscall_r_open(long, long, long);
 long uk_syscall_r_close(long);
+long uk_syscall_r_read(long, long, long);
 long uk_syscall_r_write(long, long, long);
 long uk_syscall_r_chmod(long, long);
 long uk_syscall_r_mkdir(long, long);
 long uk_syscall_r_stat(long, long);
+#if CONFIG_APPELFLOADER_AUTOGEN_RAMFS
+long uk_syscall_r_mount(long, long, long, long, long);
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_RAMFS */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_RAMFS
+/* Mount points of cf_mount_pseudofs() */
+#define CF_NMOUNTS 4
+
+static const char *cf_mounts[CF_NMOUNTS];
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_RAMFS */
 
 int cf_mkdir(const char *dpath, mode_t dmode)
 {
@@ -60,6 +73,62 @@ int cf_mkdir(const char *dpath, mode_t dmode)
 	return 1;
 }
 
+int cf_mkdirs(const char *dpath, mode_t dmode)
+{
+	char path[PATH_MAX];
+	char *sep;
+	int rc;
+
+	if (unlikely(strlen(dpath) >= sizeof(path)))
+		return -ENAMETOOLONG;
+	strcpy(path, dpath);
+
+	for (sep = strchr(path + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+		*sep = '\0';
+		rc = cf_mkdir(path, dmode);
+		*sep = '/';
+		if (unlikely(rc < 0))
+			return rc;
+	}
+	return cf_mkdir(path, dmode);
+}
+
+#if CONFIG_APPELFLOADER_AUTOGEN_RAMFS
+int cf_mount_pseudofs(const char *dpath)
+{
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < CF_NMOUNTS && cf_mounts[i]; ++i)
+		if (strcmp(cf_mounts[i], dpath) == 0)
+			return 0;
+	if (unlikely(i == CF_NMOUNTS))
+		return -ENOMEM;
+
+	rc = cf_mkdirs(dpath, 0555);
+	if (unlikely(rc < 0))
+		return rc;
+	rc = (int) uk_syscall_r_mount((long) "", (long) dpath, (long) "ramfs",
+				      0, 0);
+	if (unlikely(rc < 0)) {
+		uk_pr_err("%s: Failed to mount ramfs: %s (%d)\n",
+			  dpath, strerror(-rc), -rc);
+		return rc;
+	}
+	uk_pr_debug("%s: Mounted ramfs\n", dpath);
+	cf_mounts[i] = dpath;
+	return 0;
+}
+#else /* !CONFIG_APPELFLOADER_AUTOGEN_RAMFS */
+int cf_mount_pseudofs(const char *dpath)
+{
+	int rc;
+
+	rc = cf_mkdirs(dpath, 0555);
+	return (rc < 0) ? rc : 0;
+}
+#endif /* !CONFIG_APPELFLOADER_AUTOGEN_RAMFS */
+
 int cf_create(const char *fpath, mode_t fmode)
 {
 	struct stat st;
@@ -98,6 +167,7 @@ int cf_create(const char *fpath, mode_t fmode)
 	if (unlikely(rc < 0)) {
 		uk_pr_err("%s: Failed to chmod: %s (%d)\n",
 			  fpath, strerror(-rc), -rc);
+		cf_close(fd);
 		return rc;
 	}
 
@@ -174,3 +244,133 @@ int cf_strncpy(int fd, const char *strbuf, size_t maxlen)
 
 	return cf_write(fd, strbuf, len);
 }
+
+static int cf_bgrow(struct cf_buf *b, size_t len)
+{
+	size_t size;
+	char *data;
+
+	if (likely(b->len + len + 1 <= b->size))
+		return 0;
+	size = b->size ? b->size : 256;
+	while (size < b->len + len + 1)
+		size *= 2;
+	data = realloc(b->data, size);
+	if (unlikely(!data))
+		return -ENOMEM;
+	b->data = data;
+	b->size = size;
+	return 0;
+}
+
+int cf_bprintf(struct cf_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+	int rc;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len <= 0)
+		return len;
+
+	rc = cf_bgrow(b, (size_t)len);
+	if (unlikely(rc < 0))
+		return rc;
+
+	va_start(ap, fmt);
+	vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+	va_end(ap);
+	b->len += (size_t)len;
+	return 0;
+}
+
+int cf_bstrcpy(struct cf_buf *b, const char *strbuf)
+{
+	size_t len;
+	int rc;
+
+	len = strlen(strbuf);
+	rc = cf_bgrow(b, len);
+	if (unlikely(rc < 0))
+		return rc;
+	memcpy(b->data + b->len, strbuf, len + 1);
+	b->len += len;
+	return 0;
+}
+
+void cf_bfree(struct cf_buf *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = 0;
+	b->size = 0;
+}
+
+#if CONFIG_APPELFLOADER_AUTOGEN_REPLACEEXIST
+/* Returns 1 if the file has exactly the given content */
+static int cf_same(const char *fpath, const char *buf, size_t buflen)
+{
+	char cmp[256];
+	struct stat st;
+	ssize_t rc;
+	int same = 0;
+	int fd;
+
+	if (stat(fpath, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    (size_t)st.st_size != buflen)
+		return 0;
+
+	fd = (int) uk_syscall_r_open((long) fpath, (long) O_RDONLY, 0);
+	if (unlikely(fd < 0))
+		return 0;
+	while (buflen > 0) {
+		rc = (ssize_t) uk_syscall_r_read((long) fd, (long) cmp,
+						 (long) MIN(buflen, sizeof(cmp)));
+		if (rc == -EINTR || rc == -EAGAIN)
+			continue;
+		if (rc <= 0 || memcmp(cmp, buf, (size_t)rc) != 0)
+			goto out;
+		buflen -= rc;
+		buf    += rc;
+	}
+	same = 1;
+
+out:
+	cf_close(fd);
+	return same;
+}
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_REPLACEEXIST */
+
+int cf_put(const char *fpath, mode_t fmode, const char *buf, size_t buflen)
+{
+	int fd;
+	int rc;
+
+#if CONFIG_APPELFLOADER_AUTOGEN_REPLACEEXIST
+	if (cf_same(fpath, buf, buflen)) {
+		uk_pr_debug("%s: Up to date\n", fpath);
+		return 0;
+	}
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_REPLACEEXIST */
+
+	fd = cf_create(fpath, fmode);
+#if CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST
+	if (fd == -EEXIST)
+		return 0;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST */
+	if (fd == -EROFS) {
+		uk_pr_warn("%s: Read-only filesystem, skipped\n", fpath);
+		return 0;
+	}
+	if (unlikely(fd < 0))
+		return fd;
+
+	rc = cf_write(fd, buf, buflen);
+	if (unlikely(rc < 0))
+		uk_pr_err("%s: Failed to write: %s (%d)\n",
+			  fpath, strerror(-rc), -rc);
+	cf_close(fd);
+	return rc;
+}
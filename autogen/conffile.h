@@ -29,6 +29,28 @@
  */
 int cf_mkdir(const char *dpath, mode_t dmode);
 
+/**
+ * Creates a directory and its missing parent directories
+ *
+ * @param dpath Absolute path to directory to create
+ * @param dmode The permission mode of created directories
+ * @return 0 if the directory already existed, 1 if it was created,
+ *         a negative errno value in case of errors
+ */
+int cf_mkdirs(const char *dpath, mode_t dmode);
+
+/**
+ * Provides the directory for generated pseudo files (/proc, /sys)
+ * The directory is created if needed. With `CONFIG_APPELFLOADER_AUTOGEN_RAMFS`,
+ * a ramfs is mounted on it, so that the files are kept in memory instead of
+ * being written to the root filesystem. A directory is only mounted once;
+ * later calls for the same path return immediately.
+ *
+ * @param dpath Absolute path to the directory
+ * @return 0 on success, a negative errno value in case of errors
+ */
+int cf_mount_pseudofs(const char *dpath);
+
 /**
  * Creates/overwrites a configuration file
  * The behavior of this function in respect of already existing files is
@@ -111,4 +133,56 @@ int cf_strncpy(int fd, const char *strbuf, size_t maxlen);
  */
 void cf_close(int fd);
 
+/*
+ * Configuration files can be rendered into a memory buffer first, so that
+ * they are written with a single write operation.
+ */
+struct cf_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+#define CF_BUF_INITIALIZER { NULL, 0, 0 }
+
+/**
+ * Append a formatted string to a buffer
+ *
+ * @param b Buffer, grown as needed
+ * @param fmt Format string (see `printf()`)
+ * @param ... Additional arguments depending on the format string
+ * @return 0 on success, a negative errno code in case of errors
+ */
+int cf_bprintf(struct cf_buf *b, const char *fmt, ...) __printf(2, 3);
+
+/**
+ * Append a '\0'-terminated C-string to a buffer
+ *
+ * @param b Buffer, grown as needed
+ * @param strbuf Reference to '\0'-terminated string
+ * @return 0 on success, a negative errno code in case of errors
+ */
+int cf_bstrcpy(struct cf_buf *b, const char *strbuf);
+
+/**
+ * Release the memory of a buffer
+ * @param b Buffer to release
+ */
+void cf_bfree(struct cf_buf *b);
+
+/**
+ * Creates/overwrites a configuration file with the given content
+ * Like `cf_create()`, but with `CONFIG_APPELFLOADER_AUTOGEN_REPLACEEXIST`,
+ * an existing file that has the same content is not written again. If the
+ * filesystem is read-only, a warning is emitted and the file is skipped.
+ *
+ * @param fpath Path to file to create/overwrite
+ * @param fmode The file permission mode in case the file is created
+ * @param buf Content of the file
+ * @param buflen Number of bytes of content
+ * @return 0 on success or if the file was skipped,
+ *         a negative errno code in case of errors
+ */
+int cf_put(const char *fpath, mode_t fmode, const char *buf, size_t buflen);
+
 #endif /* APPELFLOADER_CONFFILE_H */
@@ -73,19 +73,11 @@ static int gen_etc_resolvconf(const char *fpath, mode_t fmode)
 {
 	int rc = 0;
 #if CONFIG_APPELFLOADER_AUTOGEN_ETCRESOLVCONF
+	struct cf_buf b = CF_BUF_INITIALIZER;
 	struct uk_netdev *nd;
 	const char *primary_domain;
 	const char *einfo;
 	unsigned int i;
-	int fd;
-
-	fd = cf_create(fpath, fmode);
-#if CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST
-	if (fd == -EEXIST)
-		return 0;
-#endif /* CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST */
-	if (unlikely(fd < 0))
-		return fd;
 
 	/* nameservers */
 	for (i = 0; i < uk_netdev_count(); i++) {
@@ -95,14 +87,14 @@ static int gen_etc_resolvconf(const char *fpath, mode_t fmode)
 
 		einfo = uk_netdev_einfo_get(nd, UK_NETDEV_IPV4_DNS0);
 		if (einfo && einfo[0] != '\0') {
-			rc = cf_nprintf(fd, 128, "nameserver %s\n", einfo);
+			rc = cf_bprintf(&b, "nameserver %s\n", einfo);
 			if (unlikely(rc < 0))
 				goto out;
 		}
 
 		einfo = uk_netdev_einfo_get(nd, UK_NETDEV_IPV4_DNS1);
 		if (einfo && einfo[0] != '\0') {
-			rc = cf_nprintf(fd, 128, "nameserver %s\n", einfo);
+			rc = cf_bprintf(&b, "nameserver %s\n", einfo);
 			if (unlikely(rc < 0))
 				goto out;
 		}
@@ -120,7 +112,7 @@ static int gen_etc_resolvconf(const char *fpath, mode_t fmode)
 		 * domain that we can also use as search domain. So, it is safe
 		 * to start the line with the "search" keyword already.
 		 */
-		rc = cf_strcpy(fd, "search");
+		rc = cf_bstrcpy(&b, "search");
 		if (unlikely(rc < 0))
 			goto out;
 		for (i = 0; i < uk_netdev_count(); i++) {
@@ -130,24 +122,25 @@ static int gen_etc_resolvconf(const char *fpath, mode_t fmode)
 
 			einfo = uk_netdev_einfo_get(nd, UK_NETDEV_IPV4_DOMAIN);
 			if (einfo && einfo[0] != '\0') {
-				rc = cf_nprintf(fd, 128, " %s", einfo);
+				rc = cf_bprintf(&b, " %s", einfo);
 				if (unlikely(rc < 0))
 					goto out;
 			}
 		}
-		rc = cf_strcpy(fd, "\n");
+		rc = cf_bstrcpy(&b, "\n");
 		if (unlikely(rc < 0))
 			goto out;
 
 		/* primary domain */
-		rc = cf_nprintf(fd, 128, "domain %s\n", primary_domain);
+		rc = cf_bprintf(&b, "domain %s\n", primary_domain);
 		if (unlikely(rc < 0))
 			goto out;
 	}
-	rc = 0;
+
+	rc = cf_put(fpath, fmode, b.data, b.len);
 
 out:
-	cf_close(fd);
+	cf_bfree(&b);
 #endif /* CONFIG_APPELFLOADER_AUTOGEN_ETCRESOLVCONF */
 	return rc;
 }
@@ -156,24 +149,16 @@ static int gen_etc_hosts(const char *fpath, mode_t fmode)
 {
 	int rc = 0;
 #if CONFIG_APPELFLOADER_AUTOGEN_ETCHOSTS
+	struct cf_buf b = CF_BUF_INITIALIZER;
 	struct uk_netdev *nd;
 	const char *ip4;
 	const char *domain;
 	const char *hostname;
 	unsigned int i;
-	int fd;
-
-	fd = cf_create(fpath, fmode);
-#if CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST
-	if (fd == -EEXIST)
-		return 0;
-#endif /* CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST */
-	if (unlikely(fd < 0))
-		return fd;
 
 #if CONFIG_APPELFLOADER_AUTOGEN_ETCHOSTS_LOCALHOST4
 	/* entry for localhost */
-	rc = cf_strcpy(fd, "127.0.0.1\tlocalhost\n");
+	rc = cf_bstrcpy(&b, "127.0.0.1\tlocalhost\n");
 	if (unlikely(rc < 0))
 		goto out;
 #endif /* CONFIG_APPELFLOADER_AUTOGEN_ETCHOSTS_LOCALHOST4 */
@@ -191,21 +176,21 @@ static int gen_etc_hosts(const char *fpath, mode_t fmode)
 			continue; /* no hostname, skip interface */
 		domain = uk_netdev_einfo_get(nd, UK_NETDEV_IPV4_DOMAIN);
 		if (!domain || domain[0] == '\0') {
-			rc = cf_nprintf(fd, 128, "%s\t%s\n", ip4, hostname);
+			rc = cf_bprintf(&b, "%s\t%s\n", ip4, hostname);
 			if (unlikely(rc < 0))
 				goto out;
 		} else {
-			rc = cf_nprintf(fd, 128, "%s\t%s %s.%s\n",
+			rc = cf_bprintf(&b, "%s\t%s %s.%s\n",
 					ip4, hostname, hostname, domain);
 			if (unlikely(rc < 0))
 				goto out;
 		}
 	}
 
-	rc = 0;
+	rc = cf_put(fpath, fmode, b.data, b.len);
 
 out:
-	cf_close(fd);
+	cf_bfree(&b);
 #endif /* CONFIG_APPELFLOADER_AUTOGEN_ETCHOSTS */
 	return rc;
 }
@@ -214,9 +199,9 @@ static int gen_etc_hostname(const char *fpath, mode_t fmode)
 {
 	int rc = 0;
 #if CONFIG_APPELFLOADER_AUTOGEN_ETCHOSTNAME
+	struct cf_buf b = CF_BUF_INITIALIZER;
 	struct uk_netdev *nd;
 	const char *hostname;
-	int fd;
 
 	/* Detect a primary hostname */
 	hostname = NULL;
@@ -230,18 +215,10 @@ static int gen_etc_hostname(const char *fpath, mode_t fmode)
 		return 0;
 	}
 
-	fd = cf_create(fpath, fmode);
-#if CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST
-	if (fd == -EEXIST)
-		return 0;
-#endif /* CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST */
-	if (unlikely(fd < 0))
-		return fd;
-	rc = cf_nprintf(fd, 128, "%s\n", hostname);
-	if (likely(rc > 0))
-		rc = 0;
-
-	cf_close(fd);
+	rc = cf_bprintf(&b, "%s\n", hostname);
+	if (likely(rc >= 0))
+		rc = cf_put(fpath, fmode, b.data, b.len);
+	cf_bfree(&b);
 #endif /* CONFIG_APPELFLOADER_AUTOGEN_ETCHOSTNAME */
 	return rc;
 }
@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+/*
+ * Generates /etc/ld.so.cache in the format of glibc's dynamic loader
+ * ("glibc-ld.so.cache1.1"), so that DT_NEEDED libraries are resolved with a
+ * single cache lookup instead of probing the default library directories.
+ * A cache that is shipped with the root filesystem (e.g., created with
+ * `ldconfig -r <rootfs>` at build time) is kept unless the autogen policy
+ * replaces existing files.
+ */
+#include <uk/config.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#include "conffile.h"
+
+#define LDSOCACHE_MAGIC		"glibc-ld.so.cache"
+#define LDSOCACHE_VERSION	"1.1"
+#define LDSOCACHE_ENDIAN_LITTLE	2
+
+/* Entry flags, see glibc's sysdeps/generic/ldconfig.h */
+#define LDSOCACHE_FLAG_ELF_LIBC6	0x0003
+#define LDSOCACHE_FLAG_X8664_LIB64	0x0300
+#define LDSOCACHE_FLAG_AARCH64_LIB64	0x0a00
+
+#if CONFIG_ARCH_X86_64
+#define LDSOCACHE_MACHINE	EM_X86_64
+#define LDSOCACHE_FLAGS		(LDSOCACHE_FLAG_ELF_LIBC6 | \
+				 LDSOCACHE_FLAG_X8664_LIB64)
+#elif CONFIG_ARCH_ARM_64
+#define LDSOCACHE_MACHINE	EM_AARCH64
+#define LDSOCACHE_FLAGS		(LDSOCACHE_FLAG_ELF_LIBC6 | \
+				 LDSOCACHE_FLAG_AARCH64_LIB64)
+#else
+#error "Unsupported machine type"
+#endif
+
+struct ldsocache_header {
+	char magic[sizeof(LDSOCACHE_MAGIC) - 1];
+	char version[sizeof(LDSOCACHE_VERSION) - 1];
+	__u32 nlibs;
+	__u32 len_strings;
+	__u8 flags;
+	__u8 pad[3];
+	__u32 extension_offset;
+	__u32 unused[3];
+} __packed;
+
+struct ldsocache_entry {
+	__s32 flags;
+	__u32 key;		/* file offset of the library name */
+	__u32 value;		/* file offset of the full path */
+	__u32 osversion;
+	__u64 hwcap;
+} __packed;
+
+UK_CTASSERT(sizeof(struct ldsocache_header) == 48);
+UK_CTASSERT(sizeof(struct ldsocache_entry) == 24);
+
+struct ldsocache_lib {
+	char *name;
+	char *path;
+	unsigned int prio;	/* index of the directory */
+};
+
+struct ldsocache {
+	struct ldsocache_lib *libs;
+	unsigned int nlibs;
+	unsigned int maxlibs;
+	size_t len_strings;
+};
+
+/*
+ * Compares library names like glibc's `_dl_cache_libcmp()`: sequences of
+ * digits are compared numerically
+ */
+static int ldsocache_libcmp(const char *p1, const char *p2)
+{
+	int val1, val2;
+
+	while (*p1 != '\0') {
+		if (*p1 >= '0' && *p1 <= '9') {
+			if (!(*p2 >= '0' && *p2 <= '9'))
+				return 1;
+			val1 = *p1++ - '0';
+			val2 = *p2++ - '0';
+			while (*p1 >= '0' && *p1 <= '9')
+				val1 = val1 * 10 + *p1++ - '0';
+			while (*p2 >= '0' && *p2 <= '9')
+				val2 = val2 * 10 + *p2++ - '0';
+			if (val1 != val2)
+				return val1 - val2;
+		} else if (*p2 >= '0' && *p2 <= '9') {
+			return -1;
+		} else if (*p1 != *p2) {
+			return *p1 - *p2;
+		} else {
+			++p1;
+			++p2;
+		}
+	}
+	return *p1 - *p2;
+}
+
+/*
+ * The loader does a binary search on entries that are sorted in descending
+ * order. For equal names, the library of the first directory comes first.
+ */
+static int ldsocache_lib_cmp(const void *a, const void *b)
+{
+	const struct ldsocache_lib *la = a;
+	const struct ldsocache_lib *lb = b;
+	int rc;
+
+	rc = ldsocache_libcmp(lb->name, la->name);
+	if (rc)
+		return rc;
+	return (int)la->prio - (int)lb->prio;
+}
+
+/*
+ * Returns true if the file is a shared object for this machine
+ */
+static bool ldsocache_isdso(const char *path)
+{
+	Elf64_Ehdr ehdr;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	len = pread(fd, &ehdr, sizeof(ehdr), 0);
+	close(fd);
+
+	return len == (ssize_t)sizeof(ehdr) &&
+	       memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+	       ehdr.e_ident[EI_CLASS] == ELFCLASS64 &&
+	       ehdr.e_type == ET_DYN &&
+	       ehdr.e_machine == LDSOCACHE_MACHINE;
+}
+
+static int ldsocache_add(struct ldsocache *c, const char *dir,
+			 const char *name, unsigned int prio)
+{
+	struct ldsocache_lib *libs;
+	struct ldsocache_lib *lib;
+	size_t dlen = strlen(dir);
+	size_t nlen = strlen(name);
+
+	if (c->nlibs == c->maxlibs) {
+		c->maxlibs = c->maxlibs ? c->maxlibs * 2 : 64;
+		libs = realloc(c->libs, c->maxlibs * sizeof(*libs));
+		if (unlikely(!libs))
+			return -ENOMEM;
+		c->libs = libs;
+	}
+	lib = &c->libs[c->nlibs];
+	lib->name = malloc(nlen + 1 + dlen + 1 + nlen + 1);
+	if (unlikely(!lib->name))
+		return -ENOMEM;
+	memcpy(lib->name, name, nlen + 1);
+	lib->path = lib->name + nlen + 1;
+	snprintf(lib->path, dlen + 1 + nlen + 1, "%s/%s", dir, name);
+	lib->prio = prio;
+	c->nlibs++;
+	return 0;
+}
+
+static int ldsocache_scan_dir(struct ldsocache *c, const char *dir,
+			      unsigned int prio)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *d;
+	int rc = 0;
+
+	d = opendir(dir);
+	if (!d) {
+		uk_pr_debug("%s: Skipping library directory: %s (%d)\n",
+			    dir, strerror(errno), errno);
+		return 0;
+	}
+
+	while ((de = readdir(d))) {
+		/* Same candidates as ldconfig: names containing ".so" */
+		if (de->d_type == DT_DIR || !strstr(de->d_name, ".so"))
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name)
+		    >= (int)sizeof(path))
+			continue;
+		if (!ldsocache_isdso(path))
+			continue;
+		rc = ldsocache_add(c, dir, de->d_name, prio);
+		if (unlikely(rc < 0))
+			break;
+	}
+	closedir(d);
+	return rc;
+}
+
+/*
+ * Sorts the libraries and drops names that are shadowed by a library of the
+ * same name in an earlier directory
+ */
+static void ldsocache_sort(struct ldsocache *c)
+{
+	unsigned int i, n = 0;
+
+	qsort(c->libs, c->nlibs, sizeof(*c->libs), ldsocache_lib_cmp);
+	c->len_strings = 0;
+	for (i = 0; i < c->nlibs; ++i) {
+		if (n && strcmp(c->libs[n - 1].name, c->libs[i].name) == 0) {
+			free(c->libs[i].name);
+			continue;
+		}
+		c->libs[n++] = c->libs[i];
+		c->len_strings += strlen(c->libs[i].name) + 1 +
+				  strlen(c->libs[i].path) + 1;
+	}
+	c->nlibs = n;
+}
+
+/*
+ * Renders the cache file into a single buffer
+ */
+static char *ldsocache_render(struct ldsocache *c, size_t *len)
+{
+	struct ldsocache_header *hdr;
+	struct ldsocache_entry *ent;
+	size_t slen, off;
+	unsigned int i;
+	char *buf;
+
+	off = sizeof(*hdr) + c->nlibs * sizeof(*ent);
+	*len = off + c->len_strings;
+	buf = calloc(1, *len);
+	if (unlikely(!buf))
+		return NULL;
+
+	hdr = (struct ldsocache_header *)buf;
+	memcpy(hdr->magic, LDSOCACHE_MAGIC, sizeof(hdr->magic));
+	memcpy(hdr->version, LDSOCACHE_VERSION, sizeof(hdr->version));
+	hdr->nlibs = c->nlibs;
+	hdr->len_strings = (__u32)c->len_strings;
+	hdr->flags = LDSOCACHE_ENDIAN_LITTLE;
+
+	/* String offsets are relative to the start of the file */
+	ent = (struct ldsocache_entry *)(hdr + 1);
+	for (i = 0; i < c->nlibs; ++i, ++ent) {
+		ent->flags = LDSOCACHE_FLAGS;
+
+		slen = strlen(c->libs[i].name) + 1;
+		memcpy(buf + off, c->libs[i].name, slen);
+		ent->key = (__u32)off;
+		off += slen;
+
+		slen = strlen(c->libs[i].path) + 1;
+		memcpy(buf + off, c->libs[i].path, slen);
+		ent->value = (__u32)off;
+		off += slen;
+	}
+	UK_ASSERT(off == *len);
+	return buf;
+}
+
+static int gen_ldsocache(struct uk_init_ctx *ictx __unused)
+{
+	const char *fpath = "/etc/ld.so.cache";
+	struct ldsocache c = { NULL, 0, 0, 0 };
+	char dirs[] = CONFIG_APPELFLOADER_AUTOGEN_LDSOCACHE_DIRS;
+	char *dir, *next;
+	unsigned int prio = 0;
+	unsigned int i;
+	size_t len;
+	char *buf;
+	int fd;
+	int rc;
+
+	rc = cf_mkdir("/etc", 0755);
+	if (unlikely(rc < 0))
+		return rc;
+
+	fd = cf_create(fpath, 0644);
+#if CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST
+	if (fd == -EEXIST)
+		return 0;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_SKIPEXIST */
+	if (unlikely(fd < 0))
+		return fd;
+
+	for (dir = dirs; dir; dir = next) {
+		next = strchr(dir, ':');
+		if (next)
+			*next++ = '\0';
+		if (dir[0] != '/')
+			continue;
+		rc = ldsocache_scan_dir(&c, dir, prio++);
+		if (unlikely(rc < 0))
+			goto out;
+	}
+	ldsocache_sort(&c);
+
+	buf = ldsocache_render(&c, &len);
+	if (unlikely(!buf)) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	rc = cf_write(fd, buf, len);
+	free(buf);
+	if (likely(rc >= 0))
+		uk_pr_info("%s: %u libraries\n", fpath, c.nlibs);
+
+out:
+	cf_close(fd);
+	for (i = 0; i < c.nlibs; ++i)
+		free(c.libs[i].name);
+	free(c.libs);
+	if (unlikely(rc < 0)) {
+		uk_pr_err("%s: Failed to generate: %s (%d)\n",
+			  fpath, strerror(-rc), -rc);
+		unlink(fpath);
+	}
+	return rc;
+}
+
+uk_sys_initcall(gen_ldsocache, 0x0);
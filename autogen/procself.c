@@ -0,0 +1,473 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libelf.h>
+#include <uk/arch/limits.h>
+#include <uk/essentials.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+#include <uk/syscall.h>
+#if CONFIG_LIBUKVMEM
+#include <uk/list.h>
+#include <uk/vmem.h>
+#endif /* CONFIG_LIBUKVMEM */
+
+#include "conffile.h"
+#include "procself.h"
+#include "elf_prog.h"
+#include "exit.h"
+#include "syscalls/brk.h"
+
+/* Provide syscall prototypes in case they are not defined by
+ * <uk/syscall.h>, see conffile.c
+ */
+long uk_syscall_r_open(long, long, long);
+long uk_syscall_r_rename(long, long);
+long uk_syscall_r_unlink(long);
+long uk_syscall_r_rmdir(long);
+
+#if CONFIG_APPELFLOADER_VDSO
+extern char *vdso_image_addr;
+#endif /* CONFIG_APPELFLOADER_VDSO */
+
+/* Column of the path in /proc/<pid>/maps, like Linux on 64-bit */
+#define PROCSELF_MAPS_PATHCOL	73
+
+struct procself_proc {
+	int pid;
+	const struct elf_prog *prog;
+	__uptr stack;
+	__sz stack_len;
+	void *auxv;		/* copy of the auxiliary vector */
+	__sz auxv_len;
+	struct procself_proc *next;
+};
+
+/* Serializes the registry and the regeneration of files */
+static struct uk_mutex procself_lock = UK_MUTEX_INITIALIZER(procself_lock);
+static struct procself_proc *procself_procs;
+static int procself_last = -1;	/* owner of the /proc/self/ snapshot */
+
+struct procself_map {
+	__uptr start;
+	__uptr end;
+	unsigned int prot;	/* PF_R, PF_W, PF_X */
+	__u64 off;
+	const char *name;
+};
+
+struct procself_maps {
+	struct procself_map *map;
+	__sz num;
+	__sz size;
+};
+
+static int maps_add(struct procself_maps *m, __uptr start, __uptr end,
+		    unsigned int prot, __u64 off, const char *name)
+{
+	struct procself_map *map;
+	__sz size;
+
+	if (start >= end)
+		return 0;
+	if (m->num == m->size) {
+		size = m->size ? m->size * 2 : 16;
+		map = realloc(m->map, size * sizeof(*map));
+		if (unlikely(!map))
+			return -ENOMEM;
+		m->map = map;
+		m->size = size;
+	}
+	m->map[m->num++] = (struct procself_map) {
+		.start = start,
+		.end = end,
+		.prot = prot,
+		.off = off,
+		.name = name,
+	};
+	return 0;
+}
+
+static int maps_cmp(const void *a, const void *b)
+{
+	const struct procself_map *ma = a;
+	const struct procself_map *mb = b;
+
+	if (ma->start != mb->start)
+		return ma->start < mb->start ? -1 : 1;
+	return 0;
+}
+
+/* One entry per PT_LOAD segment, taken from the in-memory program headers */
+static int maps_add_prog(struct procself_maps *m, const struct elf_prog *prog)
+{
+	const char *name = prog->path ? prog->path : prog->name;
+	__uptr vabase = (__uptr)prog->vabase;
+	const Elf64_Phdr *phdr;
+	__uptr start, end;
+	__sz i;
+	int rc;
+
+	if (!prog->vabase)
+		return 0;
+	if (prog->phdr.entsize != sizeof(*phdr) ||
+	    prog->phdr.off + prog->phdr.num * sizeof(*phdr) > prog->upperl) {
+		/* Program headers are not mapped, report the whole image */
+		return maps_add(m, vabase, vabase + prog->valen,
+				PF_R | PF_W | PF_X, 0, name);
+	}
+
+	phdr = (const Elf64_Phdr *)(vabase + prog->phdr.off);
+	for (i = 0; i < prog->phdr.num; ++i) {
+		if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0)
+			continue;
+		start = PAGE_ALIGN_DOWN(vabase + phdr[i].p_vaddr);
+		end = PAGE_ALIGN_UP(vabase + phdr[i].p_vaddr
+				    + phdr[i].p_memsz);
+		rc = maps_add(m, start, end,
+			      phdr[i].p_flags & (PF_R | PF_W | PF_X),
+			      PAGE_ALIGN_DOWN(phdr[i].p_offset), name);
+		if (unlikely(rc < 0))
+			return rc;
+	}
+	return 0;
+}
+
+#if CONFIG_APPELFLOADER_VDSO
+/* The vDSO is an ELF image that ends with its section headers */
+static __sz vdso_len(const void *img)
+{
+	const Elf64_Ehdr *ehdr = img;
+	const Elf64_Phdr *phdr;
+	__sz len;
+	__sz i;
+
+	len = ehdr->e_shoff + (__sz)ehdr->e_shnum * ehdr->e_shentsize;
+	phdr = (const Elf64_Phdr *)((__uptr)img + ehdr->e_phoff);
+	for (i = 0; i < ehdr->e_phnum; ++i)
+		if (phdr[i].p_type == PT_LOAD)
+			len = MAX(len, (__sz)(phdr[i].p_offset
+					      + phdr[i].p_filesz));
+	return len;
+}
+#endif /* CONFIG_APPELFLOADER_VDSO */
+
+#if CONFIG_LIBUKVMEM
+/*
+ * Adds the parts of the address space areas that are not covered by the
+ * entries `m->map[0..known-1]` (sorted), e.g., mappings of the application
+ * or of libraries that the dynamic loader mapped
+ */
+static int maps_add_vmas(struct procself_maps *m, __sz known)
+{
+	struct uk_vas *vas = uk_vas_get_active();
+	struct uk_vma *vma;
+	unsigned int prot;
+	__uptr cur;
+	__sz i;
+	int rc;
+
+	if (!vas)
+		return 0;
+	uk_list_for_each_entry(vma, &vas->vma_list, vma_list) {
+		prot = ((vma->attr & PAGE_ATTR_PROT_READ) ? PF_R : 0)
+		     | ((vma->attr & PAGE_ATTR_PROT_WRITE) ? PF_W : 0)
+		     | ((vma->attr & PAGE_ATTR_PROT_EXEC) ? PF_X : 0);
+		cur = vma->start;
+		for (i = 0; i < known && cur < vma->end; ++i) {
+			if (m->map[i].end <= cur)
+				continue;
+			if (m->map[i].start >= vma->end)
+				break;
+			rc = maps_add(m, cur, m->map[i].start, prot, 0, NULL);
+			if (unlikely(rc < 0))
+				return rc;
+			cur = MAX(cur, m->map[i].end);
+		}
+		rc = maps_add(m, cur, vma->end, prot, 0, NULL);
+		if (unlikely(rc < 0))
+			return rc;
+	}
+	return 0;
+}
+#endif /* CONFIG_LIBUKVMEM */
+
+static int procself_render_maps(const struct procself_proc *p,
+				struct cf_buf *b)
+{
+	struct procself_maps m = { NULL, 0, 0 };
+	const struct procself_map *e;
+	void *heap;
+	__sz heap_len;
+	__sz line;
+	__sz i;
+	int pad;
+	int rc;
+
+	rc = maps_add_prog(&m, p->prog);
+	if (unlikely(rc < 0))
+		goto out;
+	if (p->prog->interp.prog) {
+		rc = maps_add_prog(&m, p->prog->interp.prog);
+		if (unlikely(rc < 0))
+			goto out;
+	}
+	if (brk_region(p->pid, &heap, &heap_len) == 0 && heap_len) {
+		rc = maps_add(&m, (__uptr)heap,
+			      PAGE_ALIGN_UP((__uptr)heap + heap_len),
+			      PF_R | PF_W, 0, "[heap]");
+		if (unlikely(rc < 0))
+			goto out;
+	}
+	rc = maps_add(&m, p->stack, p->stack + p->stack_len,
+		      PF_R | PF_W, 0, "[stack]");
+	if (unlikely(rc < 0))
+		goto out;
+#if CONFIG_APPELFLOADER_VDSO
+	rc = maps_add(&m, PAGE_ALIGN_DOWN((__uptr)vdso_image_addr),
+		      PAGE_ALIGN_UP((__uptr)vdso_image_addr
+				    + vdso_len(vdso_image_addr)),
+		      PF_R | PF_X, 0, "[vdso]");
+	if (unlikely(rc < 0))
+		goto out;
+#endif /* CONFIG_APPELFLOADER_VDSO */
+#if CONFIG_LIBUKVMEM
+	qsort(m.map, m.num, sizeof(*m.map), maps_cmp);
+	rc = maps_add_vmas(&m, m.num);
+	if (unlikely(rc < 0))
+		goto out;
+#endif /* CONFIG_LIBUKVMEM */
+	qsort(m.map, m.num, sizeof(*m.map), maps_cmp);
+
+	for (i = 0; i < m.num; ++i) {
+		e = &m.map[i];
+		line = b->len;
+		rc = cf_bprintf(b, "%08lx-%08lx %c%c%cp %08"PRIx64" 00:00 0 ",
+				(unsigned long)e->start, (unsigned long)e->end,
+				(e->prot & PF_R) ? 'r' : '-',
+				(e->prot & PF_W) ? 'w' : '-',
+				(e->prot & PF_X) ? 'x' : '-',
+				(uint64_t)e->off);
+		if (unlikely(rc < 0))
+			goto out;
+		if (e->name) {
+			pad = PROCSELF_MAPS_PATHCOL - (int)(b->len - line);
+			rc = cf_bprintf(b, "%*s%s", MAX(pad, 1), "", e->name);
+			if (unlikely(rc < 0))
+				goto out;
+		}
+		rc = cf_bstrcpy(b, "\n");
+		if (unlikely(rc < 0))
+			goto out;
+	}
+
+out:
+	free(m.map);
+	return rc;
+}
+
+/* Writes a file of /proc/<pid>/ (`pid` >= 0) or /proc/self/ (`pid` < 0) */
+static int procself_write(int pid, const char *name,
+			  const void *buf, __sz buflen)
+{
+	char path[32];
+	char tmp[40];
+	int fd;
+	int rc;
+
+	if (pid < 0)
+		snprintf(path, sizeof(path), "/proc/self/%s", name);
+	else
+		snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	/* Readers that opened the old file keep reading it */
+	fd = (int) uk_syscall_r_open((long) tmp,
+				     (long) O_CREAT|O_WRONLY|O_TRUNC, 0444);
+	if (unlikely(fd < 0)) {
+		rc = fd;
+		goto err;
+	}
+	rc = cf_write(fd, buf, buflen);
+	cf_close(fd);
+	if (unlikely(rc < 0))
+		goto err_unlink;
+	rc = (int) uk_syscall_r_rename((long) tmp, (long) path);
+	if (unlikely(rc < 0))
+		goto err_unlink;
+	return 0;
+
+err_unlink:
+	uk_syscall_r_unlink((long) tmp);
+err:
+	uk_pr_err("%s: Failed to generate: %s (%d)\n",
+		  path, strerror(-rc), -rc);
+	return rc;
+}
+
+static __sz procself_auxv_len(const void *auxv, __sz len)
+{
+	const long *e = auxv;
+	__sz i;
+
+	/* Pairs of key and value, up to and including AT_NULL */
+	for (i = 0; i + 1 < len / sizeof(long); i += 2)
+		if (e[i] == 0)
+			return (i + 2) * sizeof(long);
+	return len / (2 * sizeof(long)) * (2 * sizeof(long));
+}
+
+static int procself_gen(const struct procself_proc *p, int pid,
+			const char *name)
+{
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	int rc;
+
+	if (!strcmp(name, "auxv"))
+		return procself_write(pid, name, p->auxv, p->auxv_len);
+
+	rc = procself_render_maps(p, &b);
+	if (likely(rc >= 0))
+		rc = procself_write(pid, name, b.data, b.len);
+	cf_bfree(&b);
+	return rc;
+}
+
+static struct procself_proc *procself_find(int pid)
+{
+	struct procself_proc *p;
+
+	for (p = procself_procs; p; p = p->next)
+		if (p->pid == pid)
+			return p;
+	return NULL;
+}
+
+void procself_attach(int pid, const struct elf_prog *prog,
+		     void *stack, __sz stack_len)
+{
+	struct procself_proc *p;
+	char dpath[24];
+	int rc;
+
+	p = calloc(1, sizeof(*p));
+	if (unlikely(!p))
+		goto err;
+	p->auxv_len = procself_auxv_len(prog->auxv, prog->auxv_len);
+	p->auxv = malloc(p->auxv_len);
+	if (unlikely(!p->auxv))
+		goto err_free_p;
+	memcpy(p->auxv, prog->auxv, p->auxv_len);
+	p->pid = pid;
+	p->prog = prog;
+	p->stack = (__uptr)stack;
+	p->stack_len = stack_len;
+
+	snprintf(dpath, sizeof(dpath), "/proc/%d", pid);
+	uk_mutex_lock(&procself_lock);
+	p->next = procself_procs;
+	procself_procs = p;
+	rc = cf_mount_pseudofs("/proc");
+	if (likely(rc >= 0))
+		rc = cf_mkdir(dpath, 0555);
+	if (likely(rc >= 0))
+		rc = cf_mkdir("/proc/self", 0555);
+	if (likely(rc >= 0))
+		rc = procself_gen(p, pid, "auxv");
+	if (likely(rc >= 0))
+		rc = procself_gen(p, pid, "maps");
+	if (likely(rc >= 0))
+		rc = procself_gen(p, -1, "auxv");
+	if (likely(rc >= 0))
+		rc = procself_gen(p, -1, "maps");
+	if (likely(rc >= 0))
+		procself_last = pid;
+	uk_mutex_unlock(&procself_lock);
+	return;
+
+err_free_p:
+	free(p);
+err:
+	uk_pr_err("%s: Cannot generate /proc/%d files: %s (%d)\n",
+		  prog->name, pid, strerror(ENOMEM), ENOMEM);
+}
+
+void procself_detach(int pid)
+{
+	struct procself_proc **prev, *p = NULL;
+	char path[32];
+
+	uk_mutex_lock(&procself_lock);
+	for (prev = &procself_procs; *prev; prev = &(*prev)->next) {
+		if ((*prev)->pid == pid) {
+			p = *prev;
+			*prev = p->next;
+			break;
+		}
+	}
+	if (!p) {
+		uk_mutex_unlock(&procself_lock);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+	uk_syscall_r_unlink((long) path);
+	snprintf(path, sizeof(path), "/proc/%d/auxv", pid);
+	uk_syscall_r_unlink((long) path);
+	snprintf(path, sizeof(path), "/proc/%d", pid);
+	uk_syscall_r_rmdir((long) path);
+	if (procself_last == pid) {
+		uk_syscall_r_unlink((long) "/proc/self/maps");
+		uk_syscall_r_unlink((long) "/proc/self/auxv");
+		procself_last = -1;
+	}
+	uk_mutex_unlock(&procself_lock);
+
+	free(p->auxv);
+	free(p);
+}
+
+int procself_open(long nr, const long args[6], long *ret)
+{
+	const char *name;
+	struct procself_proc *p;
+	long nargs[6];
+	char path[32];
+	int pid;
+	int rc;
+	int i;
+
+#ifdef SYS_open
+	i = (nr == SYS_open) ? 0 : 1;
+#else /* !SYS_open */
+	i = 1;
+#endif /* !SYS_open */
+	name = (const char *)args[i] + sizeof("/proc/self/") - 1;
+	if (strcmp(name, "maps") && strcmp(name, "auxv"))
+		return 0;
+
+	/* Unknown processes get the snapshot in /proc/self/ */
+	pid = elf_exit_pid_current();
+	uk_mutex_lock(&procself_lock);
+	p = procself_find(pid);
+	rc = p ? procself_gen(p, pid, name) : -ENOENT;
+	uk_mutex_unlock(&procself_lock);
+	if (rc < 0)
+		return 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+	memcpy(nargs, args, sizeof(nargs));
+	nargs[i] = (long)path;
+	*ret = uk_syscall6_r(nr, nargs[0], nargs[1], nargs[2],
+			     nargs[3], nargs[4], nargs[5]);
+	return 1;
+}
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_PROCSELF_H
+#define APPELFLOADER_PROCSELF_H
+
+#include <uk/config.h>
+#include <string.h>
+#include <uk/essentials.h>
+#include <uk/syscall.h>
+
+#include "elf_prog.h"
+
+/*
+ * Process information files: /proc/<pid>/maps and /proc/<pid>/auxv
+ *
+ * The files are generated from the loaded images of a started application
+ * (program and interpreter segments), its stack, its brk heap and, with
+ * ukvmem, the remaining mappings of the address space. `auxv` contains the
+ * auxiliary vector that elf_ctx_init() pushed on the stack.
+ *
+ * Opening `/proc/self/maps` or `/proc/self/auxv` through an entry that is
+ * provided by elfloader (direct system calls, vDSO) regenerates the file of
+ * the calling process and opens it instead. System calls that trap into the
+ * system call shim see `/proc/self/` files that were written when the most
+ * recent application was started.
+ */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCSELF
+/**
+ * Registers a started application and writes its files
+ *
+ * @param pid:
+ *   Process ID, see elf_exit_pid_current()
+ * @param prog:
+ *   Program, initialized with elf_ctx_init(); must stay valid until
+ *   procself_detach()
+ * @param stack:
+ *   Lowest address of the application stack
+ * @param stack_len:
+ *   Length of the application stack
+ */
+void procself_attach(int pid, const struct elf_prog *prog,
+		     void *stack, __sz stack_len);
+
+/**
+ * Removes the files of a terminated application
+ */
+void procself_detach(int pid);
+
+/**
+ * Implements `open` and `openat` of `/proc/self/{maps,auxv}`, returns
+ * non-zero if the path referred to one of these files
+ */
+int procself_open(long nr, const long args[6], long *ret);
+
+/*
+ * System call hook for elf_syscall6(): returns non-zero if it handled the
+ * system call and stored the result in `*ret`.
+ */
+static inline int procself_syscall_pre(long nr, const long args[6],
+				       long *ret)
+{
+	const char *path;
+
+	switch (nr) {
+#ifdef SYS_open
+	case SYS_open:
+		path = (const char *)args[0];
+		break;
+#endif /* SYS_open */
+	case SYS_openat:
+		path = (const char *)args[1];
+		break;
+	default:
+		return 0;
+	}
+
+	if (likely(!path || strncmp(path, "/proc/self/", 11) != 0))
+		return 0;
+	return procself_open(nr, args, ret);
+}
+#else /* !CONFIG_APPELFLOADER_AUTOGEN_PROCSELF */
+#define procself_attach(pid, prog, stack, stack_len) do {} while (0)
+#define procself_detach(pid) do { (void)(pid); } while (0)
+#define procself_syscall_pre(nr, args, ret) 0
+#endif /* !CONFIG_APPELFLOADER_AUTOGEN_PROCSELF */
+
+#endif /* APPELFLOADER_PROCSELF_H */
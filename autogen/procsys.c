@@ -0,0 +1,506 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+/*
+ * Generates the /proc and /sys files that language runtimes and libc read
+ * for sizing thread pools, heaps and arenas. Only the CPUs that the
+ * application can run on are reported: the CPUs of the placement mask with
+ * APPELFLOADER_PLACEMENT, otherwise the boot CPU. The files are a snapshot
+ * taken at boot. With APPELFLOADER_AUTOGEN_RAMFS, they live in ramfs
+ * instances that are mounted on /proc and /sys.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#if CONFIG_ARCH_X86_64
+#include <cpuid.h>
+#endif /* CONFIG_ARCH_X86_64 */
+
+#include "conffile.h"
+#include "hwcap.h"
+#include "placement/placement.h"
+
+/* cgroup v2 CPU bandwidth period (us), same default as Linux */
+#define PROCSYS_CPU_PERIOD	100000
+
+static int procsys_cpulist(struct cf_buf *b, __u64 mask)
+{
+	const char *sep = "";
+	unsigned int i = 0, j;
+	int rc;
+
+	while (i < 64) {
+		if (!(mask & (1ULL << i))) {
+			i++;
+			continue;
+		}
+		for (j = i; j + 1 < 64 && (mask & (1ULL << (j + 1))); ++j)
+			;
+		if (j == i)
+			rc = cf_bprintf(b, "%s%u", sep, i);
+		else
+			rc = cf_bprintf(b, "%s%u-%u", sep, i, j);
+		if (unlikely(rc < 0))
+			return rc;
+		sep = ",";
+		i = j + 1;
+	}
+	return cf_bstrcpy(b, "\n");
+}
+
+static int procsys_write(const char *fpath, struct cf_buf *b)
+{
+	int rc;
+
+	rc = cf_put(fpath, 0444, b->data, b->len);
+	cf_bfree(b);
+	return rc;
+}
+
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCCPU
+#if CONFIG_ARCH_X86_64
+/* Linux: arch/x86/include/asm/cpufeatures.h */
+static const char *const x86_flags_1_edx[32] = {
+	"fpu", "vme", "de", "pse", "tsc", "msr", "pae", "mce",
+	"cx8", "apic", NULL, "sep", "mtrr", "pge", "mca", "cmov",
+	"pat", "pse36", "pn", "clflush", NULL, "dts", "acpi", "mmx",
+	"fxsr", "sse", "sse2", "ss", "ht", "tm", "ia64", "pbe",
+};
+
+static const char *const x86_flags_1_ecx[32] = {
+	"pni", "pclmulqdq", "dtes64", "monitor", "ds_cpl", "vmx", "smx", "est",
+	"tm2", "ssse3", "cid", "sdbg", "fma", "cx16", "xtpr", "pdcm",
+	NULL, "pcid", "dca", "sse4_1", "sse4_2", "x2apic", "movbe", "popcnt",
+	"tsc_deadline_timer", "aes", "xsave", NULL, "avx", "f16c", "rdrand",
+	"hypervisor",
+};
+
+static const char *const x86_flags_7_ebx[32] = {
+	"fsgsbase", "tsc_adjust", "sgx", "bmi1", "hle", "avx2", NULL, "smep",
+	"bmi2", "erms", "invpcid", "rtm", "cqm", "mpx", "rdt_a", "avx512f",
+	"avx512dq", "rdseed", "adx", "smap", "avx512ifma", NULL, "clflushopt",
+	"clwb", "intel_pt", "avx512pf", "avx512er", "avx512cd", "sha_ni",
+	"avx512bw", "avx512vl", NULL,
+};
+
+static const char *const x86_flags_81_edx[32] = {
+	[11] = "syscall", [20] = "nx", [26] = "pdpe1gb", [27] = "rdtscp",
+	[29] = "lm",
+};
+
+static const char *const x86_flags_81_ecx[32] = {
+	[0] = "lahf_lm", [5] = "abm", [6] = "sse4a", [8] = "3dnowprefetch",
+};
+
+static int procsys_flags(struct cf_buf *b, const char *const names[32],
+			 __u32 reg)
+{
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < 32; ++i) {
+		if (!(reg & (1U << i)) || !names[i])
+			continue;
+		rc = cf_bprintf(b, " %s", names[i]);
+		if (unlikely(rc < 0))
+			return rc;
+	}
+	return 0;
+}
+
+static int gen_proc_cpuinfo(const char *fpath, __u64 mask)
+{
+	const struct elf_hwcap *hw = elf_hwcap_get();
+	struct cf_buf flags = CF_BUF_INITIALIZER;
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	__u32 eax, ebx, ecx, edx;
+	__u32 brand[13] = { 0 };
+	__u32 vendor[4] = { 0 };
+	unsigned int family, model, stepping, level, maxext;
+	unsigned int mhz = 0, paddr = 0, vaddr = 0;
+	unsigned int ncpus = __builtin_popcountll(mask);
+	unsigned int i;
+	int rc;
+
+	__cpuid(0, level, vendor[0], vendor[2], vendor[1]);
+	__cpuid(1, eax, ebx, ecx, edx);
+	family = (eax >> 8) & 0xf;
+	model = (eax >> 4) & 0xf;
+	stepping = eax & 0xf;
+	if (family == 0xf)
+		family += (eax >> 20) & 0xff;
+	if (family >= 0x6)
+		model |= ((eax >> 16) & 0xf) << 4;
+
+	rc = procsys_flags(&flags, x86_flags_1_edx, edx);
+	if (likely(rc >= 0))
+		rc = procsys_flags(&flags, x86_flags_1_ecx, ecx);
+	if (unlikely(rc < 0))
+		goto out;
+	if (level >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		rc = procsys_flags(&flags, x86_flags_7_ebx, ebx);
+		if (unlikely(rc < 0))
+			goto out;
+	}
+	if (level >= 0x16) {
+		__cpuid(0x16, eax, ebx, ecx, edx);
+		mhz = eax & 0xffff;
+	}
+
+	maxext = __get_cpuid_max(0x80000000, NULL);
+	if (maxext >= 0x80000001) {
+		__cpuid(0x80000001, eax, ebx, ecx, edx);
+		rc = procsys_flags(&flags, x86_flags_81_edx, edx);
+		if (likely(rc >= 0))
+			rc = procsys_flags(&flags, x86_flags_81_ecx, ecx);
+		if (unlikely(rc < 0))
+			goto out;
+	}
+	if (maxext >= 0x80000004) {
+		for (i = 0; i < 3; ++i)
+			__cpuid(0x80000002 + i, brand[i * 4], brand[i * 4 + 1],
+				brand[i * 4 + 2], brand[i * 4 + 3]);
+	}
+	if (maxext >= 0x80000008) {
+		__cpuid(0x80000008, eax, ebx, ecx, edx);
+		paddr = eax & 0xff;
+		vaddr = (eax >> 8) & 0xff;
+	}
+
+	for (i = 0; i < 64; ++i) {
+		if (!(mask & (1ULL << i)))
+			continue;
+		rc = cf_bprintf(&b,
+				"processor\t: %u\n"
+				"vendor_id\t: %s\n"
+				"cpu family\t: %u\n"
+				"model\t\t: %u\n"
+				"model name\t: %s\n"
+				"stepping\t: %u\n",
+				i, (const char *)vendor, family, model,
+				(const char *)brand, stepping);
+		if (likely(rc >= 0) && mhz)
+			rc = cf_bprintf(&b, "cpu MHz\t\t: %u.000\n", mhz);
+		if (likely(rc >= 0))
+			rc = cf_bprintf(&b,
+					"physical id\t: 0\n"
+					"siblings\t: %u\n"
+					"core id\t\t: %u\n"
+					"cpu cores\t: %u\n"
+					"apicid\t\t: %u\n"
+					"fpu\t\t: yes\n"
+					"fpu_exception\t: yes\n"
+					"cpuid level\t: %u\n"
+					"wp\t\t: yes\n"
+					"flags\t\t:%s\n"
+					"clflush size\t: %lu\n"
+					"cache_alignment\t: %lu\n"
+					"address sizes\t: %u bits physical, %u bits virtual\n"
+					"\n",
+					ncpus, i, ncpus, i, level,
+					flags.data ? flags.data : "",
+					hw->dcache_bsize, hw->dcache_bsize,
+					paddr, vaddr);
+		if (unlikely(rc < 0))
+			goto out;
+	}
+
+	rc = procsys_write(fpath, &b);
+
+out:
+	cf_bfree(&flags);
+	cf_bfree(&b);
+	return rc;
+}
+#elif CONFIG_ARCH_ARM_64
+/* Linux: arch/arm64/kernel/cpuinfo.c */
+static const char *const arm64_hwcap_str[32] = {
+	"fp", "asimd", "evtstrm", "aes", "pmull", "sha1", "sha2", "crc32",
+	"atomics", "fphp", "asimdhp", "cpuid", "asimdrdm", "jscvt", "fcma",
+	"lrcpc", "dcpop", "sha3", "sm3", "sm4", "asimddp", "sha512", "sve",
+	"asimdfhm", "dit", "uscat", "ilrcpc", "flagm", "ssbs", "sb", "paca",
+	"pacg",
+};
+
+static const char *const arm64_hwcap2_str[17] = {
+	"dcpodp", "sve2", "sveaes", "svepmull", "svebitperm", "svesha3",
+	"svesm4", "flagm2", "frint", "svei8mm", "svef32mm", "svef64mm",
+	"svebf16", "i8mm", "bf16", "dgh", "rng",
+};
+
+static int gen_proc_cpuinfo(const char *fpath, __u64 mask)
+{
+	const struct elf_hwcap *hw = elf_hwcap_get();
+	struct cf_buf flags = CF_BUF_INITIALIZER;
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	__u64 midr, cntfrq;
+	unsigned int i;
+	int rc = 0;
+
+	__asm__ __volatile__("mrs %0, midr_el1" : "=r"(midr));
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(cntfrq));
+
+	for (i = 0; i < 32 && rc >= 0; ++i)
+		if (hw->hwcap & (1UL << i))
+			rc = cf_bprintf(&flags, " %s", arm64_hwcap_str[i]);
+	for (i = 0; i < ARRAY_SIZE(arm64_hwcap2_str) && rc >= 0; ++i)
+		if (hw->hwcap2 & (1UL << i))
+			rc = cf_bprintf(&flags, " %s", arm64_hwcap2_str[i]);
+	if (unlikely(rc < 0))
+		goto out;
+
+	for (i = 0; i < 64; ++i) {
+		if (!(mask & (1ULL << i)))
+			continue;
+		/* Like Linux, BogoMIPS is derived from the timer frequency */
+		rc = cf_bprintf(&b,
+				"processor\t: %u\n"
+				"BogoMIPS\t: %lu.%02lu\n"
+				"Features\t:%s\n"
+				"CPU implementer\t: 0x%02lx\n"
+				"CPU architecture: 8\n"
+				"CPU variant\t: 0x%lx\n"
+				"CPU part\t: 0x%03lx\n"
+				"CPU revision\t: %lu\n"
+				"\n",
+				i, (unsigned long)(cntfrq / 500000),
+				(unsigned long)((cntfrq / 5000) % 100),
+				flags.data ? flags.data : "",
+				(unsigned long)((midr >> 24) & 0xff),
+				(unsigned long)((midr >> 20) & 0xf),
+				(unsigned long)((midr >> 4) & 0xfff),
+				(unsigned long)(midr & 0xf));
+		if (unlikely(rc < 0))
+			goto out;
+	}
+
+	rc = procsys_write(fpath, &b);
+
+out:
+	cf_bfree(&flags);
+	cf_bfree(&b);
+	return rc;
+}
+#endif /* CONFIG_ARCH_ARM_64 */
+
+static int gen_proc_stat(const char *fpath, __u64 mask)
+{
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	unsigned int i;
+	int rc;
+
+	/* Counted by libuv (`os.cpus()` in Node.js) and glibc's get_nprocs() */
+	rc = cf_bstrcpy(&b, "cpu  0 0 0 0 0 0 0 0 0 0\n");
+	for (i = 0; i < 64 && rc >= 0; ++i)
+		if (mask & (1ULL << i))
+			rc = cf_bprintf(&b, "cpu%u 0 0 0 0 0 0 0 0 0 0\n", i);
+	if (unlikely(rc < 0)) {
+		cf_bfree(&b);
+		return rc;
+	}
+	return procsys_write(fpath, &b);
+}
+
+static int gen_sys_cpu(const char *dpath, __u64 mask)
+{
+	static const char *const lists[] = { "possible", "present", "online" };
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	char path[64];
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(lists); ++i) {
+		rc = procsys_cpulist(&b, mask);
+		if (unlikely(rc < 0)) {
+			cf_bfree(&b);
+			return rc;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dpath, lists[i]);
+		rc = procsys_write(path, &b);
+		if (unlikely(rc < 0))
+			return rc;
+	}
+
+	/* Older glibc counts the cpu<n> directories for _SC_NPROCESSORS_CONF */
+	for (i = 0; i < 64; ++i) {
+		if (!(mask & (1ULL << i)))
+			continue;
+		snprintf(path, sizeof(path), "%s/cpu%u", dpath, i);
+		rc = cf_mkdir(path, 0555);
+		if (unlikely(rc < 0))
+			return rc;
+	}
+	return 0;
+}
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCCPU */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO
+static int gen_proc_meminfo(const char *fpath, const struct sysinfo *si)
+{
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	unsigned long total = si->totalram * si->mem_unit / 1024;
+	unsigned long free = si->freeram * si->mem_unit / 1024;
+	int rc;
+
+	/* There is no page cache and no swap */
+	rc = cf_bprintf(&b,
+			"MemTotal:       %8lu kB\n"
+			"MemFree:        %8lu kB\n"
+			"MemAvailable:   %8lu kB\n"
+			"Buffers:        %8lu kB\n"
+			"Cached:         %8lu kB\n"
+			"SwapCached:     %8lu kB\n"
+			"SwapTotal:      %8lu kB\n"
+			"SwapFree:       %8lu kB\n"
+			"Hugepagesize:   %8lu kB\n",
+			total, free, free, 0UL, 0UL, 0UL, 0UL, 0UL, 2048UL);
+	if (unlikely(rc < 0)) {
+		cf_bfree(&b);
+		return rc;
+	}
+	return procsys_write(fpath, &b);
+}
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_CGROUP
+static int gen_cgroup_file(const char *fpath, const char *content)
+{
+	struct cf_buf b = CF_BUF_INITIALIZER;
+	int rc;
+
+	rc = cf_bstrcpy(&b, content);
+	if (unlikely(rc < 0)) {
+		cf_bfree(&b);
+		return rc;
+	}
+	return procsys_write(fpath, &b);
+}
+
+/*
+ * The application is presented as the only member of the root of a cgroup v2
+ * hierarchy that is limited to the application CPUs and the memory of the
+ * unikernel. These are the files that the JVM, Go and libuv look up.
+ */
+static int gen_cgroup(__u64 mask, const struct sysinfo *si)
+{
+	char line[48];
+	int rc;
+
+	rc = cf_mkdirs("/proc/self", 0555);
+	if (unlikely(rc < 0))
+		return rc;
+	rc = gen_cgroup_file("/proc/self/cgroup", "0::/\n");
+	if (unlikely(rc < 0))
+		return rc;
+	rc = gen_cgroup_file("/proc/self/mountinfo",
+			     "1 0 0:1 / / rw - rootfs rootfs rw\n"
+			     "2 1 0:2 / /sys/fs/cgroup rw,nosuid,nodev,noexec - cgroup2 cgroup2 rw\n");
+	if (unlikely(rc < 0))
+		return rc;
+	rc = gen_cgroup_file("/proc/cgroups",
+			     "#subsys_name\thierarchy\tnum_cgroups\tenabled\n"
+			     "cpu\t0\t1\t1\n"
+			     "memory\t0\t1\t1\n");
+	if (unlikely(rc < 0))
+		return rc;
+
+	rc = cf_mkdirs("/sys/fs/cgroup", 0555);
+	if (unlikely(rc < 0))
+		return rc;
+	rc = gen_cgroup_file("/sys/fs/cgroup/cgroup.controllers",
+			     "cpu memory\n");
+	if (unlikely(rc < 0))
+		return rc;
+	snprintf(line, sizeof(line), "%llu %u\n",
+		 (unsigned long long)__builtin_popcountll(mask) *
+		 PROCSYS_CPU_PERIOD, PROCSYS_CPU_PERIOD);
+	rc = gen_cgroup_file("/sys/fs/cgroup/cpu.max", line);
+	if (unlikely(rc < 0))
+		return rc;
+	snprintf(line, sizeof(line), "%llu\n",
+		 (unsigned long long)si->totalram * si->mem_unit);
+	return gen_cgroup_file("/sys/fs/cgroup/memory.max", line);
+}
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_CGROUP */
+
+static int gen_procsys(struct uk_init_ctx *ictx __unused)
+{
+	__u64 mask = placement_cpumask();
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO || \
+	CONFIG_APPELFLOADER_AUTOGEN_CGROUP
+	struct sysinfo si;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO || ... */
+	int rc;
+
+#if !CONFIG_APPELFLOADER_AUTOGEN_PROCCPU && \
+	!CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO && \
+	!CONFIG_APPELFLOADER_AUTOGEN_CGROUP
+	return 0;
+#endif /* !CONFIG_APPELFLOADER_AUTOGEN_PROCCPU && ... */
+
+	rc = cf_mount_pseudofs("/proc");
+	if (unlikely(rc < 0))
+		goto out;
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCCPU || CONFIG_APPELFLOADER_AUTOGEN_CGROUP
+	rc = cf_mount_pseudofs("/sys");
+	if (unlikely(rc < 0))
+		goto out;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCCPU || ... */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO || \
+	CONFIG_APPELFLOADER_AUTOGEN_CGROUP
+	rc = sysinfo(&si);
+	if (unlikely(rc < 0)) {
+		rc = -errno;
+		goto out;
+	}
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO || ... */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCCPU
+	rc = gen_proc_cpuinfo("/proc/cpuinfo", mask);
+	if (unlikely(rc < 0))
+		goto out;
+	rc = gen_proc_stat("/proc/stat", mask);
+	if (unlikely(rc < 0))
+		goto out;
+	rc = cf_mkdirs("/sys/devices/system/cpu", 0555);
+	if (unlikely(rc < 0))
+		goto out;
+	rc = gen_sys_cpu("/sys/devices/system/cpu", mask);
+	if (unlikely(rc < 0))
+		goto out;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCCPU */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO
+	rc = gen_proc_meminfo("/proc/meminfo", &si);
+	if (unlikely(rc < 0))
+		goto out;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_PROCMEMINFO */
+
+#if CONFIG_APPELFLOADER_AUTOGEN_CGROUP
+	rc = gen_cgroup(mask, &si);
+	if (unlikely(rc < 0))
+		goto out;
+#endif /* CONFIG_APPELFLOADER_AUTOGEN_CGROUP */
+
+	uk_pr_info("Resources for the application: %u CPUs\n",
+		   __builtin_popcountll(mask));
+	rc = 0;
+out:
+	if (unlikely(rc < 0))
+		uk_pr_err("Failed to generate /proc and /sys files: %s (%d)\n",
+			  strerror(-rc), -rc);
+	return rc;
+}
+
+/* The CPU mask is known after the placement is set up */
+uk_late_initcall_prio(gen_procsys, 0x0, UK_PRIO_AFTER(PLACEMENT_INIT_PRIO));
@@ -0,0 +1,379 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <uk/arch/limits.h>
+#include <uk/essentials.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+#include <uk/syscall.h>
+
+#include "bundle.h"
+
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH		0x1000	/* Linux ABI, needs _GNU_SOURCE */
+#endif /* !AT_EMPTY_PATH */
+
+/* Device number reported by `fstat` for bundled files */
+#define BUNDLE_DEV		0x554b
+
+struct bundle_fd {
+	const struct bundle_ent *ent;	/* NULL if unused */
+	__u64 pos;
+};
+
+static const char *bundle_base;
+static const struct bundle_hdr *bundle_hdr;
+static const struct bundle_ent *bundle_ents;
+static const char *bundle_strs;
+
+static struct bundle_fd bundle_fds[BUNDLE_NFDS];
+static struct uk_mutex bundle_lock = UK_MUTEX_INITIALIZER(bundle_lock);
+
+int bundle_init(const void *img, __sz len)
+{
+	const struct bundle_hdr *hdr = img;
+	const struct bundle_ent *ents;
+	__u32 i;
+
+	if (len < sizeof(*hdr) ||
+	    memcmp(hdr->magic, BUNDLE_MAGIC, BUNDLE_MAGIC_LEN) != 0)
+		return -ENOEXEC;
+	if (unlikely(hdr->version != BUNDLE_VERSION)) {
+		uk_pr_err("Unsupported bundle version %"PRIu32"\n",
+			  hdr->version);
+		return -EINVAL;
+	}
+	if (unlikely(hdr->len > len || !hdr->nent ||
+		     hdr->entoff > hdr->len ||
+		     hdr->nent > (hdr->len - hdr->entoff) / sizeof(*ents) ||
+		     hdr->stroff >= hdr->len)) {
+		uk_pr_err("Malformed bundle header\n");
+		return -EINVAL;
+	}
+
+	ents = (const struct bundle_ent *)((const char *)img + hdr->entoff);
+	for (i = 0; i < hdr->nent; ++i) {
+		if (unlikely(ents[i].off > hdr->len ||
+			     ents[i].len > hdr->len - ents[i].off ||
+			     ents[i].path >= hdr->len - hdr->stroff ||
+			     !memchr((const char *)img + hdr->stroff
+				     + ents[i].path, '\0',
+				     hdr->len - hdr->stroff - ents[i].path))) {
+			uk_pr_err("Malformed bundle entry %"PRIu32"\n", i);
+			return -EINVAL;
+		}
+	}
+
+	bundle_base   = img;
+	bundle_hdr    = hdr;
+	bundle_ents   = ents;
+	bundle_strs   = bundle_base + hdr->stroff;
+	uk_pr_info("Bundle with %"PRIu32" files, program: %s\n",
+		   hdr->nent, bundle_strs + ents[0].path);
+	return 0;
+}
+
+static void bundle_file(const struct bundle_ent *e, struct bundle_file *f)
+{
+	__u32 i;
+
+	f->data = bundle_base + e->off;
+	f->len  = e->len;
+	f->path = bundle_strs + e->path;
+	f->mode = e->mode;
+
+	/* Aliases share the inode number of the first entry of the content */
+	for (i = 0; &bundle_ents[i] != e; ++i) {
+		if (bundle_ents[i].off == e->off &&
+		    bundle_ents[i].len == e->len)
+			break;
+	}
+	f->ino = i + 1;
+}
+
+static const struct bundle_ent *bundle_find(const char *path)
+{
+	__u32 i;
+
+	if (!bundle_hdr)
+		return NULL;
+	for (i = 0; i < bundle_hdr->nent; ++i) {
+		if (strcmp(bundle_strs + bundle_ents[i].path, path) == 0)
+			return &bundle_ents[i];
+	}
+	return NULL;
+}
+
+int bundle_prog(struct bundle_file *f)
+{
+	if (!bundle_hdr)
+		return -ENOENT;
+	bundle_file(&bundle_ents[0], f);
+	return 0;
+}
+
+int bundle_lookup(const char *path, struct bundle_file *f)
+{
+	const struct bundle_ent *e;
+
+	e = bundle_find(path);
+	if (!e)
+		return -ENOENT;
+	bundle_file(e, f);
+	return 0;
+}
+
+static void bundle_stat(const struct bundle_ent *e, struct stat *st)
+{
+	struct bundle_file f;
+
+	bundle_file(e, &f);
+	memset(st, 0, sizeof(*st));
+	st->st_dev     = BUNDLE_DEV;
+	st->st_ino     = f.ino;
+	st->st_mode    = S_IFREG | (f.mode & 07777);
+	st->st_nlink   = 1;
+	st->st_size    = f.len;
+	st->st_blksize = PAGE_SIZE;
+	st->st_blocks  = ALIGN_UP(f.len, 512) / 512;
+}
+
+static long bundle_open(const char *path, long flags)
+{
+	const struct bundle_ent *e;
+	int i;
+
+	e = bundle_find(path);
+	if (!e)
+		return -ENOENT;
+	if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC))
+		return -EROFS;
+	if (flags & O_DIRECTORY)
+		return -ENOTDIR;
+
+	uk_mutex_lock(&bundle_lock);
+	for (i = 0; i < BUNDLE_NFDS; ++i) {
+		if (!bundle_fds[i].ent) {
+			bundle_fds[i].ent = e;
+			bundle_fds[i].pos = 0;
+			break;
+		}
+	}
+	uk_mutex_unlock(&bundle_lock);
+	if (unlikely(i == BUNDLE_NFDS))
+		return -EMFILE;
+
+	uk_pr_debug("%s: Opened from bundle (fd %d)\n",
+		    path, BUNDLE_FD_BASE + i);
+	return BUNDLE_FD_BASE + i;
+}
+
+/* Returns the entry of an open file descriptor, or NULL */
+static const struct bundle_ent *bundle_fd_ent(long fd)
+{
+	const struct bundle_ent *e;
+
+	if (!BUNDLE_ISFD(fd))
+		return NULL;
+	uk_mutex_lock(&bundle_lock);
+	e = bundle_fds[fd - BUNDLE_FD_BASE].ent;
+	uk_mutex_unlock(&bundle_lock);
+	return e;
+}
+
+static long bundle_pread(const struct bundle_ent *e, void *buf, __sz count,
+			 __u64 off)
+{
+	if (off >= e->len)
+		return 0;
+	count = MIN(count, e->len - off);
+	memcpy(buf, bundle_base + e->off + off, count);
+	return count;
+}
+
+static long bundle_read(long fd, void *buf, __sz count)
+{
+	struct bundle_fd *bfd = &bundle_fds[fd - BUNDLE_FD_BASE];
+	long ret;
+
+	uk_mutex_lock(&bundle_lock);
+	if (unlikely(!bfd->ent)) {
+		ret = -EBADF;
+	} else {
+		ret = bundle_pread(bfd->ent, buf, count, bfd->pos);
+		bfd->pos += ret;
+	}
+	uk_mutex_unlock(&bundle_lock);
+	return ret;
+}
+
+static long bundle_lseek(long fd, long off, int whence)
+{
+	struct bundle_fd *bfd = &bundle_fds[fd - BUNDLE_FD_BASE];
+	long ret;
+
+	uk_mutex_lock(&bundle_lock);
+	if (unlikely(!bfd->ent)) {
+		ret = -EBADF;
+		goto out;
+	}
+	switch (whence) {
+	case SEEK_SET:
+		ret = off;
+		break;
+	case SEEK_CUR:
+		ret = (long)bfd->pos + off;
+		break;
+	case SEEK_END:
+		ret = (long)bfd->ent->len + off;
+		break;
+	default:
+		ret = -EINVAL;
+		goto out;
+	}
+	if (unlikely(ret < 0)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	bfd->pos = ret;
+out:
+	uk_mutex_unlock(&bundle_lock);
+	return ret;
+}
+
+static long bundle_close(long fd)
+{
+	struct bundle_fd *bfd = &bundle_fds[fd - BUNDLE_FD_BASE];
+	long ret = 0;
+
+	uk_mutex_lock(&bundle_lock);
+	if (unlikely(!bfd->ent))
+		ret = -EBADF;
+	bfd->ent = NULL;
+	uk_mutex_unlock(&bundle_lock);
+	return ret;
+}
+
+/*
+ * Private file mappings are backed by anonymous memory that receives a copy
+ * of the file content, shared writable mappings are refused.
+ */
+static long bundle_mmap(const long args[6], const struct bundle_ent *e)
+{
+	long addr, len = args[1], prot = args[2], flags = args[3];
+	__u64 off = args[5];
+	long rc;
+
+	if (unlikely((flags & MAP_TYPE) != MAP_PRIVATE && (prot & PROT_WRITE)))
+		return -EACCES;
+	if (unlikely(!PAGE_ALIGNED(off)))
+		return -EINVAL;
+
+	flags = (flags & ~MAP_TYPE) | MAP_PRIVATE | MAP_ANONYMOUS;
+	addr = uk_syscall6_r(SYS_mmap, args[0], len, PROT_READ | PROT_WRITE,
+			     flags, -1, 0);
+	if (unlikely(addr < 0 && addr >= -4095))
+		return addr;
+
+	bundle_pread(e, (void *)addr, len, off);
+	if (prot != (PROT_READ | PROT_WRITE)) {
+		rc = uk_syscall6_r(SYS_mprotect, addr, len, prot, 0, 0, 0);
+		if (unlikely(rc < 0)) {
+			uk_syscall6_r(SYS_munmap, addr, len, 0, 0, 0, 0);
+			return rc;
+		}
+	}
+	return addr;
+}
+
+int bundle_syscall(long nr, const long args[6], long *ret)
+{
+	const struct bundle_ent *e;
+
+	switch (nr) {
+#ifdef SYS_open
+	case SYS_open:
+		*ret = bundle_open((const char *)args[0], args[1]);
+		break;
+#endif /* SYS_open */
+	case SYS_openat:
+		*ret = bundle_open((const char *)args[1], args[2]);
+		break;
+	case SYS_newfstatat:
+		if (BUNDLE_ISFD(args[0])) {
+			e = bundle_fd_ent(args[0]);
+			if (!e) {
+				*ret = -EBADF;
+			} else if (!(args[3] & AT_EMPTY_PATH) ||
+				   *(const char *)args[1] != '\0') {
+				*ret = -ENOTDIR;
+			} else {
+				bundle_stat(e, (struct stat *)args[2]);
+				*ret = 0;
+			}
+			return 1;
+		}
+		e = bundle_find((const char *)args[1]);
+		if (!e)
+			return 0;
+		bundle_stat(e, (struct stat *)args[2]);
+		*ret = 0;
+		return 1;
+	case SYS_read:
+		*ret = bundle_read(args[0], (void *)args[1], args[2]);
+		return 1;
+	case SYS_pread64:
+		e = bundle_fd_ent(args[0]);
+		if (!e)
+			*ret = -EBADF;
+		else if (args[3] < 0)
+			*ret = -EINVAL;
+		else
+			*ret = bundle_pread(e, (void *)args[1], args[2],
+					    args[3]);
+		return 1;
+	case SYS_lseek:
+		*ret = bundle_lseek(args[0], args[1], args[2]);
+		return 1;
+	case SYS_fstat:
+		e = bundle_fd_ent(args[0]);
+		if (!e) {
+			*ret = -EBADF;
+			return 1;
+		}
+		bundle_stat(e, (struct stat *)args[1]);
+		*ret = 0;
+		return 1;
+	case SYS_mmap:
+		e = bundle_fd_ent(args[4]);
+		*ret = e ? bundle_mmap(args, e) : -EBADF;
+		return 1;
+	case SYS_close:
+		*ret = bundle_close(args[0]);
+		return 1;
+	default:
+		return 0;
+	}
+
+	/* Paths that are not bundled are looked up by the system. Without a
+	 * filesystem, report them as missing, so that the dynamic loader
+	 * continues with the next library directory.
+	 */
+	if (*ret == -ENOENT) {
+		*ret = uk_syscall6_r(nr, args[0], args[1], args[2],
+				     args[3], args[4], args[5]);
+		if (*ret == -ENOSYS)
+			*ret = -ENOENT;
+	}
+	return 1;
+}
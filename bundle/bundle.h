@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_BUNDLE_H
+#define APPELFLOADER_BUNDLE_H
+
+#include <uk/config.h>
+#include <errno.h>
+#include <uk/arch/types.h>
+#include <uk/essentials.h>
+#include <uk/syscall.h>
+
+/*
+ * Image bundle for dynamically-linked executables without a filesystem
+ *
+ * A bundle is given as initrd instead of a single ELF image
+ * (APPELFLOADER_INITRDEXEC). It contains the program, its program
+ * interpreter, and the shared libraries, each with the absolute path under
+ * which it is opened. Several paths may refer to the same content (e.g.,
+ * symbolic links). Layout (little endian), see support/mkbundle.py:
+ *
+ *   header:  magic "UKBUNDLE", version (u32), number of entries (u32),
+ *            offset of the entry table (u32), offset of the path strings
+ *            (u32), total length (u64)
+ *   entry:   data offset (u64, page-aligned), length (u64),
+ *            path offset relative to the path strings (u32), mode (u32)
+ *
+ * The first entry is the program. The program interpreter is loaded from the
+ * bundle by elf_load_img(). Library opens of the interpreter through the
+ * direct system call entry (APPELFLOADER_SYSRW) are served from the bundle
+ * with file descriptors starting at BUNDLE_FD_BASE: `open`, `openat`,
+ * `read`, `pread64`, `lseek`, `fstat`, `newfstatat`, `mmap` and `close` are
+ * supported. Other paths are passed on to the system call handler.
+ */
+
+#define BUNDLE_MAGIC		"UKBUNDLE"
+#define BUNDLE_MAGIC_LEN	8
+#define BUNDLE_VERSION		1
+#define BUNDLE_FD_BASE		0x7000
+#define BUNDLE_NFDS		32
+
+struct bundle_hdr {
+	char magic[BUNDLE_MAGIC_LEN];
+	__u32 version;
+	__u32 nent;
+	__u32 entoff;
+	__u32 stroff;
+	__u64 len;
+} __packed;
+
+struct bundle_ent {
+	__u64 off;
+	__u64 len;
+	__u32 path;
+	__u32 mode;
+} __packed;
+
+struct bundle_file {
+	const void *data;
+	__sz len;
+	const char *path;	/* path of the entry in the bundle */
+	__u32 mode;
+	__u32 ino;		/* same for entries with the same content */
+};
+
+#if CONFIG_APPELFLOADER_BUNDLE
+/**
+ * Uses an image as bundle if it starts with BUNDLE_MAGIC
+ *
+ * @return:
+ *   0 on success, -ENOEXEC if the image is not a bundle, -EINVAL if it is
+ *   malformed
+ */
+int bundle_init(const void *img, __sz len);
+
+/**
+ * Returns the program (first entry) of the bundle
+ *
+ * @return:
+ *   0 on success, -ENOENT if no bundle is in use
+ */
+int bundle_prog(struct bundle_file *f);
+
+/**
+ * Looks up a file by absolute path
+ *
+ * @return:
+ *   0 on success, -ENOENT if the path is not in the bundle
+ */
+int bundle_lookup(const char *path, struct bundle_file *f);
+
+/**
+ * Implements the supported system calls for bundled files and their file
+ * descriptors, returns non-zero if it handled the system call
+ */
+int bundle_syscall(long nr, const long args[6], long *ret);
+
+#define BUNDLE_ISFD(fd) \
+	((unsigned long)(fd) - BUNDLE_FD_BASE < BUNDLE_NFDS)
+
+/*
+ * System call hook for elf_syscall6(): returns non-zero if it handled the
+ * system call and stored the result in `*ret`.
+ */
+static inline int bundle_syscall_pre(long nr, const long args[6], long *ret)
+{
+	switch (nr) {
+#ifdef SYS_open
+	case SYS_open:
+		if (!args[0] || *(const char *)args[0] != '/')
+			return 0;
+		break;
+#endif /* SYS_open */
+	case SYS_openat:
+		if (!args[1] || *(const char *)args[1] != '/')
+			return 0;
+		break;
+	case SYS_newfstatat:
+		if (!BUNDLE_ISFD(args[0]) &&
+		    (!args[1] || *(const char *)args[1] != '/'))
+			return 0;
+		break;
+	case SYS_read:
+	case SYS_pread64:
+	case SYS_lseek:
+	case SYS_fstat:
+	case SYS_close:
+		if (!BUNDLE_ISFD(args[0]))
+			return 0;
+		break;
+	case SYS_mmap:
+		if (!BUNDLE_ISFD(args[4]))
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+	return bundle_syscall(nr, args, ret);
+}
+#else /* !CONFIG_APPELFLOADER_BUNDLE */
+#define bundle_init(img, len) ({ (void)(img); (void)(len); -ENOEXEC; })
+#define bundle_lookup(path, f) ({ (void)(path); (void)(f); -ENOENT; })
+#define bundle_syscall_pre(nr, args, ret) 0
+#endif /* !CONFIG_APPELFLOADER_BUNDLE */
+
+#endif /* APPELFLOADER_BUNDLE_H */
@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#include <uk/plat/memory.h>
+
+#include "cpioexec.h"
+
+#define CPIO_MAGIC		"07070"	/* followed by '1' or '2' (CRC) */
+#define CPIO_MAGIC_LEN		6
+#define CPIO_HDR_LEN		110
+#define CPIO_TRAILER		"TRAILER!!!"
+#define CPIO_MAXLINKS		8
+
+/* Field indices of the new ASCII header, 8 hex digits each after magic */
+enum cpio_field {
+	CPIO_INO = 0,
+	CPIO_MODE,
+	CPIO_UID,
+	CPIO_GID,
+	CPIO_NLINK,
+	CPIO_MTIME,
+	CPIO_FILESIZE,
+	CPIO_DEVMAJOR,
+	CPIO_DEVMINOR,
+	CPIO_RDEVMAJOR,
+	CPIO_RDEVMINOR,
+	CPIO_NAMESIZE,
+	CPIO_CHECK
+};
+
+struct cpio_ent {
+	const char *name;	/* without leading `./` or `/` */
+	__sz namelen;
+	__u32 mode;
+	const char *data;
+	__sz len;
+};
+
+static const char *cpio_base;
+static __sz cpio_len;
+static __paddr_t cpio_pbase;
+
+static bool cpio_field(const char *hdr, enum cpio_field f, __u32 *val)
+{
+	const char *s = hdr + CPIO_MAGIC_LEN + 8 * f;
+	__u32 v = 0;
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		v <<= 4;
+		if (s[i] >= '0' && s[i] <= '9')
+			v |= s[i] - '0';
+		else if (s[i] >= 'a' && s[i] <= 'f')
+			v |= s[i] - 'a' + 10;
+		else if (s[i] >= 'A' && s[i] <= 'F')
+			v |= s[i] - 'A' + 10;
+		else
+			return false;
+	}
+	*val = v;
+	return true;
+}
+
+/*
+ * Parses the entry at `*pos` and advances `*pos` to the next one.
+ * Returns 1 for an entry, 0 at the trailer, or a negative errno value.
+ */
+static int cpio_next(__sz *pos, struct cpio_ent *e)
+{
+	const char *hdr = cpio_base + *pos;
+	__u32 namesize, filesize, mode;
+	__sz off;
+
+	if (*pos + CPIO_HDR_LEN > cpio_len ||
+	    memcmp(hdr, CPIO_MAGIC, CPIO_MAGIC_LEN - 1) != 0 ||
+	    (hdr[5] != '1' && hdr[5] != '2'))
+		return -EINVAL;
+	if (!cpio_field(hdr, CPIO_MODE, &mode) ||
+	    !cpio_field(hdr, CPIO_FILESIZE, &filesize) ||
+	    !cpio_field(hdr, CPIO_NAMESIZE, &namesize) || !namesize)
+		return -EINVAL;
+
+	off = *pos + CPIO_HDR_LEN;
+	if (namesize > cpio_len - off || hdr[CPIO_HDR_LEN + namesize - 1])
+		return -EINVAL;
+	e->name = hdr + CPIO_HDR_LEN;
+	e->namelen = namesize - 1;
+	off = ALIGN_UP(off + namesize, 4);
+	if (off > cpio_len || filesize > cpio_len - off)
+		return -EINVAL;
+	e->mode = mode;
+	e->data = cpio_base + off;
+	e->len = filesize;
+	*pos = ALIGN_UP(off + filesize, 4);
+
+	if (e->namelen == sizeof(CPIO_TRAILER) - 1 &&
+	    memcmp(e->name, CPIO_TRAILER, e->namelen) == 0)
+		return 0;
+
+	while (e->namelen >= 2 && e->name[0] == '.' && e->name[1] == '/') {
+		e->name += 2;
+		e->namelen -= 2;
+	}
+	while (e->namelen && e->name[0] == '/') {
+		e->name++;
+		e->namelen--;
+	}
+	return 1;
+}
+
+/* Finds the entry of a normalized path (no leading `/`, no `.` or `..`) */
+static int cpio_find(const char *path, __sz len, struct cpio_ent *e)
+{
+	__sz pos = 0;
+	int rc;
+
+	while ((rc = cpio_next(&pos, e)) > 0) {
+		if (e->namelen == len && memcmp(e->name, path, len) == 0)
+			return 0;
+	}
+	return rc < 0 ? rc : -ENOENT;
+}
+
+/*
+ * Resolves `path` component by component, following symbolic links within
+ * the archive. `out` receives the normalized path of the final entry. Missing
+ * entries of intermediate directories are tolerated, like archives that only
+ * list files.
+ */
+static int cpio_resolve(const char *path, char *out, char *rest,
+			struct cpio_ent *e)
+{
+	unsigned int links = 0;
+	__sz outlen = 0, clen, restlen;
+	const char *c, *next;
+	bool found = false;
+	int rc;
+
+	restlen = strlen(path);
+	if (restlen >= PATH_MAX)
+		return -ENAMETOOLONG;
+	memcpy(rest, path, restlen + 1);
+
+	c = rest;
+	for (;;) {
+		while (*c == '/')
+			c++;
+		if (*c == '\0')
+			break;
+		next = strchr(c, '/');
+		if (!next)
+			next = c + strlen(c);
+		clen = next - c;
+
+		if (clen == 1 && c[0] == '.') {
+			c = next;
+			continue;
+		}
+		if (clen == 2 && c[0] == '.' && c[1] == '.') {
+			while (outlen && out[outlen - 1] != '/')
+				outlen--;
+			if (outlen)
+				outlen--;
+			c = next;
+			found = false;
+			continue;
+		}
+
+		if (outlen + 1 + clen >= PATH_MAX)
+			return -ENAMETOOLONG;
+		if (outlen)
+			out[outlen++] = '/';
+		memcpy(&out[outlen], c, clen);
+		outlen += clen;
+		c = next;
+
+		rc = cpio_find(out, outlen, e);
+		found = (rc == 0);
+		if (rc == -ENOENT)
+			continue;
+		if (rc < 0)
+			return rc;
+		if (!S_ISLNK(e->mode))
+			continue;
+
+		/* Replace the link by its target in the remaining path */
+		if (++links > CPIO_MAXLINKS)
+			return -ELOOP;
+		restlen = strlen(c);
+		if (e->len + restlen >= PATH_MAX)
+			return -ENAMETOOLONG;
+		memmove(rest + e->len, c, restlen + 1);
+		memcpy(rest, e->data, e->len);
+		c = rest;
+		if (rest[0] == '/') {
+			outlen = 0;
+		} else {
+			while (outlen && out[outlen - 1] != '/')
+				outlen--;
+			if (outlen)
+				outlen--;
+		}
+		found = false;
+	}
+	out[outlen] = '\0';
+
+	if (!found)
+		return -ENOENT;
+	return 0;
+}
+
+int cpioexec_lookup(const char *path, struct cpioexec_file *f)
+{
+	struct cpio_ent e;
+	char *buf;
+	int rc;
+
+	if (!cpio_base)
+		return -ENOENT;
+
+	buf = malloc(2 * PATH_MAX);
+	if (unlikely(!buf))
+		return -ENOMEM;
+	rc = cpio_resolve(path, buf, buf + PATH_MAX, &e);
+	if (rc < 0)
+		goto out;
+	if (unlikely(!S_ISREG(e.mode))) {
+		rc = S_ISDIR(e.mode) ? -EISDIR : -EACCES;
+		goto out;
+	}
+
+	uk_pr_debug("%s: Found in initrd at %p (%"__PRIsz" B)\n",
+		    path, e.data, e.len);
+	f->data = e.data;
+	f->len = e.len;
+	f->paddr = cpio_pbase + (__paddr_t)(e.data - cpio_base);
+	f->mode = e.mode;
+	rc = 0;
+out:
+	free(buf);
+	return rc;
+}
+
+static int cpioexec_init(struct uk_init_ctx *ictx __unused)
+{
+	struct ukplat_memregion_desc *img;
+	int rc;
+
+	rc = ukplat_memregion_find_initrd0(&img);
+	if (rc < 0 || !img->vbase || img->len < CPIO_HDR_LEN)
+		return 0;
+	if (memcmp((const void *)img->vbase, CPIO_MAGIC,
+		   CPIO_MAGIC_LEN - 1) != 0) {
+		uk_pr_debug("initrd is not a cpio archive, loading from VFS\n");
+		return 0;
+	}
+
+	cpio_base = (const char *)img->vbase;
+	cpio_len = img->len;
+	cpio_pbase = img->pbase;
+	uk_pr_info("Loading executables from cpio initrd at %p (%"__PRIsz" B)\n",
+		   cpio_base, cpio_len);
+	return 0;
+}
+
+uk_late_initcall(cpioexec_init, 0x0);
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_CPIOEXEC_H
+#define APPELFLOADER_CPIOEXEC_H
+
+#include <uk/config.h>
+#include <errno.h>
+#include <uk/arch/types.h>
+#include <uk/essentials.h>
+
+/*
+ * Read-only, in-place view of the initial ramdisk
+ *
+ * When the initrd is a cpio archive (new ASCII format, as it is extracted to
+ * the root filesystem by vfscore), executables and program interpreters are
+ * looked up in the archive and loaded from there, instead of reading them
+ * back from the extracted copy. Symbolic links in the path, e.g.,
+ * `/lib64/ld-linux-x86-64.so.2`, are resolved within the archive.
+ */
+
+struct cpioexec_file {
+	const void *data;	/* file content within the initrd */
+	__sz len;
+	__paddr_t paddr;	/* physical address of `data` */
+	__u32 mode;		/* file type and permissions */
+};
+
+#if CONFIG_APPELFLOADER_CPIOEXEC
+/**
+ * Looks up a regular file in the cpio initrd
+ *
+ * @param path:
+ *   Absolute path
+ * @param f:
+ *   Location of the file content on success
+ * @return:
+ *   0 on success, -ENOENT if the file (or a cpio initrd) does not exist,
+ *   other negative errno values for unusable files
+ */
+int cpioexec_lookup(const char *path, struct cpioexec_file *f);
+#else /* !CONFIG_APPELFLOADER_CPIOEXEC */
+#define cpioexec_lookup(path, f) ({ (void)(path); (void)(f); -ENOENT; })
+#endif /* !CONFIG_APPELFLOADER_CPIOEXEC */
+
+#endif /* APPELFLOADER_CPIOEXEC_H */
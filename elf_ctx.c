@@ -46,13 +46,17 @@
  * header of this file.
  */
 
+#include <errno.h>
+#include <stdbool.h>
 #include <string.h>
 #include <uk/plat/bootstrap.h>
+#include <uk/alloc.h>
 #include <uk/assert.h>
 #include <uk/print.h>
 #include <uk/essentials.h>
 
 #include "elf_prog.h"
+#include "hwcap.h"
 
 /* Fields for auxiliary vector
  * (https://lwn.net/Articles/519085/)
@@ -80,9 +84,11 @@
 #define AT_UCACHEBSIZE		21
 #define AT_SECURE		23
 #define AT_RANDOM		25
+#define AT_HWCAP2		26
 #define AT_EXECFN		31
 #define AT_SYSINFO_EHDR		33
 #define AT_SYSINFO		32
+#define AT_MINSIGSTKSZ		51
 
 struct auxv_entry {
 	long key;
@@ -101,42 +107,80 @@ extern char *vdso_image_addr;
 #error "Unsupported architecture"
 #endif
 
-static void infoblk_push(struct ukarch_ctx *ctx, void *buf, __sz len)
+/*
+ * String blocks that would occupy more than 1/ELF_CTX_STRBLK_SHARE of the
+ * stack are placed in a separate allocation instead
+ */
+#define ELF_CTX_STRBLK_SHARE	4
+
+static int strvec_count(char *vec[])
 {
-	UK_ASSERT(ctx);
-	UK_ASSERT(ctx->sp);
-	UK_ASSERT(buf);
-	UK_ASSERT(len);
+	int n = 0;
 
-	ctx->sp -= len + 1;
-	memcpy((void *)ctx->sp, buf, len);
-	((char *)ctx->sp)[len] = '\0';
+	if (!vec)
+		return 0;
+
+	for (; vec[n]; ++n)
+		;
+	return n;
 }
 
-static int envp_count(char *environ[])
+static __sz strvec_size(char *const vec[], int n)
 {
-	int envc = 0;
-	char **env;
+	__sz len = 0;
+	int i;
 
-	if (!environ)
-		return 0;
+	for (i = 0; i < n; ++i)
+		len += strlen(vec[i]) + 1;
+	return len;
+}
 
-	/* count the number of environment variables */
-	for (env = environ; *env; ++env)
-		++envc;
+/*
+ * Copies `n` strings to `dst` and stores their new addresses to `ptrs`.
+ * Strings that are adjacent in the source (e.g., as produced by the kernel
+ * command line parser) are copied with a single memcpy().
+ * Returns the address after the last copied byte.
+ */
+static char *strvec_copy(char *dst, char *const src[], int n, __uptr *ptrs)
+{
+	const char *run = NULL;
+	__sz run_len = 0;
+	int i;
 
-	return envc;
+	for (i = 0; i < n; ++i) {
+		if (run_len && src[i] != run + run_len) {
+			memcpy(dst, run, run_len);
+			dst += run_len;
+			run_len = 0;
+		}
+		if (!run_len)
+			run = src[i];
+		ptrs[i] = (__uptr)dst + run_len;
+		run_len += strlen(src[i]) + 1;
+	}
+	if (run_len) {
+		memcpy(dst, run, run_len);
+		dst += run_len;
+	}
+	return dst;
 }
 
-void elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
-		  const char *argv0, int argc, char *argv[], char *environ[],
-		  uint64_t rand[2])
+int elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
+		 const char *argv0, int argc, char *argv[], char *environ[],
+		 uint64_t rand[2], __sz stack_len)
 {
-	int i, elfvec_len, envc = envp_count(environ);
+	int envc = strvec_count(environ);
 	int args_count = argc + (argv0 ? 1 : 0);
-	char *infoblk_argvp[args_count];
-	char *infoblk_envp[envc];
+	const struct elf_hwcap *hw = elf_hwcap_get();
+	__sz strblk_len, vec_len, platform_len;
+	bool spilled = false;
+	char *strblk, *str;
+	struct auxv_entry *auxvp;
+	__uptr *vec;
+	__uptr sp;
 
+	UK_ASSERT(ctx);
+	UK_ASSERT(ctx->sp);
 	UK_ASSERT(prog);
 	UK_ASSERT(argv0 || ((argc >= 1) && argv));
 
@@ -164,21 +208,14 @@ void elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
 			    (uint64_t) prog->interp.prog->entry);
 	}
 
-	/* list of all auxiliary vector entries whose pointer values need
-	 * to point to information block areas
-	 */
-	struct auxv_entry infoblk_auxv[] = {
-		{ AT_PLATFORM, (__uptr)UK_AUXV_PLATFORM	},
-	};
-
-	/* list of all auxiliary vector entries whose pointer values need
-	 * not be in the information block
+	/* Auxiliary vector, entries that point to the information block
+	 * (AT_PLATFORM) are filled in after copying the strings
 	 */
 	struct auxv_entry auxv[] = {
 		{ AT_NOTELF, 0x0 },
-		{ AT_UCACHEBSIZE, 0x0 },
-		{ AT_ICACHEBSIZE, 0x0 },
-		{ AT_DCACHEBSIZE, 0x0 },
+		{ AT_UCACHEBSIZE, hw->ucache_bsize },
+		{ AT_ICACHEBSIZE, hw->icache_bsize },
+		{ AT_DCACHEBSIZE, hw->dcache_bsize },
 		/* path to executable */
 		{ AT_EXECFN, (long) (prog->path ? prog->path : prog->name) },
 		{ AT_SECURE, 0x0 },
@@ -189,7 +226,9 @@ void elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
 		{ AT_ENTRY, prog->entry },
 		{ AT_FLAGS, 0x0 },
 		{ AT_CLKTCK, 0x64 }, /* Mimic Linux */
-		{ AT_HWCAP, 0x0 },
+		{ AT_HWCAP, hw->hwcap },
+		{ AT_HWCAP2, hw->hwcap2 },
+		{ AT_MINSIGSTKSZ, hw->minsigstksz },
 		{ AT_PAGESZ, 4096 },
 		/* base addr of interpreter */
 		{ AT_BASE, prog->interp.prog ?
@@ -200,104 +239,98 @@ void elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
 		{ AT_PHDR, (__uptr)prog->vabase + prog->phdr.off },
 #if CONFIG_APPELFLOADER_VDSO
 		/* TODO: This must also be pushed and copied
-		 * or mapped to information block. Move it to infoblk_auxv
-		 * ASAP.
+		 * or mapped to information block. Move it to the string
+		 * block ASAP.
 		 */
 		{ AT_SYSINFO_EHDR, (uintptr_t)vdso_image_addr },
 #endif /* CONFIG_APPELFLOADER_VDSO */
-		{ AT_IGNORE, 0x0 }
+		{ AT_IGNORE, 0x0 },
+		{ AT_PLATFORM, 0x0 },
+		{ AT_NULL, 0x0 }
 	};
-	struct auxv_entry auxv_null = { AT_NULL, 0x0 };
-
-	for (i = (int)ARRAY_SIZE(infoblk_auxv) - 1; i >= 0; i--) {
-		infoblk_push(ctx, (void *)infoblk_auxv[i].val,
-			     strlen((const char*)infoblk_auxv[i].val));
-		/* Overwrite previous pointer to our memory to a pointer to
-		 * the newly copied buffer in the information block.
-		 */
-		infoblk_auxv[i].val = ctx->sp;
-	}
 
-	if (envc)
-		for (i = envc - 1; i >= 0; i--) {
-			infoblk_push(ctx, environ[i], strlen(environ[i]));
-			infoblk_envp[i] = (char *)ctx->sp;
-		}
+	/*
+	 * Compute the layout. From the top of the stack downwards:
+	 * - information block: NUL, argv0, argv, envp and AT_PLATFORM
+	 *   strings (ascending)
+	 * - alignment padding
+	 * - argc, argv[] + NULL, envp[] + NULL, auxv[] (ascending), where
+	 *   argc is located at the final, aligned stack pointer
+	 */
+	platform_len = sizeof(UK_AUXV_PLATFORM);
+	strblk_len = 1 + (argv0 ? strlen(argv0) + 1 : 0)
+		     + strvec_size(argv, argc) + strvec_size(environ, envc)
+		     + platform_len;
+	vec_len = (1 + args_count + 1 + envc + 1) * sizeof(__uptr)
+		  + sizeof(auxv);
 
-	if (argc)
-		for (i = argc; i >= 1; i--) {
-			infoblk_push(ctx, argv[i - 1], strlen(argv[i - 1]));
-			infoblk_argvp[i] = (char *)ctx->sp;
+	sp = ctx->sp;
+	if (strblk_len > stack_len / ELF_CTX_STRBLK_SHARE) {
+		/* The block is owned by `prog` and released by elf_unload() */
+		strblk = uk_malloc(prog->a, strblk_len);
+		spilled = true;
+		if (unlikely(!strblk)) {
+			uk_pr_err("%s: Failed to allocate %"__PRIsz" bytes for arguments and environment\n",
+				  prog->name, strblk_len);
+			return -ENOMEM;
 		}
-
-	if (argv0) {
-		infoblk_push(ctx, (void *)argv0, strlen(argv0));
-		infoblk_argvp[0] = (char *)ctx->sp;
+		uk_pr_debug("%s: Arguments and environment (%"__PRIsz" B) placed at %p\n",
+			    prog->name, strblk_len, strblk);
+	} else {
+		sp -= strblk_len;
+		strblk = (char *)sp;
+	}
+	sp = ALIGN_DOWN(sp - vec_len, UKARCH_SP_ALIGN);
+	if (unlikely(ctx->sp - sp > stack_len)) {
+		uk_pr_err("%s: Arguments and environment do not fit on the stack (%"__PRIsz" B)\n",
+			  prog->name, stack_len);
+		if (spilled)
+			uk_free(prog->a, strblk);
+		return -E2BIG;
 	}
 
-	/* Add a NULL terminator before argv0 as the cherry on top (bottom?)
-	 * and re-align stack to prepare it for what's about to be pushed
-	 * next.
-	 */
-	ctx->sp--;
-	((char *)ctx->sp)[0] = '\0';
-	ctx->sp--;
-	ctx->sp = ALIGN_DOWN(ctx->sp, UKARCH_SP_ALIGN);
+	if (spilled) {
+		if (prog->strblk)
+			uk_free(prog->a, prog->strblk);
+		prog->strblk = strblk;
+		prog->strblk_len = strblk_len;
+	}
 
 	/*
-	 * We need to respect the stack alignment ABI requirements at function
-	 * calls. (eg: x86_64 requires that the stack is 16-byte aligned)
-	 *
-	 * Here we count how many bytes are pushed to the stack:
-	 * - auxiliary vector;
-	 * - environment variables (plus extra NULL pointer);
-	 * - arguments (plus extra NULL pointer and argument count (long))
+	 * Fill in: Pointer vectors are written in place while copying the
+	 * strings
 	 */
-	elfvec_len = ((ARRAY_SIZE(auxv) + 1) * sizeof(struct auxv_entry))
-		+ (envc + 1) * sizeof(uintptr_t)
-		+ (argc + (argv0 ? 1 : 0) + 1) * sizeof(uintptr_t)
-		+ sizeof(long);
+	vec = (__uptr *)sp;
+	vec[0] = (__uptr)args_count;
+	vec++;
 
-	ctx->sp = ALIGN_DOWN(ctx->sp - elfvec_len, UKARCH_SP_ALIGN)
-		+ elfvec_len;
+	str = strblk;
+	*str++ = '\0';
+	if (argv0) {
+		str = strvec_copy(str, (char *const *)&argv0, 1, vec);
+		vec++;
+	}
+	str = strvec_copy(str, argv, argc, vec);
+	vec += argc;
+	*vec++ = (__uptr)NULL;
 
-	/*
-	 * We need to push the element on the stack in the inverse order they
-	 * will be read by the application's C library (i.e. argc in the end)
-	 *
-	 * Auxiliary vector (NOTE: we push the terminating NULL first)
-	 */
-	ukarch_rctx_stackpush_packed(ctx, auxv_null);
-	for (i = (int)ARRAY_SIZE(infoblk_auxv) - 1; i >= 0; i--)
-		ukarch_rctx_stackpush_packed(ctx, infoblk_auxv[i]);
-	for (i = (int)ARRAY_SIZE(auxv) - 1; i >= 0; --i)
-		ukarch_rctx_stackpush_packed(ctx, auxv[i]);
+	str = strvec_copy(str, environ, envc, vec);
+	vec += envc;
+	*vec++ = (__uptr)NULL;
 
-	/*
-	 * envp
-	 */
-	/* NOTE: As expected, this will push NULL to the stack first */
-	ukarch_rctx_stackpush_packed(ctx, (long)NULL);
-	if (environ) {
-		for (i = envc - 1; i >= 0; --i) {
-			uk_pr_debug("env[%d]=\"%s\"\n", i, infoblk_envp[i]);
-			ukarch_rctx_stackpush_packed(ctx,
-						     (__uptr)infoblk_envp[i]);
-		}
-	}
+	memcpy(str, UK_AUXV_PLATFORM, platform_len);
+	auxv[ARRAY_SIZE(auxv) - 2].val = (long)str;
+	str += platform_len;
+	UK_ASSERT(str == strblk + strblk_len);
 
-	/*
-	 * argv + argc
-	 */
-	/* Same as envp, pushing NULL first */
-	ukarch_rctx_stackpush_packed(ctx, (long)NULL);
-	if (args_count)
-		for (i = args_count - 1; i >= 0; i--)
-			ukarch_rctx_stackpush_packed(ctx,
-						     (__uptr)infoblk_argvp[i]);
-	ukarch_rctx_stackpush_packed(ctx, (long)args_count);
+	auxvp = (struct auxv_entry *)vec;
+	memcpy(auxvp, auxv, sizeof(auxv));
+	prog->auxv = auxvp;
+	prog->auxv_len = sizeof(auxv);
+	UK_ASSERT((__uptr)(auxvp + ARRAY_SIZE(auxv))
+		  <= (spilled ? ctx->sp : (__uptr)strblk));
 
-	UK_ASSERT(IS_ALIGNED(ctx->sp, UKARCH_SP_ALIGN));
+	UK_ASSERT(IS_ALIGNED(sp, UKARCH_SP_ALIGN));
 
 	/* ctx will enter the entry point with cleared registers. */
 	if (prog->interp.required) {
@@ -306,9 +339,10 @@ void elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
 		UK_ASSERT(prog->interp.prog);
 
 		/* dynamically linked executable, jump into loader instead */
-		ukarch_ctx_init(ctx, ctx->sp, 0x0, interp->entry);
+		ukarch_ctx_init(ctx, sp, 0x0, interp->entry);
 	} else {
 		/* statically linked executable */
-		ukarch_ctx_init(ctx, ctx->sp, 0x0, prog->entry);
+		ukarch_ctx_init(ctx, sp, 0x0, prog->entry);
 	}
+	return 0;
 }
@@ -66,6 +66,20 @@
 
 #include "libelf_helper.h"
 #include "elf_prog.h"
+#include "loadtime/loadtime.h"
+#include "loadmap/loadmap.h"
+#if CONFIG_APPELFLOADER_CPIOEXEC
+#include "cpioexec/cpioexec.h"
+#endif /* CONFIG_APPELFLOADER_CPIOEXEC */
+#if CONFIG_APPELFLOADER_BUNDLE
+#include "bundle/bundle.h"
+#endif /* CONFIG_APPELFLOADER_BUNDLE */
+#if CONFIG_APPELFLOADER_ELFZ
+#include "elfz/elfz.h"
+#endif /* CONFIG_APPELFLOADER_ELFZ */
+#if CONFIG_APPELFLOADER_SYSRW
+#include "sysrw/sysrw.h"
+#endif /* CONFIG_APPELFLOADER_SYSRW */
 
 static int get_phdr_mmap_prot(GElf_Phdr *phdr)
 {
@@ -263,9 +277,73 @@ static void elf_unload_vaimg(struct elf_prog *elf_prog)
 }
 #endif /* !CONFIG_LIBPOSIX_MMAP */
 
+#if (CONFIG_APPELFLOADER_CPIOEXEC && CONFIG_LIBPOSIX_MMAP) || \
+    CONFIG_APPELFLOADER_ELFZ
+#if CONFIG_LIBPOSIX_MMAP
+/*
+ * Reserves zeroed memory for an image that is filled by the loader, aligned
+ * to `elf_prog->align`. Like file mappings, it is released with
+ * elf_unload_vaimg().
+ */
+static int elf_load_vareserve(struct elf_prog *elf_prog)
+{
+	uintptr_t vastart, vaend;
+	__sz mmap_len;
+
+	UK_ASSERT(elf_prog->align && PAGE_ALIGNED(elf_prog->align));
+
+	/* Reserve an aligned area and give back the unused head and tail */
+	mmap_len = elf_prog->valen + elf_prog->align;
+	vastart = (uintptr_t)mmap(NULL, mmap_len,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS,
+				  -1, 0);
+	if (unlikely(vastart == (uintptr_t)MAP_FAILED)) {
+		uk_pr_debug("%s: Not enough memory to load image (failed to map %"PRIu64" bytes)\n",
+			    elf_prog->name, (uint64_t)mmap_len);
+		return -ENOMEM;
+	}
+	vaend = vastart + mmap_len;
+	elf_prog->vabase = (void *)ALIGN_UP(vastart, elf_prog->align);
+	if ((uintptr_t)elf_prog->vabase > vastart)
+		munmap((void *)vastart, (uintptr_t)elf_prog->vabase - vastart);
+	vastart = (uintptr_t)elf_prog->vabase + elf_prog->valen;
+	if (vaend > vastart)
+		munmap((void *)vastart, vaend - vastart);
+
+	uk_pr_debug("%s: Program/Library memory region: 0x%"PRIx64"-0x%"PRIx64"\n",
+		    elf_prog->name,
+		    (uint64_t)elf_prog->vabase,
+		    (uint64_t)elf_prog->vabase + elf_prog->valen);
+	return 0;
+}
+#else /* !CONFIG_LIBPOSIX_MMAP */
+static int elf_load_vareserve(struct elf_prog *elf_prog)
+{
+	UK_ASSERT(elf_prog->align && PAGE_ALIGNED(elf_prog->align));
+
+	elf_prog->vabase = uk_memalign(elf_prog->a, elf_prog->align,
+				       elf_prog->valen);
+	if (unlikely(!elf_prog->vabase)) {
+		uk_pr_debug("%s: Not enough memory to load image (failed to allocate %"PRIu64" bytes)\n",
+			    elf_prog->name, (uint64_t)elf_prog->valen);
+		return -ENOMEM;
+	}
+	memset(elf_prog->vabase, 0, elf_prog->valen);
+
+	uk_pr_debug("%s: Program/Library memory region: 0x%"PRIx64"-0x%"PRIx64"\n",
+		    elf_prog->name,
+		    (uint64_t)elf_prog->vabase,
+		    (uint64_t)elf_prog->vabase + elf_prog->valen);
+	return 0;
+}
+#endif /* !CONFIG_LIBPOSIX_MMAP */
+#endif /* (CONFIG_APPELFLOADER_CPIOEXEC && CONFIG_LIBPOSIX_MMAP) || ... */
+
 static int elf_load_imgcpy(struct elf_prog *elf_prog, Elf *elf,
 			   const void *img_base, size_t img_len __unused)
 {
+	__nsec tstart __maybe_unused;
 	size_t phnum, phi;
 	uintptr_t vastart;
 	uintptr_t vaend;
@@ -313,6 +391,7 @@ static int elf_load_imgcpy(struct elf_prog *elf_prog, Elf *elf,
 		if (phdr.p_type != PT_LOAD)
 			continue;
 
+		tstart = loadtime_start();
 		vastart = phdr.p_vaddr + (uintptr_t)elf_prog->vabase;
 		vaend   = vastart + phdr.p_filesz;
 		if (!elf_prog->start || (vastart < elf_prog->start))
@@ -337,6 +416,7 @@ static int elf_load_imgcpy(struct elf_prog *elf_prog, Elf *elf,
 			    (uint64_t) (vastart),
 			    (uint64_t) (vaend));
 		memset((void *)(vastart), 0, vaend - vastart);
+		loadtime_account(LOADTIME_SEGMENT, tstart);
 	}
 	return 0;
 
@@ -346,6 +426,45 @@ err_out:
 	return ret;
 }
 
+/* Copies the path of the program interpreter from the PT_INTERP segment */
+static int elf_load_interp_path(struct elf_prog *elf_prog, Elf *elf,
+				size_t phnum)
+{
+	GElf_Phdr phdr;
+	size_t phi;
+
+	for (phi = 0; phi < phnum; ++phi) {
+		if (gelf_getphdr(elf, phi, &phdr) != &phdr) {
+			elferr_warn("%s: Failed to get program header %"PRIu64"\n",
+				    elf_prog->name, (uint64_t) phi);
+			continue;
+		}
+		if (phdr.p_type != PT_INTERP)
+			continue;
+
+		UK_ASSERT(!elf_prog->interp.path);
+
+		elf_prog->interp.path = malloc(phdr.p_filesz);
+		if (!elf_prog->interp.path) {
+			uk_pr_err("%s: Failed to load INTERP path: %s\n",
+				  elf_prog->name, strerror(ENOMEM));
+			return -ENOMEM;
+		}
+
+		memcpy(elf_prog->interp.path,
+		       elf_rawfile(elf, NULL) + phdr.p_offset,
+		       phdr.p_filesz);
+
+		/* Enforce zero termination, this should normally
+		 * be the case with the PT_INTERP section content.
+		 * We are playing safe here.
+		 */
+		elf_prog->interp.path[phdr.p_filesz - 1] = '\0';
+		break;
+	}
+	return 0;
+}
+
 #if CONFIG_LIBVFSCORE
 #if CONFIG_LIBPOSIX_MMAP
 /* If vastart + phdr.p_filesz (vastart) < vastart + phdr.p_memsz (vaend),
@@ -623,6 +742,7 @@ static int elf_load_fdphdr(struct elf_prog *elf_prog, GElf_Phdr *phdr, int fd)
 
 static int elf_load_fd(struct elf_prog *elf_prog, Elf *elf, int fd)
 {
+	__nsec tstart __maybe_unused;
 	size_t phnum, phi;
 	GElf_Ehdr ehdr;
 	GElf_Phdr phdr;
@@ -675,34 +795,9 @@ static int elf_load_fd(struct elf_prog *elf_prog, Elf *elf, int fd)
 
 	/* Load path to program interpreter (typically: dynamic linker) */
 	if (elf_prog->interp.required) {
-		for (phi = 0; phi < phnum; ++phi) {
-			if (gelf_getphdr(elf, phi, &phdr) != &phdr) {
-				elferr_warn("%s: Failed to get program header %"PRIu64"\n",
-					    elf_prog->name, (uint64_t) phi);
-				continue;
-			}
-			if (phdr.p_type != PT_INTERP)
-				continue;
-
-			UK_ASSERT(!elf_prog->interp.path);
-
-			elf_prog->interp.path = malloc(phdr.p_filesz);
-			if (!elf_prog->interp.path) {
-				uk_pr_err("%s: Failed to load INTERP path: %s\n",
-					  elf_prog->name, strerror(-ret));
-				goto err_out;
-			}
-
-			memcpy(elf_prog->interp.path,
-			       &elf->e_rawfile[phdr.p_offset], phdr.p_filesz);
-
-			/* Enforce zero termination, this should normally
-			 * be the case with the PT_INTERP section content.
-			 * We are playing safe here.
-			 */
-			elf_prog->interp.path[phdr.p_filesz - 1] = '\0';
-			break;
-		}
+		ret = elf_load_interp_path(elf_prog, elf, phnum);
+		if (unlikely(ret < 0))
+			goto err_free_img;
 	}
 
 	for (phi = 0; phi < phnum; ++phi) {
@@ -714,9 +809,11 @@ static int elf_load_fd(struct elf_prog *elf_prog, Elf *elf, int fd)
 		if (phdr.p_type != PT_LOAD)
 			continue;
 
+		tstart = loadtime_start();
 		ret = elf_load_fdphdr(elf_prog, &phdr, fd);
 		if (unlikely(ret))
 			return ret;
+		loadtime_account(LOADTIME_SEGMENT, tstart);
 	}
 
 	return 0;
@@ -833,25 +930,312 @@ static void elf_unload_ptunprotect(struct elf_prog *elf_prog)
 #define elf_unload_ptunprotect(p) do {} while (0)
 #endif /* !CONFIG_LIBUKVMEM */
 
+#if CONFIG_APPELFLOADER_SYSRW
+/*
+ * Rewrites system call sites within the executable segments of a loaded
+ * image. Failures are not fatal: Sites that are not rewritten continue to
+ * use the regular system call trap.
+ */
+static void elf_load_sysrw(struct elf_prog *elf_prog, Elf *elf, bool mapped)
+{
+	__nsec tstart __maybe_unused;
+	GElf_Phdr phdr;
+	size_t phnum, phi;
+
+	tstart = loadtime_start();
+	if (unlikely(elf_getphnum(elf, &phnum) == 0)) {
+		elferr_warn("%s: Failed to get number of program headers",
+			    elf_prog->name);
+		return;
+	}
+
+	for (phi = 0; phi < phnum; ++phi) {
+		if (gelf_getphdr(elf, phi, &phdr) != &phdr) {
+			elferr_warn("%s: Failed to get program header %"PRIu64"\n",
+				    elf_prog->name, (uint64_t) phi);
+			continue;
+		}
+		if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X) ||
+		    !phdr.p_filesz)
+			continue;
+
+		sysrw_patch(elf_prog->name,
+			    (void *)(phdr.p_vaddr + (uintptr_t)elf_prog->vabase),
+			    phdr.p_filesz,
+			    mapped ? get_phdr_mmap_prot(&phdr) : -1);
+	}
+	loadtime_account(LOADTIME_SYSRW, tstart);
+}
+#else /* !CONFIG_APPELFLOADER_SYSRW */
+#define elf_load_sysrw(p, e, m) do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_SYSRW */
+
+#if CONFIG_APPELFLOADER_SYMS
+static int elf_sym_cmp(const void *a, const void *b)
+{
+	const struct elf_sym *sa = a;
+	const struct elf_sym *sb = b;
+
+	if (sa->vastart != sb->vastart)
+		return sa->vastart < sb->vastart ? -1 : 1;
+	return 0;
+}
+
+static bool elf_sym_isfunc(const GElf_Sym *sym)
+{
+	return GELF_ST_TYPE(sym->st_info) == STT_FUNC &&
+	       sym->st_shndx != SHN_UNDEF && sym->st_value != 0;
+}
+
+/*
+ * Keeps the function symbols of the symbol table (or, for stripped
+ * executables, of the dynamic symbol table) for the profiler and the load
+ * map. Like the restart snapshot, this is a single allocation: the symbol
+ * array followed by the names. Failures are not fatal, addresses are just
+ * not symbolized.
+ */
+static void elf_load_syms(struct elf_prog *elf_prog, Elf *elf)
+{
+	Elf_Scn *scn = NULL, *symscn = NULL;
+	GElf_Shdr shdr, symshdr;
+	struct elf_sym *sym;
+	size_t i, nsyms, num;
+	size_t nameslen, len;
+	Elf_Data *data;
+	const char *name;
+	GElf_Sym esym;
+	char *names;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) != &shdr)
+			continue;
+		if (shdr.sh_type == SHT_SYMTAB ||
+		    (shdr.sh_type == SHT_DYNSYM && !symscn)) {
+			symscn = scn;
+			symshdr = shdr;
+		}
+	}
+	if (!symscn || !symshdr.sh_entsize) {
+		uk_pr_debug("%s: No symbol table\n", elf_prog->name);
+		return;
+	}
+	data = elf_getdata(symscn, NULL);
+	if (unlikely(!data)) {
+		elferr_warn("%s: Failed to read symbol table\n",
+			    elf_prog->name);
+		return;
+	}
+	nsyms = symshdr.sh_size / symshdr.sh_entsize;
+
+	num = 0;
+	nameslen = 0;
+	for (i = 0; i < nsyms; ++i) {
+		if (gelf_getsym(data, (int)i, &esym) != &esym ||
+		    !elf_sym_isfunc(&esym))
+			continue;
+		name = elf_strptr(elf, symshdr.sh_link, esym.st_name);
+		if (!name || name[0] == '\0')
+			continue;
+		num++;
+		nameslen += strlen(name) + 1;
+	}
+	if (!num)
+		return;
+
+	sym = uk_malloc(elf_prog->a, num * sizeof(*sym) + nameslen);
+	if (unlikely(!sym)) {
+		uk_pr_warn("%s: Not enough memory for symbol table (%"__PRIsz" B)\n",
+			   elf_prog->name, num * sizeof(*sym) + nameslen);
+		return;
+	}
+	names = (char *)&sym[num];
+
+	elf_prog->syms.sym = sym;
+	for (i = 0; i < nsyms; ++i) {
+		if (gelf_getsym(data, (int)i, &esym) != &esym ||
+		    !elf_sym_isfunc(&esym))
+			continue;
+		name = elf_strptr(elf, symshdr.sh_link, esym.st_name);
+		if (!name || name[0] == '\0')
+			continue;
+		sym->vastart = esym.st_value + (uintptr_t)elf_prog->vabase;
+		sym->size = esym.st_size;
+		len = strlen(name) + 1;
+		memcpy(names, name, len);
+		sym->name = names;
+		names += len;
+		sym++;
+	}
+	elf_prog->syms.num = num;
+	qsort(elf_prog->syms.sym, num, sizeof(*sym), elf_sym_cmp);
+	uk_pr_debug("%s: Loaded %"__PRIsz" function symbols\n",
+		    elf_prog->name, num);
+}
+#else /* !CONFIG_APPELFLOADER_SYMS */
+#define elf_load_syms(p, e) do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_SYMS */
+
+#if CONFIG_APPELFLOADER_RESTART
+/*
+ * Saves the initial content of all writable segments for elf_reset(). The
+ * snapshot is a single allocation: the segment array followed by the data.
+ * Failures are not fatal, the program just cannot be restarted.
+ */
+static void elf_load_rwsnap(struct elf_prog *elf_prog, Elf *elf)
+{
+	struct elf_rwseg *seg;
+	size_t phnum, phi, num;
+	size_t datalen;
+	GElf_Phdr phdr;
+	char *data;
+
+	if (unlikely(elf_getphnum(elf, &phnum) == 0)) {
+		elferr_warn("%s: Failed to get number of program headers",
+			    elf_prog->name);
+		return;
+	}
+
+	num = 0;
+	datalen = 0;
+	for (phi = 0; phi < phnum; ++phi) {
+		if (gelf_getphdr(elf, phi, &phdr) != &phdr)
+			continue;
+		if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_W))
+			continue;
+		num++;
+		datalen += phdr.p_filesz;
+	}
+	if (!num) {
+		elf_prog->rwsnap.saved = true;
+		return;
+	}
+
+	seg = uk_malloc(elf_prog->a, num * sizeof(*seg) + datalen);
+	if (unlikely(!seg)) {
+		uk_pr_warn("%s: Not enough memory for restart snapshot (%"__PRIsz" B)\n",
+			   elf_prog->name, num * sizeof(*seg) + datalen);
+		return;
+	}
+	data = (char *)&seg[num];
+
+	elf_prog->rwsnap.seg = seg;
+	for (phi = 0; phi < phnum; ++phi) {
+		if (gelf_getphdr(elf, phi, &phdr) != &phdr)
+			continue;
+		if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_W))
+			continue;
+
+		seg->vastart = phdr.p_vaddr + (uintptr_t)elf_prog->vabase;
+		seg->filesz = phdr.p_filesz;
+		seg->memsz = phdr.p_memsz;
+		seg->data = data;
+		memcpy(data, (const void *)seg->vastart, seg->filesz);
+		data += seg->filesz;
+		seg++;
+	}
+	elf_prog->rwsnap.num = num;
+	elf_prog->rwsnap.saved = true;
+	uk_pr_debug("%s: Saved %"__PRIsz" writable segment(s) (%"__PRIsz" B) for restarts\n",
+		    elf_prog->name, num, datalen);
+}
+
+int elf_reset(struct elf_prog *elf_prog)
+{
+	struct elf_rwseg *seg;
+#if CONFIG_LIBUKVMEM
+	struct uk_vas *vas = uk_vas_get_active();
+	uintptr_t vastart, vaend;
+#endif /* CONFIG_LIBUKVMEM */
+	size_t i;
+	int ret;
+
+	if (elf_prog->interp.prog) {
+		ret = elf_reset(elf_prog->interp.prog);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+	if (unlikely(!elf_prog->rwsnap.saved))
+		return -ENOTSUP;
+
+	for (i = 0; i < elf_prog->rwsnap.num; ++i) {
+		seg = &elf_prog->rwsnap.seg[i];
+
+#if CONFIG_LIBUKVMEM
+		/* The program may have write-protected parts of the segment
+		 * (e.g., RELRO), return to the protection after loading
+		 */
+		if (!PTRISERR(vas)) {
+			vastart = PAGE_ALIGN_DOWN(seg->vastart);
+			vaend = PAGE_ALIGN_UP(seg->vastart + seg->memsz);
+			ret = uk_vma_set_attr(vas, vastart, vaend - vastart,
+					      PAGE_ATTR_PROT_READ |
+					      PAGE_ATTR_PROT_WRITE, 0);
+			if (unlikely(ret < 0)) {
+				uk_pr_err("%s: Failed to restore protection of segment at 0x%"PRIx64": %d\n",
+					  elf_prog->name,
+					  (uint64_t)seg->vastart, ret);
+				return ret;
+			}
+		}
+#endif /* CONFIG_LIBUKVMEM */
+
+		memcpy((void *)seg->vastart, seg->data, seg->filesz);
+		memset((void *)(seg->vastart + seg->filesz), 0,
+		       seg->memsz - seg->filesz);
+	}
+	return 0;
+}
+#else /* !CONFIG_APPELFLOADER_RESTART */
+#define elf_load_rwsnap(p, e) do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_RESTART */
+
 void elf_unload(struct elf_prog *elf_prog)
 {
 	if (elf_prog->interp.prog && !PTRISERR(elf_prog->interp.prog))
 		elf_unload(elf_prog->interp.prog);
 	if (elf_prog->interp.path)
 		free(elf_prog->interp.path);
+	loadmap_remove(elf_prog);
 	elf_unload_ptunprotect(elf_prog);
 	elf_unload_vaimg(elf_prog);
+	if (elf_prog->strblk)
+		uk_free(elf_prog->a, elf_prog->strblk);
+#if CONFIG_APPELFLOADER_SYMS
+	if (elf_prog->syms.sym)
+		uk_free(elf_prog->a, elf_prog->syms.sym);
+#endif /* CONFIG_APPELFLOADER_SYMS */
+#if CONFIG_APPELFLOADER_RESTART
+	if (elf_prog->rwsnap.seg)
+		uk_free(elf_prog->a, elf_prog->rwsnap.seg);
+#endif /* CONFIG_APPELFLOADER_RESTART */
 	uk_free(elf_prog->a, elf_prog);
 }
 
-struct elf_prog *elf_load_img(struct uk_alloc *a, void *img_base,
-			      size_t img_len, const char *progname)
+/* Loads the segments of a parsed image into memory */
+typedef int (*elf_load_segs_fn)(struct elf_prog *elf_prog, Elf *elf,
+				void *arg);
+
+/*
+ * Loads an image whose ELF headers are found in memory at `base`: Parses the
+ * headers, loads the segments with `load_segs`, and finishes the image
+ * (interpreter path, snapshot of writable segments, symbols, system call
+ * rewriting, page protection, load map). `load_segs` cleans up after itself
+ * on errors.
+ */
+static struct elf_prog *do_elf_load_mem(struct uk_alloc *a,
+					void *base, size_t len,
+					elf_load_segs_fn load_segs, void *arg,
+					const char *path, const char *progname,
+					bool nointerp)
 {
 	struct elf_prog *elf_prog = NULL;
+	__nsec tstart __maybe_unused;
+	size_t phnum;
 	Elf *elf;
 	int ret;
 
-	elf = elf_memory(img_base, img_len);
+	tstart = loadtime_start();
+	elf = elf_memory(base, len);
 	if (unlikely(!elf)) {
 		elferr_err("%s: Failed to initialize ELF parser\n",
 			   progname);
@@ -866,6 +1250,7 @@ struct elf_prog *elf_load_img(struct uk_alloc *a, void *img_base,
 	}
 	elf_prog->a = a;
 	elf_prog->name = progname;
+	elf_prog->path = path;
 
 	ret = elf_load_parse(elf_prog, elf);
 	if (unlikely(ret < 0)) {
@@ -873,32 +1258,54 @@ struct elf_prog *elf_load_img(struct uk_alloc *a, void *img_base,
 			  progname, strerror(-ret), ret);
 		goto err_free_elf_prog;
 	}
-	if (unlikely(elf_prog->interp.required)) {
-		uk_pr_err("%s: Requests program interpreter: Unsupported for in-memory ELF images\n",
+	if (unlikely(nointerp && elf_prog->interp.required)) {
+		uk_pr_err("%s: Requests program interpreter: Unsupported\n",
 			  progname);
 		ret = -ENOTSUP;
 		goto err_free_elf_prog;
 	}
+	loadtime_account(LOADTIME_PARSE, tstart);
 
-	ret = elf_load_imgcpy(elf_prog, elf, img_base, img_len);
+	ret = load_segs(elf_prog, elf, arg);
 	if (unlikely(ret < 0)) {
-		uk_pr_err("%s: Failed to copy the executable: %d\n",
+		uk_pr_err("%s: Failed to load the executable: %d\n",
 			  progname, ret);
 		goto err_free_elf_prog;
 	}
 
+	/* Load path to program interpreter (typically: dynamic linker) */
+	if (elf_prog->interp.required) {
+		if (unlikely(elf_getphnum(elf, &phnum) == 0)) {
+			elferr_err("%s: Failed to get number of program headers",
+				   progname);
+			ret = -ENOEXEC;
+			goto err_unload_vaimg;
+		}
+		ret = elf_load_interp_path(elf_prog, elf, phnum);
+		if (unlikely(ret < 0))
+			goto err_unload_vaimg;
+	}
+	elf_load_rwsnap(elf_prog, elf);
+	elf_load_syms(elf_prog, elf);
+
+	elf_load_sysrw(elf_prog, elf, false);
+
+	tstart = loadtime_start();
 	ret = elf_load_ptprotect(elf_prog, elf);
 	if (unlikely(ret < 0)) {
 		uk_pr_err("%s: Failed to set page protection bits: %d\n",
 			  progname, ret);
 		goto err_unload_vaimg;
 	}
+	loadtime_account(LOADTIME_PROTECT, tstart);
 
+	loadmap_add(elf_prog);
 	elf_end(elf);
 	return elf_prog;
 
 err_unload_vaimg:
 	elf_unload_vaimg(elf_prog);
+	free(elf_prog->interp.path);
 err_free_elf_prog:
 	uk_free(a, elf_prog);
 err_end_elf:
@@ -907,6 +1314,191 @@ err_out:
 	return ERR2PTR(ret);
 }
 
+#if CONFIG_APPELFLOADER_ELFZ
+/* Decompresses the segments described by the skeleton ELF */
+static int elf_load_z_segs(struct elf_prog *elf_prog, Elf *elf, void *arg)
+{
+	struct elfz *z = arg;
+	__nsec tstart __maybe_unused;
+	GElf_Ehdr ehdr;
+	int ret;
+
+	if (unlikely(gelf_getehdr(elf, &ehdr) == NULL)) {
+		elferr_err("%s: Failed to get executable header",
+			   elf_prog->name);
+		return -ENOEXEC;
+	}
+
+	tstart = loadtime_start();
+	ret = elf_load_vareserve(elf_prog);
+	if (unlikely(ret < 0))
+		return ret;
+	elf_prog->entry = (uintptr_t)elf_prog->vabase + ehdr.e_entry;
+	elf_prog->start = (uintptr_t)elf_prog->vabase + elf_prog->lowerl;
+
+	ret = elfz_load(z, elf_prog, elf);
+	if (unlikely(ret < 0)) {
+		uk_pr_err("%s: Failed to decompress the executable: %d\n",
+			  elf_prog->name, ret);
+		elf_unload_vaimg(elf_prog);
+		return ret;
+	}
+	loadtime_account(LOADTIME_SEGMENT, tstart);
+	return 0;
+}
+
+static inline struct elf_prog *do_elf_load_z(struct uk_alloc *a,
+					     struct elfz *z,
+					     const char *path,
+					     const char *progname,
+					     bool nointerp)
+{
+	return do_elf_load_mem(a, z->skel, z->hdr.skellen,
+			       elf_load_z_segs, z, path, progname, nointerp);
+}
+#endif /* CONFIG_APPELFLOADER_ELFZ */
+
+struct elf_load_img_arg {
+	const void *base;
+	size_t len;
+};
+
+static int elf_load_img_segs(struct elf_prog *elf_prog, Elf *elf, void *arg)
+{
+	struct elf_load_img_arg *img = arg;
+
+	return elf_load_imgcpy(elf_prog, elf, img->base, img->len);
+}
+
+static struct elf_prog *do_elf_load_img(struct uk_alloc *a, void *img_base,
+					size_t img_len, const char *path,
+					const char *progname, bool nointerp)
+{
+	struct elf_load_img_arg img = { .base = img_base, .len = img_len };
+#if CONFIG_APPELFLOADER_ELFZ
+	struct elf_prog *elf_prog;
+	struct elfz z;
+	int ret;
+
+	ret = elfz_open_mem(&z, img_base, img_len);
+	if (ret == 0) {
+		elf_prog = do_elf_load_z(a, &z, path, progname, nointerp);
+		elfz_close(&z);
+		return elf_prog;
+	}
+	if (unlikely(ret != -ENOEXEC)) {
+		uk_pr_err("%s: Invalid compressed image: %s (%d)\n",
+			  progname, strerror(-ret), ret);
+		return ERR2PTR(ret);
+	}
+#endif /* CONFIG_APPELFLOADER_ELFZ */
+
+	return do_elf_load_mem(a, img_base, img_len, elf_load_img_segs, &img,
+			       path, progname, nointerp);
+}
+
+#if CONFIG_APPELFLOADER_BUNDLE
+/*
+ * Library opens of the interpreter are only served from the bundle if its
+ * system calls take elfloader's direct entry. A trapping call on a bundle
+ * file descriptor reaches the system call handler instead, which does not
+ * know the descriptor, and the interpreter fails with EBADF. Refuse such an
+ * interpreter instead.
+ */
+static int elf_load_bundle_check(struct elf_prog *interp)
+{
+	static const long nrs[] = {
+#ifdef SYS_open
+		SYS_open,
+#endif /* SYS_open */
+		SYS_openat, SYS_read, SYS_pread64, SYS_lseek, SYS_fstat,
+		SYS_newfstatat, SYS_mmap, SYS_close
+	};
+	const Elf64_Phdr *phdr;
+	size_t i, found = 0;
+
+	phdr = (const Elf64_Phdr *)((__uptr)interp->vabase +
+				    interp->phdr.off);
+	for (i = 0; i < interp->phdr.num; ++i) {
+		if (phdr[i].p_type != PT_LOAD || !(phdr[i].p_flags & PF_X))
+			continue;
+		found += sysrw_count_trapping((void *)((__uptr)interp->vabase +
+						       phdr[i].p_vaddr),
+					      phdr[i].p_filesz,
+					      nrs, ARRAY_SIZE(nrs));
+	}
+	if (unlikely(found)) {
+		uk_pr_err("%s: %"__PRIsz" file system calls could not be rewritten, shared libraries cannot be loaded from the bundle\n",
+			  interp->name, found);
+		return -ENOTSUP;
+	}
+	return 0;
+}
+#endif /* CONFIG_APPELFLOADER_BUNDLE */
+
+struct elf_prog *elf_load_img(struct uk_alloc *a, void *img_base,
+			      size_t img_len, const char *progname)
+{
+#if CONFIG_APPELFLOADER_BUNDLE
+	struct elf_prog *elf_prog;
+	const char *path = NULL;
+	struct bundle_file f;
+	__nsec tstart __maybe_unused;
+	int err;
+
+	/* Load the program (first entry) of a bundle */
+	err = bundle_init(img_base, img_len);
+	if (err == 0) {
+		bundle_prog(&f);
+		img_base = (void *)f.data;
+		img_len  = f.len;
+		path     = f.path;
+	} else if (unlikely(err != -ENOEXEC)) {
+		return ERR2PTR(err);
+	}
+
+	elf_prog = do_elf_load_img(a, img_base, img_len, path, progname,
+				   false);
+	if (PTRISERR(elf_prog) || !elf_prog)
+		return elf_prog;
+
+	/* Load program interpreter/dynamic loader from the bundle */
+	if (elf_prog->interp.required) {
+		uk_pr_debug("%s: Loading program interpreter %s...\n",
+			    elf_prog->name, elf_prog->interp.path);
+		tstart = loadtime_start();
+		err = bundle_lookup(elf_prog->interp.path, &f);
+		if (unlikely(err < 0)) {
+			uk_pr_err("%s: Program interpreter %s is not in the bundle\n",
+				  elf_prog->name, elf_prog->interp.path);
+			goto err_unload_prog;
+		}
+		elf_prog->interp.prog = do_elf_load_img(a, (void *)f.data,
+							f.len, f.path,
+							"<interp>", true);
+		if (unlikely(PTRISERR(elf_prog->interp.prog) ||
+			     !elf_prog->interp.prog)) {
+			err = PTR2ERR(elf_prog->interp.prog);
+			uk_pr_err("%s: Failed to load program interpreter %s: %s\n",
+				  elf_prog->name, elf_prog->interp.path,
+				  strerror(-err));
+			goto err_unload_prog;
+		}
+		err = elf_load_bundle_check(elf_prog->interp.prog);
+		if (unlikely(err < 0))
+			goto err_unload_prog;
+		loadtime_account(LOADTIME_INTERP, tstart);
+	}
+	return elf_prog;
+
+err_unload_prog:
+	elf_unload(elf_prog);
+	return ERR2PTR(err);
+#else /* !CONFIG_APPELFLOADER_BUNDLE */
+	return do_elf_load_img(a, img_base, img_len, NULL, progname, true);
+#endif /* !CONFIG_APPELFLOADER_BUNDLE */
+}
+
 #if CONFIG_LIBVFSCORE
 static struct elf_prog *do_elf_load_vfs(struct uk_alloc *a, const char *path,
 					const char *progname, bool nointerp)
@@ -915,10 +1507,15 @@ static struct elf_prog *do_elf_load_vfs(struct uk_alloc *a, const char *path,
 #if CONFIG_APPELFLOADER_VFSEXEC_EXECBIT
 	struct stat fd_stat;
 #endif /* CONFIG_APPELFLOADER_VFSEXEC_EXECBIT */
+#if CONFIG_APPELFLOADER_ELFZ
+	struct elfz z;
+#endif /* CONFIG_APPELFLOADER_ELFZ */
 	struct elf_prog *elf_prog = NULL;
+	__nsec tstart __maybe_unused;
 	Elf *elf;
 	int ret;
 
+	tstart = loadtime_start();
 	fd = open(path, O_RDONLY);
 	if (unlikely(fd < 0)) {
 		uk_pr_err("%s: Failed to execute %s: %s\n",
@@ -945,7 +1542,24 @@ static struct elf_prog *do_elf_load_vfs(struct uk_alloc *a, const char *path,
 #else /* !CONFIG_APPELFLOADER_VFSEXEC_EXECBIT */
 	uk_pr_debug("%s: Note, ignoring executable bit state\n", progname);
 #endif /* !CONFIG_APPELFLOADER_VFSEXEC_EXECBIT */
+	loadtime_account(LOADTIME_OPEN, tstart);
+
+#if CONFIG_APPELFLOADER_ELFZ
+	ret = elfz_open_fd(&z, fd);
+	if (ret == 0) {
+		elf_prog = do_elf_load_z(a, &z, path, progname, nointerp);
+		elfz_close(&z);
+		close(fd);
+		return elf_prog;
+	}
+	if (unlikely(ret != -ENOEXEC)) {
+		uk_pr_err("%s: Failed to execute %s: %s\n",
+			  progname, path, strerror(-ret));
+		goto err_close_fd;
+	}
+#endif /* CONFIG_APPELFLOADER_ELFZ */
 
+	tstart = loadtime_start();
 	elf = elf_open(fd);
 	if (unlikely(!elf)) {
 		elferr_err("%s: Failed to initialize ELF parser\n",
@@ -975,6 +1589,7 @@ static struct elf_prog *do_elf_load_vfs(struct uk_alloc *a, const char *path,
 		ret = -ENOTSUP;
 		goto err_free_elf_prog;
 	}
+	loadtime_account(LOADTIME_PARSE, tstart);
 
 	ret = elf_load_fd(elf_prog, elf, fd);
 	if (unlikely(ret < 0)) {
@@ -982,17 +1597,28 @@ static struct elf_prog *do_elf_load_vfs(struct uk_alloc *a, const char *path,
 			  progname, ret);
 		goto err_free_elf_prog;
 	}
+	elf_load_rwsnap(elf_prog, elf);
+	elf_load_syms(elf_prog, elf);
+
+#if CONFIG_LIBPOSIX_MMAP
+	elf_load_sysrw(elf_prog, elf, true);
+#else /* !CONFIG_LIBPOSIX_MMAP */
+	elf_load_sysrw(elf_prog, elf, false);
+#endif /* !CONFIG_LIBPOSIX_MMAP */
 
 	/* This is already ensured by the `mmap` flags */
 #if !CONFIG_LIBPOSIX_MMAP
+	tstart = loadtime_start();
 	ret = elf_load_ptprotect(elf_prog, elf);
 	if (unlikely(ret < 0)) {
 		uk_pr_err("%s: Failed to set page protection bits: %d\n",
 			  progname, ret);
 		goto err_unload_vaimg;
 	}
+	loadtime_account(LOADTIME_PROTECT, tstart);
 #endif /* !CONFIG_LIBPOSIX_MMAP */
 
+	loadmap_add(elf_prog);
 	elf_end(elf);
 	close(fd);
 	return elf_prog;
@@ -1011,13 +1637,232 @@ err_out:
 	return ERR2PTR(ret);
 }
 
+#if CONFIG_APPELFLOADER_CPIOEXEC
+#if CONFIG_APPELFLOADER_CPIOEXEC_INPLACE
+/*
+ * Returns true if a segment can be mapped read-only from the initrd: The
+ * file content has to cover the whole segment, it has to be placed at the
+ * same page offset within the initrd as in memory, and no other segment may
+ * share a page with it.
+ */
+static bool elf_load_cpio_inplace(Elf *elf, size_t phnum, size_t phi,
+				  GElf_Phdr *phdr,
+				  const struct cpioexec_file *f)
+{
+	uintptr_t vastart, vaend;
+	GElf_Phdr other;
+	size_t i;
+
+	if ((phdr->p_flags & PF_W) || !phdr->p_filesz ||
+	    phdr->p_filesz != phdr->p_memsz ||
+	    phdr->p_offset > f->len || phdr->p_filesz > f->len - phdr->p_offset)
+		return false;
+#if CONFIG_APPELFLOADER_SYSRW
+	/* System call sites are rewritten within executable segments */
+	if (phdr->p_flags & PF_X)
+		return false;
+#endif /* CONFIG_APPELFLOADER_SYSRW */
+	if ((f->paddr + phdr->p_offset) % PAGE_SIZE !=
+	    phdr->p_vaddr % PAGE_SIZE)
+		return false;
+
+	vastart = PAGE_ALIGN_DOWN(phdr->p_vaddr);
+	vaend   = PAGE_ALIGN_UP(phdr->p_vaddr + phdr->p_memsz);
+	for (i = 0; i < phnum; ++i) {
+		if (i == phi || gelf_getphdr(elf, i, &other) != &other ||
+		    other.p_type != PT_LOAD)
+			continue;
+		if (PAGE_ALIGN_DOWN(other.p_vaddr) < vaend &&
+		    PAGE_ALIGN_UP(other.p_vaddr + other.p_memsz) > vastart)
+			return false;
+	}
+	return true;
+}
+
+static int elf_load_cpio_map(struct elf_prog *elf_prog, GElf_Phdr *phdr,
+			     const struct cpioexec_file *f)
+{
+	struct uk_vas *vas;
+	__vaddr_t vaddr;
+	__paddr_t paddr;
+	__sz len;
+
+	vas = uk_vas_get_active();
+	if (unlikely(PTRISERR(vas)))
+		return -ENOTSUP;
+
+	vaddr = PAGE_ALIGN_DOWN(phdr->p_vaddr + (uintptr_t)elf_prog->vabase);
+	paddr = PAGE_ALIGN_DOWN(f->paddr + phdr->p_offset);
+	len   = PAGE_ALIGN_UP(phdr->p_vaddr + phdr->p_memsz)
+		- PAGE_ALIGN_DOWN(phdr->p_vaddr);
+	uk_pr_debug("%s: Mapping initrd 0x%"PRIx64" - 0x%"PRIx64" to 0x%"PRIx64" - 0x%"PRIx64"\n",
+		    elf_prog->name,
+		    (uint64_t) paddr, (uint64_t) paddr + len,
+		    (uint64_t) vaddr, (uint64_t) vaddr + len);
+	return uk_vma_map_dma(vas, &vaddr, len,
+			      PAGE_ATTR_PROT_READ |
+			      ((phdr->p_flags & PF_X) ?
+			       PAGE_ATTR_PROT_EXEC : 0x0),
+			      UK_VMA_MAP_REPLACE, elf_prog->name, paddr);
+}
+#else /* !CONFIG_APPELFLOADER_CPIOEXEC_INPLACE */
+#define elf_load_cpio_inplace(e, n, i, p, f) ({ false; })
+#define elf_load_cpio_map(p, h, f) ({ -ENOTSUP; })
+#endif /* !CONFIG_APPELFLOADER_CPIOEXEC_INPLACE */
+
+#if CONFIG_LIBPOSIX_MMAP
+/*
+ * Loads the segments of an image found in the cpio initrd. Read-only
+ * segments are mapped in place if possible, all others are copied into an
+ * anonymous mapping, so that elf_unload_vaimg() releases both with munmap.
+ */
+static int elf_load_cpio_segs(struct elf_prog *elf_prog, Elf *elf, void *arg)
+{
+	const struct cpioexec_file *f = arg;
+	__nsec tstart __maybe_unused;
+	uintptr_t vastart;
+	size_t phnum, phi;
+	GElf_Ehdr ehdr;
+	GElf_Phdr phdr;
+	int ret;
+
+	if (unlikely(gelf_getehdr(elf, &ehdr) == NULL)) {
+		elferr_err("%s: Failed to get executable header",
+			   elf_prog->name);
+		return -ENOEXEC;
+	}
+	if (unlikely(elf_getphnum(elf, &phnum) == 0)) {
+		elferr_err("%s: Failed to get number of program headers",
+			   elf_prog->name);
+		return -ENOEXEC;
+	}
+
+	ret = elf_load_vareserve(elf_prog);
+	if (unlikely(ret < 0))
+		return ret;
+
+	elf_prog->entry = (uintptr_t)elf_prog->vabase + ehdr.e_entry;
+	for (phi = 0; phi < phnum; ++phi) {
+		if (gelf_getphdr(elf, phi, &phdr) != &phdr) {
+			elferr_warn("%s: Failed to get program header %"PRIu64"\n",
+				    elf_prog->name, (uint64_t) phi);
+			continue;
+		}
+		if (phdr.p_type != PT_LOAD)
+			continue;
+
+		tstart = loadtime_start();
+		vastart = phdr.p_vaddr + (uintptr_t)elf_prog->vabase;
+		if (!elf_prog->start || (vastart < elf_prog->start))
+			elf_prog->start = vastart;
+
+		if (elf_load_cpio_inplace(elf, phnum, phi, &phdr, f)) {
+			ret = elf_load_cpio_map(elf_prog, &phdr, f);
+			if (ret >= 0) {
+				loadtime_account(LOADTIME_SEGMENT, tstart);
+				continue;
+			}
+			uk_pr_warn("%s: Failed to map segment in place, copying: %d\n",
+				   elf_prog->name, ret);
+		}
+
+		if (unlikely(phdr.p_offset > f->len ||
+			     phdr.p_filesz > f->len - phdr.p_offset)) {
+			uk_pr_err("%s: Segment exceeds the file\n",
+				  elf_prog->name);
+			ret = -ENOEXEC;
+			goto err_free_img;
+		}
+
+		/* The rest of the segment is already zeroed by mmap */
+		uk_pr_debug("%s: Copying 0x%"PRIx64" - 0x%"PRIx64" -> 0x%"PRIx64" - 0x%"PRIx64"\n",
+			    elf_prog->name,
+			    (uint64_t) phdr.p_offset,
+			    (uint64_t) phdr.p_offset + phdr.p_filesz,
+			    (uint64_t) vastart,
+			    (uint64_t) vastart + phdr.p_filesz);
+		memcpy((void *)vastart,
+		       (const char *)f->data + phdr.p_offset,
+		       (size_t)phdr.p_filesz);
+		loadtime_account(LOADTIME_SEGMENT, tstart);
+	}
+	return 0;
+
+err_free_img:
+	elf_unload_vaimg(elf_prog);
+	return ret;
+}
+#else /* !CONFIG_LIBPOSIX_MMAP */
+static int elf_load_cpio_segs(struct elf_prog *elf_prog, Elf *elf, void *arg)
+{
+	const struct cpioexec_file *f = arg;
+
+	return elf_load_imgcpy(elf_prog, elf, f->data, f->len);
+}
+#endif /* !CONFIG_LIBPOSIX_MMAP */
+
+static struct elf_prog *do_elf_load_cpio(struct uk_alloc *a,
+					 const struct cpioexec_file *f,
+					 const char *path,
+					 const char *progname, bool nointerp)
+{
+#if CONFIG_APPELFLOADER_ELFZ
+	/* Compressed images are decompressed, not mapped in place */
+	if (f->len >= ELFZ_MAGIC_LEN &&
+	    memcmp(f->data, ELFZ_MAGIC, ELFZ_MAGIC_LEN) == 0)
+		return do_elf_load_img(a, (void *)f->data, f->len, path,
+				       progname, nointerp);
+#endif /* CONFIG_APPELFLOADER_ELFZ */
+
+	return do_elf_load_mem(a, (void *)f->data, f->len,
+			       elf_load_cpio_segs, (void *)f,
+			       path, progname, nointerp);
+}
+#endif /* CONFIG_APPELFLOADER_CPIOEXEC */
+
+/*
+ * Loads an executable from the cpio initrd if it is found there, otherwise
+ * through VFS
+ */
+static struct elf_prog *elf_load_path(struct uk_alloc *a, const char *path,
+				      const char *progname, bool nointerp)
+{
+#if CONFIG_APPELFLOADER_CPIOEXEC
+	struct cpioexec_file f;
+	__nsec tstart __maybe_unused;
+	int ret;
+
+	if (path[0] == '/') {
+		tstart = loadtime_start();
+		ret = cpioexec_lookup(path, &f);
+		loadtime_account(LOADTIME_OPEN, tstart);
+		if (ret == 0) {
+#if CONFIG_APPELFLOADER_VFSEXEC_EXECBIT
+			if (unlikely(!(f.mode & S_IXUSR))) {
+				uk_pr_err("%s: Failed to execute %s: %s\n",
+					  progname, path, strerror(EPERM));
+				return ERR2PTR(-EPERM);
+			}
+#endif /* CONFIG_APPELFLOADER_VFSEXEC_EXECBIT */
+			return do_elf_load_cpio(a, &f, path, progname,
+						nointerp);
+		}
+		if (ret != -ENOENT)
+			uk_pr_warn("%s: Cannot load %s from initrd, trying VFS: %s\n",
+				   progname, path, strerror(-ret));
+	}
+#endif /* CONFIG_APPELFLOADER_CPIOEXEC */
+	return do_elf_load_vfs(a, path, progname, nointerp);
+}
+
 struct elf_prog *elf_load_vfs(struct uk_alloc *a, const char *path,
 			      const char *progname)
 {
 	struct elf_prog *elf_prog;
+	__nsec tstart __maybe_unused;
 	int err;
 
-	elf_prog = do_elf_load_vfs(a, path, progname, false);
+	elf_prog = elf_load_path(a, path, progname, false);
 	if (PTRISERR(elf_prog) || !elf_prog) {
 		err = PTR2ERR(elf_prog);
 		goto err_out;
@@ -1027,9 +1872,10 @@ struct elf_prog *elf_load_vfs(struct uk_alloc *a, const char *path,
 	if (elf_prog->interp.required) {
 		uk_pr_debug("%s: Loading program interpreter %s...\n",
 			    elf_prog->name, elf_prog->interp.path);
-		elf_prog->interp.prog = do_elf_load_vfs(a,
-							elf_prog->interp.path,
-							"<interp>", true);
+		tstart = loadtime_start();
+		elf_prog->interp.prog = elf_load_path(a,
+						      elf_prog->interp.path,
+						      "<interp>", true);
 		if (unlikely(PTRISERR(elf_prog->interp.prog) ||
 			     !elf_prog->interp.prog)) {
 			err = PTR2ERR(elf_prog->interp.prog);
@@ -1038,6 +1884,7 @@ struct elf_prog *elf_load_vfs(struct uk_alloc *a, const char *path,
 				  strerror(-err));
 			goto err_unload_prog;
 		}
+		loadtime_account(LOADTIME_INTERP, tstart);
 	}
 
 	return elf_prog;
@@ -43,6 +43,25 @@
 #include <uk/arch/ctx.h>
 #include <uk/essentials.h>
 
+#if CONFIG_APPELFLOADER_RESTART
+/* Initial content of a writable segment */
+struct elf_rwseg {
+	uintptr_t vastart;
+	size_t filesz;
+	size_t memsz;
+	const void *data;	/* `filesz` bytes */
+};
+#endif /* CONFIG_APPELFLOADER_RESTART */
+
+#if CONFIG_APPELFLOADER_SYMS
+/* Function symbol, for symbolizing addresses */
+struct elf_sym {
+	uintptr_t vastart;
+	size_t size;		/* 0 if unknown */
+	const char *name;
+};
+#endif /* CONFIG_APPELFLOADER_SYMS */
+
 struct elf_prog {
 	struct uk_alloc *a;
 	const char *name;
@@ -66,6 +85,29 @@ struct elf_prog {
 	uintptr_t lowerl;
 	uintptr_t upperl;
 	size_t align;
+
+	/* Set by elf_ctx_init(): */
+	char *strblk;	/* argument and environment strings, if not on stack */
+	size_t strblk_len;	/* length of `strblk` */
+	const void *auxv;	/* auxiliary vector on the stack */
+	size_t auxv_len;	/* length of auxiliary vector in bytes */
+
+#if CONFIG_APPELFLOADER_SYMS
+	/* Function symbols, sorted by address */
+	struct {
+		size_t num;
+		struct elf_sym *sym;	/* followed by the names */
+	} syms;
+#endif /* CONFIG_APPELFLOADER_SYMS */
+
+#if CONFIG_APPELFLOADER_RESTART
+	/* Needed by elf_reset(): */
+	struct {
+		bool saved;
+		size_t num;
+		struct elf_rwseg *seg;
+	} rwsnap;
+#endif /* CONFIG_APPELFLOADER_RESTART */
 };
 
 /**
@@ -124,6 +166,24 @@ struct elf_prog *elf_load_vfs(struct uk_alloc *a, const char *path,
  */
 void elf_unload(struct elf_prog *elf_prog);
 
+#if CONFIG_APPELFLOADER_RESTART
+/**
+ * Restores the writable segments of a loaded ELF program (and its program
+ * interpreter) to their state right after loading, so that the program can
+ * be started again with `elf_ctx_init()`. Parsed headers and read-only
+ * segments are reused as they are.
+ * NOTE: Memory that the program mapped itself at runtime (e.g., shared
+ *       libraries loaded by the dynamic loader) is not covered.
+ *
+ * @param elf_prog:
+ *   Loaded ELF program
+ * @return:
+ *   0 on success, -ENOTSUP if no snapshot of the writable segments is
+ *   available
+ */
+int elf_reset(struct elf_prog *elf_prog);
+#endif /* CONFIG_APPELFLOADER_RESTART */
+
 /**
  * Initializes an ukarch_ctx with a loaded ELF program. This program
  * will be executed as soon as the context is scheduled/loaded to
@@ -154,9 +214,17 @@ void elf_unload(struct elf_prog *elf_prog);
  *   Random seed that is passed to the application
  *   Only a reference to rand[] is handed over to the application. Do not
  *   release/modify while `ctx` and `prog` are in use.
+ * @param stack_len:
+ *   Usable stack size below `ctx->sp`. If the argument and environment
+ *   strings would occupy a large share of it, they are copied to a separate
+ *   allocation (from the allocator of `prog`, released by
+ *   elf_unload()) instead.
+ * @return:
+ *   0 on success, -ENOMEM if the separate allocation failed, -E2BIG if the
+ *   vectors do not fit on the stack.
  */
-void elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
-		  const char *argv0, int argc, char *argv[], char *environ[],
-		  uint64_t rand[2]);
+int elf_ctx_init(struct ukarch_ctx *ctx, struct elf_prog *prog,
+		 const char *argv0, int argc, char *argv[], char *environ[],
+		 uint64_t rand[2], __sz stack_len);
 
 #endif /* ELF_PROG_H */
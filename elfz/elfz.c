@@ -0,0 +1,448 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gelf.h>
+#if CONFIG_LIBVFSCORE
+#include <unistd.h>
+#endif /* CONFIG_LIBVFSCORE */
+#include <uk/essentials.h>
+#include <uk/print.h>
+
+#include "elfz.h"
+#include "../libelf_helper.h"
+
+/* LZ4 frame format (little endian, like the supported architectures) */
+#define LZ4F_MAGIC		0x184D2204
+#define LZ4F_FLG_VERSION_MASK	0xc0
+#define LZ4F_FLG_VERSION	0x40
+#define LZ4F_FLG_BINDEP		0x20
+#define LZ4F_FLG_BCSUM		0x10
+#define LZ4F_FLG_CSIZE		0x08
+#define LZ4F_FLG_CCSUM		0x04
+#define LZ4F_FLG_DICTID		0x01
+#define LZ4F_BD_BLOCKMAX(bd)	(1UL << (2 * (((bd) >> 4) & 0x7) + 8))
+#define LZ4F_BLOCK_RAW		0x80000000
+#define LZ4_MINMATCH		4
+
+/* File content of a loadable segment and its place in memory */
+struct elfz_seg {
+	__u64 off;
+	__u64 len;
+	char *dst;
+};
+
+/* Reader for the compressed stream */
+struct elfz_in {
+	const struct elfz *z;
+	__u64 pos;
+	__u64 end;
+	char *buf;		/* block buffer when reading from a file */
+};
+
+#if CONFIG_LIBVFSCORE
+static int elfz_pread(int fd, void *dst, __sz len, __u64 off)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = pread(fd, dst, len, (off_t)off);
+		if (unlikely(rc < 0)) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (unlikely(rc == 0))
+			return -ENOEXEC;
+		dst = (char *)dst + rc;
+		off += rc;
+		len -= rc;
+	}
+	return 0;
+}
+#endif /* CONFIG_LIBVFSCORE */
+
+/* Copies the next `len` bytes of the stream to `dst` */
+static int elfz_read(struct elfz_in *in, void *dst, __sz len)
+{
+	int rc = 0;
+
+	if (unlikely(len > in->end - in->pos))
+		return -ENOEXEC;
+	if (in->z->mem)
+		memcpy(dst, in->z->mem + in->pos, len);
+#if CONFIG_LIBVFSCORE
+	else
+		rc = elfz_pread(in->z->fd, dst, len, in->pos);
+#endif /* CONFIG_LIBVFSCORE */
+	in->pos += len;
+	return rc;
+}
+
+/* Returns the next `len` bytes of the stream, at most the block size */
+static const void *elfz_map(struct elfz_in *in, __sz len)
+{
+	const void *p;
+
+	if (in->z->mem) {
+		if (unlikely(len > in->end - in->pos))
+			return NULL;
+		p = in->z->mem + in->pos;
+		in->pos += len;
+		return p;
+	}
+	if (unlikely(elfz_read(in, in->buf, len) < 0))
+		return NULL;
+	return in->buf;
+}
+
+/*
+ * Decodes an LZ4 block. Matches may only refer to data of the same block
+ * (independent blocks), so the output can be placed anywhere.
+ */
+static int lz4_block(const __u8 *src, __sz srclen, __u8 *dst, __sz dstcap,
+		     __sz *outlen)
+{
+	const __u8 *ip = src, *iend = src + srclen;
+	__u8 *op = dst, *oend = dst + dstcap;
+	const __u8 *match;
+	__sz len, off, i;
+	__u8 token, b;
+
+	for (;;) {
+		if (unlikely(ip >= iend))
+			return -EINVAL;
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (unlikely(ip >= iend))
+					return -EINVAL;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (unlikely(len > (__sz)(iend - ip) ||
+			     len > (__sz)(oend - op)))
+			return -EINVAL;
+		/* Short literal runs are copied with a fixed size if there
+		 * is room; the excess is overwritten by the next sequence
+		 */
+		if (len <= 16 && iend - ip >= 16 && oend - op >= 16)
+			memcpy(op, ip, 16);
+		else
+			memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence consists of literals only */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			return -EINVAL;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (unlikely(!off || off > (__sz)(op - dst)))
+			return -EINVAL;
+
+		len = token & 0xf;
+		if (len == 15) {
+			do {
+				if (unlikely(ip >= iend))
+					return -EINVAL;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += LZ4_MINMATCH;
+		if (unlikely(len > (__sz)(oend - op)))
+			return -EINVAL;
+
+		match = op - off;
+		if (off >= 8 && (__sz)(oend - op) >= ALIGN_UP(len, 8)) {
+			/* Copies in steps of 8 bytes; overlapping matches
+			 * read what the previous steps wrote
+			 */
+			for (i = 0; i < len; i += 8)
+				memcpy(op + i, match + i, 8);
+			op += len;
+		} else if (off >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			/* Overlapping match repeats the last `off` bytes */
+			while (len--)
+				*op++ = *match++;
+		}
+	}
+	*outlen = op - dst;
+	return 0;
+}
+
+/* Returns the segment that holds all of [off, off + len), if it is the only
+ * one touching this range
+ */
+static struct elfz_seg *elfz_seg_find(struct elfz_seg *segs, size_t nsegs,
+				      __u64 off, __sz len)
+{
+	struct elfz_seg *found = NULL;
+	size_t i;
+
+	for (i = 0; i < nsegs; ++i) {
+		if (segs[i].off >= off + len || segs[i].off + segs[i].len <= off)
+			continue;
+		if (found || segs[i].off > off ||
+		    segs[i].off + segs[i].len < off + len)
+			return NULL;
+		found = &segs[i];
+	}
+	return found;
+}
+
+/* Copies the parts of [off, off + len) that are segment content */
+static void elfz_scatter(struct elfz_seg *segs, size_t nsegs, __u64 off,
+			 const char *src, __sz len)
+{
+	__u64 lo, hi;
+	size_t i;
+
+	for (i = 0; i < nsegs; ++i) {
+		lo = MAX(off, segs[i].off);
+		hi = MIN(off + len, segs[i].off + segs[i].len);
+		if (lo < hi)
+			memcpy(segs[i].dst + (lo - segs[i].off),
+			       src + (lo - off), hi - lo);
+	}
+}
+
+static int elfz_lz4(struct elfz *z, const char *name,
+		    struct elfz_seg *segs, size_t nsegs)
+{
+	struct elfz_in in = {
+		.z = z,
+		.pos = z->hdr.zoff,
+		.end = z->hdr.zoff + z->hdr.zlen,
+	};
+	__u64 rawlen = z->hdr.rawlen, off = 0;
+	struct elfz_seg *seg;
+	char *scratch = NULL;
+	const void *src;
+	__u32 magic, bsize;
+	__sz blockmax, cap, n;
+	__u8 desc[2];
+	bool raw;
+	char *dst;
+	int rc;
+
+	rc = elfz_read(&in, &magic, sizeof(magic));
+	if (unlikely(rc < 0 || magic != LZ4F_MAGIC))
+		goto err_format;
+	rc = elfz_read(&in, desc, sizeof(desc));
+	if (unlikely(rc < 0 ||
+		     (desc[0] & LZ4F_FLG_VERSION_MASK) != LZ4F_FLG_VERSION))
+		goto err_format;
+	if (unlikely(!(desc[0] & LZ4F_FLG_BINDEP) ||
+		     (desc[0] & LZ4F_FLG_DICTID))) {
+		uk_pr_err("%s: LZ4 frame with linked blocks or dictionary: Unsupported\n",
+			  name);
+		return -ENOTSUP;
+	}
+	blockmax = LZ4F_BD_BLOCKMAX(desc[1]);
+	if (unlikely(blockmax < (1UL << 16)))
+		goto err_format;
+	/* Skip content size and header checksum, checksums are not verified */
+	in.pos += ((desc[0] & LZ4F_FLG_CSIZE) ? 8 : 0) + 1;
+
+	if (!z->mem) {
+		in.buf = malloc(blockmax);
+		if (unlikely(!in.buf))
+			return -ENOMEM;
+	}
+
+	for (;;) {
+		rc = elfz_read(&in, &bsize, sizeof(bsize));
+		if (unlikely(rc < 0))
+			goto err_format;
+		if (!bsize)
+			break;
+		raw = bsize & LZ4F_BLOCK_RAW;
+		bsize &= ~LZ4F_BLOCK_RAW;
+		if (unlikely(bsize > blockmax || off >= rawlen))
+			goto err_format;
+
+		/* Decompress straight into the segment if the block cannot
+		 * extend beyond it
+		 */
+		cap = raw ? bsize : MIN(blockmax, rawlen - off);
+		seg = elfz_seg_find(segs, nsegs, off, cap);
+		if (seg) {
+			dst = seg->dst + (off - seg->off);
+		} else {
+			if (!scratch) {
+				scratch = malloc(blockmax);
+				if (unlikely(!scratch)) {
+					rc = -ENOMEM;
+					goto out;
+				}
+			}
+			dst = scratch;
+		}
+
+		if (raw) {
+			rc = elfz_read(&in, dst, bsize);
+			n = bsize;
+		} else {
+			src = elfz_map(&in, bsize);
+			rc = src ? lz4_block(src, bsize, (__u8 *)dst, cap, &n)
+				 : -EINVAL;
+		}
+		if (unlikely(rc < 0))
+			goto err_format;
+		if (!seg)
+			elfz_scatter(segs, nsegs, off, scratch, n);
+		off += n;
+
+		if (desc[0] & LZ4F_FLG_BCSUM)
+			in.pos += 4;
+	}
+	if (unlikely(off != rawlen))
+		goto err_format;
+	rc = 0;
+	goto out;
+
+err_format:
+	uk_pr_err("%s: Corrupt LZ4 stream at offset %"PRIu64" of the image\n",
+		  name, off);
+	rc = -ENOEXEC;
+out:
+	free(scratch);
+	free(in.buf);
+	return rc;
+}
+
+static int elfz_check(const struct elfz_hdr *hdr)
+{
+	if (unlikely(hdr->version != ELFZ_VERSION))
+		return -ENOEXEC;
+	if (unlikely(hdr->codec != ELFZ_CODEC_LZ4)) {
+		uk_pr_err("Compressed image with unsupported codec %"PRIu32"\n",
+			  hdr->codec);
+		return -ENOTSUP;
+	}
+	if (unlikely(hdr->skellen < sizeof(Elf64_Ehdr) ||
+		     hdr->skeloff + hdr->skellen < hdr->skeloff ||
+		     hdr->zoff + hdr->zlen < hdr->zoff))
+		return -ENOEXEC;
+	return 0;
+}
+
+int elfz_open_mem(struct elfz *z, const void *img, __sz len)
+{
+	int rc;
+
+	if (len < sizeof(z->hdr) ||
+	    memcmp(img, ELFZ_MAGIC, ELFZ_MAGIC_LEN) != 0)
+		return -ENOEXEC;
+	memcpy(&z->hdr, img, sizeof(z->hdr));
+	rc = elfz_check(&z->hdr);
+	if (unlikely(rc < 0))
+		return rc;
+	if (unlikely(z->hdr.skeloff + z->hdr.skellen > len ||
+		     z->hdr.zoff + z->hdr.zlen > len))
+		return -ENOEXEC;
+
+	z->mem  = img;
+	z->fd   = -1;
+	z->skel = (char *)img + z->hdr.skeloff;
+	return 0;
+}
+
+#if CONFIG_LIBVFSCORE
+int elfz_open_fd(struct elfz *z, int fd)
+{
+	int rc;
+
+	rc = elfz_pread(fd, &z->hdr, sizeof(z->hdr), 0);
+	if (rc == -ENOEXEC ||
+	    (rc == 0 && memcmp(z->hdr.magic, ELFZ_MAGIC, ELFZ_MAGIC_LEN)))
+		return -ENOEXEC;
+	if (unlikely(rc < 0))
+		return rc;
+	rc = elfz_check(&z->hdr);
+	if (unlikely(rc < 0))
+		return rc;
+
+	z->skel = malloc(z->hdr.skellen);
+	if (unlikely(!z->skel))
+		return -ENOMEM;
+	rc = elfz_pread(fd, z->skel, z->hdr.skellen, z->hdr.skeloff);
+	if (unlikely(rc < 0)) {
+		free(z->skel);
+		z->skel = NULL;
+		return rc;
+	}
+	z->mem = NULL;
+	z->fd  = fd;
+	return 0;
+}
+#endif /* CONFIG_LIBVFSCORE */
+
+void elfz_close(struct elfz *z)
+{
+	if (!z->mem)
+		free(z->skel);
+	z->skel = NULL;
+}
+
+int elfz_load(struct elfz *z, struct elf_prog *elf_prog, Elf *elf)
+{
+	struct elfz_seg *segs;
+	size_t phnum, phi, nsegs = 0;
+	GElf_Phdr phdr;
+	int rc;
+
+	if (unlikely(elf_getphnum(elf, &phnum) == 0)) {
+		elferr_err("%s: Failed to get number of program headers",
+			   elf_prog->name);
+		return -ENOEXEC;
+	}
+	segs = calloc(phnum, sizeof(*segs));
+	if (unlikely(!segs))
+		return -ENOMEM;
+
+	for (phi = 0; phi < phnum; ++phi) {
+		if (gelf_getphdr(elf, phi, &phdr) != &phdr) {
+			elferr_warn("%s: Failed to get program header %"PRIu64"\n",
+				    elf_prog->name, (uint64_t) phi);
+			continue;
+		}
+		if (phdr.p_type != PT_LOAD || !phdr.p_filesz)
+			continue;
+		if (unlikely(phdr.p_offset > z->hdr.rawlen ||
+			     phdr.p_filesz > z->hdr.rawlen - phdr.p_offset)) {
+			uk_pr_err("%s: Segment exceeds the image\n",
+				  elf_prog->name);
+			rc = -ENOEXEC;
+			goto out;
+		}
+		segs[nsegs].off = phdr.p_offset;
+		segs[nsegs].len = phdr.p_filesz;
+		segs[nsegs].dst = (char *)elf_prog->vabase + phdr.p_vaddr;
+		nsegs++;
+	}
+
+	uk_pr_debug("%s: Decompressing %"PRIu64" B to %"PRIu64" B into %"__PRIsz" segments\n",
+		    elf_prog->name, z->hdr.zlen, z->hdr.rawlen, nsegs);
+	rc = elfz_lz4(z, elf_prog->name, segs, nsegs);
+out:
+	free(segs);
+	return rc;
+}
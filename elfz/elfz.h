@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_ELFZ_H
+#define APPELFLOADER_ELFZ_H
+
+#include <uk/config.h>
+#include <errno.h>
+#include <libelf.h>
+#include <uk/arch/types.h>
+#include <uk/essentials.h>
+
+#include "../elf_prog.h"
+
+/*
+ * Compressed ELF images
+ *
+ * A compressed image, created with support/mkelfz.py, consists of a header,
+ * a skeleton ELF and the compressed original file:
+ *
+ *   header:    magic "UKELFZ\0\0", version (u32), codec (u32), length of
+ *              the original file (u64), offset and length of the skeleton
+ *              (u64 each), offset and length of the compressed stream (u64
+ *              each); little endian
+ *   skeleton:  ELF header and program headers of the original file, the
+ *              path of the program interpreter and the symbol table, so
+ *              that the image can be parsed without decompressing it
+ *   stream:    LZ4 frame of the original file with independent blocks
+ *              (`lz4 -B4` or larger block sizes)
+ *
+ * The program headers in the skeleton keep the offsets of the original
+ * file, except for PT_INTERP. The loadable segments are decompressed block by
+ * block straight into their place in memory; only blocks that span segment
+ * boundaries or hold no segment content go through a buffer of the frame's
+ * block size.
+ */
+
+#define ELFZ_MAGIC		"UKELFZ\0\0"
+#define ELFZ_MAGIC_LEN		8
+#define ELFZ_VERSION		1
+#define ELFZ_CODEC_LZ4		1
+
+struct elfz_hdr {
+	char magic[ELFZ_MAGIC_LEN];
+	__u32 version;
+	__u32 codec;
+	__u64 rawlen;
+	__u64 skeloff;
+	__u64 skellen;
+	__u64 zoff;
+	__u64 zlen;
+} __packed;
+
+struct elfz {
+	struct elfz_hdr hdr;
+	void *skel;		/* skeleton ELF */
+	const char *mem;	/* image in memory, or NULL */
+	int fd;			/* file to read from if `mem` is NULL */
+};
+
+#if CONFIG_APPELFLOADER_ELFZ
+/**
+ * Opens a compressed image in memory
+ *
+ * @return:
+ *   0 on success, -ENOEXEC if the image is not compressed, other negative
+ *   errno values for invalid images
+ */
+int elfz_open_mem(struct elfz *z, const void *img, __sz len);
+
+/**
+ * Opens a compressed image from a file; the skeleton is read into memory
+ *
+ * @return:
+ *   0 on success, -ENOEXEC if the file is not compressed, other negative
+ *   errno values for invalid images or read errors
+ */
+int elfz_open_fd(struct elfz *z, int fd);
+
+/**
+ * Releases the skeleton of an opened image
+ */
+void elfz_close(struct elfz *z);
+
+/**
+ * Decompresses the file content of the loadable segments to
+ * `elf_prog->vabase`. The zero-initialized remainder of segments is not
+ * touched.
+ *
+ * @param elf:
+ *   ELF handle of the skeleton
+ */
+int elfz_load(struct elfz *z, struct elf_prog *elf_prog, Elf *elf);
+#else /* !CONFIG_APPELFLOADER_ELFZ */
+#define elfz_open_mem(z, img, len) ({ (void)(z); -ENOEXEC; })
+#define elfz_open_fd(z, fd) ({ (void)(z); -ENOEXEC; })
+#define elfz_close(z) do { (void)(z); } while (0)
+#endif /* !CONFIG_APPELFLOADER_ELFZ */
+
+#endif /* APPELFLOADER_ELFZ_H */
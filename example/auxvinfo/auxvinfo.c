@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+/*
+ * Prints the CPU feature related entries of the auxiliary vector as seen by
+ * the application through `getauxval()`. Exits with a non-zero status if
+ * the kernel did not provide any hardware capabilities.
+ */
+#include <stdio.h>
+#include <sys/auxv.h>
+
+#ifndef AT_HWCAP2
+#define AT_HWCAP2	26
+#endif
+#ifndef AT_MINSIGSTKSZ
+#define AT_MINSIGSTKSZ	51
+#endif
+
+#if defined(__x86_64__)
+static const char *const hwcap_names[32] = {
+	"fpu", "vme", "de", "pse", "tsc", "msr", "pae", "mce",
+	"cx8", "apic", NULL, "sep", "mtrr", "pge", "mca", "cmov",
+	"pat", "pse36", "pn", "clflush", NULL, "dts", "acpi", "mmx",
+	"fxsr", "sse", "sse2", "ss", "ht", "tm", "ia64", "pbe",
+};
+static const char *const hwcap2_names[32] = {
+	"ring3mwait", "fsgsbase",
+};
+#elif defined(__aarch64__)
+static const char *const hwcap_names[32] = {
+	"fp", "asimd", "evtstrm", "aes", "pmull", "sha1", "sha2", "crc32",
+	"atomics", "fphp", "asimdhp", "cpuid", "asimdrdm", "jscvt", "fcma",
+	"lrcpc", "dcpop", "sha3", "sm3", "sm4", "asimddp", "sha512", "sve",
+	"asimdfhm", "dit", "uscat", "ilrcpc", "flagm", "ssbs", "sb", "paca",
+	"pacg",
+};
+static const char *const hwcap2_names[32] = {
+	"dcpodp", "sve2", "sveaes", "svepmull", "svebitperm", "svesha3",
+	"svesm4", "flagm2", "frint", "svei8mm", "svef32mm", "svef64mm",
+	"svebf16", "i8mm", "bf16", "dgh", "rng", "bti", "mte",
+};
+#else
+static const char *const hwcap_names[32];
+static const char *const hwcap2_names[32];
+#endif
+
+static void print_bits(const char *name, unsigned long val,
+		       const char *const names[32])
+{
+	unsigned int b;
+
+	printf("%-16s 0x%016lx", name, val);
+	for (b = 0; b < 32; ++b)
+		if ((val & (1UL << b)) && names[b])
+			printf(" %s", names[b]);
+	printf("\n");
+}
+
+int main(void)
+{
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	print_bits("AT_HWCAP", hwcap, hwcap_names);
+	print_bits("AT_HWCAP2", getauxval(AT_HWCAP2), hwcap2_names);
+	printf("%-16s %lu\n", "AT_DCACHEBSIZE", getauxval(AT_DCACHEBSIZE));
+	printf("%-16s %lu\n", "AT_ICACHEBSIZE", getauxval(AT_ICACHEBSIZE));
+	printf("%-16s %lu\n", "AT_UCACHEBSIZE", getauxval(AT_UCACHEBSIZE));
+	printf("%-16s %lu\n", "AT_MINSIGSTKSZ", getauxval(AT_MINSIGSTKSZ));
+
+	if (!hwcap) {
+		fprintf(stderr, "No hardware capabilities reported\n");
+		return 1;
+	}
+	return 0;
+}
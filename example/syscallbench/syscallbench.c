@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+/*
+ * Microbenchmarks for system call and vDSO paths that are relevant for
+ * applications under elfloader. Run it with different kernel configurations
+ * (e.g., with and without `APPELFLOADER_SYSRW`, `APPELFLOADER_VDSO`, or
+ * `LIBSYSCALL_SHIM_HANDLER_ULTLS`) and compare the output.
+ *
+ * System calls are issued through libc wrappers or through stubs with the
+ * same instruction pattern (`mov $nr, %eax; syscall`), so that
+ * `APPELFLOADER_SYSRW` rewrites them. glibc's generic `syscall()` loads the
+ * number from a register; it always traps and is only used for the time
+ * measurement and for `clock_gettime_syscall_trap`.
+ *
+ * Usage: syscallbench [-n <iterations>] [<benchmark> ...]
+ *
+ * The output is CSV with a fixed set of columns; the first line is a version
+ * tag, the second one the header:
+ *   # syscallbench 3
+ *   name,iterations,total_ns,ns_per_op,min_ns_per_op
+ * Each benchmark is run in SB_ROUNDS rounds; `min_ns_per_op` is the per
+ * operation time of the fastest round, `ns_per_op` the average over all.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <asm/prctl.h>
+#endif
+
+#define SB_VERSION		3
+#define SB_ROUNDS		10
+#define DEFAULT_ITERATIONS	100000UL
+
+static volatile long sink;
+
+#if defined(__x86_64__)
+/*
+ * System call stub like glibc's wrappers: The number is an immediate and the
+ * `syscall` instruction is followed by the error check, which is one of the
+ * sequences that APPELFLOADER_SYSRW accepts for rewriting. Returns the raw
+ * result (negative errno values on errors).
+ */
+#define SB_SYSCALL(nr, a1, a2, a3, a4)					\
+	({								\
+		register long _a1 __asm__("rdi") = (long)(a1);		\
+		register long _a2 __asm__("rsi") = (long)(a2);		\
+		register long _a3 __asm__("rdx") = (long)(a3);		\
+		register long _a4 __asm__("r10") = (long)(a4);		\
+		long _ret;						\
+									\
+		__asm__ __volatile__("mov %[n], %%eax\n\t"		\
+				     "syscall\n\t"			\
+				     "cmp $-4095, %%rax"		\
+				     : "=a"(_ret)			\
+				     : [n] "i"(nr), "r"(_a1), "r"(_a2),	\
+				       "r"(_a3), "r"(_a4)		\
+				     : "rcx", "r11", "memory", "cc");	\
+		_ret;							\
+	})
+#else
+#define SB_SYSCALL(nr, a1, a2, a3, a4)					\
+	syscall(nr, a1, a2, a3, a4)
+#endif
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	/* Always the real system call, independent of the vDSO */
+	syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Benchmarks: Each one executes `n` operations and returns 0, or a negative
+ * errno value if the operation is not supported
+ */
+static int bench_null(unsigned long n)
+{
+	unsigned long i;
+
+	/* libc wrapper, rewritten by APPELFLOADER_SYSRW */
+	for (i = 0; i < n; ++i)
+		sink += getppid();
+	return 0;
+}
+
+static int bench_null_stub(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; ++i)
+		sink += SB_SYSCALL(SYS_getppid, 0, 0, 0, 0);
+	return 0;
+}
+
+static int bench_getpid(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; ++i)
+		sink += getpid();
+	return 0;
+}
+
+static int bench_clock_gettime_vdso(unsigned long n)
+{
+	struct timespec ts;
+	unsigned long i;
+
+	/* libc uses the vDSO if the kernel provides one */
+	for (i = 0; i < n; ++i) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		sink += ts.tv_nsec;
+	}
+	return 0;
+}
+
+static int bench_clock_gettime_sys(unsigned long n)
+{
+	struct timespec ts;
+	unsigned long i;
+
+	for (i = 0; i < n; ++i) {
+		SB_SYSCALL(SYS_clock_gettime, CLOCK_MONOTONIC, &ts, 0, 0);
+		sink += ts.tv_nsec;
+	}
+	return 0;
+}
+
+static int bench_clock_gettime_trap(unsigned long n)
+{
+	struct timespec ts;
+	unsigned long i;
+
+	/* Never rewritten: Always measures the trapping path */
+	for (i = 0; i < n; ++i) {
+		syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+		sink += ts.tv_nsec;
+	}
+	return 0;
+}
+
+static int bench_brk(unsigned long n)
+{
+	uintptr_t cur;
+	unsigned long i;
+
+	cur = (uintptr_t)SB_SYSCALL(SYS_brk, 0, 0, 0, 0);
+	if (!cur)
+		return -ENOSYS;
+	/* One operation: grow by one page and shrink again */
+	for (i = 0; i < n; ++i) {
+		if ((uintptr_t)SB_SYSCALL(SYS_brk, cur + 4096, 0, 0, 0) !=
+		    cur + 4096)
+			return -ENOMEM;
+		SB_SYSCALL(SYS_brk, cur, 0, 0, 0);
+	}
+	return 0;
+}
+
+static int bench_mmap(unsigned long n, size_t len)
+{
+	unsigned long i;
+	void *p;
+
+	/* One operation: map, touch the first page, unmap */
+	for (i = 0; i < n; ++i) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return -errno;
+		*(volatile char *)p = 1;
+		munmap(p, len);
+	}
+	return 0;
+}
+
+static int bench_mmap_4k(unsigned long n)
+{
+	return bench_mmap(n, 4096);
+}
+
+static int bench_mmap_64k(unsigned long n)
+{
+	return bench_mmap(n, 64 * 1024);
+}
+
+static int bench_mmap_1m(unsigned long n)
+{
+	return bench_mmap(n, 1024 * 1024);
+}
+
+static int bench_mmap_16m(unsigned long n)
+{
+	return bench_mmap(n, 16 * 1024 * 1024);
+}
+
+static int bench_arch_prctl(unsigned long n)
+{
+#if defined(__x86_64__)
+	unsigned long fs;
+	unsigned long i;
+
+	if (syscall(SYS_arch_prctl, ARCH_GET_FS, &fs) < 0)
+		return -errno;
+	/* Re-set the current TLS pointer, anything else would break libc.
+	 * arch_prctl is never rewritten, it needs the trapped register state.
+	 */
+	for (i = 0; i < n; ++i)
+		sink += SB_SYSCALL(SYS_arch_prctl, ARCH_SET_FS, fs, 0, 0);
+	return 0;
+#else
+	(void)n;
+	return -ENOTSUP;
+#endif
+}
+
+static int bench_futex_wake(unsigned long n)
+{
+	static int futex_word;
+	unsigned long i;
+
+	/* No waiters: measures the plain system call path of the futex */
+	for (i = 0; i < n; ++i)
+		sink += SB_SYSCALL(SYS_futex, &futex_word,
+				   FUTEX_WAKE_PRIVATE, 1, NULL);
+	return 0;
+}
+
+static void *thread_fn(void *arg)
+{
+	return arg;
+}
+
+static int bench_thread(unsigned long n)
+{
+	pthread_t t;
+	unsigned long i;
+	int rc;
+
+	/* One operation: create and join a thread */
+	for (i = 0; i < n; ++i) {
+		rc = pthread_create(&t, NULL, thread_fn, NULL);
+		if (rc)
+			return -rc;
+		pthread_join(t, NULL);
+	}
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(unsigned long n);
+	unsigned long div;	/* fewer iterations for expensive operations */
+} benchs[] = {
+	{ "null",			bench_null,			1 },
+	{ "null_stub",			bench_null_stub,		1 },
+	{ "getpid",			bench_getpid,			1 },
+	{ "clock_gettime_vdso",		bench_clock_gettime_vdso,	1 },
+	{ "clock_gettime_syscall",	bench_clock_gettime_sys,	1 },
+	{ "clock_gettime_syscall_trap",	bench_clock_gettime_trap,	1 },
+	{ "brk",			bench_brk,			10 },
+	{ "mmap_4k",			bench_mmap_4k,			10 },
+	{ "mmap_64k",			bench_mmap_64k,			10 },
+	{ "mmap_1m",			bench_mmap_1m,			100 },
+	{ "mmap_16m",			bench_mmap_16m,			1000 },
+	{ "arch_prctl_set_fs",		bench_arch_prctl,		1 },
+	{ "futex_wake",			bench_futex_wake,		1 },
+	{ "thread_create",		bench_thread,			1000 },
+};
+
+static int selected(const char *name, int argc, char *argv[])
+{
+	int i;
+
+	if (argc == 0)
+		return 1;
+	for (i = 0; i < argc; ++i)
+		if (strcmp(argv[i], name) == 0)
+			return 1;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long t0, dt, total, min;
+	unsigned long n = DEFAULT_ITERATIONS;
+	unsigned long per_round;
+	unsigned int b, r;
+	int opt, rc;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-n <iterations>] [<benchmark> ...]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!n)
+		n = DEFAULT_ITERATIONS;
+
+	printf("# syscallbench %d\n", SB_VERSION);
+	printf("name,iterations,total_ns,ns_per_op,min_ns_per_op\n");
+	for (b = 0; b < sizeof(benchs) / sizeof(benchs[0]); ++b) {
+		if (!selected(benchs[b].name, argc - optind, &argv[optind]))
+			continue;
+
+		per_round = n / benchs[b].div / SB_ROUNDS;
+		if (!per_round)
+			per_round = 1;
+
+		/* Warm-up, also detects unsupported operations */
+		rc = benchs[b].fn(1);
+		if (rc < 0) {
+			printf("%s,0,0,nan,nan\n", benchs[b].name);
+			fprintf(stderr, "%s: %s\n", benchs[b].name,
+				strerror(-rc));
+			continue;
+		}
+
+		total = 0;
+		min = ~0ULL;
+		for (r = 0; r < SB_ROUNDS; ++r) {
+			t0 = now_ns();
+			benchs[b].fn(per_round);
+			dt = now_ns() - t0;
+			total += dt;
+			if (dt < min)
+				min = dt;
+		}
+		printf("%s,%lu,%llu,%.1f,%.1f\n", benchs[b].name,
+		       per_round * SB_ROUNDS, total,
+		       (double)total / (per_round * SB_ROUNDS),
+		       (double)min / per_round);
+	}
+	fflush(stdout);
+	return 0;
+}
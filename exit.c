@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <uk/assert.h>
+#include <uk/spinlock.h>
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+#include <uk/process.h>
+#endif /* CONFIG_LIBPOSIX_PROCESS_PIDS */
+
+#include "exit.h"
+#include "memacct/memacct.h"
+
+/* Running applications */
+static struct elf_exit *elf_exit_list;
+static __spinlock elf_exit_lock = UK_SPINLOCK_INITIALIZER();
+
+int elf_exit_pid_current(void)
+{
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+	return (int)ukthread2pid(uk_thread_current());
+#else /* !CONFIG_LIBPOSIX_PROCESS_PIDS */
+	return 0;
+#endif /* !CONFIG_LIBPOSIX_PROCESS_PIDS */
+}
+
+void elf_exit_init(struct elf_exit *e)
+{
+	uk_semaphore_init(&e->sem, 0);
+	e->thread = NULL;
+	e->pid = 0;
+	e->status = 0;
+	e->status_valid = false;
+	e->next = NULL;
+}
+
+void elf_exit_attach(struct elf_exit *e, struct uk_thread *t)
+{
+	UK_ASSERT(e && t);
+
+	e->thread = t;
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+	e->pid = (int)ukthread2pid(t);
+#endif /* CONFIG_LIBPOSIX_PROCESS_PIDS */
+
+	uk_spin_lock(&elf_exit_lock);
+	e->next = elf_exit_list;
+	elf_exit_list = e;
+	uk_spin_unlock(&elf_exit_lock);
+}
+
+void elf_exit_record(int status)
+{
+	int pid = elf_exit_pid_current();
+	struct elf_exit *e;
+
+	uk_spin_lock(&elf_exit_lock);
+	for (e = elf_exit_list; e; e = e->next) {
+		/* Without process IDs, all applications share pid 0 */
+		if (e->pid == pid) {
+			/* Only the low byte is visible, like on Linux */
+			e->status = status & 0xff;
+			e->status_valid = true;
+			break;
+		}
+	}
+	uk_spin_unlock(&elf_exit_lock);
+}
+
+void elf_exit_thread_dtor(struct uk_thread *t)
+{
+	struct elf_exit *e;
+	int pid = -1;
+
+	uk_spin_lock(&elf_exit_lock);
+	for (e = elf_exit_list; e; e = e->next) {
+		if (e->thread == t) {
+			pid = e->pid;
+			break;
+		}
+	}
+	uk_spin_unlock(&elf_exit_lock);
+	if (pid < 0)
+		return;
+
+	/* The stack of the thread is released after this destructor */
+	memacct_thread_exit(pid);
+
+	uk_spin_lock(&elf_exit_lock);
+	for (e = elf_exit_list; e; e = e->next) {
+		if (e->thread == t) {
+			e->thread = NULL;
+			uk_semaphore_up(&e->sem);
+			break;
+		}
+	}
+	uk_spin_unlock(&elf_exit_lock);
+}
+
+int elf_exit_wait(struct elf_exit *e, int *status)
+{
+	struct elf_exit **prev;
+
+	UK_ASSERT(e && status);
+
+	uk_semaphore_down(&e->sem);
+
+	uk_spin_lock(&elf_exit_lock);
+	for (prev = &elf_exit_list; *prev; prev = &(*prev)->next) {
+		if (*prev == e) {
+			*prev = e->next;
+			break;
+		}
+	}
+	uk_spin_unlock(&elf_exit_lock);
+
+	*status = e->status;
+	return e->status_valid ? 0 : -ENOENT;
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_EXIT_H
+#define APPELFLOADER_EXIT_H
+
+#include <uk/config.h>
+#include <stdbool.h>
+#include <uk/essentials.h>
+#include <uk/semaphore.h>
+#include <uk/thread.h>
+
+/*
+ * Termination of applications
+ *
+ * The launcher waits for the main thread of an application to be released
+ * after it exited. The exit status is recorded when the application calls
+ * `exit_group` through an entry that is provided by elfloader: The direct
+ * system call entry (APPELFLOADER_SYSRW) observes it before the trampoline
+ * issues the trapping system call. Without rewritten call sites, the status
+ * is not visible here.
+ */
+struct elf_exit {
+	struct uk_semaphore sem;
+	struct uk_thread *thread;	/* main thread of the application */
+	int pid;			/* process ID, 0 without posix-process */
+	int status;
+	bool status_valid;
+	struct elf_exit *next;
+};
+
+/**
+ * Returns the process ID of the current thread, 0 without posix-process
+ */
+int elf_exit_pid_current(void);
+
+/**
+ * Initializes the exit state of an application before it (re-)starts
+ */
+void elf_exit_init(struct elf_exit *e);
+
+/**
+ * Associates an exit state with the main thread of the application. Call
+ * this after the process is created and before the thread is scheduled.
+ */
+void elf_exit_attach(struct elf_exit *e, struct uk_thread *t);
+
+/**
+ * Records the exit status of the calling application
+ */
+void elf_exit_record(int status);
+
+/**
+ * Thread destructor for application main threads, signals `elf_exit_wait()`.
+ * It runs before elfloader releases the stack of the thread.
+ */
+void elf_exit_thread_dtor(struct uk_thread *t);
+
+/**
+ * Waits until the main thread of the application is released
+ *
+ * @param e:
+ *   Exit state that was attached with `elf_exit_attach()`
+ * @param status:
+ *   Receives the exit status of the application
+ * @return:
+ *   0 if the exit status is known, -ENOENT otherwise (`status` is set to 0)
+ */
+int elf_exit_wait(struct elf_exit *e, int *status);
+
+#endif /* APPELFLOADER_EXIT_H */
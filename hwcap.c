@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <stdbool.h>
+#include <uk/essentials.h>
+#include <uk/arch/ctx.h>
+#include <uk/print.h>
+#if CONFIG_ARCH_X86_64
+#include <cpuid.h>
+#endif /* CONFIG_ARCH_X86_64 */
+
+#include "hwcap.h"
+
+/*
+ * Room for the signal frame (ucontext, siginfo, return address) on top of
+ * the extended register state, see Linux' get_sigframe_size()
+ */
+#define HWCAP_SIGFRAME_OVERHEAD	1024
+
+#if CONFIG_ARCH_X86_64
+#define HWCAP_MINSIGSTKSZ	2048	/* Linux: MINSIGSTKSZ */
+
+/* Linux: arch/x86/include/uapi/asm/hwcap2.h */
+#define HWCAP2_FSGSBASE		(1UL << 1)
+
+#define X86_CPUID7_EBX_FSGSBASE	(1U << 0)
+#define X86_CR4_FSGSBASE	(1UL << 16)
+
+static void hwcap_detect(struct elf_hwcap *hw)
+{
+	__u32 eax, ebx, ecx, edx;
+	unsigned long cr4;
+
+	/* Linux reports the feature flags of CPUID leaf 1 (EDX) */
+	__cpuid(1, eax, ebx, ecx, edx);
+	hw->hwcap = edx;
+
+	/* CLFLUSH line size in 8-byte units */
+	hw->dcache_bsize = ((ebx >> 8) & 0xff) * 8;
+	hw->icache_bsize = hw->dcache_bsize;
+	hw->ucache_bsize = hw->dcache_bsize;
+
+	/* The FS/GSBASE instructions are usable only if enabled in CR4 */
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		__asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+		if ((ebx & X86_CPUID7_EBX_FSGSBASE) &&
+		    (cr4 & X86_CR4_FSGSBASE))
+			hw->hwcap2 |= HWCAP2_FSGSBASE;
+	}
+}
+#elif CONFIG_ARCH_ARM_64
+#define HWCAP_MINSIGSTKSZ	5120	/* Linux: MINSIGSTKSZ */
+
+/* Linux: arch/arm64/include/uapi/asm/hwcap.h */
+#define HWCAP_FP		(1UL << 0)
+#define HWCAP_ASIMD		(1UL << 1)
+#define HWCAP_AES		(1UL << 3)
+#define HWCAP_PMULL		(1UL << 4)
+#define HWCAP_SHA1		(1UL << 5)
+#define HWCAP_SHA2		(1UL << 6)
+#define HWCAP_CRC32		(1UL << 7)
+#define HWCAP_ATOMICS		(1UL << 8)
+#define HWCAP_FPHP		(1UL << 9)
+#define HWCAP_ASIMDHP		(1UL << 10)
+#define HWCAP_CPUID		(1UL << 11)
+#define HWCAP_ASIMDRDM		(1UL << 12)
+#define HWCAP_JSCVT		(1UL << 13)
+#define HWCAP_FCMA		(1UL << 14)
+#define HWCAP_LRCPC		(1UL << 15)
+#define HWCAP_DCPOP		(1UL << 16)
+#define HWCAP_SHA3		(1UL << 17)
+#define HWCAP_SM3		(1UL << 18)
+#define HWCAP_SM4		(1UL << 19)
+#define HWCAP_ASIMDDP		(1UL << 20)
+#define HWCAP_SHA512		(1UL << 21)
+#define HWCAP_ASIMDFHM		(1UL << 23)
+#define HWCAP_DIT		(1UL << 24)
+#define HWCAP_USCAT		(1UL << 25)
+#define HWCAP_ILRCPC		(1UL << 26)
+#define HWCAP_FLAGM		(1UL << 27)
+#define HWCAP_SSBS		(1UL << 28)
+#define HWCAP_SB		(1UL << 29)
+
+#define HWCAP2_DCPODP		(1UL << 0)
+#define HWCAP2_FLAGM2		(1UL << 7)
+#define HWCAP2_FRINT		(1UL << 8)
+#define HWCAP2_I8MM		(1UL << 13)
+#define HWCAP2_BF16		(1UL << 14)
+#define HWCAP2_DGH		(1UL << 15)
+#define HWCAP2_RNG		(1UL << 16)
+
+#define ID_FIELD(reg, shift)	(((reg) >> (shift)) & 0xfUL)
+
+#define read_sysreg(name)						\
+	({								\
+		__u64 _val;						\
+		__asm__ __volatile__("mrs %0, " #name : "=r"(_val));	\
+		_val;							\
+	})
+
+static void hwcap_detect(struct elf_hwcap *hw)
+{
+	__u64 isar0 = read_sysreg(ID_AA64ISAR0_EL1);
+	__u64 isar1 = read_sysreg(ID_AA64ISAR1_EL1);
+	__u64 pfr0  = read_sysreg(ID_AA64PFR0_EL1);
+	__u64 pfr1  = read_sysreg(ID_AA64PFR1_EL1);
+	__u64 mmfr2 = read_sysreg(S3_0_C0_C7_2); /* ID_AA64MMFR2_EL1 */
+	__u64 ctr   = read_sysreg(CTR_EL0);
+	unsigned long fp, simd;
+
+	/*
+	 * NOTE: Features that need kernel support beyond the plain
+	 *       instructions (SVE, SME, pointer authentication, BTI, MTE)
+	 *       are not reported.
+	 */
+	fp = ID_FIELD(pfr0, 16);
+	simd = ID_FIELD(pfr0, 20);
+	if (fp != 0xf) {
+		hw->hwcap |= HWCAP_FP;
+		if (fp >= 1)
+			hw->hwcap |= HWCAP_FPHP;
+	}
+	if (simd != 0xf) {
+		hw->hwcap |= HWCAP_ASIMD;
+		if (simd >= 1)
+			hw->hwcap |= HWCAP_ASIMDHP;
+	}
+	if (ID_FIELD(pfr0, 48) >= 1)
+		hw->hwcap |= HWCAP_DIT;
+	if (ID_FIELD(pfr1, 4) >= 2)
+		hw->hwcap |= HWCAP_SSBS;
+
+	/* Applications run at EL1, so reading ID registers just works */
+	hw->hwcap |= HWCAP_CPUID;
+
+	if (ID_FIELD(isar0, 4) >= 1)
+		hw->hwcap |= HWCAP_AES;
+	if (ID_FIELD(isar0, 4) >= 2)
+		hw->hwcap |= HWCAP_PMULL;
+	if (ID_FIELD(isar0, 8) >= 1)
+		hw->hwcap |= HWCAP_SHA1;
+	if (ID_FIELD(isar0, 12) >= 1)
+		hw->hwcap |= HWCAP_SHA2;
+	if (ID_FIELD(isar0, 12) >= 2)
+		hw->hwcap |= HWCAP_SHA512;
+	if (ID_FIELD(isar0, 16) >= 1)
+		hw->hwcap |= HWCAP_CRC32;
+	if (ID_FIELD(isar0, 20) >= 2)
+		hw->hwcap |= HWCAP_ATOMICS;
+	if (ID_FIELD(isar0, 28) >= 1)
+		hw->hwcap |= HWCAP_ASIMDRDM;
+	if (ID_FIELD(isar0, 32) >= 1)
+		hw->hwcap |= HWCAP_SHA3;
+	if (ID_FIELD(isar0, 36) >= 1)
+		hw->hwcap |= HWCAP_SM3;
+	if (ID_FIELD(isar0, 40) >= 1)
+		hw->hwcap |= HWCAP_SM4;
+	if (ID_FIELD(isar0, 44) >= 1)
+		hw->hwcap |= HWCAP_ASIMDDP;
+	if (ID_FIELD(isar0, 48) >= 1)
+		hw->hwcap |= HWCAP_ASIMDFHM;
+	if (ID_FIELD(isar0, 52) >= 1)
+		hw->hwcap |= HWCAP_FLAGM;
+	if (ID_FIELD(isar0, 52) >= 2)
+		hw->hwcap2 |= HWCAP2_FLAGM2;
+	if (ID_FIELD(isar0, 60) >= 1)
+		hw->hwcap2 |= HWCAP2_RNG;
+
+	if (ID_FIELD(isar1, 0) >= 1)
+		hw->hwcap |= HWCAP_DCPOP;
+	if (ID_FIELD(isar1, 0) >= 2)
+		hw->hwcap2 |= HWCAP2_DCPODP;
+	if (ID_FIELD(isar1, 12) >= 1)
+		hw->hwcap |= HWCAP_JSCVT;
+	if (ID_FIELD(isar1, 16) >= 1)
+		hw->hwcap |= HWCAP_FCMA;
+	if (ID_FIELD(isar1, 20) >= 1)
+		hw->hwcap |= HWCAP_LRCPC;
+	if (ID_FIELD(isar1, 20) >= 2)
+		hw->hwcap |= HWCAP_ILRCPC;
+	if (ID_FIELD(isar1, 32) >= 1)
+		hw->hwcap2 |= HWCAP2_FRINT;
+	if (ID_FIELD(isar1, 36) >= 1)
+		hw->hwcap |= HWCAP_SB;
+	if (ID_FIELD(isar1, 44) >= 1)
+		hw->hwcap2 |= HWCAP2_BF16;
+	if (ID_FIELD(isar1, 48) >= 1)
+		hw->hwcap2 |= HWCAP2_DGH;
+	if (ID_FIELD(isar1, 52) >= 1)
+		hw->hwcap2 |= HWCAP2_I8MM;
+
+	if (ID_FIELD(mmfr2, 32) >= 1)
+		hw->hwcap |= HWCAP_USCAT;
+
+	/* CTR_EL0: log2 of the number of 4-byte words per cache line */
+	hw->dcache_bsize = 4UL << ID_FIELD(ctr, 16);
+	hw->icache_bsize = 4UL << ID_FIELD(ctr, 0);
+	hw->ucache_bsize = MIN(hw->dcache_bsize, hw->icache_bsize);
+}
+#else
+#error "Unsupported architecture"
+#endif
+
+const struct elf_hwcap *elf_hwcap_get(void)
+{
+	static struct elf_hwcap hw;
+	static bool detected;
+
+	if (detected)
+		return &hw;
+
+	hwcap_detect(&hw);
+	hw.minsigstksz = MAX((unsigned long)HWCAP_MINSIGSTKSZ,
+			     ukarch_ectx_size() + HWCAP_SIGFRAME_OVERHEAD);
+	detected = true;
+
+	uk_pr_debug("hwcap: 0x%lx, hwcap2: 0x%lx, cache line: %lu B, minsigstksz: %lu B\n",
+		    hw.hwcap, hw.hwcap2, hw.dcache_bsize, hw.minsigstksz);
+	return &hw;
+}
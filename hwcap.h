@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_HWCAP_H
+#define APPELFLOADER_HWCAP_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+
+/*
+ * CPU feature information that is handed over to the application with the
+ * auxiliary vector. The values follow the Linux ABI of the respective
+ * architecture, so that libc and libraries select the same optimized code
+ * paths as they would on Linux.
+ */
+struct elf_hwcap {
+	unsigned long hwcap;		/* AT_HWCAP */
+	unsigned long hwcap2;		/* AT_HWCAP2 */
+	unsigned long dcache_bsize;	/* AT_DCACHEBSIZE */
+	unsigned long icache_bsize;	/* AT_ICACHEBSIZE */
+	unsigned long ucache_bsize;	/* AT_UCACHEBSIZE */
+	unsigned long minsigstksz;	/* AT_MINSIGSTKSZ */
+};
+
+/**
+ * Returns the CPU feature information of the boot CPU. The information is
+ * detected on the first call.
+ */
+const struct elf_hwcap *elf_hwcap_get(void);
+
+#endif /* APPELFLOADER_HWCAP_H */
@@ -0,0 +1,572 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/errptr.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/process.h>
+#include <uk/sched.h>
+#include <uk/semaphore.h>
+#include <uk/thread.h>
+#if CONFIG_LIBUKLIBPARAM
+#include <uk/libparam.h>
+#endif /* CONFIG_LIBUKLIBPARAM */
+#if CONFIG_LIBUKSWRAND
+#include <uk/swrand.h>
+#endif /* CONFIG_LIBUKSWRAND */
+
+#include "launch.h"
+#include "elf_prog.h"
+#include "stack.h"
+#include "exit.h"
+#include "syscalls/brk.h"
+#include "loadtime/loadtime.h"
+#include "placement/placement.h"
+#include "autogen/procself.h"
+#include "profile/profile.h"
+#include "memacct/memacct.h"
+#include "thpool/thpool.h"
+
+#if CONFIG_LIBPOSIX_ENVIRON
+extern char **environ;
+#else /* !CONFIG_LIBPOSIX_ENVIRON */
+#define environ NULL
+#endif /* !CONFIG_LIBPOSIX_ENVIRON */
+
+#if CONFIG_LIBUKLIBPARAM
+static char *launch;
+static char *manifest;
+
+UK_LIBPARAM_PARAM(launch, charp,
+		  "Launch manifest, entries separated by ';'");
+UK_LIBPARAM_PARAM(manifest, charp,
+		  "Path to launch manifest file");
+#endif /* CONFIG_LIBUKLIBPARAM */
+
+struct elf_launch {
+	/* From the manifest */
+	const char *path;
+	const char *progname;
+	int argc;
+	char **argv;
+	char **envp;
+	const char *cwd;
+	int cpu;		/* -1: no placement requested */
+	char **tok;		/* token vector of the entry */
+
+	/* Filled by the loader thread */
+	struct uk_semaphore loaded;
+	int rc;
+	struct elf_prog *prog;
+	struct uk_thread *thread;
+	void *stack;
+	__sz stack_len;
+	uint64_t rand[2];
+
+	bool started;
+	struct elf_exit exit;
+};
+
+static inline bool elf_launch_isspace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool elf_launch_issep(char c)
+{
+	return c == '\n' || c == ';' || c == '\0';
+}
+
+/*
+ * Splits an entry in-place into whitespace-separated tokens. If `tok` is
+ * NULL, the tokens are only counted and the entry is not modified.
+ */
+static int elf_launch_tokenize(char *entry, char **tok)
+{
+	int ntok = 0;
+	char *p = entry;
+
+	for (;;) {
+		while (elf_launch_isspace(*p))
+			p++;
+		if (*p == '\0')
+			break;
+		if (tok)
+			tok[ntok] = p;
+		ntok++;
+		while (*p != '\0' && !elf_launch_isspace(*p))
+			p++;
+		if (*p == '\0')
+			break;
+		if (tok)
+			*p = '\0';
+		p++;
+	}
+	if (tok)
+		tok[ntok] = NULL;
+	return ntok;
+}
+
+/*
+ * Builds the environment of a program: the kernel environment with the
+ * `env=` overrides of the entry applied
+ */
+static char **elf_launch_envp(struct uk_alloc *a, char **tok, int ntok)
+{
+	char **kenv = environ;
+	char **envp;
+	size_t nkenv = 0, nenv = 0;
+	size_t klen;
+	int i, nover = 0;
+
+	for (i = 0; i < ntok; ++i)
+		if (strncmp(tok[i], "env=", 4) == 0)
+			nover++;
+	while (kenv && kenv[nkenv])
+		nkenv++;
+
+	envp = uk_malloc(a, (nkenv + nover + 1) * sizeof(*envp));
+	if (unlikely(!envp))
+		return NULL;
+
+	for (; kenv && *kenv; ++kenv) {
+		klen = strcspn(*kenv, "=");
+		for (i = 0; i < ntok; ++i) {
+			if (strncmp(tok[i], "env=", 4) == 0 &&
+			    strncmp(tok[i] + 4, *kenv, klen) == 0 &&
+			    tok[i][4 + klen] == '=')
+				break;
+		}
+		if (i == ntok)
+			envp[nenv++] = *kenv;
+	}
+	for (i = 0; i < ntok; ++i)
+		if (strncmp(tok[i], "env=", 4) == 0)
+			envp[nenv++] = tok[i] + 4;
+	envp[nenv] = NULL;
+	return envp;
+}
+
+static int elf_launch_parse_entry(struct uk_alloc *a, struct elf_launch *l,
+				  char *entry)
+{
+	char *end;
+	int ntok, i;
+
+	ntok = elf_launch_tokenize(entry, NULL);
+	UK_ASSERT(ntok > 0);
+	l->tok = uk_malloc(a, (ntok + 1) * sizeof(*l->tok));
+	if (unlikely(!l->tok))
+		return -ENOMEM;
+	elf_launch_tokenize(entry, l->tok);
+
+	l->cpu = -1;
+	for (i = 0; i < ntok; ++i) {
+		if (strcmp(l->tok[i], "--") == 0) {
+			i++;
+			break;
+		}
+		if (l->tok[i][0] == '/')
+			break;
+		if (strncmp(l->tok[i], "cpu=", 4) == 0) {
+			l->cpu = (int)strtol(l->tok[i] + 4, &end, 0);
+			if (end == l->tok[i] + 4 || *end != '\0' ||
+			    l->cpu < 0) {
+				uk_pr_err("Invalid CPU in launch manifest: %s\n",
+					  l->tok[i]);
+				return -EINVAL;
+			}
+		} else if (strncmp(l->tok[i], "cwd=", 4) == 0) {
+			l->cwd = l->tok[i] + 4;
+		} else if (strncmp(l->tok[i], "env=", 4) != 0 ||
+			   !strchr(l->tok[i] + 4, '=')) {
+			uk_pr_err("Invalid option in launch manifest: %s\n",
+				  l->tok[i]);
+			return -EINVAL;
+		}
+	}
+	if (unlikely(i == ntok || l->tok[i][0] != '/')) {
+		uk_pr_err("Launch manifest entry without absolute program path\n");
+		return -EINVAL;
+	}
+
+	l->path = l->tok[i];
+	l->progname = strrchr(l->path, '/') + 1;
+	if (unlikely(l->progname[0] == '\0')) {
+		uk_pr_err("Invalid program path in launch manifest: %s\n",
+			  l->path);
+		return -EINVAL;
+	}
+	l->argc = ntok - i - 1;
+	l->argv = &l->tok[i + 1];
+
+	/* Only tokens before the program path can be options */
+	l->envp = elf_launch_envp(a, l->tok, i);
+	if (unlikely(!l->envp))
+		return -ENOMEM;
+	return 0;
+}
+
+/*
+ * Returns the manifest text (to be freed with `free()`), NULL if there is
+ * no manifest, or an error pointer
+ */
+static char *elf_launch_read(void)
+{
+	const char *path = CONFIG_APPELFLOADER_MANIFEST_PATH;
+	bool optional = true;
+	struct stat st;
+	char *buf;
+	ssize_t rc;
+	size_t off;
+	int fd;
+	int err;
+
+#if CONFIG_LIBUKLIBPARAM
+	if (launch) {
+		buf = strdup(launch);
+		return buf ? buf : ERR2PTR(-ENOMEM);
+	}
+	if (manifest) {
+		path = manifest;
+		optional = false;
+	}
+#endif /* CONFIG_LIBUKLIBPARAM */
+	if (path[0] == '\0')
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT && optional)
+			return NULL;
+		err = -errno;
+		uk_pr_err("Failed to open launch manifest %s: %s (%d)\n",
+			  path, strerror(-err), err);
+		return ERR2PTR(err);
+	}
+	if (unlikely(fstat(fd, &st) < 0)) {
+		err = -errno;
+		goto err_close;
+	}
+	buf = malloc((size_t)st.st_size + 1);
+	if (unlikely(!buf)) {
+		err = -ENOMEM;
+		goto err_close;
+	}
+	for (off = 0; off < (size_t)st.st_size; off += rc) {
+		rc = read(fd, buf + off, (size_t)st.st_size - off);
+		if (rc < 0 && errno == EINTR) {
+			rc = 0;
+			continue;
+		}
+		if (unlikely(rc <= 0)) {
+			err = (rc < 0) ? -errno : -EIO;
+			goto err_free_buf;
+		}
+	}
+	buf[off] = '\0';
+	close(fd);
+	uk_pr_debug("Launch manifest read from %s\n", path);
+	return buf;
+
+err_free_buf:
+	free(buf);
+err_close:
+	close(fd);
+	uk_pr_err("Failed to read launch manifest %s: %s (%d)\n",
+		  path, strerror(-err), err);
+	return ERR2PTR(err);
+}
+
+/*
+ * Splits the manifest text into entries and parses them. `nlaunches` counts
+ * the entries that need to be released, also on errors.
+ */
+static int elf_launch_parse(struct uk_alloc *a, char *text,
+			    struct elf_launch **launches, int *nlaunches)
+{
+	struct elf_launch *l;
+	char *p, *entry;
+	int nentries = 0;
+	int rc;
+
+	/* Blank out comments, count candidate entries */
+	for (p = text; *p != '\0'; ++p) {
+		if (*p == '#' &&
+		    (p == text || elf_launch_isspace(p[-1]) ||
+		     elf_launch_issep(p[-1]))) {
+			while (p[1] != '\0' && p[1] != '\n')
+				*p++ = ' ';
+			*p = ' ';
+		}
+		if (elf_launch_issep(*p))
+			nentries++;
+	}
+	nentries++;
+
+	l = uk_calloc(a, nentries, sizeof(*l));
+	if (unlikely(!l))
+		return -ENOMEM;
+	*launches = l;
+
+	for (entry = text; ; entry = p + 1) {
+		for (p = entry; !elf_launch_issep(*p); ++p)
+			;
+		if (*p == '\0') {
+			/* Last entry */
+			if (elf_launch_tokenize(entry, NULL) > 0) {
+				rc = elf_launch_parse_entry(a,
+							    &l[(*nlaunches)++],
+							    entry);
+				if (unlikely(rc < 0))
+					return rc;
+			}
+			break;
+		}
+		*p = '\0';
+		if (elf_launch_tokenize(entry, NULL) > 0) {
+			rc = elf_launch_parse_entry(a, &l[(*nlaunches)++],
+						    entry);
+			if (unlikely(rc < 0))
+				return rc;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Loader thread: loads a program and prepares its application thread
+ */
+static void elf_launch_loader(void *arg)
+{
+	struct elf_launch *l = (struct elf_launch *)arg;
+	struct uk_alloc *a = uk_alloc_get_default();
+	__nsec tstart __maybe_unused;
+
+	uk_pr_debug("%s: Load executable (%s)...\n", l->progname, l->path);
+	l->prog = elf_load_vfs(a, l->path, l->progname);
+	if (unlikely(PTRISERR(l->prog) || !l->prog)) {
+		l->rc = errno ? -errno : -ENOEXEC;
+		l->prog = NULL;
+		uk_pr_err("%s: Failed to load executable: %s (%d)\n",
+			  l->progname, strerror(-l->rc), l->rc);
+		goto out;
+	}
+	uk_pr_info("%s: ELF program loaded to 0x%"PRIx64"-0x%"PRIx64" (%"__PRIsz" B), entry at %p\n",
+		   l->progname,
+		   (uint64_t) l->prog->vabase,
+		   (uint64_t) l->prog->vabase + l->prog->valen,
+		   l->prog->valen, (void *) l->prog->entry);
+
+	l->thread = elf_stack_thread_create(thpool_alloc(), l->progname,
+					    l->stack_len, &l->stack,
+					    elf_exit_thread_dtor);
+	if (unlikely(!l->thread)) {
+		uk_pr_err("%s: Failed to allocate thread container\n",
+			  l->progname);
+		l->rc = -ENOMEM;
+		goto out;
+	}
+
+#if CONFIG_LIBUKSWRAND
+	uk_swrand_fill_buffer(l->rand, sizeof(l->rand));
+#else /* !CONFIG_LIBUKSWRAND */
+	/* Without random numbers, use a hardcoded seed */
+	uk_pr_warn("%s: Using hard-coded random seed\n", l->progname);
+	l->rand[0] = 0xB0B0;
+	l->rand[1] = 0xF00D;
+#endif /* !CONFIG_LIBUKSWRAND */
+
+	tstart = loadtime_start();
+	l->rc = elf_ctx_init(&l->thread->ctx, l->prog, l->progname,
+			     l->argc, l->argv, l->envp, l->rand, l->stack_len);
+	if (unlikely(l->rc < 0)) {
+		uk_pr_err("%s: Failed to initialize application thread: %s (%d)\n",
+			  l->progname, strerror(-l->rc), l->rc);
+		goto out;
+	}
+	loadtime_account(LOADTIME_CTXINIT, tstart);
+
+out:
+	uk_semaphore_up(&l->loaded);
+}
+
+static int elf_launch_start(struct elf_launch *l)
+{
+	__nsec tstart __maybe_unused;
+	int rc;
+
+	tstart = loadtime_start();
+	l->thread->flags |= UK_THREADF_RUNNABLE;
+	rc = uk_posix_process_create(uk_alloc_get_default(), l->thread,
+				     uk_thread_current());
+	if (unlikely(rc < 0)) {
+		uk_pr_err("%s: Failed to create process: %s (%d)\n",
+			  l->progname, strerror(-rc), rc);
+		return rc;
+	}
+	elf_exit_init(&l->exit);
+	elf_exit_attach(&l->exit, l->thread);
+	procself_attach(l->exit.pid, l->prog, l->stack, l->stack_len);
+	profile_attach(l->exit.pid, l->prog, l->stack, l->stack_len);
+	memacct_attach(l->exit.pid, l->prog, l->stack, l->stack_len);
+	uk_pr_debug("%s: Application stack at %p - %p, pointer: %p\n",
+		    l->progname, l->stack,
+		    (void *) ((uintptr_t) l->stack + l->stack_len),
+		    (void *) l->thread->ctx.sp);
+	uk_pr_debug("%s: Application entrance at %p\n",
+		    l->progname, (void *) l->thread->ctx.ip);
+
+	uk_sched_thread_add(placement_main(l->thread, l->cpu), l->thread);
+	l->started = true;
+	loadtime_account(LOADTIME_HANDOFF, tstart);
+	return 0;
+}
+
+int elf_launch_manifest(int *status)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct elf_launch *launches = NULL;
+	struct elf_launch *l;
+	const char *cwd = NULL;
+	char *text;
+	int nlaunches = 0;
+	int exit_status;
+	int ret;
+	int i;
+
+	UK_ASSERT(status);
+	*status = 0;
+
+	text = elf_launch_read();
+	if (!text)
+		return -ENOENT;
+	if (unlikely(PTRISERR(text)))
+		return PTR2ERR(text);
+
+	ret = elf_launch_parse(a, text, &launches, &nlaunches);
+	if (unlikely(ret < 0))
+		goto out;
+	if (unlikely(nlaunches == 0)) {
+		uk_pr_err("Launch manifest is empty\n");
+		ret = -EINVAL;
+		goto out;
+	}
+	uk_pr_info("Launching %d programs from manifest\n", nlaunches);
+
+	/*
+	 * Load all programs concurrently
+	 */
+	for (i = 0; i < nlaunches; ++i) {
+		l = &launches[i];
+		uk_semaphore_init(&l->loaded, 0);
+		l->stack_len = elf_stack_len();
+#if !CONFIG_APPELFLOADER_PLACEMENT
+		if (l->cpu >= 0)
+			uk_pr_warn("%s: CPU placement is not enabled, ignoring cpu=%d\n",
+				   l->progname, l->cpu);
+#endif /* !CONFIG_APPELFLOADER_PLACEMENT */
+		/* Load on the CPU that the program will run on */
+		if (!uk_sched_thread_create(placement_sched(l->cpu),
+					    elf_launch_loader, l,
+					    "elfloader-load")) {
+			/* Load in this thread instead */
+			elf_launch_loader(l);
+		}
+	}
+	ret = 0;
+	for (i = 0; i < nlaunches; ++i) {
+		l = &launches[i];
+		uk_semaphore_down(&l->loaded);
+		if (l->rc < 0 && ret == 0)
+			ret = l->rc;
+	}
+	if (unlikely(ret < 0))
+		goto out;
+
+	/*
+	 * The working directory is shared by all processes
+	 */
+	for (i = 0; i < nlaunches; ++i) {
+		l = &launches[i];
+		if (!l->cwd)
+			continue;
+		if (!cwd) {
+			cwd = l->cwd;
+			continue;
+		}
+		if (strcmp(cwd, l->cwd) != 0)
+			uk_pr_warn("%s: Working directory is shared, ignoring cwd=%s\n",
+				   l->progname, l->cwd);
+	}
+	if (cwd && chdir(cwd) < 0) {
+		ret = -errno;
+		uk_pr_err("Failed to change working directory to '%s': %s (%d)\n",
+			  cwd, strerror(errno), errno);
+		goto out;
+	}
+
+	/*
+	 * Start in manifest order
+	 */
+	for (i = 0; i < nlaunches; ++i) {
+		l = &launches[i];
+		if (unlikely(elf_launch_start(l) < 0) && !*status)
+			*status = 1;
+	}
+	loadtime_report(launches[0].progname);
+
+	/*
+	 * Wait for all programs to exit
+	 */
+	for (i = 0; i < nlaunches; ++i) {
+		l = &launches[i];
+		if (!l->started)
+			continue;
+		if (elf_exit_wait(&l->exit, &exit_status) < 0) {
+			uk_pr_info("%s: Application thread terminated (exit status unknown)\n",
+				   l->progname);
+		} else {
+			uk_pr_info("%s: Application exited with status %d\n",
+				   l->progname, exit_status);
+			if (exit_status && !*status)
+				*status = exit_status;
+		}
+		/* The thread is released by the scheduler */
+		l->thread = NULL;
+		procself_detach(l->exit.pid);
+		profile_detach(l->exit.pid);
+		memacct_detach(l->exit.pid);
+		brk_release(l->exit.pid);
+	}
+
+out:
+	for (i = 0; i < nlaunches; ++i) {
+		l = &launches[i];
+		if (l->thread)
+			uk_thread_release(l->thread);
+		if (l->prog)
+			elf_unload(l->prog);
+		if (l->envp)
+			uk_free(a, l->envp);
+		if (l->tok)
+			uk_free(a, l->tok);
+	}
+	if (launches)
+		uk_free(a, launches);
+	free(text);
+	return ret;
+}
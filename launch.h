@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_LAUNCH_H
+#define APPELFLOADER_LAUNCH_H
+
+#include <uk/config.h>
+
+#if CONFIG_APPELFLOADER_MANIFEST
+/*
+ * Launch manifest
+ *
+ * A manifest lists programs that are started together, each one in its own
+ * process. Entries are separated by newlines or `;`, tokens by whitespace;
+ * `#` starts a comment that extends to the end of the line:
+ *
+ *   [cpu=<n>] [cwd=<dir>] [env=<name>=<value> ...] [--] <path> [<arg> ...]
+ *
+ * `<path>` must be absolute. `env=` entries are added to (or replace
+ * variables of) the kernel environment. The manifest is taken from the
+ * `appelfloader.launch` kernel parameter or read from the file that is given
+ * with `appelfloader.manifest` (default: APPELFLOADER_MANIFEST_PATH).
+ *
+ * All programs are loaded concurrently, each by its own loader thread on the
+ * CPU that is requested with `cpu=` (see APPELFLOADER_PLACEMENT). They
+ * are started in manifest order once all of them are loaded; if any program
+ * fails to load, none is started.
+ */
+
+/**
+ * Loads and runs the programs of the launch manifest and waits until all
+ * of them exited
+ *
+ * @param status:
+ *   Receives the first non-zero exit status in manifest order, 0 otherwise
+ * @return:
+ *   0 if the programs were run, -ENOENT if there is no manifest (the caller
+ *   should start a single program instead), or a negative errno value if the
+ *   manifest is invalid or a program failed to load
+ */
+int elf_launch_manifest(int *status);
+#endif /* CONFIG_APPELFLOADER_MANIFEST */
+
+#endif /* APPELFLOADER_LAUNCH_H */
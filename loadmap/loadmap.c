@@ -0,0 +1,464 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <libelf.h>
+#include <uk/alloc.h>
+#include <uk/essentials.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+#include <uk/plat/console.h>
+
+#include "loadmap.h"
+
+#define LOADMAP_PREFIX		"loadmap: "
+#define LOADMAP_BUILDID_MAX	64	/* bytes */
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID		3
+#endif /* !NT_GNU_BUILD_ID */
+
+#if defined(__x86_64__)
+#define LOADMAP_MACHINE		EM_X86_64
+#elif defined(__aarch64__)
+#define LOADMAP_MACHINE		EM_AARCH64
+#else
+#error "Unsupported architecture"
+#endif
+
+/*
+ * GDB JIT compilation interface: the names, the layout, and the protocol are
+ * defined by GDB. GDB reads the descriptor and places a breakpoint on the
+ * registration function when it finds both symbols in the kernel image.
+ */
+enum {
+	JIT_NOACTION = 0,
+	JIT_REGISTER_FN,
+	JIT_UNREGISTER_FN
+};
+
+struct jit_code_entry {
+	struct jit_code_entry *next_entry;
+	struct jit_code_entry *prev_entry;
+	const char *symfile_addr;
+	__u64 symfile_size;
+};
+
+struct jit_descriptor {
+	__u32 version;
+	__u32 action_flag;
+	struct jit_code_entry *relevant_entry;
+	struct jit_code_entry *first_entry;
+};
+
+struct jit_descriptor __jit_debug_descriptor __used = {
+	1, JIT_NOACTION, NULL, NULL
+};
+
+void __jit_debug_register_code(void);
+
+void __noinline __used __jit_debug_register_code(void)
+{
+	/* Keep the call from being optimized away */
+	__asm__ __volatile__("" ::: "memory");
+}
+
+/* Registered image; the symbol file follows in the same allocation */
+struct loadmap_img {
+	struct jit_code_entry jit;
+	const struct elf_prog *prog;
+	char buildid[2 * LOADMAP_BUILDID_MAX + 1];
+};
+
+/* Serializes the descriptor and the console output */
+static struct uk_mutex loadmap_lock = UK_MUTEX_INITIALIZER(loadmap_lock);
+
+/* Program headers of the image in memory, NULL if they are not mapped */
+static const Elf64_Phdr *loadmap_phdr(const struct elf_prog *prog)
+{
+	if (prog->phdr.entsize != sizeof(Elf64_Phdr) ||
+	    prog->phdr.off + prog->phdr.num * sizeof(Elf64_Phdr)
+	    > prog->upperl)
+		return NULL;
+	return (const Elf64_Phdr *)((__uptr)prog->vabase + prog->phdr.off);
+}
+
+/* Whether [vaddr, vaddr + len) is backed by file content in memory */
+static int loadmap_mapped(const Elf64_Phdr *phdr, __sz phnum,
+			  Elf64_Addr vaddr, Elf64_Xword len)
+{
+	__sz i;
+
+	for (i = 0; i < phnum; ++i) {
+		if (phdr[i].p_type != PT_LOAD)
+			continue;
+		if (vaddr >= phdr[i].p_vaddr &&
+		    vaddr + len <= phdr[i].p_vaddr + phdr[i].p_filesz)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Finds the GNU build ID note in the loaded image. Returns the note (header,
+ * name, and descriptor) and its length, or NULL.
+ */
+static const Elf64_Nhdr *loadmap_buildid(const struct elf_prog *prog,
+					 const Elf64_Phdr *phdr,
+					 __sz *len)
+{
+	const Elf64_Nhdr *nhdr;
+	__uptr pos, end;
+	__sz i, nlen;
+
+	for (i = 0; i < prog->phdr.num; ++i) {
+		if (phdr[i].p_type != PT_NOTE ||
+		    !loadmap_mapped(phdr, prog->phdr.num,
+				    phdr[i].p_vaddr, phdr[i].p_filesz))
+			continue;
+
+		pos = (__uptr)prog->vabase + phdr[i].p_vaddr;
+		end = pos + phdr[i].p_filesz;
+		while (pos + sizeof(*nhdr) <= end) {
+			nhdr = (const Elf64_Nhdr *)pos;
+			nlen = sizeof(*nhdr) + ALIGN_UP(nhdr->n_namesz, 4)
+			       + ALIGN_UP(nhdr->n_descsz, 4);
+			if (nlen > end - pos)
+				break;
+			if (nhdr->n_type == NT_GNU_BUILD_ID &&
+			    nhdr->n_namesz == 4 &&
+			    memcmp(nhdr + 1, "GNU", 4) == 0 &&
+			    nhdr->n_descsz > 0 &&
+			    nhdr->n_descsz <= LOADMAP_BUILDID_MAX) {
+				*len = nlen;
+				return nhdr;
+			}
+			pos += nlen;
+		}
+	}
+	return NULL;
+}
+
+static const char *loadmap_secname(Elf64_Word flags)
+{
+	if (flags & PF_X)
+		return ".text";
+	if (flags & PF_W)
+		return ".data";
+	return ".rodata";
+}
+
+/* Section name string table of the symbol file */
+static const char loadmap_shstrtab[] =
+	"\0.text\0.data\0.rodata\0.note.gnu.build-id\0"
+	".symtab\0.strtab\0.shstrtab";
+
+static Elf64_Word loadmap_shname(const char *name)
+{
+	const char *s = loadmap_shstrtab + 1;
+
+	while (strcmp(s, name) != 0)
+		s += strlen(s) + 1;
+	return (Elf64_Word)(s - loadmap_shstrtab);
+}
+
+/*
+ * Size of the symbol file. Layout: ELF header, symbols, build ID note,
+ * symbol names, section names, section headers.
+ */
+static __sz loadmap_symfile_len(const struct elf_prog *prog, __sz nsec,
+				__sz notelen)
+{
+	__sz len, i;
+
+	len = sizeof(Elf64_Ehdr);
+	len += (prog->syms.num + 1) * sizeof(Elf64_Sym);
+	len += ALIGN_UP(notelen, 4);
+	len += 1;
+	for (i = 0; i < prog->syms.num; ++i)
+		len += strlen(prog->syms.sym[i].name) + 1;
+	len += sizeof(loadmap_shstrtab);
+	len = ALIGN_UP(len, 8);
+	len += nsec * sizeof(Elf64_Shdr);
+	return len;
+}
+
+/*
+ * Writes an ELF object without content: one NOBITS section per loaded
+ * segment at its runtime address and the function symbols at their runtime
+ * addresses. This is what GDB needs to symbolize the image.
+ */
+static void loadmap_symfile(const struct elf_prog *prog,
+			    const Elf64_Phdr *phdr,
+			    const Elf64_Nhdr *note, __sz notelen,
+			    char *buf, __sz nsec, __sz len)
+{
+	__uptr vabase = (__uptr)prog->vabase;
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *)buf;
+	Elf64_Shdr *shdr;
+	Elf64_Sym *sym;
+	__sz i, j, pos, strpos, namelen;
+	__sz nload = 0;
+	Elf64_Half symndx, strndx, notendx = 0;
+
+	memset(buf, 0, len);
+	shdr = (Elf64_Shdr *)(buf + len - nsec * sizeof(*shdr));
+
+	/* Sections of the loaded segments */
+	for (i = 0; phdr && i < prog->phdr.num; ++i) {
+		if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0)
+			continue;
+		nload++;
+		shdr[nload].sh_name = loadmap_shname(
+					loadmap_secname(phdr[i].p_flags));
+		shdr[nload].sh_type = SHT_NOBITS;
+		shdr[nload].sh_flags = SHF_ALLOC
+				| ((phdr[i].p_flags & PF_W) ? SHF_WRITE : 0)
+				| ((phdr[i].p_flags & PF_X) ? SHF_EXECINSTR : 0);
+		shdr[nload].sh_addr = vabase + phdr[i].p_vaddr;
+		shdr[nload].sh_size = phdr[i].p_memsz;
+		shdr[nload].sh_addralign = 1;
+	}
+	if (!phdr) {
+		/* Program headers are not mapped, describe the whole image */
+		nload = 1;
+		shdr[1].sh_name = loadmap_shname(".text");
+		shdr[1].sh_type = SHT_NOBITS;
+		shdr[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+		shdr[1].sh_addr = vabase;
+		shdr[1].sh_size = prog->valen;
+		shdr[1].sh_addralign = 1;
+	}
+	symndx = (Elf64_Half)(nload + 1);
+	if (note)
+		notendx = symndx++;
+	strndx = (Elf64_Half)(symndx + 1);
+
+	/* Symbols, each in the section of the segment containing it */
+	pos = sizeof(*ehdr);
+	sym = (Elf64_Sym *)(buf + pos);
+	strpos = 1;
+	for (i = 0; i < prog->syms.num; ++i) {
+		sym[i + 1].st_value = prog->syms.sym[i].vastart;
+		sym[i + 1].st_size = prog->syms.sym[i].size;
+		sym[i + 1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+		sym[i + 1].st_shndx = SHN_ABS;
+		for (j = 1; j <= nload; ++j) {
+			if (sym[i + 1].st_value >= shdr[j].sh_addr &&
+			    sym[i + 1].st_value < shdr[j].sh_addr
+						  + shdr[j].sh_size) {
+				sym[i + 1].st_shndx = (Elf64_Half)j;
+				break;
+			}
+		}
+		sym[i + 1].st_name = (Elf64_Word)strpos;
+		strpos += strlen(prog->syms.sym[i].name) + 1;
+	}
+	shdr[symndx].sh_name = loadmap_shname(".symtab");
+	shdr[symndx].sh_type = SHT_SYMTAB;
+	shdr[symndx].sh_offset = pos;
+	shdr[symndx].sh_size = (prog->syms.num + 1) * sizeof(*sym);
+	shdr[symndx].sh_link = strndx;
+	shdr[symndx].sh_info = 1;	/* no local symbols */
+	shdr[symndx].sh_addralign = 8;
+	shdr[symndx].sh_entsize = sizeof(*sym);
+	pos += shdr[symndx].sh_size;
+
+	/* Build ID, so that GDB can find separate debug information */
+	if (note) {
+		memcpy(buf + pos, note, notelen);
+		shdr[notendx].sh_name = loadmap_shname(".note.gnu.build-id");
+		shdr[notendx].sh_type = SHT_NOTE;
+		shdr[notendx].sh_offset = pos;
+		shdr[notendx].sh_size = notelen;
+		shdr[notendx].sh_addralign = 4;
+		pos += ALIGN_UP(notelen, 4);
+	}
+
+	shdr[strndx].sh_name = loadmap_shname(".strtab");
+	shdr[strndx].sh_type = SHT_STRTAB;
+	shdr[strndx].sh_offset = pos;
+	shdr[strndx].sh_size = strpos;
+	shdr[strndx].sh_addralign = 1;
+	pos++;
+	for (i = 0; i < prog->syms.num; ++i) {
+		namelen = strlen(prog->syms.sym[i].name) + 1;
+		memcpy(buf + pos, prog->syms.sym[i].name, namelen);
+		pos += namelen;
+	}
+
+	shdr[strndx + 1].sh_name = loadmap_shname(".shstrtab");
+	shdr[strndx + 1].sh_type = SHT_STRTAB;
+	shdr[strndx + 1].sh_offset = pos;
+	shdr[strndx + 1].sh_size = sizeof(loadmap_shstrtab);
+	shdr[strndx + 1].sh_addralign = 1;
+	memcpy(buf + pos, loadmap_shstrtab, sizeof(loadmap_shstrtab));
+
+	memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+	ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+	ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr->e_ident[EI_OSABI] = ELFOSABI_NONE;
+	ehdr->e_type = ET_EXEC;	/* addresses are absolute */
+	ehdr->e_machine = LOADMAP_MACHINE;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_shoff = len - nsec * sizeof(*shdr);
+	ehdr->e_ehsize = sizeof(*ehdr);
+	ehdr->e_shentsize = sizeof(*shdr);
+	ehdr->e_shnum = (Elf64_Half)nsec;
+	ehdr->e_shstrndx = strndx + 1;
+}
+
+static void loadmap_out(const char *fmt, ...) __printf(1, 2);
+
+static void loadmap_out(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if ((__sz)len > sizeof(buf) - 2)
+		len = sizeof(buf) - 2;
+	buf[len++] = '\n';
+	ukplat_coutk(buf, len);
+}
+
+static void loadmap_print(const struct loadmap_img *img)
+{
+	const struct elf_prog *prog = img->prog;
+	__uptr vabase = (__uptr)prog->vabase;
+	const Elf64_Phdr *phdr;
+	__sz i;
+
+	loadmap_out(LOADMAP_PREFIX "load base=0x%"PRIxPTR" len=0x%zx build-id=%s path=%s",
+		    vabase, prog->valen, img->buildid[0] ? img->buildid : "-",
+		    prog->path ? prog->path : prog->name);
+
+	phdr = loadmap_phdr(prog);
+	if (!phdr) {
+		loadmap_out(LOADMAP_PREFIX "seg base=0x%"PRIxPTR" start=0x%"PRIxPTR" end=0x%"PRIxPTR" prot=rwx offset=0x0",
+			    vabase, vabase, vabase + prog->valen);
+		return;
+	}
+	for (i = 0; i < prog->phdr.num; ++i) {
+		if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0)
+			continue;
+		loadmap_out(LOADMAP_PREFIX "seg base=0x%"PRIxPTR" start=0x%"PRIxPTR" end=0x%"PRIxPTR" prot=%c%c%c offset=0x%"PRIx64,
+			    vabase, vabase + (__uptr)phdr[i].p_vaddr,
+			    vabase + (__uptr)(phdr[i].p_vaddr
+					      + phdr[i].p_memsz),
+			    (phdr[i].p_flags & PF_R) ? 'r' : '-',
+			    (phdr[i].p_flags & PF_W) ? 'w' : '-',
+			    (phdr[i].p_flags & PF_X) ? 'x' : '-',
+			    (__u64)phdr[i].p_offset);
+	}
+}
+
+void loadmap_add(const struct elf_prog *prog)
+{
+	const Elf64_Nhdr *note = NULL;
+	const unsigned char *desc;
+	const Elf64_Phdr *phdr;
+	struct loadmap_img *img;
+	__sz i, nsec, notelen = 0, len;
+
+	if (!prog->vabase)
+		return;
+
+	phdr = loadmap_phdr(prog);
+	nsec = 1 + 3;	/* NULL, .symtab, .strtab, .shstrtab */
+	if (phdr) {
+		for (i = 0; i < prog->phdr.num; ++i)
+			if (phdr[i].p_type == PT_LOAD && phdr[i].p_memsz)
+				nsec++;
+		note = loadmap_buildid(prog, phdr, &notelen);
+		if (note)
+			nsec++;
+	} else {
+		nsec++;
+	}
+	len = loadmap_symfile_len(prog, nsec, notelen);
+
+	img = uk_malloc(prog->a, sizeof(*img) + len);
+	if (unlikely(!img)) {
+		uk_pr_warn("%s: Not enough memory for load map entry (%"__PRIsz" B)\n",
+			   prog->name, sizeof(*img) + len);
+		return;
+	}
+	img->prog = prog;
+	img->buildid[0] = '\0';
+	if (note) {
+		desc = (const unsigned char *)(note + 1) + 4;
+		for (i = 0; i < note->n_descsz; ++i)
+			snprintf(&img->buildid[2 * i], 3, "%02x", desc[i]);
+	}
+	loadmap_symfile(prog, phdr, note, notelen,
+			(char *)(img + 1), nsec, len);
+	img->jit.symfile_addr = (const char *)(img + 1);
+	img->jit.symfile_size = len;
+
+	uk_mutex_lock(&loadmap_lock);
+	img->jit.prev_entry = NULL;
+	img->jit.next_entry = __jit_debug_descriptor.first_entry;
+	if (img->jit.next_entry)
+		img->jit.next_entry->prev_entry = &img->jit;
+	__jit_debug_descriptor.first_entry = &img->jit;
+	__jit_debug_descriptor.relevant_entry = &img->jit;
+	__jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+	__jit_debug_register_code();
+	loadmap_print(img);
+	uk_mutex_unlock(&loadmap_lock);
+}
+
+void loadmap_remove(const struct elf_prog *prog)
+{
+	struct jit_code_entry *e;
+	struct loadmap_img *img;
+
+	uk_mutex_lock(&loadmap_lock);
+	for (e = __jit_debug_descriptor.first_entry; e; e = e->next_entry) {
+		img = __containerof(e, struct loadmap_img, jit);
+		if (img->prog == prog)
+			break;
+	}
+	if (!e) {
+		uk_mutex_unlock(&loadmap_lock);
+		return;
+	}
+
+	if (e->prev_entry)
+		e->prev_entry->next_entry = e->next_entry;
+	else
+		__jit_debug_descriptor.first_entry = e->next_entry;
+	if (e->next_entry)
+		e->next_entry->prev_entry = e->prev_entry;
+	__jit_debug_descriptor.relevant_entry = e;
+	__jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+	__jit_debug_register_code();
+	loadmap_out(LOADMAP_PREFIX "unload base=0x%"PRIxPTR,
+		    (__uptr)prog->vabase);
+	uk_mutex_unlock(&loadmap_lock);
+
+	uk_free(prog->a, img);
+}
+
+void loadmap_dump(void)
+{
+	struct jit_code_entry *e;
+
+	uk_mutex_lock(&loadmap_lock);
+	for (e = __jit_debug_descriptor.first_entry; e; e = e->next_entry)
+		loadmap_print(__containerof(e, struct loadmap_img, jit));
+	uk_mutex_unlock(&loadmap_lock);
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_LOADMAP_H
+#define APPELFLOADER_LOADMAP_H
+
+#include <uk/config.h>
+
+#include "../elf_prog.h"
+
+/*
+ * Load map for external tooling
+ *
+ * Every loaded image (programs and their interpreters) is registered with
+ * the GDB JIT interface (`__jit_debug_descriptor`): GDB picks up a small
+ * in-memory ELF object per image that describes the loaded segments at their
+ * runtime addresses together with the function symbols of the image, so no
+ * load addresses have to be entered by hand.
+ *
+ * Additionally, one line per image and per segment is written to the kernel
+ * console, prefixed with `loadmap: `:
+ *
+ *   loadmap: load base=0x<vabase> len=0x<valen> build-id=<hex|-> path=<path>
+ *   loadmap: seg base=0x<vabase> start=0x<start> end=0x<end> prot=<rwx> offset=0x<file offset>
+ *   loadmap: unload base=0x<vabase>
+ *
+ * `path` is the last field and extends to the end of the line.
+ */
+
+#if CONFIG_APPELFLOADER_LOADMAP
+/**
+ * Registers a loaded image
+ *
+ * @param prog:
+ *   Loaded image; must stay valid until loadmap_remove()
+ */
+void loadmap_add(const struct elf_prog *prog);
+
+/**
+ * Unregisters an image before it is unloaded
+ */
+void loadmap_remove(const struct elf_prog *prog);
+
+/**
+ * Writes the `load` and `seg` lines of all registered images
+ */
+void loadmap_dump(void);
+#else /* !CONFIG_APPELFLOADER_LOADMAP */
+#define loadmap_add(prog) do {} while (0)
+#define loadmap_remove(prog) do {} while (0)
+#define loadmap_dump() do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_LOADMAP */
+
+#endif /* APPELFLOADER_LOADMAP_H */
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/plat/console.h>
+#include <uk/plat/time.h>
+
+#include "loadtime.h"
+
+struct loadtime_entry {
+	__nsec nsec;
+	__nsec max;
+	unsigned int count;
+};
+
+static const char *const loadtime_names[LOADTIME_NPHASES] = {
+	[LOADTIME_LOCATE]  = "locate",
+	[LOADTIME_OPEN]    = "open",
+	[LOADTIME_PARSE]   = "parse",
+	[LOADTIME_SEGMENT] = "segment",
+	[LOADTIME_INTERP]  = "interp",
+	[LOADTIME_PROTECT] = "protect",
+	[LOADTIME_SYSRW]   = "sysrw",
+	[LOADTIME_CTXINIT] = "ctxinit",
+	[LOADTIME_HANDOFF] = "handoff",
+};
+
+static struct loadtime_entry loadtime_tab[LOADTIME_NPHASES];
+static __nsec loadtime_main;
+
+void loadtime_begin(void)
+{
+	loadtime_main = ukplat_monotonic_clock();
+}
+
+void loadtime_account(enum loadtime_phase phase, __nsec tstart)
+{
+	__nsec dt = ukplat_monotonic_clock() - tstart;
+	struct loadtime_entry *e;
+	__nsec max;
+
+	UK_ASSERT(phase < LOADTIME_NPHASES);
+
+	/* Programs of a launch manifest are loaded concurrently */
+	e = &loadtime_tab[phase];
+	__atomic_add_fetch(&e->nsec, dt, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&e->count, 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&e->max, __ATOMIC_RELAXED);
+	while (dt > max &&
+	       !__atomic_compare_exchange_n(&e->max, &max, dt, 0,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+__nsec loadtime_get(enum loadtime_phase phase, unsigned int *count)
+{
+	UK_ASSERT(phase < LOADTIME_NPHASES);
+
+	if (count)
+		*count = loadtime_tab[phase].count;
+	return loadtime_tab[phase].nsec;
+}
+
+const char *loadtime_name(enum loadtime_phase phase)
+{
+	UK_ASSERT(phase < LOADTIME_NPHASES);
+
+	return loadtime_names[phase];
+}
+
+void loadtime_reset(void)
+{
+	memset(loadtime_tab, 0, sizeof(loadtime_tab));
+}
+
+static void __printf(1, 2) loadtime_coutk(const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len <= 0)
+		return;
+	ukplat_coutk(buf, MIN((unsigned int)len, sizeof(buf) - 1));
+}
+
+#define NSEC_US(ns)	((ns) / 1000), ((ns) % 1000)
+
+void loadtime_report(const char *progname)
+{
+	__nsec now = ukplat_monotonic_clock();
+	const struct loadtime_entry *e;
+	unsigned int p;
+
+	loadtime_coutk("%s: boot-to-entry %"PRIu64".%03"PRIu64" us (kernel %"PRIu64".%03"PRIu64" us, loader %"PRIu64".%03"PRIu64" us)\n",
+		       progname, NSEC_US(now), NSEC_US(loadtime_main),
+		       NSEC_US(now - loadtime_main));
+	for (p = 0; p < LOADTIME_NPHASES; ++p) {
+		e = &loadtime_tab[p];
+		if (!e->count)
+			continue;
+		loadtime_coutk("  %-8s %10"PRIu64".%03"PRIu64" us",
+			       loadtime_names[p], NSEC_US(e->nsec));
+		if (e->count > 1)
+			loadtime_coutk(" (%ux, max %"PRIu64".%03"PRIu64" us)",
+				       e->count, NSEC_US(e->max));
+		loadtime_coutk("\n");
+	}
+
+#if CONFIG_APPELFLOADER_LOADTIME_MACHINE
+	/* Single line of `key=nanoseconds` pairs for log scrapers */
+	loadtime_coutk("loadtime: v=1 boot=%"PRIu64" main=%"PRIu64,
+		       (__u64)now, (__u64)loadtime_main);
+	for (p = 0; p < LOADTIME_NPHASES; ++p)
+		loadtime_coutk(" %s=%"PRIu64":%u", loadtime_names[p],
+			       (__u64)loadtime_tab[p].nsec,
+			       loadtime_tab[p].count);
+	loadtime_coutk("\n");
+#endif /* CONFIG_APPELFLOADER_LOADTIME_MACHINE */
+}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_LOADTIME_H
+#define APPELFLOADER_LOADTIME_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+#if CONFIG_APPELFLOADER_LOADTIME
+#include <uk/plat/time.h>
+#endif /* CONFIG_APPELFLOADER_LOADTIME */
+
+/*
+ * Timing of the phases between entering `main()` and handing over to the
+ * application thread. Each phase accumulates the time of all of its
+ * occurrences (e.g., one per loaded segment).
+ */
+enum loadtime_phase {
+	LOADTIME_LOCATE = 0,	/* PATH lookup */
+	LOADTIME_OPEN,		/* open(), fstat() */
+	LOADTIME_PARSE,		/* libelf init and header parsing */
+	LOADTIME_SEGMENT,	/* mmap/read/copy of a single segment */
+	LOADTIME_INTERP,	/* interpreter load, including its sub-phases */
+	LOADTIME_PROTECT,	/* page protection setup */
+	LOADTIME_SYSRW,		/* system call rewriting */
+	LOADTIME_CTXINIT,	/* elf_ctx_init() */
+	LOADTIME_HANDOFF,	/* process creation, scheduling of the app */
+	LOADTIME_NPHASES
+};
+
+#if CONFIG_APPELFLOADER_LOADTIME
+static inline __nsec loadtime_start(void)
+{
+	return ukplat_monotonic_clock();
+}
+
+/**
+ * Marks entering `main()`
+ */
+void loadtime_begin(void);
+
+/**
+ * Accounts the time since `tstart` (see `loadtime_start()`) to a phase
+ */
+void loadtime_account(enum loadtime_phase phase, __nsec tstart);
+
+/**
+ * Returns the accumulated time and number of occurrences of a phase
+ */
+__nsec loadtime_get(enum loadtime_phase phase, unsigned int *count);
+
+/**
+ * Returns the name of a phase as used in the reports
+ */
+const char *loadtime_name(enum loadtime_phase phase);
+
+/**
+ * Clears all accumulated phase timings
+ */
+void loadtime_reset(void);
+
+/**
+ * Prints the phase summary to the kernel console. Intended to be called
+ * once the application thread is about to be scheduled.
+ */
+void loadtime_report(const char *progname);
+#else /* !CONFIG_APPELFLOADER_LOADTIME */
+#define loadtime_start() ((__nsec)0)
+#define loadtime_begin() do {} while (0)
+#define loadtime_account(phase, tstart) do {} while (0)
+#define loadtime_reset() do {} while (0)
+#define loadtime_report(progname) do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_LOADTIME */
+
+#endif /* APPELFLOADER_LOADTIME_H */
@@ -55,8 +55,30 @@
 #include <uk/argparse.h>
 #include <uk/streambuf.h>
 #endif /* CONFIG_APPELFLOADER_VFSEXEC_ENVPATH */
+#if CONFIG_APPELFLOADER_RESTART
+#include <uk/plat/time.h>
+#endif /* CONFIG_APPELFLOADER_RESTART */
 
 #include "elf_prog.h"
+#include "stack.h"
+#include "exit.h"
+#if CONFIG_APPELFLOADER_RESTART
+#include "syscalls/brk.h"
+#include "restart.h"
+#endif /* CONFIG_APPELFLOADER_RESTART */
+#if CONFIG_APPELFLOADER_MANIFEST
+#include "launch.h"
+#endif /* CONFIG_APPELFLOADER_MANIFEST */
+#include "loadtime/loadtime.h"
+#include "placement/placement.h"
+#include "autogen/procself.h"
+#include "profile/profile.h"
+#include "memacct/memacct.h"
+#include "thpool/thpool.h"
+#include "sysstat/sysstat.h"
+#if CONFIG_APPELFLOADER_VFSEXEC_PATHINDEX
+#include "pathidx.h"
+#endif /* CONFIG_APPELFLOADER_VFSEXEC_PATHINDEX */
 
 #if CONFIG_LIBPOSIX_ENVIRON
 extern char **environ;
@@ -64,10 +86,6 @@ extern char **environ;
 #define environ NULL
 #endif /* !CONFIG_LIBPOSIX_ENVIRON */
 
-#ifndef PAGES2BYTES
-#define PAGES2BYTES(x) ((x) << __PAGE_SHIFT)
-#endif
-
 /*
  * Internal version of `basename`
  * We keep an own version here that modifies the input string in-place.
@@ -99,6 +117,21 @@ again:
 }
 
 #if CONFIG_APPELFLOADER_VFSEXEC_ENVPATH
+#if CONFIG_APPELFLOADER_VFSEXEC_PATHINDEX
+/*
+ * Locates an executable with the index of the `PATH` directories, see
+ * `pathidx_locate()`. It is in the responsibility of the caller to free the
+ * returned string after use with `free()`.
+ */
+static inline char *locate_exec(const char *basename, const char *path_env)
+{
+	if (!basename || basename[0] == '/' || basename[0] == '.') {
+		/* no name given, absolute, or cwd-relative */
+		return ERR2PTR(-EINVAL);
+	}
+	return pathidx_locate(basename, path_env);
+}
+#else /* !CONFIG_APPELFLOADER_VFSEXEC_PATHINDEX */
 /*
  * Routine that locates an executable in a colon-separated list of directories.
  * On success, it returns a malloc'ed C-string containing the full path. It is
@@ -170,6 +203,7 @@ err_free_buf:
 err_out:
 	return ERR2PTR(err);
 }
+#endif /* !CONFIG_APPELFLOADER_VFSEXEC_PATHINDEX */
 #endif /* CONFIG_APPELFLOADER_VFSEXEC_ENVPATH */
 
 /*
@@ -193,9 +227,25 @@ int main(int argc, char *argv[])
 #endif /* CONFIG_APPELFLOADER_VFSEXEC */
 	const char *progname;
 	struct elf_prog *prog;
+#if CONFIG_APPELFLOADER_BOOTTHREAD
+	struct ukarch_ctx app_ctx, boot_ctx;
+#else /* !CONFIG_APPELFLOADER_BOOTTHREAD */
 	struct uk_thread *app_thread;
+	struct elf_exit app_exit;
+#endif /* !CONFIG_APPELFLOADER_BOOTTHREAD */
+	void *app_stack = NULL;
+	__sz app_stack_len;
+	__nsec tstart __maybe_unused;
 	uint64_t rand[2];
+#if !CONFIG_APPELFLOADER_BOOTTHREAD
+	int status, exit_rc;
+#endif /* !CONFIG_APPELFLOADER_BOOTTHREAD */
 	int ret = 0;
+#if CONFIG_APPELFLOADER_RESTART
+	struct elf_restart app_restart;
+	unsigned int restarts = 0;
+	__nsec trestart = 0;
+#endif /* CONFIG_APPELFLOADER_RESTART */
 #if CONFIG_APPELFLOADER_VFSEXEC_ENVPATH
 	char *env_path;
 #endif /* CONFIG_APPELFLOADER_VFSEXEC_ENVPATH */
@@ -203,6 +253,20 @@ int main(int argc, char *argv[])
 	char *env_pwd;
 #endif /* CONFIG_APPELFLOADER_VFSEXEC_ENVPWD */
 
+	loadtime_begin();
+
+#if CONFIG_APPELFLOADER_MANIFEST
+	/*
+	 * Launch the programs of a manifest instead, if there is one
+	 */
+	ret = elf_launch_manifest(&status);
+	if (ret != -ENOENT) {
+		ret = (ret < 0) ? 1 : status;
+		goto out;
+	}
+	ret = 0;
+#endif /* CONFIG_APPELFLOADER_MANIFEST */
+
 	/*
 	 * Prepare `progname` (and `path`) from command line
 	 * or compiled-in settings
@@ -263,25 +327,35 @@ int main(int argc, char *argv[])
 		   (void *) img->vbase, img->len);
 #endif /* CONFIG_APPELFLOADER_INITRDEXEC */
 
+#if CONFIG_APPELFLOADER_BOOTTHREAD
+	/*
+	 * Allocate application stack
+	 * The application will take over the current (boot) thread
+	 */
+	app_stack_len = elf_stack_len();
+	app_ctx.sp = (__uptr) elf_stack_alloc(uk_alloc_get_default(), progname,
+					      app_stack_len, &app_stack);
+	if (unlikely(!app_ctx.sp)) {
+		uk_pr_err("%s: Failed to allocate stack\n", progname);
+		ret = 1;
+		goto out;
+	}
+#else /* !CONFIG_APPELFLOADER_BOOTTHREAD */
 	/*
 	 * Create thread container
 	 * It will have a new stack and an ukarch_ctx
 	 */
-	app_thread = uk_thread_create_container(uk_alloc_get_default(),
-						uk_alloc_get_default(),
-				 PAGES2BYTES(CONFIG_APPELFLOADER_STACK_NBPAGES),
-						uk_alloc_get_default(),
-						0,
-						uk_alloc_get_default(),
-						false,
-						progname,
-						NULL, NULL);
+	app_stack_len = elf_stack_len();
+	app_thread = elf_stack_thread_create(thpool_alloc(), progname,
+					     app_stack_len, &app_stack,
+					     elf_exit_thread_dtor);
 	if (unlikely(!app_thread)) {
 		uk_pr_err("%s: Failed to allocate thread container\n",
 			  progname);
 		ret = 1;
 		goto out;
 	}
+#endif /* !CONFIG_APPELFLOADER_BOOTTHREAD */
 
 #if CONFIG_APPELFLOADER_VFSEXEC_ENVPWD
 	/*
@@ -311,7 +385,9 @@ int main(int argc, char *argv[])
 #if CONFIG_APPELFLOADER_VFSEXEC_ENVPATH
 	env_path = getenv("PATH");
 	if (env_path) {
+		tstart = loadtime_start();
 		realpath = locate_exec(path, env_path);
+		loadtime_account(LOADTIME_LOCATE, tstart);
 		if (PTR2ERR(realpath) == -EINVAL) {
 			realpath = NULL;
 		} else if (PTRISERR(realpath) && PTR2ERR(realpath) != -EINVAL) {
@@ -341,6 +417,18 @@ int main(int argc, char *argv[])
 		   (uint64_t) prog->vabase + prog->valen,
 		   prog->valen, (void *) prog->entry);
 
+#if CONFIG_APPELFLOADER_RESTART
+	/* Remember what is not the application's before it runs */
+	ret = elf_restart_save(&app_restart);
+	if (unlikely(ret < 0)) {
+		uk_pr_err("%s: Failed to save state for restarts: %s (%d)\n",
+			  progname, strerror(-ret), ret);
+		ret = 1;
+		goto out_unload_prog;
+	}
+
+launch:
+#endif /* CONFIG_APPELFLOADER_RESTART */
 	/*
 	 * Initialize application thread
 	 */
@@ -354,19 +442,62 @@ int main(int argc, char *argv[])
 #endif /* !CONFIG_LIBUKSWRAND */
 
 	uk_pr_debug("%s: Prepare application thread...\n", progname);
-	elf_ctx_init(&app_thread->ctx, prog, progname,
-		     argc, argv, environ, rand);
+	tstart = loadtime_start();
+#if CONFIG_APPELFLOADER_BOOTTHREAD
+	ret = elf_ctx_init(&app_ctx, prog, progname,
+			   argc, argv, environ, rand, app_stack_len);
+#else /* !CONFIG_APPELFLOADER_BOOTTHREAD */
+	ret = elf_ctx_init(&app_thread->ctx, prog, progname,
+			   argc, argv, environ, rand, app_stack_len);
+#endif /* !CONFIG_APPELFLOADER_BOOTTHREAD */
+	if (unlikely(ret < 0)) {
+		uk_pr_err("%s: Failed to initialize application thread: %s (%d)\n",
+			  progname, strerror(-ret), ret);
+		goto out_unload_prog;
+	}
+	loadtime_account(LOADTIME_CTXINIT, tstart);
+
+#if CONFIG_APPELFLOADER_BOOTTHREAD
+	uk_pr_debug("%s: Application stack at %p - %p, pointer: %p\n",
+		    progname,
+		    app_stack,
+		    (void *) ((uintptr_t) app_stack + app_stack_len),
+		    (void *) app_ctx.sp);
+	uk_pr_debug("%s: Application entrance at %p\n",
+		    progname,
+		    (void *) app_ctx.ip);
+	procself_attach(elf_exit_pid_current(), prog,
+			app_stack, app_stack_len);
+	profile_attach(elf_exit_pid_current(), prog,
+		       app_stack, app_stack_len);
+	memacct_attach(elf_exit_pid_current(), prog,
+		       app_stack, app_stack_len);
+	loadtime_report(progname);
+
+	/*
+	 * Execute application
+	 * The boot thread continues as application thread and keeps its
+	 * process (posix-process), there is no way back.
+	 */
+	ukarch_ctx_switch(&boot_ctx, &app_ctx);
+	UK_CRASH("%s: Unexpected return from application\n", progname);
+#else /* !CONFIG_APPELFLOADER_BOOTTHREAD */
+	tstart = loadtime_start();
 	app_thread->flags |= UK_THREADF_RUNNABLE;
 #if CONFIG_LIBPOSIX_PROCESS
 	uk_posix_process_create(uk_alloc_get_default(),
 				app_thread,
 				uk_thread_current());
 #endif
+	elf_exit_init(&app_exit);
+	elf_exit_attach(&app_exit, app_thread);
+	procself_attach(app_exit.pid, prog, app_stack, app_stack_len);
+	profile_attach(app_exit.pid, prog, app_stack, app_stack_len);
+	memacct_attach(app_exit.pid, prog, app_stack, app_stack_len);
 	uk_pr_debug("%s: Application stack at %p - %p, pointer: %p\n",
 		    progname,
-		    (void *) app_thread->_mem.stack,
-		    (void *) ((uintptr_t) app_thread->_mem.stack
-			      + PAGES2BYTES(CONFIG_APPELFLOADER_STACK_NBPAGES)),
+		    app_stack,
+		    (void *) ((uintptr_t) app_stack + app_stack_len),
 		    (void *) app_thread->ctx.sp);
 	uk_pr_debug("%s: Application entrance at %p\n",
 		    progname,
@@ -375,20 +506,92 @@ int main(int argc, char *argv[])
 	/*
 	 * Execute application
 	 */
-	uk_sched_thread_add(uk_sched_current(), app_thread);
+	uk_sched_thread_add(placement_main(app_thread, -1), app_thread);
+#if CONFIG_APPELFLOADER_RESTART
+	if (restarts) {
+		uk_pr_info("%s: Restarted in %"PRIu64" us\n", progname,
+			   (uint64_t)(ukplat_monotonic_clock() - trestart)
+			   / 1000);
+	} else
+#endif /* CONFIG_APPELFLOADER_RESTART */
+	{
+		loadtime_account(LOADTIME_HANDOFF, tstart);
+		loadtime_report(progname);
+	}
 
 	/*
-	 * FIXME: Instead of an infinite wait, wait for application
-	 *        to exit (this needs thread_wait support with
-	 *        uksched and/or posix-process)
+	 * Wait for the application to exit. The thread is released by the
+	 * scheduler afterwards.
 	 */
-	for (;;)
-		sleep(10);
+	exit_rc = elf_exit_wait(&app_exit, &status);
+	if (exit_rc < 0)
+		uk_pr_info("%s: Application thread terminated (exit status unknown)\n",
+			   progname);
+	else
+		uk_pr_info("%s: Application exited with status %d\n",
+			   progname, status);
+	app_thread = NULL;
+	ret = status;
+	procself_detach(app_exit.pid);
+	profile_detach(app_exit.pid);
+	memacct_detach(app_exit.pid);
+
+	/* Statistics are reported per run of the application */
+	sysstat_dump();
+	sysstat_reset();
+
+#if CONFIG_APPELFLOADER_RESTART
+#if CONFIG_APPELFLOADER_RESTART_ONFAILURE
+	/* An unknown exit status counts as failure */
+	if (exit_rc == 0 && status == 0)
+		goto out_unload_prog;
+#endif /* CONFIG_APPELFLOADER_RESTART_ONFAILURE */
+	if (CONFIG_APPELFLOADER_RESTART_MAX &&
+	    restarts >= CONFIG_APPELFLOADER_RESTART_MAX) {
+		uk_pr_warn("%s: Giving up after %u restarts\n",
+			   progname, restarts);
+		goto out_unload_prog;
+	}
+
+	trestart = ukplat_monotonic_clock();
+	ret = elf_reset(prog);
+	if (unlikely(ret < 0)) {
+		uk_pr_err("%s: Cannot restart: %s (%d)\n",
+			  progname, strerror(-ret), ret);
+		goto out_unload_prog;
+	}
+	brk_release(app_exit.pid);
+	elf_restart_cleanup(&app_restart, progname);
 
-	/* TODO: As soon as we are able to return: properly exit/shutdown */
+	app_thread = elf_stack_thread_create(thpool_alloc(), progname,
+					     app_stack_len, &app_stack,
+					     elf_exit_thread_dtor);
+	if (unlikely(!app_thread)) {
+		uk_pr_err("%s: Failed to allocate thread container\n",
+			  progname);
+		ret = 1;
+		goto out_unload_prog;
+	}
+	restarts++;
+	uk_pr_info("%s: Restarting (%u)...\n", progname, restarts);
+	goto launch;
+#endif /* CONFIG_APPELFLOADER_RESTART */
+#endif /* !CONFIG_APPELFLOADER_BOOTTHREAD */
 
+out_unload_prog:
+#if CONFIG_APPELFLOADER_RESTART
+	elf_restart_free(&app_restart);
+#endif /* CONFIG_APPELFLOADER_RESTART */
+	elf_unload(prog);
 out_free_thread:
-	uk_thread_release(app_thread);
+#if CONFIG_APPELFLOADER_BOOTTHREAD
+	elf_stack_free(uk_alloc_get_default(),
+		       (void *) ((uintptr_t) app_stack + app_stack_len),
+		       app_stack_len);
+#else /* !CONFIG_APPELFLOADER_BOOTTHREAD */
+	if (app_thread)
+		uk_thread_release(app_thread);
+#endif /* !CONFIG_APPELFLOADER_BOOTTHREAD */
 out:
 #if CONFIG_APPELFLOADER_VFSEXEC
 	if (progname_conv)
@@ -0,0 +1,423 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <libelf.h>
+#include <uk/alloc.h>
+#include <uk/arch/limits.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+#include <uk/plat/console.h>
+#if CONFIG_PAGING
+#include <uk/plat/paging.h>
+#endif /* CONFIG_PAGING */
+
+#include "memacct.h"
+#include "exit.h"
+#include "syscalls/brk.h"
+
+#define MEMACCT_NSEGS		16	/* segments reported per process */
+#define MEMACCT_NPT		64	/* page tables told apart per walk */
+
+#define KIB(x)			((x) / 1024)
+
+struct memacct_seg {
+	const char *name;
+	Elf64_Word flags;
+	struct memacct_range file;
+	struct memacct_range bss;
+};
+
+struct memacct_snap {
+	bool valid;
+	struct memacct_stats st;
+	__sz nseg;
+	struct memacct_seg seg[MEMACCT_NSEGS];
+};
+
+struct memacct_proc {
+	int pid;
+	const struct elf_prog *prog;
+	__uptr stack;
+	__sz stack_len;
+	struct memacct_snap snap;	/* taken on exit_group */
+	struct memacct_proc *next;
+};
+
+/* Last-level page tables found while measuring one process */
+struct memacct_pt {
+	__sz num;
+	__uptr tab[MEMACCT_NPT];
+};
+
+/* Serializes the process list, the measurements, and the output */
+static struct uk_mutex memacct_lock = UK_MUTEX_INITIALIZER(memacct_lock);
+static struct memacct_proc *memacct_procs;
+
+static struct memacct_proc *memacct_find(int pid)
+{
+	struct memacct_proc *p;
+
+	for (p = memacct_procs; p; p = p->next)
+		if (p->pid == pid)
+			return p;
+	return NULL;
+}
+
+#if CONFIG_PAGING
+static void memacct_pt_add(struct memacct_pt *pt, __uptr tab)
+{
+	__sz i;
+
+	for (i = 0; i < pt->num; ++i)
+		if (pt->tab[i] == tab)
+			return;
+	/* When the list is full, tables are counted more than once */
+	if (pt->num < MEMACCT_NPT)
+		pt->tab[pt->num] = tab;
+	pt->num++;
+}
+
+/*
+ * Walks the page table over [start, end). Ranges that are not mapped at a
+ * higher level are skipped as a whole.
+ */
+static void memacct_walk(__uptr start, __uptr end,
+			 struct memacct_range *r, struct memacct_pt *pt)
+{
+	struct uk_pagetable *upt = ukplat_pt_get_active();
+	__uptr va, next;
+	unsigned int lvl;
+	__vaddr_t tab;
+	__pte_t pte;
+
+	if (start >= end)
+		return;
+	r->reserved += end - start;
+	for (va = start; va < end; va = next) {
+		lvl = PAGE_LEVEL;
+		if (unlikely(ukplat_pt_walk(upt, va, &lvl, &tab, &pte) < 0)) {
+			next = va + PAGE_SIZE;
+			continue;
+		}
+		next = ALIGN_DOWN(va, PAGE_Lx_SIZE(lvl)) + PAGE_Lx_SIZE(lvl);
+		if (lvl == PAGE_LEVEL)
+			memacct_pt_add(pt, tab);
+		if (PT_Lx_PTE_PRESENT(pte, lvl))
+			r->resident += MIN(next, end) - va;
+	}
+}
+#else /* !CONFIG_PAGING */
+/* Without paging, all memory is backed when it is allocated */
+static void memacct_walk(__uptr start, __uptr end,
+			 struct memacct_range *r,
+			 struct memacct_pt *pt __unused)
+{
+	if (start >= end)
+		return;
+	r->reserved += end - start;
+	r->resident += end - start;
+}
+#endif /* !CONFIG_PAGING */
+
+/* Allocations that the loader keeps for an image */
+static __sz memacct_metadata(const struct elf_prog *prog)
+{
+	__sz len = sizeof(*prog);
+	__sz i __maybe_unused;
+
+	if (prog->strblk)
+		len += prog->strblk_len;
+	if (prog->interp.path)
+		len += strlen(prog->interp.path) + 1;
+#if CONFIG_APPELFLOADER_SYMS
+	len += prog->syms.num * sizeof(*prog->syms.sym);
+	for (i = 0; i < prog->syms.num; ++i)
+		len += strlen(prog->syms.sym[i].name) + 1;
+#endif /* CONFIG_APPELFLOADER_SYMS */
+#if CONFIG_APPELFLOADER_RESTART
+	len += prog->rwsnap.num * sizeof(*prog->rwsnap.seg);
+	for (i = 0; i < prog->rwsnap.num; ++i)
+		len += prog->rwsnap.seg[i].filesz;
+#endif /* CONFIG_APPELFLOADER_RESTART */
+	return len;
+}
+
+static void memacct_seg_add(struct memacct_snap *s, const char *name,
+			    Elf64_Word flags, __uptr start, __uptr fend,
+			    __uptr end, struct memacct_pt *pt)
+{
+	struct memacct_seg seg;
+
+	memset(&seg, 0, sizeof(seg));
+	seg.name = name;
+	seg.flags = flags;
+	memacct_walk(start, fend, &seg.file, pt);
+	memacct_walk(fend, end, &seg.bss, pt);
+
+	s->st.image.reserved += seg.file.reserved;
+	s->st.image.resident += seg.file.resident;
+	s->st.bss.reserved += seg.bss.reserved;
+	s->st.bss.resident += seg.bss.resident;
+	if (s->nseg < MEMACCT_NSEGS)
+		s->seg[s->nseg++] = seg;
+}
+
+/*
+ * Accounts the PT_LOAD segments of an image, taken from the in-memory program
+ * headers. Pages shared by neighboring segments are counted once.
+ */
+static void memacct_img(struct memacct_snap *s, const struct elf_prog *prog,
+			struct memacct_pt *pt)
+{
+	const char *name = prog->path ? prog->path : prog->name;
+	__uptr vabase = (__uptr)prog->vabase;
+	__uptr start, fend, end, last = 0;
+	const Elf64_Phdr *phdr;
+	__sz i;
+
+	if (!prog->vabase)
+		return;
+	s->st.metadata += memacct_metadata(prog);
+
+	if (prog->phdr.entsize != sizeof(*phdr) ||
+	    prog->phdr.off + prog->phdr.num * sizeof(*phdr) > prog->upperl) {
+		/* Program headers are not mapped, account the whole image */
+		memacct_seg_add(s, name, PF_R | PF_W | PF_X,
+				PAGE_ALIGN_DOWN(vabase),
+				PAGE_ALIGN_UP(vabase + prog->valen),
+				PAGE_ALIGN_UP(vabase + prog->valen), pt);
+		return;
+	}
+
+	phdr = (const Elf64_Phdr *)(vabase + prog->phdr.off);
+	for (i = 0; i < prog->phdr.num; ++i) {
+		if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0)
+			continue;
+		start = PAGE_ALIGN_DOWN(vabase + phdr[i].p_vaddr);
+		fend = PAGE_ALIGN_UP(vabase + phdr[i].p_vaddr
+				     + phdr[i].p_filesz);
+		end = PAGE_ALIGN_UP(vabase + phdr[i].p_vaddr
+				    + phdr[i].p_memsz);
+		start = MAX(start, last);
+		fend = MAX(fend, start);
+		memacct_seg_add(s, name, phdr[i].p_flags, start, fend, end,
+				pt);
+		last = MAX(last, end);
+	}
+}
+
+static void memacct_measure(struct memacct_proc *p, struct memacct_snap *s)
+{
+	struct memacct_pt pt;
+	void *heap __maybe_unused;
+	__sz heap_len __maybe_unused;
+
+	memset(s, 0, sizeof(*s));
+	pt.num = 0;
+
+	memacct_img(s, p->prog, &pt);
+	if (p->prog->interp.prog)
+		memacct_img(s, p->prog->interp.prog, &pt);
+#if CONFIG_APPELFLOADER_BRK
+	/* The whole heap is allocated on first use of brk() */
+	if (brk_region(p->pid, &heap, &heap_len) == 0)
+		memacct_walk(PAGE_ALIGN_DOWN((__uptr)heap),
+			     PAGE_ALIGN_UP((__uptr)heap
+					   + ((__sz)CONFIG_APPELFLOADER_BRK_NBPAGES
+					      << __PAGE_SHIFT)),
+			     &s->st.heap, &pt);
+#endif /* CONFIG_APPELFLOADER_BRK */
+	if (p->stack)
+		memacct_walk(PAGE_ALIGN_DOWN(p->stack),
+			     PAGE_ALIGN_UP(p->stack + p->stack_len),
+			     &s->st.stack, &pt);
+	s->st.pagetables = pt.num * PAGE_SIZE;
+	s->valid = true;
+}
+
+static void __printf(1, 2) memacct_coutk(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len <= 0)
+		return;
+	ukplat_coutk(buf, MIN((unsigned int)len, sizeof(buf) - 1));
+}
+
+static void memacct_line(const struct memacct_range *r, const char *what,
+			 const char *name)
+{
+	memacct_coutk("  %10"__PRIsz" %10"__PRIsz"  %s%s%s\n",
+		      KIB(r->reserved), KIB(r->resident), what,
+		      name ? " " : "", name ? name : "");
+}
+
+static void memacct_print(const struct memacct_proc *p,
+			  const struct memacct_snap *s)
+{
+	const struct memacct_stats *st = &s->st;
+	struct memacct_range r;
+	char prot[4];
+	ssize_t avail;
+	__sz i;
+
+	memacct_coutk("%s: memory footprint (KiB)\n  %10s %10s\n",
+		      p->prog->name, "reserved", "resident");
+	for (i = 0; i < s->nseg; ++i) {
+		prot[0] = (s->seg[i].flags & PF_R) ? 'r' : '-';
+		prot[1] = (s->seg[i].flags & PF_W) ? 'w' : '-';
+		prot[2] = (s->seg[i].flags & PF_X) ? 'x' : '-';
+		prot[3] = '\0';
+		memacct_line(&s->seg[i].file, prot, s->seg[i].name);
+		if (s->seg[i].bss.reserved)
+			memacct_line(&s->seg[i].bss, "bss", s->seg[i].name);
+	}
+	memacct_line(&st->heap, "heap", NULL);
+	memacct_line(&st->stack, "stack", NULL);
+	r.reserved = r.resident = st->pagetables;
+	memacct_line(&r, "page tables", NULL);
+	r.reserved = r.resident = st->metadata;
+	memacct_line(&r, "loader metadata", NULL);
+
+	r.reserved = st->image.reserved + st->bss.reserved
+		     + st->heap.reserved + st->stack.reserved
+		     + st->pagetables + st->metadata;
+	r.resident = st->image.resident + st->bss.resident
+		     + st->heap.resident + st->stack.resident
+		     + st->pagetables + st->metadata;
+	memacct_line(&r, "total", NULL);
+
+	/* Single line of `key=reserved:resident` pairs for log scrapers */
+	memacct_coutk("memacct: v=1 pid=%d image=%"__PRIsz":%"__PRIsz" bss=%"__PRIsz":%"__PRIsz" heap=%"__PRIsz":%"__PRIsz" stack=%"__PRIsz":%"__PRIsz" pagetables=%"__PRIsz" metadata=%"__PRIsz" total=%"__PRIsz":%"__PRIsz,
+		      p->pid,
+		      st->image.reserved, st->image.resident,
+		      st->bss.reserved, st->bss.resident,
+		      st->heap.reserved, st->heap.resident,
+		      st->stack.reserved, st->stack.resident,
+		      st->pagetables, st->metadata,
+		      r.reserved, r.resident);
+	avail = uk_alloc_availmem_total();
+	if (avail >= 0)
+		memacct_coutk(" availmem=%zd", avail);
+	memacct_coutk("\n");
+}
+
+void memacct_attach(int pid, const struct elf_prog *prog,
+		    void *stack, __sz stack_len)
+{
+	struct memacct_proc *p;
+
+	p = uk_calloc(uk_alloc_get_default(), 1, sizeof(*p));
+	if (unlikely(!p)) {
+		uk_pr_warn("%s: Not enough memory for memory accounting\n",
+			   prog->name);
+		return;
+	}
+	p->pid = pid;
+	p->prog = prog;
+	p->stack = (__uptr)stack;
+	p->stack_len = stack_len;
+
+	uk_mutex_lock(&memacct_lock);
+	p->next = memacct_procs;
+	memacct_procs = p;
+	uk_mutex_unlock(&memacct_lock);
+}
+
+void memacct_detach(int pid)
+{
+	struct memacct_proc **prev, *p = NULL;
+
+	uk_mutex_lock(&memacct_lock);
+	for (prev = &memacct_procs; *prev; prev = &(*prev)->next) {
+		if ((*prev)->pid == pid) {
+			p = *prev;
+			*prev = p->next;
+			break;
+		}
+	}
+	if (p) {
+		/* The stack was released already, leave it out */
+		if (!p->snap.valid) {
+			p->stack = 0;
+			memacct_measure(p, &p->snap);
+		}
+		memacct_print(p, &p->snap);
+	}
+	uk_mutex_unlock(&memacct_lock);
+
+	if (p)
+		uk_free(uk_alloc_get_default(), p);
+}
+
+void memacct_exit(void)
+{
+	struct memacct_proc *p;
+
+	uk_mutex_lock(&memacct_lock);
+	p = memacct_find(elf_exit_pid_current());
+	if (p)
+		memacct_measure(p, &p->snap);
+	uk_mutex_unlock(&memacct_lock);
+}
+
+void memacct_thread_exit(int pid)
+{
+	struct memacct_proc *p;
+
+	/* Destructors may run in the idle thread, which must not block */
+	if (!uk_mutex_trylock(&memacct_lock))
+		return;
+	p = memacct_find(pid);
+	if (p && !p->snap.valid)
+		memacct_measure(p, &p->snap);
+	uk_mutex_unlock(&memacct_lock);
+}
+
+int memacct_get(int pid, struct memacct_stats *stats)
+{
+	struct memacct_snap snap;
+	struct memacct_proc *p;
+
+	UK_ASSERT(stats);
+
+	uk_mutex_lock(&memacct_lock);
+	p = memacct_find(pid);
+	if (p)
+		memacct_measure(p, &snap);
+	uk_mutex_unlock(&memacct_lock);
+	if (!p)
+		return -ENOENT;
+
+	*stats = snap.st;
+	return 0;
+}
+
+void memacct_dump(void)
+{
+	struct memacct_snap snap;
+	struct memacct_proc *p;
+
+	uk_mutex_lock(&memacct_lock);
+	for (p = memacct_procs; p; p = p->next) {
+		memacct_measure(p, &snap);
+		memacct_print(p, &snap);
+	}
+	uk_mutex_unlock(&memacct_lock);
+}
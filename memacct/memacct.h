@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_MEMACCT_H
+#define APPELFLOADER_MEMACCT_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+
+#include "../elf_prog.h"
+
+/*
+ * Memory footprint accounting
+ *
+ * Reports for each process how much memory the loader reserved for the
+ * loaded images (program and interpreter), the brk heap, and the stack of the
+ * main thread, and how much of it is resident, i.e., mapped in the page
+ * table. Resident memory is measured when the process calls `exit_group` or,
+ * if it does not, when its main thread is released, before the stack goes
+ * away. The report is written to the kernel
+ * console when a process exits, ending with a single `memacct: ` line of
+ * `key=reserved:resident` pairs in bytes for scripts.
+ */
+
+#if CONFIG_APPELFLOADER_MEMACCT
+struct memacct_range {
+	__sz reserved;	/* bytes of address space set up by the loader */
+	__sz resident;	/* bytes of it that are mapped */
+};
+
+struct memacct_stats {
+	struct memacct_range image;	/* loaded segments without BSS */
+	struct memacct_range bss;	/* zero-initialized part of segments */
+	struct memacct_range heap;	/* brk heap */
+	struct memacct_range stack;	/* stack of the main thread */
+	__sz pagetables;	/* last-level page tables of the above */
+	__sz metadata;		/* loader bookkeeping of the images */
+};
+
+/**
+ * Starts accounting a started application
+ *
+ * @param pid:
+ *   Process ID, see elf_exit_pid_current()
+ * @param prog:
+ *   Program; must stay valid until memacct_detach()
+ * @param stack:
+ *   Lowest address of the stack of the main thread
+ * @param stack_len:
+ *   Length of the stack of the main thread
+ */
+void memacct_attach(int pid, const struct elf_prog *prog,
+		    void *stack, __sz stack_len);
+
+/**
+ * Writes the report of a terminated application and stops accounting it
+ */
+void memacct_detach(int pid);
+
+/**
+ * Measures the memory of the calling process before it exits
+ */
+void memacct_exit(void);
+
+/**
+ * Measures the memory of a process whose main thread is released, unless it
+ * was measured on `exit_group` already. Called from the thread destructor
+ * before the stack is released; skips the measurement instead of blocking.
+ */
+void memacct_thread_exit(int pid);
+
+/**
+ * Measures the current memory footprint of a process
+ *
+ * @return:
+ *   0 on success, -ENOENT if the process is not accounted
+ */
+int memacct_get(int pid, struct memacct_stats *stats);
+
+/**
+ * Writes the current report of all accounted processes
+ */
+void memacct_dump(void);
+#else /* !CONFIG_APPELFLOADER_MEMACCT */
+#define memacct_attach(pid, prog, stack, stack_len) do {} while (0)
+#define memacct_detach(pid) do { (void)(pid); } while (0)
+#define memacct_exit() do {} while (0)
+#define memacct_thread_exit(pid) do { (void)(pid); } while (0)
+#define memacct_dump() do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_MEMACCT */
+
+#endif /* APPELFLOADER_MEMACCT_H */
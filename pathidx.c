@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <uk/errptr.h>
+#include <uk/essentials.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+
+#include "pathidx.h"
+
+#define PATHIDX_NBUCKETS	256
+
+struct pathidx_dir {
+	char *path;
+	size_t pathlen;
+	bool indexed;
+	bool present;		/* directory existed when it was indexed */
+	struct timespec mtime;
+	dev_t dev;
+	ino_t ino;
+	struct pathidx_dir *next;
+};
+
+struct pathidx_ent {
+	struct pathidx_ent *next;
+	struct pathidx_dir *dir;
+	__u32 hash;
+	mode_t mode;		/* 0 until the file was found executable */
+	char name[];
+};
+
+static struct pathidx_ent *pathidx_tab[PATHIDX_NBUCKETS];
+static struct pathidx_dir *pathidx_dirs;
+static struct uk_mutex pathidx_lock = UK_MUTEX_INITIALIZER(pathidx_lock);
+
+/* FNV-1a */
+static __u32 pathidx_hash(const char *name)
+{
+	__u32 h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static struct pathidx_dir *pathidx_dir_get(const char *path, size_t len)
+{
+	struct pathidx_dir *dir;
+
+	for (dir = pathidx_dirs; dir; dir = dir->next)
+		if (dir->pathlen == len && memcmp(dir->path, path, len) == 0)
+			return dir;
+
+	dir = calloc(1, sizeof(*dir) + len + 1);
+	if (unlikely(!dir))
+		return NULL;
+	dir->path = (char *)(dir + 1);
+	memcpy(dir->path, path, len);
+	dir->path[len] = '\0';
+	dir->pathlen = len;
+	dir->next = pathidx_dirs;
+	pathidx_dirs = dir;
+	return dir;
+}
+
+static void pathidx_dir_drop(struct pathidx_dir *dir)
+{
+	struct pathidx_ent **prev, *e;
+	unsigned int b;
+
+	for (b = 0; b < PATHIDX_NBUCKETS; ++b) {
+		prev = &pathidx_tab[b];
+		while ((e = *prev)) {
+			if (e->dir == dir) {
+				*prev = e->next;
+				free(e);
+			} else {
+				prev = &e->next;
+			}
+		}
+	}
+	dir->indexed = false;
+}
+
+static int pathidx_dir_index(struct pathidx_dir *dir)
+{
+	struct pathidx_ent *e;
+	struct dirent *de;
+	unsigned int n = 0;
+	size_t len;
+	DIR *d;
+
+	d = opendir(dir->path);
+	if (!d)
+		return -errno;
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.' &&
+		    (de->d_name[1] == '\0' ||
+		     (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+			continue;
+		if (de->d_type == DT_DIR)
+			continue;
+
+		len = strlen(de->d_name);
+		e = malloc(sizeof(*e) + len + 1);
+		if (unlikely(!e)) {
+			closedir(d);
+			pathidx_dir_drop(dir);
+			return -ENOMEM;
+		}
+		memcpy(e->name, de->d_name, len + 1);
+		e->dir = dir;
+		e->hash = pathidx_hash(e->name);
+		e->mode = 0;
+		e->next = pathidx_tab[e->hash % PATHIDX_NBUCKETS];
+		pathidx_tab[e->hash % PATHIDX_NBUCKETS] = e;
+		n++;
+	}
+	closedir(d);
+
+	uk_pr_debug("Indexed %u files under %s\n", n, dir->path);
+	return 0;
+}
+
+/*
+ * Rebuilds the index of a directory if it changed since it was indexed
+ */
+static void pathidx_dir_validate(struct pathidx_dir *dir)
+{
+	struct stat st;
+
+	if (stat(dir->path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		if (dir->indexed && !dir->present)
+			return;
+		pathidx_dir_drop(dir);
+		dir->indexed = true;
+		dir->present = false;
+		return;
+	}
+
+	if (dir->indexed && dir->present &&
+	    dir->dev == st.st_dev && dir->ino == st.st_ino &&
+	    dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+	    dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return;
+
+	pathidx_dir_drop(dir);
+	if (pathidx_dir_index(dir) < 0)
+		return; /* searched again with the next lookup */
+	dir->indexed = true;
+	dir->present = true;
+	dir->dev = st.st_dev;
+	dir->ino = st.st_ino;
+	dir->mtime = st.st_mtim;
+}
+
+/*
+ * Returns true if the indexed file is an executable regular file. Only
+ * positive results are cached, so that a later `chmod` is noticed.
+ */
+static bool pathidx_ent_isexec(struct pathidx_ent *e)
+{
+	char buf[PATH_MAX];
+	struct stat st;
+
+	if (e->mode)
+		return true;
+
+	if (snprintf(buf, sizeof(buf), "%s/%s", e->dir->path, e->name)
+	    >= (int)sizeof(buf))
+		return false;
+	if (stat(buf, &st) != 0)
+		return false; /* removed in the meantime */
+	if (unlikely(!S_ISREG(st.st_mode)))
+		return false; /* found but not a file */
+#if CONFIG_APPELFLOADER_VFSEXEC_EXECBIT
+	if (unlikely(!(st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))))
+		return false; /* found but not an executable */
+#endif /* CONFIG_APPELFLOADER_VFSEXEC_EXECBIT */
+
+	e->mode = st.st_mode;
+	return true;
+}
+
+char *pathidx_locate(const char *name, const char *path_env)
+{
+	struct pathidx_dir *dir;
+	struct pathidx_ent *e = NULL;
+	const char *cur, *next;
+	char *buf = NULL;
+	size_t len;
+	__u32 hash;
+	int err = -ENOENT;
+
+	if (!name || name[0] == '\0' || strchr(name, '/'))
+		return ERR2PTR(-EINVAL);
+	hash = pathidx_hash(name);
+
+	uk_mutex_lock(&pathidx_lock);
+	for (cur = path_env; cur; cur = next) {
+		next = strchr(cur, ':');
+		len = next ? (size_t)(next - cur) : strlen(cur);
+		if (next)
+			next++;
+
+		/* An empty entry stands for the working directory */
+		dir = len ? pathidx_dir_get(cur, len) : pathidx_dir_get(".", 1);
+		if (unlikely(!dir)) {
+			err = -ENOMEM;
+			break;
+		}
+		pathidx_dir_validate(dir);
+
+		for (e = pathidx_tab[hash % PATHIDX_NBUCKETS]; e; e = e->next)
+			if (e->dir == dir && e->hash == hash &&
+			    strcmp(e->name, name) == 0)
+				break;
+		if (e && pathidx_ent_isexec(e))
+			break;
+		e = NULL;
+	}
+
+	if (e) {
+		len = e->dir->pathlen + 1 + strlen(name) + 1;
+		if (unlikely(len > PATH_MAX)) {
+			err = -ENOSPC;
+		} else {
+			buf = malloc(len);
+			if (unlikely(!buf))
+				err = -ENOMEM;
+			else
+				snprintf(buf, len, "%s/%s", e->dir->path, name);
+		}
+	}
+	uk_mutex_unlock(&pathidx_lock);
+
+	if (!buf) {
+		uk_pr_debug("No executable found for %s\n", name);
+		return ERR2PTR(err);
+	}
+	uk_pr_debug("Found executable %s\n", buf);
+	return buf;
+}
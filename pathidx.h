@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_PATHIDX_H
+#define APPELFLOADER_PATHIDX_H
+
+#include <uk/config.h>
+
+/*
+ * Index of executables in the `PATH` directories
+ *
+ * Each directory is read once into a hash table of file names when it is
+ * first searched. The index of a directory is rebuilt when its modification
+ * time changes, so a lookup costs one `stat()` per searched directory and
+ * a hash lookup instead of one `stat()` per candidate path. The latter is
+ * expensive on remote filesystems (e.g., 9pfs) because failed lookups are
+ * not cached by the VFS.
+ */
+
+/**
+ * Locates an executable in a colon-separated list of directories
+ *
+ * @param name:
+ *   File name of the executable (no slashes)
+ * @param path_env:
+ *   Colon-separated list of directories, like the `PATH` variable
+ * @return:
+ *   Full path of the executable allocated with `malloc()` that the caller
+ *   releases with `free()`, or an error pointer: -ENOENT if no executable
+ *   was found, -ENOSPC if a path exceeds PATH_MAX, -ENOMEM
+ */
+char *pathidx_locate(const char *name, const char *path_env);
+
+#endif /* APPELFLOADER_PATHIDX_H */
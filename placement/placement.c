@@ -0,0 +1,398 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#include <uk/process.h>
+#include <uk/sched.h>
+#include <uk/spinlock.h>
+#include <uk/thread.h>
+#if CONFIG_LIBUKLIBPARAM
+#include <uk/libparam.h>
+#endif /* CONFIG_LIBUKLIBPARAM */
+
+#include "placement.h"
+
+/* Application threads whose CPU and affinity are tracked */
+#define PLACEMENT_NTHREADS	256
+
+enum placement_policy {
+	PLACEMENT_INHERIT,
+	PLACEMENT_ROUNDROBIN,
+	PLACEMENT_LEASTLOADED,
+};
+
+#if CONFIG_LIBUKLIBPARAM
+static int cpu = -1;
+static char *cpu_mask;
+static char *cpu_policy;
+
+UK_LIBPARAM_PARAM(cpu, int,
+		  "CPU for the application main thread");
+UK_LIBPARAM_PARAM(cpu_mask, charp,
+		  "CPUs that the application may use (hexadecimal mask)");
+UK_LIBPARAM_PARAM(cpu_policy, charp,
+		  "Placement of new threads: inherit, rr, least");
+#endif /* CONFIG_LIBUKLIBPARAM */
+
+static struct uk_sched *placement_scheds[PLACEMENT_NCPUS];
+static unsigned int placement_ncpus;
+static __u64 placement_mask;
+static enum placement_policy placement_policy;
+static unsigned int placement_rr;
+
+/* Number of application threads per CPU */
+static unsigned long placement_load[PLACEMENT_NCPUS];
+
+/*
+ * Placed application threads. `mask` is the affinity that the thread set
+ * or inherited, 0 if it uses the mask of the application.
+ */
+static struct {
+	struct uk_thread *t;
+	__u64 mask;
+	int cpu;
+} placement_threads[PLACEMENT_NTHREADS];
+static __spinlock placement_lock = UK_SPINLOCK_INITIALIZER();
+
+static int placement_cpu_of(struct uk_sched *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < placement_ncpus; ++i)
+		if (placement_scheds[i] == s)
+			return (int)i;
+	return -1;
+}
+
+static inline int placement_cpu_current(void)
+{
+	return placement_cpu_of(uk_sched_current());
+}
+
+/*
+ * Selects a CPU out of `mask` according to the policy. `parent` is the CPU
+ * of the creating thread, negative if there is none.
+ */
+static int placement_pick(__u64 mask, int parent)
+{
+	unsigned long load, min = ~0UL;
+	unsigned int i, n;
+	int best = -1;
+
+	UK_ASSERT(mask);
+
+	switch (placement_policy) {
+	case PLACEMENT_INHERIT:
+		if (parent >= 0 && (mask & (1ULL << parent)))
+			return parent;
+		break;
+	case PLACEMENT_ROUNDROBIN:
+		n = __atomic_fetch_add(&placement_rr, 1, __ATOMIC_RELAXED);
+		for (i = 0; i < placement_ncpus; ++i) {
+			best = (int)((n + i) % placement_ncpus);
+			if (mask & (1ULL << best))
+				return best;
+		}
+		break;
+	case PLACEMENT_LEASTLOADED:
+		for (i = 0; i < placement_ncpus; ++i) {
+			if (!(mask & (1ULL << i)))
+				continue;
+			load = __atomic_load_n(&placement_load[i],
+					       __ATOMIC_RELAXED);
+			/* Prefer the parent's CPU on ties */
+			if (load < min || (load == min && (int)i == parent)) {
+				min = load;
+				best = (int)i;
+			}
+		}
+		if (best >= 0)
+			return best;
+		break;
+	}
+	return __builtin_ctzll(mask);
+}
+
+/* Returns the slot of a tracked thread, -1 if it is not tracked */
+static int placement_slot(struct uk_thread *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < PLACEMENT_NTHREADS; ++i)
+		if (placement_threads[i].t == t)
+			return (int)i;
+	return -1;
+}
+
+/*
+ * Starts tracking an application thread on CPU `to`. Threads beyond
+ * PLACEMENT_NTHREADS are not counted, and the threads that they create stay
+ * on the CPU of their parent.
+ */
+static void placement_track(struct uk_thread *t, int to, __u64 mask)
+{
+	int slot;
+
+	uk_spin_lock(&placement_lock);
+	slot = placement_slot(NULL);
+	if (slot >= 0) {
+		placement_threads[slot].t = t;
+		placement_threads[slot].mask = mask;
+		placement_threads[slot].cpu = to;
+		__atomic_add_fetch(&placement_load[to], 1, __ATOMIC_RELAXED);
+	}
+	uk_spin_unlock(&placement_lock);
+	if (unlikely(slot < 0))
+		uk_pr_warn("Too many application threads, thread %s is not tracked\n",
+			   t->name ? t->name : "<unnamed>");
+}
+
+/* Returns the affinity mask of a thread, the application's if it has none */
+static __u64 placement_thread_mask(struct uk_thread *t)
+{
+	__u64 mask = 0;
+	int slot;
+
+	uk_spin_lock(&placement_lock);
+	slot = placement_slot(t);
+	if (slot >= 0)
+		mask = placement_threads[slot].mask;
+	uk_spin_unlock(&placement_lock);
+	return mask ? mask : placement_mask;
+}
+
+/*
+ * Moves a thread that is not running to the scheduler of CPU `to`
+ */
+static void placement_move(struct uk_thread *t, int to)
+{
+	int from = placement_cpu_of(t->sched);
+	int slot;
+
+	if (from == to)
+		return;
+	/* Threads on other CPUs could be running at this moment */
+	if (from != placement_cpu_current())
+		return;
+
+	uk_sched_thread_remove(t);
+	uk_sched_thread_add(placement_scheds[to], t);
+
+	uk_spin_lock(&placement_lock);
+	slot = placement_slot(t);
+	if (slot >= 0) {
+		__atomic_sub_fetch(&placement_load[placement_threads[slot].cpu],
+				   1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&placement_load[to], 1, __ATOMIC_RELAXED);
+		placement_threads[slot].cpu = to;
+	}
+	uk_spin_unlock(&placement_lock);
+	uk_pr_debug("Thread %s moved to CPU %d\n",
+		    t->name ? t->name : "<unnamed>", to);
+}
+
+struct uk_sched *placement_sched(int idx)
+{
+	if (idx < 0 || (unsigned int)idx >= placement_ncpus)
+		return uk_sched_current();
+	return placement_scheds[idx];
+}
+
+struct uk_sched *placement_main(struct uk_thread *t, int req)
+{
+	int target = req;
+
+	if (unlikely(!placement_ncpus))
+		return uk_sched_current();
+#if CONFIG_LIBUKLIBPARAM
+	if (target < 0)
+		target = cpu;
+#endif /* CONFIG_LIBUKLIBPARAM */
+	if (target >= 0 && ((unsigned int)target >= placement_ncpus ||
+			    !(placement_mask & (1ULL << target)))) {
+		uk_pr_warn("CPU %d is not available for applications\n",
+			   target);
+		target = -1;
+	}
+	if (target < 0)
+		target = placement_pick(placement_mask,
+					placement_cpu_current());
+
+	placement_track(t, target, 0);
+	uk_pr_debug("Application main thread placed on CPU %d\n", target);
+	return placement_scheds[target];
+}
+
+__u64 placement_cpumask(void)
+{
+	return placement_mask ? placement_mask : 1ULL;
+}
+
+#if CONFIG_LIBPOSIX_PROCESS_CLONE
+/*
+ * posix-process adds a new thread to the scheduler of its parent. The
+ * parent is still running on this CPU, so the child did not run yet and
+ * can be moved. Like on Linux, it inherits the affinity of its parent.
+ */
+static int placement_clone(const struct clone_args *cl_args __unused,
+			   size_t cl_args_len __unused,
+			   struct uk_thread *child, struct uk_thread *parent)
+{
+	int from, target;
+	__u64 mask = 0;
+	int slot;
+
+	if (unlikely(!placement_ncpus))
+		return 0;
+
+	uk_spin_lock(&placement_lock);
+	slot = placement_slot(parent);
+	if (slot >= 0)
+		mask = placement_threads[slot].mask;
+	uk_spin_unlock(&placement_lock);
+	/* Only threads of applications are placed */
+	if (slot < 0)
+		return 0;
+
+	from = placement_cpu_of(child->sched);
+	if (unlikely(from < 0))
+		return 0;
+	placement_track(child, from, mask);
+	target = placement_pick(mask ? mask : placement_mask, from);
+	placement_move(child, target);
+	return 0;
+}
+UK_POSIX_CLONE_HANDLER(0x0, false, placement_clone, 0x0);
+#endif /* CONFIG_LIBPOSIX_PROCESS_CLONE */
+
+static void placement_thread_term(struct uk_thread *t)
+{
+	int slot;
+
+	uk_spin_lock(&placement_lock);
+	slot = placement_slot(t);
+	if (slot >= 0) {
+		__atomic_sub_fetch(&placement_load[placement_threads[slot].cpu],
+				   1, __ATOMIC_RELAXED);
+		placement_threads[slot].t = NULL;
+	}
+	uk_spin_unlock(&placement_lock);
+}
+UK_THREAD_INIT_PRIO(0x0, placement_thread_term, UK_PRIO_EARLIEST);
+
+long placement_affinity(long nr, const long args[6])
+{
+	long tid = args[0];
+	__sz len = (__sz)args[1];
+	void *umask = (void *)args[2];
+	struct uk_thread *t;
+	__u64 mask = 0;
+	int target;
+	int slot;
+
+	if (!tid) {
+		t = uk_thread_current();
+	} else {
+		t = tid2ukthread((pid_t)tid);
+		if (!t)
+			return -ESRCH;
+	}
+	if (unlikely(!umask))
+		return -EFAULT;
+
+	if (nr == SYS_sched_getaffinity) {
+		/* Like Linux, require space for all possible CPUs */
+		if (len < sizeof(mask) || (len & (sizeof(long) - 1)))
+			return -EINVAL;
+		mask = placement_thread_mask(t);
+		memcpy(umask, &mask, sizeof(mask));
+		return sizeof(mask);
+	}
+
+	memcpy(&mask, umask, MIN(len, sizeof(mask)));
+	mask &= placement_mask;
+	if (!mask)
+		return -EINVAL;
+
+	uk_spin_lock(&placement_lock);
+	slot = placement_slot(t);
+	if (slot >= 0)
+		placement_threads[slot].mask =
+			(mask == placement_mask) ? 0 : mask;
+	uk_spin_unlock(&placement_lock);
+
+	/*
+	 * The calling thread keeps running where it is, the mask applies to
+	 * the threads it creates afterwards
+	 */
+	if (t != uk_thread_current()) {
+		target = placement_cpu_of(t->sched);
+		if (target < 0 || !(mask & (1ULL << target)))
+			placement_move(t, placement_pick(mask, target));
+	}
+	return 0;
+}
+
+static int placement_init(struct uk_init_ctx *ictx __unused)
+{
+	struct uk_sched *s;
+	const char *policy = NULL;
+	__u64 mask = ~0ULL;
+
+	uk_sched_foreach(s) {
+		if (placement_ncpus == PLACEMENT_NCPUS)
+			break;
+		placement_scheds[placement_ncpus++] = s;
+	}
+	if (unlikely(!placement_ncpus))
+		return 0;
+
+#if CONFIG_APPELFLOADER_PLACEMENT_ROUNDROBIN
+	placement_policy = PLACEMENT_ROUNDROBIN;
+#elif CONFIG_APPELFLOADER_PLACEMENT_LEASTLOADED
+	placement_policy = PLACEMENT_LEASTLOADED;
+#else /* CONFIG_APPELFLOADER_PLACEMENT_INHERIT */
+	placement_policy = PLACEMENT_INHERIT;
+#endif /* CONFIG_APPELFLOADER_PLACEMENT_INHERIT */
+
+#if CONFIG_LIBUKLIBPARAM
+	if (cpu_mask)
+		mask = strtoull(cpu_mask, NULL, 16);
+	policy = cpu_policy;
+#endif /* CONFIG_LIBUKLIBPARAM */
+	if (policy) {
+		if (strcmp(policy, "inherit") == 0)
+			placement_policy = PLACEMENT_INHERIT;
+		else if (strcmp(policy, "rr") == 0)
+			placement_policy = PLACEMENT_ROUNDROBIN;
+		else if (strcmp(policy, "least") == 0)
+			placement_policy = PLACEMENT_LEASTLOADED;
+		else
+			uk_pr_warn("Unknown CPU placement policy '%s'\n",
+				   policy);
+	}
+
+	if (placement_ncpus < PLACEMENT_NCPUS)
+		mask &= (1ULL << placement_ncpus) - 1;
+	if (!mask) {
+		uk_pr_warn("CPU mask excludes all %u CPUs, using all\n",
+			   placement_ncpus);
+		mask = (placement_ncpus < PLACEMENT_NCPUS)
+		       ? (1ULL << placement_ncpus) - 1 : ~0ULL;
+	}
+	placement_mask = mask;
+
+	uk_pr_info("Application CPUs: mask 0x%llx of %u CPUs\n",
+		   (unsigned long long)placement_mask, placement_ncpus);
+	return 0;
+}
+uk_late_initcall_prio(placement_init, 0x0, PLACEMENT_INIT_PRIO);
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_PLACEMENT_H
+#define APPELFLOADER_PLACEMENT_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/prio.h>
+#include <uk/sched.h>
+#include <uk/syscall.h>
+
+/*
+ * CPU placement of application threads
+ *
+ * A CPU is one of the registered schedulers, numbered in registration order
+ * (one per logical CPU on SMP builds). The application may use the CPUs of
+ * the `appelfloader.cpu_mask` kernel parameter (hexadecimal, default: all).
+ * Main threads are placed on `appelfloader.cpu` or, if not given, by the
+ * policy (`appelfloader.cpu_policy`). Threads that the application creates
+ * are added to the scheduler of their parent by posix-process; a clone
+ * handler moves them according to the policy before they first run.
+ *
+ * Affinity requests are seen at the system call entries that are provided
+ * by elfloader (direct system calls, vDSO). The mask is remembered per
+ * thread and inherited by the threads it creates. `sched_setaffinity` moves
+ * a thread that is not running onto a CPU of the requested mask; running
+ * threads are never migrated.
+ */
+#define PLACEMENT_NCPUS		64
+
+/* Priority of the late initcall that sets up the CPU table */
+#define PLACEMENT_INIT_PRIO	UK_PRIO_EARLIEST
+
+#if CONFIG_APPELFLOADER_PLACEMENT
+/**
+ * Returns the scheduler of CPU `cpu`, the current one if `cpu` is negative
+ * or out of range
+ */
+struct uk_sched *placement_sched(int cpu);
+
+/**
+ * Selects the scheduler for the main thread of an application and accounts
+ * the thread to it
+ *
+ * @param t:
+ *   Main thread, not yet added to a scheduler
+ * @param cpu:
+ *   Requested CPU, negative for the default placement
+ */
+struct uk_sched *placement_main(struct uk_thread *t, int cpu);
+
+/**
+ * Returns the mask of CPUs that the application may use, known after the
+ * late initcalls of priority PLACEMENT_INIT_PRIO
+ */
+__u64 placement_cpumask(void);
+
+/**
+ * Implements `sched_setaffinity` and `sched_getaffinity`
+ */
+long placement_affinity(long nr, const long args[6]);
+
+/*
+ * System call hook for elf_syscall6(): Returns non-zero if it handled the
+ * system call and stored the result in `*ret`.
+ */
+static inline int placement_syscall_pre(long nr, const long args[6],
+					long *ret)
+{
+	switch (nr) {
+	case SYS_sched_setaffinity:
+	case SYS_sched_getaffinity:
+		*ret = placement_affinity(nr, args);
+		return 1;
+	default:
+		return 0;
+	}
+}
+#else /* !CONFIG_APPELFLOADER_PLACEMENT */
+#define placement_sched(cpu) uk_sched_current()
+#define placement_main(t, cpu) uk_sched_current()
+#define placement_cpumask() (1ULL)
+#define placement_syscall_pre(nr, args, ret) 0
+#endif /* !CONFIG_APPELFLOADER_PLACEMENT */
+
+#endif /* APPELFLOADER_PLACEMENT_H */
@@ -0,0 +1,440 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libelf.h>
+#include <uk/alloc.h>
+#include <uk/arch/limits.h>
+#include <uk/arch/time.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+#include <uk/process.h>
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/plat/console.h>
+#if CONFIG_LIBUKVMEM
+#include <uk/vmem.h>
+#endif /* CONFIG_LIBUKVMEM */
+
+#include "profile.h"
+
+#define PROFILE_DEPTH		32	/* frames per stack */
+#define PROFILE_SCAN		4096	/* words scanned per stack */
+#define PROFILE_PROBES		64	/* table slots tried per stack */
+#define PROFILE_NTEXT		4	/* executable segments per image */
+#define PROFILE_NSTACKS		CONFIG_APPELFLOADER_PROFILE_NSTACKS
+
+#define PROFILE_PREFIX		"profile: "
+#define PROFILE_PREFIX_LEN	(sizeof(PROFILE_PREFIX) - 1)
+
+struct profile_img {
+	const struct elf_prog *prog;
+	const char *name;
+	__sz ntext;
+	struct {
+		__uptr start;
+		__uptr end;
+	} text[PROFILE_NTEXT];
+};
+
+struct profile_proc {
+	int pid;
+	__uptr stack;
+	__uptr stack_end;
+	__sz nimg;
+	struct profile_img img[2];	/* program, interpreter */
+	struct profile_proc *next;
+};
+
+struct profile_stack {
+	__u64 count;			/* 0 if the slot is free */
+	int pid;
+	__u32 depth;
+	__uptr pc[PROFILE_DEPTH];	/* innermost frame first */
+};
+
+/* Serializes sampling, the process list and the output */
+static struct uk_mutex profile_lock = UK_MUTEX_INITIALIZER(profile_lock);
+static struct profile_proc *profile_procs;
+static struct profile_stack *profile_stacks;
+static __u64 profile_dropped;
+static int profile_fd = -1;
+
+static struct profile_proc *profile_find(int pid)
+{
+	struct profile_proc *p;
+
+	for (p = profile_procs; p; p = p->next)
+		if (p->pid == pid)
+			return p;
+	return NULL;
+}
+
+static const struct profile_img *profile_img_of(const struct profile_proc *p,
+						__uptr addr)
+{
+	__sz i, j;
+
+	for (i = 0; i < p->nimg; ++i)
+		for (j = 0; j < p->img[i].ntext; ++j)
+			if (addr >= p->img[i].text[j].start &&
+			    addr < p->img[i].text[j].end)
+				return &p->img[i];
+	return NULL;
+}
+
+/* Executable segments from the in-memory program headers */
+static void profile_img_init(struct profile_img *img,
+			     const struct elf_prog *prog)
+{
+	__uptr vabase = (__uptr)prog->vabase;
+	const Elf64_Phdr *phdr;
+	const char *name;
+	__sz i;
+
+	name = prog->path ? prog->path : prog->name;
+	img->name = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+	img->prog = prog;
+	img->ntext = 0;
+
+	if (prog->phdr.entsize != sizeof(*phdr) ||
+	    prog->phdr.off + prog->phdr.num * sizeof(*phdr) > prog->upperl) {
+		img->text[0].start = vabase;
+		img->text[0].end = vabase + prog->valen;
+		img->ntext = 1;
+		return;
+	}
+
+	phdr = (const Elf64_Phdr *)(vabase + prog->phdr.off);
+	for (i = 0; i < prog->phdr.num && img->ntext < PROFILE_NTEXT; ++i) {
+		if (phdr[i].p_type != PT_LOAD || !(phdr[i].p_flags & PF_X))
+			continue;
+		img->text[img->ntext].start = vabase + phdr[i].p_vaddr;
+		img->text[img->ntext].end = vabase + phdr[i].p_vaddr
+					    + phdr[i].p_memsz;
+		img->ntext++;
+	}
+}
+
+/* Upper bound for scanning the stack at `sp` */
+static __uptr profile_scan_end(const struct profile_proc *p, __uptr sp)
+{
+#if CONFIG_LIBUKVMEM
+	struct uk_vma *vma;
+#endif /* CONFIG_LIBUKVMEM */
+	__uptr end;
+
+	if (sp >= p->stack && sp < p->stack_end) {
+		end = p->stack_end;
+	} else {
+		/* Stack of a thread that the application created */
+#if CONFIG_LIBUKVMEM
+		vma = uk_vma_find(uk_vas_get_active(), sp);
+		end = vma ? vma->end : PAGE_ALIGN_UP(sp + 1);
+#else /* !CONFIG_LIBUKVMEM */
+		end = PAGE_ALIGN_UP(sp + 1);
+#endif /* !CONFIG_LIBUKVMEM */
+	}
+	return MIN(end, sp + PROFILE_SCAN * sizeof(__uptr));
+}
+
+static void profile_count(int pid, const __uptr *pc, __u32 depth)
+{
+	struct profile_stack *s;
+	__u64 h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	__u32 i;
+
+	h = (h ^ (__u64)pid) * 0x100000001b3ULL;
+	for (i = 0; i < depth; ++i)
+		h = (h ^ pc[i]) * 0x100000001b3ULL;
+
+	for (i = 0; i < PROFILE_PROBES; ++i) {
+		s = &profile_stacks[(h + i) % PROFILE_NSTACKS];
+		if (!s->count) {
+			s->pid = pid;
+			s->depth = depth;
+			memcpy(s->pc, pc, depth * sizeof(*pc));
+			s->count = 1;
+			return;
+		}
+		if (s->pid == pid && s->depth == depth &&
+		    !memcmp(s->pc, pc, depth * sizeof(*pc))) {
+			s->count++;
+			return;
+		}
+	}
+	profile_dropped++;
+}
+
+/*
+ * Words on the stack that point into executable segments are taken as
+ * return addresses. This needs neither frame pointers nor unwind tables,
+ * but stale return addresses and function pointers on the stack show up
+ * as additional frames.
+ */
+static void profile_sample(const struct profile_proc *p,
+			   const struct uk_thread *t)
+{
+	__uptr pc[PROFILE_DEPTH];
+	const __uptr *sp, *end;
+	__u32 depth = 0;
+
+	sp = (const __uptr *)ALIGN_UP(t->ctx.sp, sizeof(__uptr));
+	end = (const __uptr *)profile_scan_end(p, (__uptr)sp);
+	for (; sp < end && depth < PROFILE_DEPTH; ++sp)
+		if (profile_img_of(p, *sp))
+			pc[depth++] = *sp;
+	profile_count(p->pid, pc, depth);
+}
+
+static void profile_sampler(void *arg)
+{
+	struct uk_sched *s = (struct uk_sched *)arg;
+	struct profile_proc *p;
+	struct uk_thread *t;
+
+	for (;;) {
+		uk_sched_thread_sleep(ukarch_time_msec_to_nsec(
+				CONFIG_APPELFLOADER_PROFILE_INTERVAL));
+
+		uk_mutex_lock(&profile_lock);
+		if (profile_procs) {
+			uk_sched_foreach_thread(s, t) {
+				if (t == uk_thread_current())
+					continue;
+				p = profile_find((int)ukthread2pid(t));
+				if (p)
+					profile_sample(p, t);
+			}
+		}
+		uk_mutex_unlock(&profile_lock);
+	}
+}
+
+/* Function name of a return address, or image name and offset */
+static int profile_symbolize(const struct profile_proc *p, __uptr pc,
+			     char *buf, __sz len)
+{
+	const struct profile_img *img = profile_img_of(p, pc);
+	const struct elf_sym *sym = NULL;
+	__sz lo, hi, mid;
+	__uptr addr;
+
+	if (unlikely(!img))
+		return snprintf(buf, len, ";0x%lx", (unsigned long)pc);
+
+	/* The call instruction is right before the return address */
+	addr = pc - 1;
+	lo = 0;
+	hi = img->prog->syms.num;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (img->prog->syms.sym[mid].vastart <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0)
+		sym = &img->prog->syms.sym[lo - 1];
+	if (sym && (!sym->size || addr < sym->vastart + sym->size))
+		return snprintf(buf, len, ";%s", sym->name);
+	return snprintf(buf, len, ";%s+0x%lx", img->name,
+			(unsigned long)(addr - (__uptr)img->prog->vabase));
+}
+
+static void profile_out(const char *buf, __sz len)
+{
+	ssize_t rc;
+
+	if (profile_fd < 0) {
+		ukplat_coutk(buf, len);
+		return;
+	}
+
+	/* The console prefix is only needed to find lines on the console */
+	buf += PROFILE_PREFIX_LEN;
+	len -= PROFILE_PREFIX_LEN;
+	while (len) {
+		rc = write(profile_fd, buf, len);
+		if (unlikely(rc < 0)) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			uk_pr_err("profile: Failed to write samples: %s (%d)\n",
+				  strerror(errno), errno);
+			return;
+		}
+		len -= rc;
+		buf += rc;
+	}
+}
+
+/* Writes one folded stack: `prog[off-cpu];outer;...;inner <count>` */
+static void profile_write_stack(const struct profile_proc *p,
+				const struct profile_stack *s)
+{
+	char line[1024];
+	char frame[128];
+	__sz len;
+	__u32 i;
+	int flen;
+
+	len = (__sz)snprintf(line, sizeof(line), PROFILE_PREFIX "%s[off-cpu]",
+			     p->img[0].name);
+	for (i = s->depth; i-- > 0;) {
+		flen = profile_symbolize(p, s->pc[i], frame, sizeof(frame));
+		if (flen <= 0)
+			continue;
+		flen = MIN(flen, (int)sizeof(frame) - 1);
+		if (len + flen + 24 > sizeof(line))
+			break;
+		memcpy(line + len, frame, flen);
+		len += flen;
+	}
+	if (!s->depth) {
+		/* No return address into the program was found */
+		memcpy(line + len, ";[unknown]", 10);
+		len += 10;
+	}
+	len += (__sz)snprintf(line + len, sizeof(line) - len,
+			      " %"PRIu64"\n", s->count);
+	profile_out(line, MIN(len, sizeof(line) - 1));
+}
+
+/*
+ * Writes and clears the stacks of process `pid`, of all processes if `pid`
+ * is negative. Clearing slots breaks probe sequences of other stacks: they
+ * may get a second slot later on, which just results in a second line for
+ * the same stack.
+ */
+static void profile_flush(int pid)
+{
+	const struct profile_proc *p;
+	struct profile_stack *s;
+	__sz i;
+
+	for (i = 0; i < PROFILE_NSTACKS; ++i) {
+		s = &profile_stacks[i];
+		if (!s->count || (pid >= 0 && s->pid != pid))
+			continue;
+		p = profile_find(s->pid);
+		if (p)
+			profile_write_stack(p, s);
+		s->count = 0;
+	}
+}
+
+void profile_attach(int pid, const struct elf_prog *prog,
+		    void *stack, __sz stack_len)
+{
+	struct profile_proc *p;
+
+	if (unlikely(!profile_stacks))
+		return;
+
+	p = calloc(1, sizeof(*p));
+	if (unlikely(!p)) {
+		uk_pr_err("%s: Cannot profile: %s (%d)\n",
+			  prog->name, strerror(ENOMEM), ENOMEM);
+		return;
+	}
+	p->pid = pid;
+	p->stack = (__uptr)stack;
+	p->stack_end = (__uptr)stack + stack_len;
+	profile_img_init(&p->img[p->nimg++], prog);
+	if (prog->interp.prog)
+		profile_img_init(&p->img[p->nimg++], prog->interp.prog);
+
+	uk_mutex_lock(&profile_lock);
+	p->next = profile_procs;
+	profile_procs = p;
+	uk_mutex_unlock(&profile_lock);
+	uk_pr_info("%s: Sampling blocked (off-CPU) stacks every %u ms\n",
+		   prog->name,
+		   (unsigned int)CONFIG_APPELFLOADER_PROFILE_INTERVAL);
+}
+
+void profile_detach(int pid)
+{
+	struct profile_proc **prev, *p = NULL;
+
+	uk_mutex_lock(&profile_lock);
+	for (prev = &profile_procs; *prev; prev = &(*prev)->next) {
+		if ((*prev)->pid == pid) {
+			p = *prev;
+			break;
+		}
+	}
+	if (p) {
+		profile_flush(pid);
+		*prev = p->next;
+	}
+	uk_mutex_unlock(&profile_lock);
+	free(p);
+}
+
+void profile_dump(void)
+{
+	if (unlikely(!profile_stacks))
+		return;
+	uk_mutex_lock(&profile_lock);
+	profile_flush(-1);
+	uk_mutex_unlock(&profile_lock);
+}
+
+static int profile_init(struct uk_init_ctx *ictx __unused)
+{
+	const char *path = CONFIG_APPELFLOADER_PROFILE_PATH;
+	struct uk_thread *t;
+	struct uk_sched *s;
+
+	profile_stacks = uk_calloc(uk_alloc_get_default(), PROFILE_NSTACKS,
+				   sizeof(*profile_stacks));
+	if (unlikely(!profile_stacks)) {
+		uk_pr_err("profile: Failed to allocate table for %d stacks\n",
+			  PROFILE_NSTACKS);
+		return -ENOMEM;
+	}
+
+	if (path[0] != '\0') {
+		profile_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (unlikely(profile_fd < 0)) {
+			uk_pr_warn("profile: Failed to open %s: %s (%d), writing to console\n",
+				   path, strerror(errno), errno);
+		}
+	}
+
+	uk_sched_foreach(s) {
+		t = uk_sched_thread_create(s, profile_sampler, s, "profile");
+		if (unlikely(!t)) {
+			uk_pr_err("profile: Failed to create sampler thread\n");
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void profile_term(const struct uk_term_ctx *tctx __unused)
+{
+	profile_dump();
+	if (profile_dropped)
+		uk_pr_warn("profile: %"PRIu64" samples dropped, table full\n",
+			   profile_dropped);
+
+	if (profile_fd >= 0) {
+		close(profile_fd);
+		profile_fd = -1;
+	}
+}
+
+uk_late_initcall(profile_init, profile_term);
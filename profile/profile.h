@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_PROFILE_H
+#define APPELFLOADER_PROFILE_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+
+#include "../elf_prog.h"
+
+/*
+ * Off-CPU (blocked stack) profiler
+ *
+ * A sampler thread per CPU wakes up periodically and samples the application
+ * threads of its CPU that are not running: The saved stack of a thread is
+ * scanned for return addresses into the executable segments of the program
+ * and its interpreter. Identical stacks are counted in a table and written
+ * in the folded stack format (`prog;outer;...;inner <count>`) that flame
+ * graph tools take as input. Addresses are symbolized with the function
+ * symbols that elf_load_*() read from the ELF image.
+ *
+ * Because the sampler runs as a regular thread, it never sees a thread
+ * while it computes: The profile shows where threads block or wait, not
+ * where CPU time is spent. The root frame is tagged `[off-cpu]`.
+ *
+ * Output is appended to a file on the VFS or, prefixed with `profile: `,
+ * written to the kernel console: for a process when it exits, for all
+ * processes on shutdown or with profile_dump().
+ */
+
+#if CONFIG_APPELFLOADER_PROFILE
+/**
+ * Starts profiling a started application
+ *
+ * @param pid:
+ *   Process ID, see elf_exit_pid_current()
+ * @param prog:
+ *   Program; must stay valid until profile_detach()
+ * @param stack:
+ *   Lowest address of the stack of the main thread
+ * @param stack_len:
+ *   Length of the stack of the main thread
+ */
+void profile_attach(int pid, const struct elf_prog *prog,
+		    void *stack, __sz stack_len);
+
+/**
+ * Writes the samples of a terminated application and stops profiling it
+ */
+void profile_detach(int pid);
+
+/**
+ * Writes the samples taken so far and starts counting from zero
+ */
+void profile_dump(void);
+#else /* !CONFIG_APPELFLOADER_PROFILE */
+#define profile_attach(pid, prog, stack, stack_len) do {} while (0)
+#define profile_detach(pid) do { (void)(pid); } while (0)
+#define profile_dump() do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_PROFILE */
+
+#endif /* APPELFLOADER_PROFILE_H */
@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/errptr.h>
+#if CONFIG_LIBUKVMEM
+#include <uk/arch/limits.h>
+#include <uk/list.h>
+#include <uk/mutex.h>
+#include <uk/syscall.h>
+#include <uk/vmem.h>
+#endif /* CONFIG_LIBUKVMEM */
+
+#include "restart.h"
+
+#define FDS_BITS	(8 * sizeof(unsigned long))
+
+static inline int elf_restart_fd_isopen(int fd)
+{
+	return fcntl(fd, F_GETFD) >= 0;
+}
+
+#if CONFIG_LIBUKVMEM
+/* Restart state of the running application, protects its `maps` */
+static struct elf_restart *elf_restart_cur;
+static struct uk_mutex elf_restart_lock =
+	UK_MUTEX_INITIALIZER(elf_restart_lock);
+
+/*
+ * Removes [start, end) from the mappings of the application. A mapping may
+ * be split in two, so one free entry is required.
+ */
+static void elf_restart_maps_del(struct elf_restart *r,
+				 __uptr start, __uptr end)
+{
+	struct elf_restart_range *m;
+	__sz i = 0;
+
+	UK_ASSERT(r->nmaps < r->mapscap);
+
+	while (i < r->nmaps) {
+		m = &r->maps[i];
+		if (m->end <= start || m->start >= end) {
+			i++;
+			continue;
+		}
+		if (m->start < start && m->end > end) {
+			r->maps[r->nmaps].start = end;
+			r->maps[r->nmaps].end = m->end;
+			r->nmaps++;
+			m->end = start;
+			return;
+		}
+		if (m->start < start) {
+			m->end = start;
+			i++;
+		} else if (m->end > end) {
+			m->start = end;
+			i++;
+		} else {
+			*m = r->maps[--r->nmaps];
+		}
+	}
+}
+
+/* Adds [start, end), which may replace mappings (MAP_FIXED, mremap) */
+static void elf_restart_maps_add(struct elf_restart *r,
+				 __uptr start, __uptr end)
+{
+	elf_restart_maps_del(r, start, end);
+	r->maps[r->nmaps].start = start;
+	r->maps[r->nmaps].end = end;
+	r->nmaps++;
+}
+
+/* Ensures room for splitting a mapping and adding another one */
+static int elf_restart_maps_reserve(struct elf_restart *r)
+{
+	struct elf_restart_range *maps;
+	__sz cap;
+
+	if (r->nmaps + 2 <= r->mapscap)
+		return 0;
+
+	cap = MAX(r->mapscap * 2, (__sz)32);
+	maps = uk_realloc(uk_alloc_get_default(), r->maps,
+			  cap * sizeof(*maps));
+	if (unlikely(!maps))
+		return -ENOMEM;
+	r->maps = maps;
+	r->mapscap = cap;
+	return 0;
+}
+
+void elf_restart_syscall_post(long nr, const long args[6], long ret)
+{
+	struct elf_restart *r;
+
+	if (ret < 0 && ret > -4096)
+		return;
+	if (nr != SYS_mmap && nr != SYS_mremap && nr != SYS_munmap)
+		return;
+
+	uk_mutex_lock(&elf_restart_lock);
+	r = elf_restart_cur;
+	if (!r)
+		goto out;
+	if (unlikely(elf_restart_maps_reserve(r) < 0)) {
+		uk_pr_warn("Cannot track mappings for restarts\n");
+		goto out;
+	}
+
+	switch (nr) {
+	case SYS_mmap:
+		elf_restart_maps_add(r, (__uptr)ret,
+				     (__uptr)ret + PAGE_ALIGN_UP(args[1]));
+		break;
+	case SYS_mremap:
+		elf_restart_maps_del(r, (__uptr)args[0],
+				     (__uptr)args[0] + PAGE_ALIGN_UP(args[1]));
+		elf_restart_maps_add(r, (__uptr)ret,
+				     (__uptr)ret + PAGE_ALIGN_UP(args[2]));
+		break;
+	case SYS_munmap:
+		elf_restart_maps_del(r, (__uptr)args[0],
+				     (__uptr)args[0] + PAGE_ALIGN_UP(args[1]));
+		break;
+	}
+out:
+	uk_mutex_unlock(&elf_restart_lock);
+}
+
+static int elf_restart_save_vmas(struct elf_restart *r)
+{
+	struct uk_vas *vas = uk_vas_get_active();
+	struct uk_vma *vma;
+	__sz n = 0;
+
+	if (PTRISERR(vas))
+		return 0;
+
+	uk_list_for_each_entry(vma, &vas->vma_list, vma_list)
+		n++;
+	if (!n)
+		goto out;
+
+	r->ranges = uk_malloc(uk_alloc_get_default(), n * sizeof(*r->ranges));
+	if (unlikely(!r->ranges))
+		return -ENOMEM;
+
+	/* The list is sorted by address */
+	uk_list_for_each_entry(vma, &vas->vma_list, vma_list) {
+		if (r->nranges == n)
+			break;
+		r->ranges[r->nranges].start = vma->start;
+		r->ranges[r->nranges].end = vma->end;
+		r->nranges++;
+	}
+
+out:
+	uk_mutex_lock(&elf_restart_lock);
+	elf_restart_cur = r;
+	uk_mutex_unlock(&elf_restart_lock);
+	return 0;
+}
+
+/*
+ * Returns the first part of [start, end) that is not covered by a recorded
+ * range. Areas that were present before may have been split or merged by
+ * the application (e.g., with mprotect()), so areas are not compared as a
+ * whole.
+ */
+static int elf_restart_uncovered(const struct elf_restart *r,
+				 __uptr start, __uptr end,
+				 __uptr *ustart, __uptr *uend)
+{
+	__uptr cur = start;
+	__sz i;
+
+	for (i = 0; i < r->nranges && cur < end; ++i) {
+		if (r->ranges[i].end <= cur)
+			continue;
+		if (r->ranges[i].start >= end)
+			break;
+		if (r->ranges[i].start > cur) {
+			*ustart = cur;
+			*uend = r->ranges[i].start;
+			return 1;
+		}
+		cur = r->ranges[i].end;
+	}
+	if (cur < end) {
+		*ustart = cur;
+		*uend = end;
+		return 1;
+	}
+	return 0;
+}
+
+static void elf_restart_cleanup_vmas(struct elf_restart *r,
+				     const char *name)
+{
+	struct uk_vas *vas = uk_vas_get_active();
+	__uptr ustart, uend, cur;
+	__sz unmapped = 0;
+	__sz i;
+	int rc;
+
+	if (PTRISERR(vas))
+		return;
+
+	uk_mutex_lock(&elf_restart_lock);
+	for (i = 0; i < r->nmaps; ++i) {
+		cur = r->maps[i].start;
+		while (elf_restart_uncovered(r, cur, r->maps[i].end,
+					     &ustart, &uend)) {
+			uk_pr_debug("%s: Unmapping %p-%p\n", name,
+				    (void *)ustart, (void *)uend);
+			rc = uk_vma_unmap(vas, ustart, uend - ustart, 0);
+			if (unlikely(rc < 0))
+				uk_pr_err("%s: Failed to unmap %p-%p: %d\n",
+					  name, (void *)ustart, (void *)uend,
+					  rc);
+			else
+				unmapped += uend - ustart;
+			cur = uend;
+		}
+	}
+	r->nmaps = 0;
+	uk_mutex_unlock(&elf_restart_lock);
+
+	if (unmapped)
+		uk_pr_info("%s: Released %"__PRIsz" bytes of mappings\n",
+			   name, unmapped);
+}
+
+static void elf_restart_free_vmas(struct elf_restart *r)
+{
+	uk_mutex_lock(&elf_restart_lock);
+	if (elf_restart_cur == r)
+		elf_restart_cur = NULL;
+	uk_mutex_unlock(&elf_restart_lock);
+
+	if (r->maps)
+		uk_free(uk_alloc_get_default(), r->maps);
+	r->maps = NULL;
+	r->nmaps = 0;
+	r->mapscap = 0;
+}
+#else /* !CONFIG_LIBUKVMEM */
+#define elf_restart_save_vmas(r) ({ (void)(r); 0; })
+#define elf_restart_cleanup_vmas(r, name) do {} while (0)
+#define elf_restart_free_vmas(r) do {} while (0)
+#endif /* !CONFIG_LIBUKVMEM */
+
+int elf_restart_save(struct elf_restart *r)
+{
+	int fd;
+
+	UK_ASSERT(r);
+
+	memset(r, 0, sizeof(*r));
+	for (fd = 0; fd < ELF_RESTART_NFDS; ++fd)
+		if (elf_restart_fd_isopen(fd))
+			r->fds[fd / FDS_BITS] |= 1UL << (fd % FDS_BITS);
+	return elf_restart_save_vmas(r);
+}
+
+void elf_restart_cleanup(struct elf_restart *r, const char *name)
+{
+	unsigned int closed = 0;
+	int fd;
+
+	UK_ASSERT(r);
+
+	for (fd = 0; fd < ELF_RESTART_NFDS; ++fd) {
+		if (r->fds[fd / FDS_BITS] & (1UL << (fd % FDS_BITS)))
+			continue;
+		if (elf_restart_fd_isopen(fd) && close(fd) == 0)
+			closed++;
+	}
+	if (closed)
+		uk_pr_info("%s: Closed %u file descriptor(s)\n", name, closed);
+
+	elf_restart_cleanup_vmas(r, name);
+}
+
+void elf_restart_free(struct elf_restart *r)
+{
+	UK_ASSERT(r);
+
+	elf_restart_free_vmas(r);
+	if (r->ranges)
+		uk_free(uk_alloc_get_default(), r->ranges);
+	r->ranges = NULL;
+	r->nranges = 0;
+}
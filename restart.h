@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_RESTART_H
+#define APPELFLOADER_RESTART_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+
+/*
+ * Resources of an application that are released on restart
+ *
+ * elf_reset() only restores the writable segments of the program and its
+ * interpreter. Before the application starts for the first time, the
+ * launcher records the mapped address ranges and the open file descriptors.
+ * After the application terminated, the files it left open are closed and
+ * the memory it mapped itself (e.g., shared libraries loaded by the dynamic
+ * loader, thread stacks) is unmapped.
+ *
+ * Mappings of the application are tracked at the system call entries that
+ * are provided by elfloader (mmap, mremap, munmap), so that mappings which
+ * the kernel or its libraries create in the meantime are left alone.
+ * Mappings created with system calls that do not pass one of these entries
+ * are not released. Ranges that were mapped before the first start are
+ * never unmapped.
+ */
+
+/* File descriptors above this limit are not closed on restart */
+#define ELF_RESTART_NFDS	1024
+
+struct elf_restart_range {
+	__uptr start;
+	__uptr end;
+};
+
+struct elf_restart {
+	__sz nranges;
+	struct elf_restart_range *ranges;	/* sorted by address */
+	__sz nmaps;
+	__sz mapscap;
+	struct elf_restart_range *maps;		/* mapped by the application */
+	unsigned long fds[ELF_RESTART_NFDS / (8 * sizeof(unsigned long))];
+};
+
+/**
+ * Records the mapped address ranges and open file descriptors before the
+ * first start of the application
+ *
+ * @return:
+ *   0 on success, -ENOMEM if the address ranges cannot be recorded
+ */
+int elf_restart_save(struct elf_restart *r);
+
+/**
+ * Unmaps memory that the application mapped and closes file descriptors that
+ * were opened since elf_restart_save(). Call this after the application
+ * terminated.
+ *
+ * @param name:
+ *   Name of the application used for kernel messages
+ */
+void elf_restart_cleanup(struct elf_restart *r, const char *name);
+
+/**
+ * Releases the recorded state
+ */
+void elf_restart_free(struct elf_restart *r);
+
+#if CONFIG_APPELFLOADER_RESTART && CONFIG_LIBUKVMEM
+/**
+ * System call hook for elf_syscall6(): Tracks the mappings of the
+ * application after a system call completed
+ */
+void elf_restart_syscall_post(long nr, const long args[6], long ret);
+#else /* !(CONFIG_APPELFLOADER_RESTART && CONFIG_LIBUKVMEM) */
+#define elf_restart_syscall_post(nr, args, ret) do {} while (0)
+#endif /* !(CONFIG_APPELFLOADER_RESTART && CONFIG_LIBUKVMEM) */
+
+#endif /* APPELFLOADER_RESTART_H */
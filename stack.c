@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/errptr.h>
+#include <uk/arch/limits.h>
+#if CONFIG_LIBUKLIBPARAM
+#include <uk/libparam.h>
+#endif /* CONFIG_LIBUKLIBPARAM */
+#if CONFIG_APPELFLOADER_STACK_VMEM
+#include <uk/vmem.h>
+#endif /* CONFIG_APPELFLOADER_STACK_VMEM */
+
+#include "stack.h"
+
+#ifndef PAGES2BYTES
+#define PAGES2BYTES(x) ((x) << __PAGE_SHIFT)
+#endif
+
+#if CONFIG_LIBUKLIBPARAM
+static char *stack_size;
+
+UK_LIBPARAM_PARAM(stack_size, charp,
+		  "Application stack size in bytes, suffixes K, M, G");
+#endif /* CONFIG_LIBUKLIBPARAM */
+
+/*
+ * Parses `<n>[K|M|G]`, returns 0 on errors
+ */
+static __sz elf_stack_parse_size(const char *str)
+{
+	unsigned long long val;
+	char *end;
+
+	val = strtoull(str, &end, 0);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		val <<= 10;
+		/* fall through */
+	case 'M':
+	case 'm':
+		val <<= 10;
+		/* fall through */
+	case 'K':
+	case 'k':
+		val <<= 10;
+		++end;
+		break;
+	default:
+		break;
+	}
+	if (*end != '\0' || end == str)
+		return 0;
+	return (__sz)val;
+}
+
+__sz elf_stack_len(void)
+{
+	__sz len = PAGES2BYTES((__sz)CONFIG_APPELFLOADER_STACK_NBPAGES);
+
+#if CONFIG_LIBUKLIBPARAM
+	if (stack_size) {
+		__sz plen = elf_stack_parse_size(stack_size);
+
+		if (unlikely(plen < __PAGE_SIZE))
+			uk_pr_warn("Ignoring invalid stack size '%s'\n",
+				   stack_size);
+		else
+			len = PAGE_ALIGN_UP(plen);
+	}
+#endif /* CONFIG_LIBUKLIBPARAM */
+	return len;
+}
+
+#if CONFIG_APPELFLOADER_STACK_VMEM
+#define ELF_STACK_GUARD_LEN	__PAGE_SIZE
+
+struct elf_stack {
+	struct uk_alloc *a;
+	__vaddr_t vaddr;	/* start of the region, including guard */
+	__sz len;		/* length of the region, including guard */
+	uk_thread_dtor_t dtor;	/* destructor of the thread owning the stack */
+};
+
+static struct elf_stack *elf_stack_map(struct uk_vas *vas, struct uk_alloc *a,
+				       const char *name, __sz stack_len)
+{
+	struct elf_stack *s;
+	int rc;
+
+	s = uk_malloc(a, sizeof(*s));
+	if (unlikely(!s))
+		return NULL;
+	s->a = a;
+	s->len = stack_len + ELF_STACK_GUARD_LEN;
+	s->vaddr = __VADDR_ANY;
+
+	/* Reserve the range only, pages are populated on first access */
+	rc = uk_vma_map_anon(vas, &s->vaddr, s->len, PAGE_ATTR_PROT_RW, 0,
+			     "[stack]");
+	if (unlikely(rc)) {
+		uk_pr_err("%s: Failed to reserve %"__PRIsz" bytes for the stack: %d\n",
+			  name, s->len, rc);
+		goto err_free_s;
+	}
+
+	/* Overflows hit the guard and fault instead of corrupting memory */
+	rc = uk_vma_set_attr(vas, s->vaddr, ELF_STACK_GUARD_LEN,
+			     PAGE_ATTR_PROT_NONE, 0);
+	if (unlikely(rc)) {
+		uk_pr_err("%s: Failed to set up stack guard page: %d\n",
+			  name, rc);
+		goto err_unmap;
+	}
+	return s;
+
+err_unmap:
+	uk_vma_unmap(vas, s->vaddr, s->len, 0);
+err_free_s:
+	uk_free(a, s);
+	return NULL;
+}
+
+static void elf_stack_unmap(struct uk_vas *vas, struct elf_stack *s)
+{
+	int rc;
+
+	rc = uk_vma_unmap(vas, s->vaddr, s->len, 0);
+	if (unlikely(rc))
+		uk_pr_err("Failed to unmap stack at %p: %d\n",
+			  (void *)s->vaddr, rc);
+	uk_free(s->a, s);
+}
+
+static void elf_stack_thread_dtor(struct uk_thread *t)
+{
+	struct elf_stack *s = t->priv;
+	struct uk_vas *vas;
+
+	if (!s)
+		return;
+
+	if (s->dtor)
+		s->dtor(t);
+
+	vas = uk_vas_get_active();
+	UK_ASSERT(!PTRISERR(vas));
+	elf_stack_unmap(vas, s);
+	t->priv = NULL;
+}
+
+static struct uk_thread *elf_stack_thread_create_vmem(struct uk_alloc *a,
+						      const char *name,
+						      __sz stack_len,
+						      void **stack,
+						      uk_thread_dtor_t dtor)
+{
+	struct uk_thread *t;
+	struct elf_stack *s;
+	struct uk_vas *vas;
+
+	vas = uk_vas_get_active();
+	if (unlikely(PTRISERR(vas)))
+		return ERR2PTR(-ENOTSUP);
+
+	s = elf_stack_map(vas, a, name, stack_len);
+	if (unlikely(!s))
+		return NULL;
+	s->dtor = dtor;
+
+	t = uk_thread_create_container(a,
+				       NULL, 0,
+				       a, 0,
+				       a,
+				       false,
+				       name,
+				       s, elf_stack_thread_dtor);
+	if (unlikely(!t)) {
+		elf_stack_unmap(vas, s);
+		return NULL;
+	}
+
+	t->ctx.sp = (__uptr)s->vaddr + s->len;
+	if (stack)
+		*stack = (void *)(s->vaddr + ELF_STACK_GUARD_LEN);
+	uk_pr_debug("%s: Stack region at %p - %p, guard page at %p\n",
+		    name, (void *)(s->vaddr + ELF_STACK_GUARD_LEN),
+		    (void *)(s->vaddr + s->len), (void *)s->vaddr);
+	return t;
+}
+
+#endif /* CONFIG_APPELFLOADER_STACK_VMEM */
+
+struct uk_thread *elf_stack_thread_create(struct uk_alloc *a,
+					  const char *name, __sz stack_len,
+					  void **stack, uk_thread_dtor_t dtor)
+{
+	struct uk_thread *t;
+
+	UK_ASSERT(PAGE_ALIGNED(stack_len));
+
+#if CONFIG_APPELFLOADER_STACK_VMEM
+	t = elf_stack_thread_create_vmem(a, name, stack_len, stack, dtor);
+	if (PTR2ERR(t) != -ENOTSUP)
+		return t;
+	uk_pr_warn("%s: No virtual address space, allocating stack eagerly\n",
+		   name);
+#endif /* CONFIG_APPELFLOADER_STACK_VMEM */
+
+	t = uk_thread_create_container(a,
+				       a, stack_len,
+				       a, 0,
+				       a,
+				       false,
+				       name,
+				       NULL, dtor);
+	if (unlikely(!t))
+		return NULL;
+	if (stack)
+		*stack = t->_mem.stack;
+	return t;
+}
+
+void *elf_stack_alloc(struct uk_alloc *a, const char *name, __sz stack_len,
+		      void **stack)
+{
+	void *base;
+#if CONFIG_APPELFLOADER_STACK_VMEM
+	struct elf_stack *s;
+	struct uk_vas *vas;
+	void *top;
+#endif /* CONFIG_APPELFLOADER_STACK_VMEM */
+
+	UK_ASSERT(PAGE_ALIGNED(stack_len));
+
+#if CONFIG_APPELFLOADER_STACK_VMEM
+	vas = uk_vas_get_active();
+	if (!PTRISERR(vas)) {
+		s = elf_stack_map(vas, a, name, stack_len);
+		if (unlikely(!s))
+			return NULL;
+
+		/* Without a thread, the region is identified by its top */
+		UK_ASSERT(s->len == stack_len + ELF_STACK_GUARD_LEN);
+		top = (void *)(s->vaddr + s->len);
+		if (stack)
+			*stack = (void *)(s->vaddr + ELF_STACK_GUARD_LEN);
+		uk_free(s->a, s);
+		return top;
+	}
+	uk_pr_warn("%s: No virtual address space, allocating stack eagerly\n",
+		   name);
+#endif /* CONFIG_APPELFLOADER_STACK_VMEM */
+
+	base = uk_memalign(a, __PAGE_SIZE, stack_len);
+	if (unlikely(!base))
+		return NULL;
+	if (stack)
+		*stack = base;
+	return (void *)((__uptr)base + stack_len);
+}
+
+void elf_stack_free(struct uk_alloc *a, void *top, __sz stack_len)
+{
+#if CONFIG_APPELFLOADER_STACK_VMEM
+	struct uk_vas *vas;
+
+	vas = uk_vas_get_active();
+	if (!PTRISERR(vas)) {
+		uk_vma_unmap(vas,
+			     (__vaddr_t)top - stack_len - ELF_STACK_GUARD_LEN,
+			     stack_len + ELF_STACK_GUARD_LEN, 0);
+		return;
+	}
+#endif /* CONFIG_APPELFLOADER_STACK_VMEM */
+
+	uk_free(a, (void *)((__uptr)top - stack_len));
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_STACK_H
+#define APPELFLOADER_STACK_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/alloc.h>
+#include <uk/thread.h>
+
+/*
+ * Main stack of the application thread
+ *
+ * With APPELFLOADER_STACK_VMEM, the stack is a demand-zero region of the
+ * virtual address space with an inaccessible guard page below it. Physical
+ * memory is only allocated for pages that the application touches, so the
+ * stack size is the limit the stack can grow to (like RLIMIT_STACK on
+ * Linux). Otherwise, the stack is allocated eagerly with the thread.
+ */
+
+/**
+ * Returns the size of the application stack in bytes (page-aligned). The
+ * size is configured with APPELFLOADER_STACK_NBPAGES and can be overridden
+ * with the `appelfloader.stack_size=<n>[K|M|G]` kernel parameter.
+ */
+__sz elf_stack_len(void);
+
+/**
+ * Creates a thread container with an application stack of `stack_len`
+ * bytes. On return, `ctx.sp` of the thread points to the top of the stack.
+ * The stack is released together with the thread (uk_thread_release()).
+ *
+ * @param a:
+ *   Allocator for the thread and, without virtual memory support, the stack
+ * @param name:
+ *   Name of the thread
+ * @param stack_len:
+ *   Stack size in bytes, see elf_stack_len()
+ * @param stack:
+ *   Receives the lowest usable address of the stack (optional)
+ * @param dtor:
+ *   Destructor that is called when the thread is released (optional)
+ * @return:
+ *   Thread container, NULL on errors
+ */
+struct uk_thread *elf_stack_thread_create(struct uk_alloc *a,
+					  const char *name, __sz stack_len,
+					  void **stack, uk_thread_dtor_t dtor);
+
+/**
+ * Allocates an application stack of `stack_len` bytes without a thread, for
+ * running the application on an existing thread.
+ *
+ * @param a:
+ *   Allocator for bookkeeping and, without virtual memory support, the stack
+ * @param name:
+ *   Name of the application used for kernel messages
+ * @param stack_len:
+ *   Stack size in bytes, see elf_stack_len()
+ * @param stack:
+ *   Receives the lowest usable address of the stack (optional)
+ * @return:
+ *   Top of the stack, NULL on errors
+ */
+void *elf_stack_alloc(struct uk_alloc *a, const char *name, __sz stack_len,
+		      void **stack);
+
+/**
+ * Releases a stack that was allocated with elf_stack_alloc()
+ *
+ * @param a:
+ *   Allocator that was passed to elf_stack_alloc()
+ * @param top:
+ *   Top of the stack as returned by elf_stack_alloc()
+ * @param stack_len:
+ *   Stack size in bytes that was passed to elf_stack_alloc()
+ */
+void elf_stack_free(struct uk_alloc *a, void *top, __sz stack_len);
+
+#endif /* APPELFLOADER_STACK_H */
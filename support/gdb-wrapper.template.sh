@@ -10,17 +10,27 @@ gdb-add-symbols()
 {
 	local LOAD_ELF="$1"
 	local LOAD_ADDR="${2}"
-	local LOAD_TADDR=
-	local TEXT_OFFSET=
 
-	# Hacky way to figure out the .text offset
-	TEXT_OFFSET=$( readelf -S "${LOAD_ELF}" | grep '.text' | awk '{ print $5 }' )
+	# Generate GDB command; `-o` relocates all sections by the base address
+	printf 'add-symbol-file -readnow %s -o 0x%s' "${LOAD_ELF}" "${LOAD_ADDR}"
+}
 
-	# Compute offset of .text section with base address
-	LOAD_TADDR=$( printf 'obase=16;ibase=16;%s+%s\n' "${LOAD_ADDR^^}" "${TEXT_OFFSET^^}" | bc )
+# Generate GDB commands for loading the symbols of all images that are listed
+# with `loadmap: load` lines in a kernel console log (APPELFLOADER_LOADMAP).
+# Usage: gdb-add-loadmap "<console log>" "<root filesystem directory>" \
+#        > loadmap.gdb
+gdb-add-loadmap()
+{
+	local LOG="$1"
+	local ROOTFS="$2"
+	local LOAD_BASE=
+	local LOAD_PATH=
 
-	# Generate GDB command
-	printf 'add-symbol-file -readnow %s 0x%s' "${LOAD_ELF}" "${LOAD_TADDR}"
+	sed -n 's/^.*loadmap: load base=\(0x[0-9a-f]*\) .* path=\(.*\)$/\1 \2/p' "${LOG}" |
+	while read -r LOAD_BASE LOAD_PATH; do
+		printf 'add-symbol-file -readnow %s%s -o %s\n' \
+		       "${ROOTFS}" "${LOAD_PATH}" "${LOAD_BASE}"
+	done
 }
 
 # Connect to $GDBSRV and set up gdb
@@ -40,6 +50,12 @@ gdb-add-symbols()
 #       Debian's libc, you can install (`apt install glibc-source`) and
 #       extract the glibc sources under /usr/src/glibc.
 #         --eval-command="directory /usr/src/glibc/glibc-2.31"
+# HINT: With APPELFLOADER_LOADMAP, elfloader registers every loaded image with
+#       the GDB JIT interface: function symbols of the application and its
+#       dynamic loader are available as soon as they are loaded. For full
+#       debug information, generate the `add-symbol-file` commands from the
+#       `loadmap:` lines of a previous console log with `gdb-add-loadmap` and
+#       pass them with `--command=loadmap.gdb`.
 # NOTE: We additionally set useful breakpoints to catch every abnormal
 #       trap.
 exec gdb \
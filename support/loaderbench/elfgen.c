@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elfgen.h"
+
+#define ELFGEN_PAGE	4096UL
+#define ELFGEN_ALIGN(x)	(((x) + ELFGEN_PAGE - 1) & ~(ELFGEN_PAGE - 1))
+
+void *elfgen_image(const struct elfgen_params *p, size_t *len)
+{
+	size_t phnum, hdrlen, interplen, off, total;
+	Elf64_Ehdr *ehdr;
+	Elf64_Phdr *phdr;
+	unsigned int i;
+	char *img;
+
+	if (!p->nsegs || !p->segsz)
+		return NULL;
+
+	interplen = p->interp ? strlen(p->interp) + 1 : 0;
+	/* Header segment, PT_LOAD segments, notes, and interpreter */
+	phnum = 1 + p->nsegs + p->nnotes + (p->interp ? 1 : 0);
+	if (phnum >= PN_XNUM)
+		return NULL;
+
+	/* Headers and the interpreter path share the first page(s) */
+	hdrlen = sizeof(*ehdr) + phnum * sizeof(*phdr) + interplen;
+	off = ELFGEN_ALIGN(hdrlen);
+	total = off + p->nsegs * ELFGEN_ALIGN(p->segsz);
+
+	img = calloc(1, total);
+	if (!img)
+		return NULL;
+
+	ehdr = (Elf64_Ehdr *)img;
+	memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+	ehdr->e_ident[EI_CLASS]   = ELFCLASS64;
+	ehdr->e_ident[EI_DATA]    = ELFDATA2LSB;
+	ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr->e_ident[EI_OSABI]   = ELFOSABI_NONE;
+	ehdr->e_type      = ET_DYN;
+#if defined(__aarch64__)
+	ehdr->e_machine   = EM_AARCH64;
+#else
+	ehdr->e_machine   = EM_X86_64;
+#endif
+	ehdr->e_version   = EV_CURRENT;
+	ehdr->e_entry     = off;
+	ehdr->e_phoff     = sizeof(*ehdr);
+	ehdr->e_ehsize    = sizeof(*ehdr);
+	ehdr->e_phentsize = sizeof(*phdr);
+	ehdr->e_phnum     = (Elf64_Half)phnum;
+
+	phdr = (Elf64_Phdr *)(img + sizeof(*ehdr));
+	if (p->interp) {
+		phdr->p_type   = PT_INTERP;
+		phdr->p_flags  = PF_R;
+		phdr->p_offset = hdrlen - interplen;
+		phdr->p_vaddr  = phdr->p_offset;
+		phdr->p_paddr  = phdr->p_offset;
+		phdr->p_filesz = interplen;
+		phdr->p_memsz  = interplen;
+		phdr->p_align  = 1;
+		memcpy(img + phdr->p_offset, p->interp, interplen);
+		phdr++;
+	}
+
+	/* First segment: headers, read-only */
+	phdr->p_type   = PT_LOAD;
+	phdr->p_flags  = PF_R;
+	phdr->p_offset = 0;
+	phdr->p_filesz = off;
+	phdr->p_memsz  = off;
+	phdr->p_align  = ELFGEN_PAGE;
+	phdr++;
+
+	/* Remaining segments alternate between code and data */
+	for (i = 0; i < p->nsegs; ++i, ++phdr) {
+		phdr->p_type   = PT_LOAD;
+		phdr->p_flags  = (i % 2) ? (PF_R | PF_W) : (PF_R | PF_X);
+		phdr->p_offset = off;
+		phdr->p_vaddr  = off;
+		phdr->p_paddr  = off;
+		phdr->p_filesz = p->segsz;
+		phdr->p_memsz  = p->segsz;
+		phdr->p_align  = ELFGEN_PAGE;
+		memset(img + off, 0xc3 /* ret */, p->segsz);
+		off += ELFGEN_ALIGN(p->segsz);
+	}
+	/* BSS is appended to the last (data or code) segment */
+	phdr[-1].p_memsz += p->bss;
+	if (p->bss)
+		phdr[-1].p_flags |= PF_W;
+
+	for (i = 0; i < p->nnotes; ++i, ++phdr) {
+		phdr->p_type  = PT_NOTE;
+		phdr->p_flags = PF_R;
+		phdr->p_align = 4;
+	}
+
+	*len = total;
+	return img;
+}
+
+int elfgen_file(const struct elfgen_params *p, const char *path)
+{
+	size_t len, done;
+	ssize_t rc;
+	char *img;
+	int fd, ret = 0;
+
+	img = elfgen_image(p, &len);
+	if (!img)
+		return -EINVAL;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+	for (done = 0; done < len; done += (size_t)rc) {
+		rc = write(fd, img + done, len - done);
+		if (rc < 0) {
+			ret = -errno;
+			break;
+		}
+	}
+	close(fd);
+out:
+	free(img);
+	return ret;
+}
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_ELFGEN_H
+#define LOADERBENCH_ELFGEN_H
+
+#include <stddef.h>
+
+/*
+ * Generator for synthetic position-independent x86_64 ELF images. The
+ * images are never executed; they only need to be accepted by the loader.
+ */
+struct elfgen_params {
+	unsigned int nsegs;	/* number of PT_LOAD segments (>= 1) */
+	size_t segsz;		/* file size of each segment */
+	size_t bss;		/* extra zero-filled memory after last segment */
+	unsigned int nnotes;	/* additional PT_NOTE headers (phdr table) */
+	const char *interp;	/* PT_INTERP path, NULL for none */
+};
+
+/**
+ * Generates an image in memory
+ *
+ * @return
+ *   malloc'ed image, its size is returned with `len`; NULL on errors
+ */
+void *elfgen_image(const struct elfgen_params *p, size_t *len);
+
+/**
+ * Generates an image and writes it to a file
+ *
+ * @return
+ *   0 on success, a negative errno value otherwise
+ */
+int elfgen_file(const struct elfgen_params *p, const char *path);
+
+#endif /* LOADERBENCH_ELFGEN_H */
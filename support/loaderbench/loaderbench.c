@@ -0,0 +1,493 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Host-side microbenchmark for the ELF loading paths of elfloader
+ *
+ * elf_load.c, elf_ctx.c, and loadtime.c are built unmodified against the
+ * stand-in headers under shim/. Memory allocations go through a counting
+ * allocator, mmap()/munmap()/pread() of the loader are redirected to
+ * counting wrappers. Depending on CONFIG_LIBPOSIX_MMAP, the VFS path
+ * measures either the pread or the mmap variant of the loader. With
+ * CONFIG_APPELFLOADER_ELFZ, compressed images are accepted as well.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <uk/alloc.h>
+#include <uk/print.h>
+#include <uk/errptr.h>
+#include <uk/plat/time.h>
+#include <libelf.h>
+
+#include "elf_prog.h"
+#include "loadtime/loadtime.h"
+#include "hwcap.h"
+#include "elfgen.h"
+
+#if CONFIG_LIBPOSIX_MMAP
+#define LB_VFS_PATH	"mmap"
+#elif CONFIG_APPELFLOADER_ELFZ
+#define LB_VFS_PATH	"elfz"
+#else /* !CONFIG_LIBPOSIX_MMAP && !CONFIG_APPELFLOADER_ELFZ */
+#define LB_VFS_PATH	"pread"
+#endif /* !CONFIG_LIBPOSIX_MMAP && !CONFIG_APPELFLOADER_ELFZ */
+
+int loaderbench_klvl = KLVL_ERR;
+
+/*
+ * Counting stand-ins
+ */
+static struct uk_alloc lb_alloc;
+
+struct uk_alloc *uk_alloc_get_default(void)
+{
+	return &lb_alloc;
+}
+
+void *uk_malloc(struct uk_alloc *a, size_t size)
+{
+	a->nallocs++;
+	a->bytes += size;
+	return malloc(size);
+}
+
+void *uk_calloc(struct uk_alloc *a, size_t nmemb, size_t size)
+{
+	a->nallocs++;
+	a->bytes += nmemb * size;
+	return calloc(nmemb, size);
+}
+
+void *uk_memalign(struct uk_alloc *a, size_t align, size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, MAX(align, sizeof(void *)), size))
+		return NULL;
+	a->nallocs++;
+	a->bytes += size;
+	return ptr;
+}
+
+void uk_free(struct uk_alloc *a, void *ptr)
+{
+	if (ptr)
+		a->nfrees++;
+	free(ptr);
+}
+
+static struct {
+	uint64_t nmmap;
+	uint64_t mmap_bytes;
+	uint64_t nmunmap;
+	uint64_t npread;
+	uint64_t pread_bytes;
+} lb_io;
+
+void *lb_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	lb_io.nmmap++;
+	lb_io.mmap_bytes += len;
+	return mmap(addr, len, prot, flags, fd, off);
+}
+
+int lb_munmap(void *addr, size_t len)
+{
+	lb_io.nmunmap++;
+	return munmap(addr, len);
+}
+
+ssize_t lb_pread(int fd, void *buf, size_t count, off_t off)
+{
+	lb_io.npread++;
+	lb_io.pread_bytes += count;
+	return pread(fd, buf, count, off);
+}
+
+/* Reading the CPU features needs kernel privileges; report none */
+const struct elf_hwcap *elf_hwcap_get(void)
+{
+	static const struct elf_hwcap hw = { .minsigstksz = 2048 };
+
+	return &hw;
+}
+
+/*
+ * Measurements
+ */
+struct lb_result {
+	unsigned int iters;
+	__nsec total;
+	__nsec min;
+	__nsec phases[LOADTIME_NPHASES];
+	uint64_t nallocs;
+	uint64_t bytes;
+	uint64_t nmmap;
+	uint64_t npread;
+};
+
+static bool lb_csv;
+
+static void lb_begin(void)
+{
+	memset(&lb_alloc, 0, sizeof(lb_alloc));
+	memset(&lb_io, 0, sizeof(lb_io));
+	loadtime_reset();
+}
+
+static void lb_end(struct lb_result *r, __nsec dt)
+{
+	unsigned int p;
+
+	r->iters++;
+	r->total += dt;
+	if (!r->min || dt < r->min)
+		r->min = dt;
+	r->nallocs += lb_alloc.nallocs;
+	r->bytes   += lb_alloc.bytes;
+	r->nmmap   += lb_io.nmmap;
+	r->npread  += lb_io.npread;
+	for (p = 0; p < LOADTIME_NPHASES; ++p)
+		r->phases[p] += loadtime_get(p, NULL);
+}
+
+static void lb_print_header(void)
+{
+	unsigned int p;
+
+	if (lb_csv) {
+		printf("scenario,path,iters,mean_ns,min_ns,allocs,alloc_bytes,mmaps,preads");
+		for (p = 0; p < LOADTIME_NPHASES; ++p)
+			printf(",%s_ns", loadtime_name(p));
+		printf("\n");
+		return;
+	}
+	printf("%-10s %-6s %6s %12s %12s %7s %10s %6s %6s  %s\n",
+	       "scenario", "path", "iters", "mean[us]", "min[us]",
+	       "allocs", "alloc[kB]", "mmaps", "preads", "phases[us]");
+}
+
+static void lb_print(const char *scenario, const char *path,
+		     const struct lb_result *r)
+{
+	unsigned int n = r->iters ? r->iters : 1;
+	unsigned int p;
+
+	if (lb_csv) {
+		printf("%s,%s,%u,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64,
+		       scenario, path, r->iters, r->total / n, r->min,
+		       r->nallocs / n, r->bytes / n, r->nmmap / n,
+		       r->npread / n);
+		for (p = 0; p < LOADTIME_NPHASES; ++p)
+			printf(",%"PRIu64, r->phases[p] / n);
+		printf("\n");
+		return;
+	}
+	printf("%-10s %-6s %6u %12.3f %12.3f %7"PRIu64" %10"PRIu64" %6"PRIu64" %6"PRIu64" ",
+	       scenario, path, r->iters,
+	       (double)r->total / n / 1000., (double)r->min / 1000.,
+	       r->nallocs / n, r->bytes / n / 1024, r->nmmap / n,
+	       r->npread / n);
+	for (p = 0; p < LOADTIME_NPHASES; ++p)
+		if (r->phases[p])
+			printf(" %s=%.3f", loadtime_name(p),
+			       (double)r->phases[p] / n / 1000.);
+	printf("\n");
+}
+
+static int lb_img(const char *scenario, void *img, size_t len,
+		  unsigned int iters)
+{
+	struct lb_result r = { 0 };
+	struct elf_prog *prog;
+	unsigned int i;
+	__nsec t;
+
+	for (i = 0; i < iters; ++i) {
+		lb_begin();
+		t = ukplat_monotonic_clock();
+		prog = elf_load_img(uk_alloc_get_default(), img, len, scenario);
+		t = ukplat_monotonic_clock() - t;
+		if (PTRISERR(prog) || !prog) {
+			fprintf(stderr, "%s: elf_load_img() failed: %d\n",
+				scenario, PTR2ERR(prog));
+			return -1;
+		}
+		lb_end(&r, t);
+		elf_unload(prog);
+	}
+	lb_print(scenario, "img", &r);
+	return 0;
+}
+
+static int lb_gen(const char *scenario, const struct elfgen_params *gp,
+		  unsigned int iters)
+{
+	void *img;
+	size_t len;
+	int ret;
+
+	img = elfgen_image(gp, &len);
+	if (!img)
+		return -ENOMEM;
+	ret = lb_img(scenario, img, len, iters);
+	free(img);
+	return ret;
+}
+
+static int lb_vfs(const char *scenario, const char *file, unsigned int iters)
+{
+	struct lb_result r = { 0 };
+	struct elf_prog *prog;
+	unsigned int i;
+	__nsec t;
+
+	for (i = 0; i < iters; ++i) {
+		lb_begin();
+		t = ukplat_monotonic_clock();
+		prog = elf_load_vfs(uk_alloc_get_default(), file, scenario);
+		t = ukplat_monotonic_clock() - t;
+		if (PTRISERR(prog) || !prog) {
+			fprintf(stderr, "%s: elf_load_vfs() failed: %d\n",
+				scenario, PTR2ERR(prog));
+			return -1;
+		}
+		lb_end(&r, t);
+		elf_unload(prog);
+	}
+	lb_print(scenario, LB_VFS_PATH, &r);
+	return 0;
+}
+
+/* Loads a given (static) executable, e.g., a compressed image */
+static int lb_file(const char *file, unsigned int iters)
+{
+	const char *scenario;
+	size_t len = 0;
+	char *img = NULL;
+	FILE *f;
+	int ret = -1;
+
+	scenario = strrchr(file, '/');
+	scenario = scenario ? scenario + 1 : file;
+
+	f = fopen(file, "rb");
+	if (!f || fseek(f, 0, SEEK_END) < 0 || (long)(len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) < 0 || !(img = malloc(len)) ||
+	    fread(img, 1, len, f) != len) {
+		perror(file);
+		goto out;
+	}
+	ret = lb_img(scenario, img, len, iters);
+	if (ret == 0)
+		ret = lb_vfs(scenario, file, iters);
+out:
+	free(img);
+	if (f)
+		fclose(f);
+	return ret;
+}
+
+static char **lb_strvec(unsigned int n, size_t len, char c)
+{
+	char **v;
+	unsigned int i;
+
+	v = calloc(n + 1, sizeof(*v));
+	if (!v)
+		return NULL;
+	for (i = 0; i < n; ++i) {
+		v[i] = malloc(len + 1);
+		if (!v[i])
+			return NULL; /* leaked on purpose, we exit anyways */
+		memset(v[i], c, len);
+		v[i][len] = '\0';
+	}
+	return v;
+}
+
+static int lb_ctx(const char *scenario, unsigned int argc, unsigned int envc,
+		  size_t len, unsigned int iters)
+{
+	const struct elfgen_params gp = { .nsegs = 2, .segsz = 4096 };
+	const size_t stacklen = 16UL << 20;
+	struct lb_result r = { 0 };
+	uint64_t rand[2] = { 0xB0B0, 0xF00D };
+	struct ukarch_ctx ctx;
+	struct elf_prog *prog;
+	char **argv, **envp;
+	unsigned int i;
+	size_t imglen;
+	void *stack;
+	void *img;
+	__nsec t;
+
+	img = elfgen_image(&gp, &imglen);
+	argv = lb_strvec(argc, len, 'a');
+	envp = lb_strvec(envc, len, 'e');
+	stack = malloc(stacklen);
+	if (!img || !argv || !envp || !stack)
+		return -ENOMEM;
+	prog = elf_load_img(uk_alloc_get_default(), img, imglen, scenario);
+	if (PTRISERR(prog) || !prog)
+		return -1;
+
+	for (i = 0; i < iters; ++i) {
+		lb_begin();
+		ctx.sp = (__uptr)stack + stacklen;
+		t = ukplat_monotonic_clock();
+		if (elf_ctx_init(&ctx, prog, scenario, (int)argc, argv, envp,
+				 rand, stacklen) < 0)
+			return -1;
+		t = ukplat_monotonic_clock() - t;
+		r.phases[LOADTIME_CTXINIT] += t;
+		lb_end(&r, t);
+	}
+	lb_print(scenario, "ctx", &r);
+
+	elf_unload(prog);
+	free(stack);
+	free(img);
+	return 0;
+}
+
+static void lb_usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-c] [-s <scale>] [-v] [-f <file>]...\n"
+		"  -c          Print CSV instead of a table\n"
+		"  -f <file>   Measure loading <file> (static executable) instead\n"
+		"              of the synthetic images\n"
+		"  -s <scale>  Multiply iteration counts by <scale> (default: 1)\n"
+		"  -v          Print loader warnings and errors\n",
+		argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		struct elfgen_params p;
+		unsigned int iters;
+	} scen[] = {
+		{ "small",   { .nsegs = 2,   .segsz = 64 << 10 },  200 },
+		{ "manyseg", { .nsegs = 256, .segsz = 4096 },      100 },
+		{ "hugebss", { .nsegs = 2,   .segsz = 64 << 10,
+			       .bss = 256 << 20 },                 10 },
+		{ "bigphdr", { .nsegs = 2,   .segsz = 64 << 10,
+			       .nnotes = 8192 },                   100 },
+	};
+	const struct elfgen_params interp = { .nsegs = 2, .segsz = 64 << 10 };
+	char dir[] = "/tmp/loaderbench.XXXXXX";
+	char file[PATH_MAX];
+	char *ipath = NULL;
+	const char *files[16];
+	unsigned int nfiles = 0;
+	unsigned int scale = 1;
+	unsigned int i;
+	size_t plen;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "cf:s:vh")) != -1) {
+		switch (opt) {
+		case 'c':
+			lb_csv = true;
+			break;
+		case 'f':
+			if (nfiles == ARRAY_SIZE(files)) {
+				fprintf(stderr, "Too many files\n");
+				return 1;
+			}
+			files[nfiles++] = optarg;
+			break;
+		case 's':
+			scale = (unsigned int)strtoul(optarg, NULL, 10);
+			if (!scale)
+				scale = 1;
+			break;
+		case 'v':
+			loaderbench_klvl = KLVL_WARN;
+			break;
+		default:
+			lb_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		fprintf(stderr, "Failed to initialize libelf\n");
+		return 1;
+	}
+
+	if (nfiles) {
+		lb_print_header();
+		for (i = 0; i < nfiles; ++i)
+			if (lb_file(files[i], 100 * scale))
+				return 1;
+		return 0;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	lb_print_header();
+	for (i = 0; i < ARRAY_SIZE(scen); ++i) {
+		snprintf(file, sizeof(file), "%s/%s", dir, scen[i].name);
+		if (elfgen_file(&scen[i].p, file) < 0)
+			goto out;
+		if (lb_gen(scen[i].name, &scen[i].p, scen[i].iters * scale))
+			goto out;
+		if (lb_vfs(scen[i].name, file, scen[i].iters * scale))
+			goto out;
+		unlink(file);
+	}
+
+	/* Long PT_INTERP path: "<dir>/././././.../ld.so" */
+	snprintf(file, sizeof(file), "%s/ld.so", dir);
+	if (elfgen_file(&interp, file) < 0)
+		goto out;
+	ipath = malloc(PATH_MAX);
+	if (!ipath)
+		goto out;
+	plen = (size_t)snprintf(ipath, PATH_MAX, "%s/", dir);
+	while (plen + 2 + sizeof("ld.so") < PATH_MAX) {
+		memcpy(&ipath[plen], "./", 2);
+		plen += 2;
+	}
+	strcpy(&ipath[plen], "ld.so");
+	{
+		struct elfgen_params p = interp;
+
+		p.interp = ipath;
+		snprintf(file, sizeof(file), "%s/dynamic", dir);
+		if (elfgen_file(&p, file) < 0)
+			goto out;
+		if (lb_vfs("interp", file, 100 * scale))
+			goto out;
+		unlink(file);
+	}
+	snprintf(file, sizeof(file), "%s/ld.so", dir);
+	unlink(file);
+
+	if (lb_ctx("ctx-small", 4, 16, 32, 1000 * scale))
+		goto out;
+	if (lb_ctx("ctx-huge", 16384, 16384, 128, 10 * scale))
+		goto out;
+	ret = 0;
+out:
+	free(ipath);
+	rmdir(dir);
+	return ret;
+}
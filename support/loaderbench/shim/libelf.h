@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Maps the elftoolchain-specific interfaces that are used by elfloader to
+ * the host libelf (elfutils).
+ */
+#ifndef LOADERBENCH_LIBELF_H
+#define LOADERBENCH_LIBELF_H
+
+#include_next <libelf.h>
+
+static inline Elf *elf_open(int fd)
+{
+	return elf_begin(fd, ELF_C_READ, NULL);
+}
+
+/* elftoolchain's deprecated elf_getphnum() returns non-zero on success */
+#define elf_getphnum(elf, dst)	(elf_getphdrnum((elf), (dst)) == 0)
+
+#endif /* LOADERBENCH_LIBELF_H */
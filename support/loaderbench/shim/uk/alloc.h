@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ALLOC_H
+#define LOADERBENCH_UK_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Counting allocator: Forwards to the host libc and keeps track of the
+ * number of allocations and the allocated bytes.
+ */
+struct uk_alloc {
+	uint64_t nallocs;
+	uint64_t nfrees;
+	uint64_t bytes;
+};
+
+struct uk_alloc *uk_alloc_get_default(void);
+void *uk_malloc(struct uk_alloc *a, size_t size);
+void *uk_calloc(struct uk_alloc *a, size_t nmemb, size_t size);
+void *uk_memalign(struct uk_alloc *a, size_t align, size_t size);
+void uk_free(struct uk_alloc *a, void *ptr);
+
+#endif /* LOADERBENCH_UK_ALLOC_H */
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ARCH_CTX_H
+#define LOADERBENCH_UK_ARCH_CTX_H
+
+#include <uk/essentials.h>
+
+#define UKARCH_SP_ALIGN		16
+
+struct ukarch_ctx {
+	__uptr ip;
+	__uptr sp;
+};
+
+#define ukarch_rctx_stackpush_packed(ctx, value)			\
+	do {								\
+		(ctx)->sp -= sizeof(value);				\
+		*((__typeof__(value) *)(ctx)->sp) = (value);		\
+	} while (0)
+
+static inline void ukarch_ctx_init(struct ukarch_ctx *ctx, __uptr sp,
+				   int keep_regs __unused, __uptr ip)
+{
+	ctx->sp = sp;
+	ctx->ip = ip;
+}
+
+#endif /* LOADERBENCH_UK_ARCH_CTX_H */
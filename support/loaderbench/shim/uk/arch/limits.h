@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ARCH_LIMITS_H
+#define LOADERBENCH_UK_ARCH_LIMITS_H
+
+#include <uk/essentials.h>
+
+#define __PAGE_SHIFT		12
+#ifndef PAGE_SHIFT
+#define PAGE_SHIFT		__PAGE_SHIFT
+#endif
+#ifndef PAGE_SIZE
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+#endif
+#define PAGE_ALIGN_UP(v)	ALIGN_UP((__uptr)(v), PAGE_SIZE)
+#define PAGE_ALIGN_DOWN(v)	ALIGN_DOWN((__uptr)(v), PAGE_SIZE)
+#define PAGE_ALIGNED(v)		IS_ALIGNED((__uptr)(v), PAGE_SIZE)
+#define CACHE_LINE_SIZE		64
+
+#endif /* LOADERBENCH_UK_ARCH_LIMITS_H */
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ARCH_TYPES_H
+#define LOADERBENCH_UK_ARCH_TYPES_H
+
+/* Host stand-in: The fixed-size types are defined with the essentials */
+#include <uk/essentials.h>
+
+#endif /* LOADERBENCH_UK_ARCH_TYPES_H */
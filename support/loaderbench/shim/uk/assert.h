@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ASSERT_H
+#define LOADERBENCH_UK_ASSERT_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define UK_ASSERT(x)		assert(x)
+#define UK_BUGON(x)		assert(!(x))
+#define UK_CRASH(fmt, ...)						\
+	do {								\
+		fprintf(stderr, "CRASH: " fmt "\n", ##__VA_ARGS__);	\
+		abort();						\
+	} while (0)
+
+#endif /* LOADERBENCH_UK_ASSERT_H */
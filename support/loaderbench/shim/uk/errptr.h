@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ERRPTR_H
+#define LOADERBENCH_UK_ERRPTR_H
+
+#include <stdint.h>
+
+#define ERR2PTR(e)	((void *)(intptr_t)(e))
+#define PTR2ERR(p)	((int)(intptr_t)(p))
+#define PTRISERR(p)	((uintptr_t)(p) >= (uintptr_t)-4095)
+
+#endif /* LOADERBENCH_UK_ERRPTR_H */
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_ESSENTIALS_H
+#define LOADERBENCH_UK_ESSENTIALS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t   __u8;
+typedef uint16_t  __u16;
+typedef uint32_t  __u32;
+typedef uint64_t  __u64;
+typedef int16_t   __s16;
+typedef int32_t   __s32;
+typedef int64_t   __s64;
+typedef size_t    __sz;
+typedef ptrdiff_t __ssz;
+typedef uintptr_t __uptr;
+typedef uint64_t  __nsec;
+typedef uint64_t  __paddr_t;
+typedef uint64_t  __vaddr_t;
+typedef int       __lcpuid;
+
+#define __PRIsz		"zu"
+
+#define __unused		__attribute__((unused))
+#define __maybe_unused		__attribute__((unused))
+#define __used			__attribute__((used))
+#define __noreturn		__attribute__((noreturn))
+#define __packed		__attribute__((packed))
+#define __align(a)		__attribute__((aligned(a)))
+#define __constructor		__attribute__((constructor))
+#define __printf(f, a)		__attribute__((format(printf, f, a)))
+#define likely(x)		(__builtin_expect(!!(x), 1))
+#define unlikely(x)		(__builtin_expect(!!(x), 0))
+
+#ifndef MIN
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b)		((a) > (b) ? (a) : (b))
+#endif
+#define ARRAY_SIZE(x)		(sizeof(x) / sizeof((x)[0]))
+#define ALIGN_UP(v, a)		(((v) + (a) - 1) & ~((a) - 1))
+#define ALIGN_DOWN(v, a)	((v) & ~((a) - 1))
+#define IS_ALIGNED(v, a)	(((v) & ((a) - 1)) == 0)
+
+#endif /* LOADERBENCH_UK_ESSENTIALS_H */
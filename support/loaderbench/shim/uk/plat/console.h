@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_PLAT_CONSOLE_H
+#define LOADERBENCH_UK_PLAT_CONSOLE_H
+
+#include <stdio.h>
+
+static inline int ukplat_coutk(const char *buf, unsigned int len)
+{
+	return (int)fwrite(buf, 1, len, stderr);
+}
+
+#endif /* LOADERBENCH_UK_PLAT_CONSOLE_H */
@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_PLAT_TIME_H
+#define LOADERBENCH_UK_PLAT_TIME_H
+
+#include <time.h>
+#include <uk/essentials.h>
+
+static inline __nsec ukplat_monotonic_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__nsec)ts.tv_sec * 1000000000ULL + (__nsec)ts.tv_nsec;
+}
+
+#endif /* LOADERBENCH_UK_PLAT_TIME_H */
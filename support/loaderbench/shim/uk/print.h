@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef LOADERBENCH_UK_PRINT_H
+#define LOADERBENCH_UK_PRINT_H
+
+#include <stdio.h>
+
+#define KLVL_CRIT	0
+#define KLVL_ERR	1
+#define KLVL_WARN	2
+#define KLVL_INFO	3
+
+/* Messages at or below this level are printed to stderr */
+extern int loaderbench_klvl;
+
+#define uk_printk(lvl, fmt, ...)					\
+	do {								\
+		if ((lvl) <= loaderbench_klvl)				\
+			fprintf(stderr, fmt, ##__VA_ARGS__);		\
+	} while (0)
+
+#define uk_pr_crit(fmt, ...)	uk_printk(KLVL_CRIT, fmt, ##__VA_ARGS__)
+#define uk_pr_err(fmt, ...)	uk_printk(KLVL_ERR,  fmt, ##__VA_ARGS__)
+#define uk_pr_warn(fmt, ...)	uk_printk(KLVL_WARN, fmt, ##__VA_ARGS__)
+#define uk_pr_info(fmt, ...)	uk_printk(KLVL_INFO, fmt, ##__VA_ARGS__)
+#define uk_pr_debug(fmt, ...)	do {} while (0)
+
+#endif /* LOADERBENCH_UK_PRINT_H */
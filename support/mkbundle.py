@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Creates an elfloader bundle (APPELFLOADER_BUNDLE) from a dynamically-linked
+# executable: The program, its program interpreter and all shared libraries
+# that it needs (DT_NEEDED, recursively) are stored with the paths under which
+# the interpreter looks them up, so that they can be loaded without a
+# filesystem. The content of each file starts on a page boundary.
+#
+# Usage: mkbundle.py [--root <dir>] [-L <dir>]... [--add <path>]...
+#                    [--page-size <bytes>] <program> <output>
+#
+# Paths are absolute paths within the root directory (default: /). Libraries
+# that are opened with dlopen() have to be added with --add.
+
+import argparse
+import os
+import posixpath
+import stat
+import struct
+import sys
+
+MAGIC = b'UKBUNDLE'
+VERSION = 1
+HDR = struct.Struct('<8sIIIIQ')
+ENT = struct.Struct('<QQII')
+
+PT_LOAD = 1
+PT_DYNAMIC = 2
+PT_INTERP = 3
+DT_NULL = 0
+DT_NEEDED = 1
+DT_STRTAB = 5
+DT_RPATH = 15
+DT_RUNPATH = 29
+
+LIBDIRS = ['/lib/x86_64-linux-gnu', '/usr/lib/x86_64-linux-gnu',
+           '/lib64', '/usr/lib64', '/lib', '/usr/lib', '/usr/local/lib']
+
+
+def align(n, a):
+    return (n + a - 1) // a * a
+
+
+class Root:
+    """Resolves absolute paths within a root directory"""
+
+    def __init__(self, root):
+        self.root = root
+
+    def host(self, path):
+        parts = [p for p in path.split('/') if p]
+        out = []
+        links = 0
+        while parts:
+            c = parts.pop(0)
+            if c == '.':
+                continue
+            if c == '..':
+                if out:
+                    out.pop()
+                continue
+            h = os.path.join(self.root, *out, c)
+            if os.path.islink(h):
+                links += 1
+                if links > 40:
+                    raise OSError('%s: Too many levels of symbolic links' %
+                                  path)
+                target = os.readlink(h)
+                if target.startswith('/'):
+                    out = []
+                parts = [p for p in target.split('/') if p] + parts
+                continue
+            out.append(c)
+        return os.path.join(self.root, *out)
+
+    def isfile(self, path):
+        return os.path.isfile(self.host(path))
+
+
+class Elf:
+    def __init__(self, path, data):
+        if data[:4] != b'\x7fELF' or data[4] != 2 or data[5] != 1:
+            raise ValueError('%s: Not a little-endian ELF64 file' % path)
+        self.data = data
+        phoff, = struct.unpack_from('<Q', data, 0x20)
+        phentsize, phnum = struct.unpack_from('<HH', data, 0x36)
+        self.phdrs = [struct.unpack_from('<IIQQQQQQ', data,
+                                         phoff + i * phentsize)
+                      for i in range(phnum)]
+
+    def segment(self, ptype):
+        for p in self.phdrs:
+            if p[0] == ptype:
+                return p
+        return None
+
+    def interp(self):
+        p = self.segment(PT_INTERP)
+        if not p:
+            return None
+        return self.data[p[2]:p[2] + p[5]].split(b'\0')[0].decode()
+
+    def offset(self, vaddr):
+        for p in self.phdrs:
+            if p[0] == PT_LOAD and p[3] <= vaddr < p[3] + p[5]:
+                return vaddr - p[3] + p[2]
+        raise ValueError('Address 0x%x is not in a file segment' % vaddr)
+
+    def dynamic(self):
+        """Returns (needed, rpath, runpath)"""
+        p = self.segment(PT_DYNAMIC)
+        if not p:
+            return [], [], []
+        tags = []
+        for off in range(p[2], p[2] + p[5], 16):
+            tag, val = struct.unpack_from('<qQ', self.data, off)
+            if tag == DT_NULL:
+                break
+            tags.append((tag, val))
+        strtab = self.offset(dict(tags)[DT_STRTAB])
+
+        def string(val):
+            end = self.data.index(b'\0', strtab + val)
+            return self.data[strtab + val:end].decode()
+
+        needed = [string(v) for t, v in tags if t == DT_NEEDED]
+        rpath = [string(v) for t, v in tags if t == DT_RPATH]
+        runpath = [string(v) for t, v in tags if t == DT_RUNPATH]
+        return needed, rpath, runpath
+
+
+def search_dirs(paths, origin):
+    return [d.replace('$ORIGIN', origin).replace('${ORIGIN}', origin)
+            for p in paths for d in p.split(':') if d]
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument('--root', default='/')
+    p.add_argument('-L', dest='libdirs', action='append', default=[],
+                   help='library directory in LD_LIBRARY_PATH of the program')
+    p.add_argument('--add', action='append', default=[],
+                   help='additional file (e.g., a library loaded by dlopen)')
+    p.add_argument('--page-size', type=int, default=4096)
+    p.add_argument('program')
+    p.add_argument('output')
+    args = p.parse_args()
+
+    root = Root(args.root)
+    files = []      # (guest path, host path)
+    seen = set()
+
+    def add(path):
+        path = posixpath.normpath(path)
+        if path in seen:
+            return None
+        seen.add(path)
+        host = root.host(path)
+        files.append((path, host))
+        return host
+
+    queue = [args.program] + args.add
+    for path in queue:
+        host = add(path)
+        if host is None:
+            continue
+        with open(host, 'rb') as f:
+            data = f.read()
+        if data[:4] != b'\x7fELF':
+            continue
+        elf = Elf(path, data)
+        interp = elf.interp()
+        if interp:
+            queue.append(interp)
+        needed, rpath, runpath = elf.dynamic()
+        origin = posixpath.dirname(path)
+        dirs = (search_dirs(rpath if not runpath else [], origin) +
+                args.libdirs + search_dirs(runpath, origin) + LIBDIRS)
+        for name in needed:
+            if '/' in name:
+                queue.append(name)
+                continue
+            for d in dirs:
+                if root.isfile(posixpath.join(d, name)):
+                    queue.append(posixpath.join(d, name))
+                    break
+            else:
+                print('%s: %s not found' % (path, name), file=sys.stderr)
+                sys.exit(1)
+
+    # Header, entry table, and path strings; then the page-aligned content
+    strs = b''
+    paths = []
+    for path, _ in files:
+        paths.append(len(strs))
+        strs += path.encode() + b'\0'
+    entoff = HDR.size
+    stroff = entoff + ENT.size * len(files)
+    pos = align(stroff + len(strs), args.page_size)
+
+    ents = []
+    blobs = []
+    content = {}    # real host path -> (offset, length)
+    for (path, host), pathoff in zip(files, paths):
+        real = os.path.realpath(host)
+        if real not in content:
+            with open(real, 'rb') as f:
+                data = f.read()
+            content[real] = (pos, len(data))
+            blobs.append((pos, data))
+            pos = align(pos + len(data), args.page_size)
+        off, length = content[real]
+        mode = stat.S_IMODE(os.stat(real).st_mode)
+        ents.append(ENT.pack(off, length, pathoff, mode))
+        print('%s -> %s (0x%x, %u B)' % (path, real, off, length))
+
+    with open(args.output, 'wb') as out:
+        out.write(HDR.pack(MAGIC, VERSION, len(files), entoff, stroff, pos))
+        out.write(b''.join(ents))
+        out.write(strs)
+        for off, data in blobs:
+            out.write(b'\0' * (off - out.tell()))
+            out.write(data)
+        out.write(b'\0' * (pos - out.tell()))
+    print('%s: %u files, %u B' % (args.output, len(files), pos))
+
+
+if __name__ == '__main__':
+    main()
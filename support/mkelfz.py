@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Creates a compressed ELF image for elfloader (APPELFLOADER_ELFZ): A skeleton
+# ELF with the headers, the path of the program interpreter and the symbol
+# table of the program, followed by the whole program file as LZ4 frame with
+# independent 64 KiB blocks. The loader parses the skeleton and decompresses
+# the loadable segments block by block straight into memory.
+#
+# Usage: mkelfz.py [--no-symbols] <program> <output>
+#
+# The Python module `lz4` is used for compression if it is installed,
+# otherwise a built-in (slower, less effective) compressor.
+
+import argparse
+import struct
+import sys
+
+MAGIC = b'UKELFZ\0\0'
+VERSION = 1
+CODEC_LZ4 = 1
+HDR = struct.Struct('<8sIIQQQQQ')
+
+PT_INTERP = 3
+SHT_SYMTAB = 2
+SHT_STRTAB = 3
+SHT_DYNSYM = 11
+SHDR = struct.Struct('<IIQQQQIIQQ')
+
+LZ4F_MAGIC = 0x184D2204
+LZ4F_FLG = 0x60             # version 01, independent blocks
+LZ4F_BD = 0x40              # 64 KiB blocks
+BLOCKSIZE = 64 << 10
+
+
+def align(n, a):
+    return (n + a - 1) // a * a
+
+
+def skeleton(data, symbols=True):
+    """Returns the skeleton ELF of a program"""
+    if data[:4] != b'\x7fELF' or data[4] != 2 or data[5] != 1:
+        raise ValueError('Not a little-endian ELF64 file')
+    phoff, shoff = struct.unpack_from('<QQ', data, 0x20)
+    phentsize, phnum, shentsize, shnum, shstrndx = \
+        struct.unpack_from('<HHHHH', data, 0x36)
+
+    skel = bytearray(data[:phoff + phnum * phentsize])
+    for i in range(phnum):
+        off = phoff + i * phentsize
+        ptype, = struct.unpack_from('<I', skel, off)
+        if ptype != PT_INTERP:
+            continue
+        ioff, = struct.unpack_from('<Q', skel, off + 8)
+        ilen, = struct.unpack_from('<Q', skel, off + 32)
+        struct.pack_into('<Q', skel, off + 8, len(skel))
+        skel += data[ioff:ioff + ilen]
+
+    shdrs = [SHDR.unpack_from(data, shoff + i * shentsize)
+             for i in range(shnum)] if shoff else []
+    sym = None
+    if symbols:
+        for t in (SHT_SYMTAB, SHT_DYNSYM):
+            sym = next((s for s in shdrs if s[1] == t), None)
+            if sym:
+                break
+    # Without symbols, the skeleton has no section headers
+    struct.pack_into('<Q', skel, 0x28, 0)
+    struct.pack_into('<HHH', skel, 0x3a, SHDR.size, 0, 0)
+    if not sym:
+        return bytes(skel)
+
+    names = (b'.symtab', b'.strtab') if sym[1] == SHT_SYMTAB \
+        else (b'.dynsym', b'.dynstr')
+    shstrtab = b'\0' + names[0] + b'\0' + names[1] + b'\0.shstrtab\0'
+    str_ = shdrs[sym[6]]
+    out = []
+    for s, name in ((sym, 1), (str_, 2 + len(names[0]))):
+        skel += b'\0' * (align(len(skel), 8) - len(skel))
+        out.append((name, s, len(skel)))
+        skel += data[s[4]:s[4] + s[5]]
+    shstroff = len(skel)
+    skel += shstrtab
+    skel += b'\0' * (align(len(skel), 8) - len(skel))
+
+    e_shoff = len(skel)
+    skel += SHDR.pack(*[0] * 10)
+    (symname, s, off), (strname, t, toff) = out
+    skel += SHDR.pack(symname, s[1], 0, 0, off, s[5], 2, s[7], 8, s[9])
+    skel += SHDR.pack(strname, SHT_STRTAB, 0, 0, toff, t[5], 0, 0, 1, 0)
+    skel += SHDR.pack(len(shstrtab) - len(b'.shstrtab\0'), SHT_STRTAB,
+                      0, 0, shstroff, len(shstrtab), 0, 0, 1, 0)
+    struct.pack_into('<Q', skel, 0x28, e_shoff)
+    struct.pack_into('<HHH', skel, 0x3a, SHDR.size, 4, 3)
+    return bytes(skel)
+
+
+def xxh32(data, seed=0):
+    """XXH32 of up to 15 bytes (LZ4 frame descriptor checksum)"""
+    P1, P2, P3, P4, P5 = (2654435761, 2246822519, 3266489917, 668265263,
+                          374761393)
+    M = 0xffffffff
+
+    def rotl(x, r):
+        return ((x << r) | (x >> (32 - r))) & M
+
+    assert len(data) < 16
+    h = (seed + P5 + len(data)) & M
+    i = 0
+    while i + 4 <= len(data):
+        v, = struct.unpack_from('<I', data, i)
+        h = rotl((h + v * P3) & M, 17) * P4 & M
+        i += 4
+    for b in data[i:]:
+        h = rotl((h + b * P5) & M, 11) * P1 & M
+    h ^= h >> 15
+    h = h * P2 & M
+    h ^= h >> 13
+    h = h * P3 & M
+    h ^= h >> 16
+    return h
+
+
+def lz4_block(src):
+    """Greedy LZ4 block compression"""
+    n = len(src)
+    out = bytearray()
+    table = {}
+    anchor = i = 0
+
+    def length(v):
+        while v >= 255:
+            out.append(255)
+            v -= 255
+        out.append(v)
+
+    def sequence(lit, off=0, mlen=0):
+        ml = mlen - 4
+        out.append(min(len(lit), 15) << 4 | (min(ml, 15) if off else 0))
+        if len(lit) >= 15:
+            length(len(lit) - 15)
+        out.extend(lit)
+        if off:
+            out.extend(struct.pack('<H', off))
+            if ml >= 15:
+                length(ml - 15)
+
+    # The last match starts 12 B before the end at the latest, the last
+    # 5 B are literals
+    while i < n - 12:
+        seq = src[i:i + 4]
+        ref = table.get(seq)
+        table[seq] = i
+        if ref is None or i - ref > 0xffff:
+            i += 1
+            continue
+        m = 4
+        mmax = n - 5 - i
+        while m + 32 <= mmax and src[ref + m:ref + m + 32] == \
+                src[i + m:i + m + 32]:
+            m += 32
+        while m < mmax and src[ref + m] == src[i + m]:
+            m += 1
+        sequence(src[anchor:i], i - ref, m)
+        i += m
+        anchor = i
+    sequence(src[anchor:])
+    return bytes(out)
+
+
+def lz4_frame(data):
+    try:
+        import lz4.frame
+        return lz4.frame.compress(data,
+                                  block_size=lz4.frame.BLOCKSIZE_MAX64KB,
+                                  block_linked=False)
+    except ImportError:
+        pass
+
+    desc = bytes([LZ4F_FLG, LZ4F_BD])
+    out = bytearray(struct.pack('<I', LZ4F_MAGIC) + desc)
+    out.append(xxh32(desc) >> 8 & 0xff)
+    for off in range(0, len(data), BLOCKSIZE):
+        raw = data[off:off + BLOCKSIZE]
+        blk = lz4_block(raw)
+        if len(blk) < len(raw):
+            out += struct.pack('<I', len(blk)) + blk
+        else:
+            out += struct.pack('<I', len(raw) | 0x80000000) + raw
+    out += struct.pack('<I', 0)
+    return bytes(out)
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument('--no-symbols', action='store_true',
+                   help='omit the symbol table from the skeleton')
+    p.add_argument('program')
+    p.add_argument('output')
+    args = p.parse_args()
+
+    with open(args.program, 'rb') as f:
+        data = f.read()
+    try:
+        skel = skeleton(data, not args.no_symbols)
+    except ValueError as e:
+        print('%s: %s' % (args.program, e), file=sys.stderr)
+        sys.exit(1)
+    z = lz4_frame(data)
+
+    skeloff = align(HDR.size, 8)
+    zoff = align(skeloff + len(skel), 8)
+    with open(args.output, 'wb') as out:
+        out.write(HDR.pack(MAGIC, VERSION, CODEC_LZ4, len(data),
+                           skeloff, len(skel), zoff, len(z)))
+        out.write(b'\0' * (skeloff - out.tell()))
+        out.write(skel)
+        out.write(b'\0' * (zoff - out.tell()))
+        out.write(z)
+    print('%s: %u B -> %u B (skeleton %u B, LZ4 %u B)' %
+          (args.output, len(data), zoff + len(z), len(skel), len(z)))
+
+
+if __name__ == '__main__':
+    main()
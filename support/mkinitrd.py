@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Creates a cpio initrd (new ASCII format) from a root filesystem directory.
+# The content of ELF files starts on a page boundary within the archive, so
+# that elfloader (APPELFLOADER_CPIOEXEC) can map their read-only segments in
+# place instead of copying them. Alignment is achieved by small filler files
+# in /.cpio-pad that are extracted like any other file.
+#
+# Usage: mkinitrd.py [--page-size <bytes>] <rootfs directory> <output.cpio>
+
+import argparse
+import os
+import stat
+import sys
+
+HDR_LEN = 110
+PAD_DIR = '.cpio-pad'
+ELF_MAGIC = b'\x7fELF'
+
+
+def align4(n):
+    return (n + 3) & ~3
+
+
+class Writer:
+    def __init__(self, out):
+        self.out = out
+        self.pos = 0
+        self.ino = 1
+        self.npad = 0
+
+    def entry(self, name, mode, data=b'', mtime=0):
+        name = name.encode() + b'\0'
+        hdr = '070701' + ''.join('%08x' % v for v in (
+            self.ino, mode, 0, 0, 2 if stat.S_ISDIR(mode) else 1, mtime,
+            len(data), 0, 0, 0, 0, len(name), 0))
+        self.ino += 1
+        buf = hdr.encode() + name
+        buf += b'\0' * (align4(HDR_LEN + len(name)) - len(buf))
+        buf += data + b'\0' * (align4(len(data)) - len(data))
+        self.out.write(buf)
+        self.pos += len(buf)
+
+    def align_data(self, name, page):
+        """Pads so that the data of the entry `name` starts page-aligned"""
+        hdrlen = align4(HDR_LEN + len(name.encode()) + 1)
+        gap = (-(self.pos + hdrlen)) % page
+        if gap == 0:
+            return
+        padname = '%s/%u' % (PAD_DIR, self.npad)
+        padhdr = align4(HDR_LEN + len(padname) + 1)
+        while gap < padhdr:
+            gap += page
+        self.npad += 1
+        self.entry(padname, stat.S_IFREG | 0o444, b'\0' * (gap - padhdr))
+
+
+def is_elf(path):
+    with open(path, 'rb') as f:
+        return f.read(4) == ELF_MAGIC
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument('--page-size', type=int, default=4096)
+    p.add_argument('rootfs')
+    p.add_argument('output')
+    args = p.parse_args()
+
+    with open(args.output, 'wb') as out:
+        w = Writer(out)
+        w.entry(PAD_DIR, stat.S_IFDIR | 0o755)
+        nelf = 0
+        for top, dirs, files in os.walk(args.rootfs):
+            dirs.sort()
+            for name in sorted(dirs) + sorted(files):
+                path = os.path.join(top, name)
+                rel = os.path.relpath(path, args.rootfs)
+                st = os.lstat(path)
+                if stat.S_ISDIR(st.st_mode):
+                    w.entry(rel, st.st_mode, mtime=int(st.st_mtime))
+                elif stat.S_ISLNK(st.st_mode):
+                    w.entry(rel, st.st_mode, os.readlink(path).encode(),
+                            int(st.st_mtime))
+                elif stat.S_ISREG(st.st_mode):
+                    if is_elf(path):
+                        w.align_data(rel, args.page_size)
+                        nelf += 1
+                    with open(path, 'rb') as f:
+                        w.entry(rel, st.st_mode, f.read(), int(st.st_mtime))
+                else:
+                    print('%s: Skipping special file' % rel, file=sys.stderr)
+        w.entry('TRAILER!!!', 0)
+        out.write(b'\0' * ((-w.pos) % 512))
+
+    print('%s: %u B, %u ELF files page-aligned with %u filler files' %
+          (args.output, w.pos, nelf, w.npad))
+
+
+if __name__ == '__main__':
+    main()
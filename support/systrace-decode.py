@@ -0,0 +1,251 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Decodes the binary system call trace of elfloader (APPELFLOADER_SYSTRACE)
+# into strace-like text. The input is either the trace file or a console log
+# containing `systrace: <hex>` lines. Arguments of common system calls are
+# rendered like strace does (file descriptors, paths, flags), all others as
+# hexadecimal numbers.
+#
+# Usage: systrace-decode.py [--unistd <unistd_64.h>] [--raw] <trace|console.log>
+
+import argparse
+import errno
+import os
+import re
+import struct
+import sys
+
+MAGIC = b'UKSYSTR1'
+HDR = struct.Struct('<8sII')
+REC = struct.Struct('<HHI6QqQQ48s')
+
+AT_FDCWD = -100
+
+
+def flags(val, table, zero='0'):
+    if not val:
+        return zero
+    out = []
+    for bits, name in table:
+        if val & bits == bits:
+            out.append(name)
+            val &= ~bits
+    if val:
+        out.append(hex(val))
+    return '|'.join(out)
+
+
+O_ACCMODE = ['O_RDONLY', 'O_WRONLY', 'O_RDWR', '0x3']
+O_FLAGS = [
+    (0o4010000, 'O_SYNC'), (0o100, 'O_CREAT'), (0o200, 'O_EXCL'), (0o400, 'O_NOCTTY'),
+    (0o1000, 'O_TRUNC'), (0o2000, 'O_APPEND'), (0o4000, 'O_NONBLOCK'),
+    (0o10000, 'O_DSYNC'), (0o40000, 'O_DIRECT'), (0o200000, 'O_DIRECTORY'),
+    (0o400000, 'O_NOFOLLOW'), (0o1000000, 'O_NOATIME'),
+    (0o2000000, 'O_CLOEXEC'), (0o10000000, 'O_PATH'),
+]
+PROT = [(0x1, 'PROT_READ'), (0x2, 'PROT_WRITE'), (0x4, 'PROT_EXEC')]
+MAP = [
+    (0x01, 'MAP_SHARED'), (0x02, 'MAP_PRIVATE'), (0x10, 'MAP_FIXED'),
+    (0x20, 'MAP_ANONYMOUS'), (0x100, 'MAP_GROWSDOWN'),
+    (0x4000, 'MAP_NORESERVE'), (0x8000, 'MAP_POPULATE'),
+    (0x100000, 'MAP_FIXED_NOREPLACE'),
+]
+AT = [
+    (0x100, 'AT_SYMLINK_NOFOLLOW'), (0x200, 'AT_REMOVEDIR'),
+    (0x400, 'AT_SYMLINK_FOLLOW'), (0x800, 'AT_NO_AUTOMOUNT'),
+    (0x1000, 'AT_EMPTY_PATH'),
+]
+WHENCE = ['SEEK_SET', 'SEEK_CUR', 'SEEK_END', 'SEEK_DATA', 'SEEK_HOLE']
+
+
+def s64(val):
+    return val - (1 << 64) if val & (1 << 63) else val
+
+
+def fmt_fd(val, rec):
+    return str(s64(val))
+
+
+def fmt_dirfd(val, rec):
+    return 'AT_FDCWD' if s64(val) == AT_FDCWD else str(s64(val))
+
+
+def fmt_path(val, rec):
+    if not val:
+        return 'NULL'
+    path = rec[12].split(b'\0', 1)
+    text = path[0].decode('utf-8', 'backslashreplace')
+    text = '"{}"'.format(text.replace('\\', '\\\\').replace('"', '\\"'))
+    return text if len(path) > 1 else text + '...'
+
+
+def fmt_oflags(val, rec):
+    if val & ~0o3:
+        return O_ACCMODE[val & 0o3] + '|' + flags(val & ~0o3, O_FLAGS)
+    return O_ACCMODE[val & 0o3]
+
+
+def fmt_mode(val, rec):
+    return '0{:02o}'.format(val)
+
+
+def fmt_prot(val, rec):
+    return flags(val, PROT, 'PROT_NONE')
+
+
+def fmt_map(val, rec):
+    return flags(val, MAP)
+
+
+def fmt_at(val, rec):
+    return flags(val, AT)
+
+
+def fmt_whence(val, rec):
+    return WHENCE[val] if val < len(WHENCE) else str(val)
+
+
+def fmt_int(val, rec):
+    return str(s64(val))
+
+
+def fmt_hex(val, rec):
+    return 'NULL' if not val else hex(val)
+
+
+# Argument formatters of common system calls, by name
+FORMATS = {
+    'read': (fmt_fd, fmt_hex, fmt_int),
+    'write': (fmt_fd, fmt_hex, fmt_int),
+    'pread64': (fmt_fd, fmt_hex, fmt_int, fmt_int),
+    'pwrite64': (fmt_fd, fmt_hex, fmt_int, fmt_int),
+    'readv': (fmt_fd, fmt_hex, fmt_int),
+    'writev': (fmt_fd, fmt_hex, fmt_int),
+    'open': (fmt_path, fmt_oflags, fmt_mode),
+    'creat': (fmt_path, fmt_mode),
+    'openat': (fmt_dirfd, fmt_path, fmt_oflags, fmt_mode),
+    'close': (fmt_fd,),
+    'stat': (fmt_path, fmt_hex),
+    'lstat': (fmt_path, fmt_hex),
+    'fstat': (fmt_fd, fmt_hex),
+    'newfstatat': (fmt_dirfd, fmt_path, fmt_hex, fmt_at),
+    'statx': (fmt_dirfd, fmt_path, fmt_at, fmt_hex, fmt_hex),
+    'access': (fmt_path, fmt_mode),
+    'faccessat': (fmt_dirfd, fmt_path, fmt_mode),
+    'readlink': (fmt_path, fmt_hex, fmt_int),
+    'readlinkat': (fmt_dirfd, fmt_path, fmt_hex, fmt_int),
+    'mkdir': (fmt_path, fmt_mode),
+    'mkdirat': (fmt_dirfd, fmt_path, fmt_mode),
+    'rmdir': (fmt_path,),
+    'unlink': (fmt_path,),
+    'unlinkat': (fmt_dirfd, fmt_path, fmt_at),
+    'rename': (fmt_path, fmt_hex),
+    'renameat': (fmt_dirfd, fmt_path, fmt_dirfd, fmt_hex),
+    'chdir': (fmt_path,),
+    'chmod': (fmt_path, fmt_mode),
+    'truncate': (fmt_path, fmt_int),
+    'statfs': (fmt_path, fmt_hex),
+    'execve': (fmt_path, fmt_hex, fmt_hex),
+    'lseek': (fmt_fd, fmt_int, fmt_whence),
+    'dup': (fmt_fd,),
+    'dup2': (fmt_fd, fmt_fd),
+    'dup3': (fmt_fd, fmt_fd, fmt_oflags),
+    'fcntl': (fmt_fd, fmt_int, fmt_hex),
+    'ioctl': (fmt_fd, fmt_hex, fmt_hex),
+    'mmap': (fmt_hex, fmt_int, fmt_prot, fmt_map, fmt_fd, fmt_int),
+    'mprotect': (fmt_hex, fmt_int, fmt_prot),
+    'munmap': (fmt_hex, fmt_int),
+    'brk': (fmt_hex,),
+    'exit': (fmt_int,),
+    'exit_group': (fmt_int,),
+}
+
+UNISTD_PATHS = [
+    '/usr/include/x86_64-linux-gnu/asm/unistd_64.h',
+    '/usr/include/asm/unistd_64.h',
+]
+
+
+def load_names(path):
+    paths = [path] if path else UNISTD_PATHS
+    for p in paths:
+        try:
+            with open(p) as f:
+                names = {}
+                for line in f:
+                    m = re.match(r'#define\s+__NR_(\w+)\s+(\d+)', line)
+                    if m:
+                        names[int(m.group(2))] = m.group(1)
+                return names
+        except OSError:
+            continue
+    return {}
+
+
+def read_stream(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data.startswith(MAGIC):
+        return data
+    # Console log: concatenate payload of all `systrace:` lines
+    out = bytearray()
+    for line in data.decode('utf-8', 'replace').splitlines():
+        m = re.search(r'systrace: ([0-9a-f]+)\s*$', line)
+        if m:
+            out += bytes.fromhex(m.group(1))
+    return bytes(out)
+
+
+def fmt_ret(ret):
+    if -4096 < ret < 0:
+        return '-1 {} ({})'.format(errno.errorcode.get(-ret, str(-ret)),
+                                   os.strerror(-ret))
+    if ret > 0xffff or ret < 0:
+        return hex(ret & 0xffffffffffffffff)
+    return str(ret)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode an elfloader system call trace')
+    parser.add_argument('--unistd', help='unistd_64.h to resolve names')
+    parser.add_argument('--raw', action='store_true',
+                        help='print absolute timestamps')
+    parser.add_argument('trace')
+    args = parser.parse_args()
+
+    names = load_names(args.unistd)
+    data = read_stream(args.trace)
+    if len(data) < HDR.size or not data.startswith(MAGIC):
+        sys.exit('{}: Not a systrace stream'.format(args.trace))
+    _, version, recsize = HDR.unpack_from(data)
+    if version != 2 or recsize != REC.size:
+        sys.exit('{}: Unsupported version {} (record size {})'.format(
+            args.trace, version, recsize))
+
+    recs = []
+    for off in range(HDR.size, len(data) - recsize + 1, recsize):
+        recs.append(REC.unpack_from(data, off))
+    # Records are drained per CPU; restore global order
+    recs.sort(key=lambda r: r[10])
+    t0 = recs[0][10] if recs else 0
+
+    for r in recs:
+        nr, cpu, tid = r[0], r[1], r[2]
+        name = names.get(nr, 'syscall_{}'.format(nr))
+        fmts = FORMATS.get(name)
+        if fmts:
+            sargs = ', '.join(f(a, r) for f, a in zip(fmts, r[3:9]))
+        else:
+            sargs = ', '.join(hex(a) for a in r[3:9])
+        ret, ts_start, ts_end = r[9], r[10], r[11]
+        ts = ts_start if args.raw else ts_start - t0
+        print('{:>6}.{:06} [{}/{}] {}({}) = {} <{}.{:06}>'.format(
+            ts // 1000000000, (ts // 1000) % 1000000, cpu, tid,
+            name, sargs, fmt_ret(ret),
+            (ts_end - ts_start) // 1000000000,
+            ((ts_end - ts_start) // 1000) % 1000000))
+
+
+if __name__ == '__main__':
+    main()
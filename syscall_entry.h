@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_SYSCALL_ENTRY_H
+#define APPELFLOADER_SYSCALL_ENTRY_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/syscall.h>
+#if CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE
+#include <uk/plat/time.h>
+#endif /* CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE */
+
+#include "exit.h"
+#include "restart.h"
+#include "bundle/bundle.h"
+#include "memacct/memacct.h"
+#include "autogen/procself.h"
+#include "placement/placement.h"
+#include "sysstat/sysstat.h"
+#include "systrace/systrace.h"
+
+/*
+ * Observes a system call of the ELF application before it is executed,
+ * also if it is issued as trapping system call after passing an entry that
+ * is provided by elfloader
+ */
+static inline void elf_syscall_observe(long nr, const long args[6])
+{
+	/* exit_group does not return, keep the status for `main()` */
+	if (unlikely(nr == SYS_exit_group)) {
+		elf_exit_record((int)args[0]);
+		memacct_exit();
+	}
+}
+
+/*
+ * Common path for executing a system call on behalf of the ELF application
+ * from an entry that is provided by elfloader (direct system calls, vDSO).
+ * The caller is responsible for switching to the Unikraft TLS beforehand.
+ */
+static inline long elf_syscall6(long nr, const long args[6])
+{
+#if CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE
+	__nsec tstart, tend;
+#endif /* CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE */
+	long ret;
+
+#if CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE
+	tstart = ukplat_monotonic_clock();
+#endif /* CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE */
+	elf_syscall_observe(nr, args);
+	if (!placement_syscall_pre(nr, args, &ret) &&
+	    !procself_syscall_pre(nr, args, &ret) &&
+	    !bundle_syscall_pre(nr, args, &ret))
+		ret = uk_syscall6_r(nr,
+				    args[0], args[1], args[2],
+				    args[3], args[4], args[5]);
+	elf_restart_syscall_post(nr, args, ret);
+#if CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE
+	tend = ukplat_monotonic_clock();
+	sysstat_account(nr, ret, tend - tstart);
+	systrace_record(nr, args, ret, tstart, tend);
+#endif /* CONFIG_APPELFLOADER_SYSSTAT || CONFIG_APPELFLOADER_SYSTRACE */
+	return ret;
+}
+
+#endif /* APPELFLOADER_SYSCALL_ENTRY_H */
@@ -36,9 +36,13 @@
 #include <errno.h>
 #include <uk/alloc.h>
 #include <uk/print.h>
+#include <uk/spinlock.h>
 #include <uk/syscall.h>
 #include <uk/arch/limits.h>
 
+#include "brk.h"
+#include "../exit.h"
+
 #ifndef PAGES2BYTES
 #define PAGES2BYTES(x) ((x) << __PAGE_SHIFT)
 #endif
@@ -47,56 +51,152 @@
 #define HEAP_LEN   PAGES2BYTES(CONFIG_APPELFLOADER_BRK_NBPAGES)
 
 /*
- * For now we only support one custom heap
+ * One brk heap per process. Without posix-process, all applications share
+ * the heap of pid 0.
  */
-static void *base = NULL;
-static void *brk_cur = NULL;
-static void *zeroed = NULL;
-static intptr_t len = 0;
-
-UK_LLSYSCALL_R_DEFINE(void *, brk, void *, addr)
+struct brk_ctx {
+	int pid;
+	void *base;
+	void *brk_cur;
+	void *zeroed;
+	intptr_t len;
+	struct brk_ctx *next;
+};
+
+static struct brk_ctx *brk_ctxs;
+static __spinlock brk_lock = UK_SPINLOCK_INITIALIZER();
+
+static struct brk_ctx *brk_ctx_find(int pid)
 {
-	/* allocate brk context */
-	if (!base) {
-		base = uk_palloc(uk_alloc_get_default(), HEAP_PAGES);
-		if (!base) {
-			uk_pr_crit("Could not allocate memory for heap (%"PRIu64" KiB): Out of memory\n",
-				   (uint64_t) HEAP_LEN / 1024);
-			return ERR2PTR(-ENOMEM);
-		}
+	struct brk_ctx *ctx;
+
+	uk_spin_lock(&brk_lock);
+	for (ctx = brk_ctxs; ctx; ctx = ctx->next)
+		if (ctx->pid == pid)
+			break;
+	uk_spin_unlock(&brk_lock);
+	return ctx;
+}
 
-		/* initialize brk_cur with start of allocated heap region */
-		brk_cur = base;
-		zeroed = base;
-		len = 0;
+/* Returns the brk context of the calling process, allocates it on first use */
+static struct brk_ctx *brk_ctx_get(void)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	int pid = elf_exit_pid_current();
+	struct brk_ctx *ctx, *cur;
+
+	ctx = brk_ctx_find(pid);
+	if (ctx)
+		return ctx;
+
+	/* Allocate outside of the lock, the allocation can be expensive */
+	ctx = uk_malloc(a, sizeof(*ctx));
+	if (!ctx)
+		goto err_out;
+	ctx->base = uk_palloc(a, HEAP_PAGES);
+	if (!ctx->base)
+		goto err_free_ctx;
+	ctx->pid = pid;
+	/* initialize brk_cur with start of allocated heap region */
+	ctx->brk_cur = ctx->base;
+	ctx->zeroed = ctx->base;
+	ctx->len = 0;
+
+	uk_spin_lock(&brk_lock);
+	for (cur = brk_ctxs; cur; cur = cur->next)
+		if (cur->pid == pid)
+			break;
+	if (!cur) {
+		ctx->next = brk_ctxs;
+		brk_ctxs = ctx;
+	}
+	uk_spin_unlock(&brk_lock);
 
-		uk_pr_debug("New brk heap region: %p-%p\n",
-			    base, base + HEAP_LEN);
+	if (cur) {
+		/* Another thread of the process was faster */
+		uk_pfree(a, ctx->base, HEAP_PAGES);
+		uk_free(a, ctx);
+		return cur;
 	}
 
-	UK_ASSERT(brk_cur != NULL);
+	uk_pr_debug("New brk heap region for pid %d: %p-%p\n",
+		    pid, ctx->base, ctx->base + HEAP_LEN);
+	return ctx;
+
+err_free_ctx:
+	uk_free(a, ctx);
+err_out:
+	uk_pr_crit("Could not allocate memory for heap (%"PRIu64" KiB): Out of memory\n",
+		   (uint64_t) HEAP_LEN / 1024);
+	return NULL;
+}
 
-	if (addr < base || addr >= (base + HEAP_LEN)) {
+UK_LLSYSCALL_R_DEFINE(void *, brk, void *, addr)
+{
+	struct brk_ctx *ctx;
+
+	/* allocate brk context */
+	ctx = brk_ctx_get();
+	if (!ctx)
+		return ERR2PTR(-ENOMEM);
+
+	UK_ASSERT(ctx->brk_cur != NULL);
+
+	if (addr < ctx->base || addr >= (ctx->base + HEAP_LEN)) {
 		uk_pr_debug("Outside of brk range, return current brk %p\n",
-			    brk_cur);
-		return brk_cur;
+			    ctx->brk_cur);
+		return ctx->brk_cur;
 	}
 
 	/* Zero out requested memory (e.g., glibc requires) */
-	if (addr > zeroed) {
-		uk_pr_debug("zeroing %p-%p...\n", zeroed, addr);
-		memset(zeroed, 0x0, (size_t) (addr - zeroed));
+	if (addr > ctx->zeroed) {
+		uk_pr_debug("zeroing %p-%p...\n", ctx->zeroed, addr);
+		memset(ctx->zeroed, 0x0, (size_t) (addr - ctx->zeroed));
 	}
 
-	brk_cur = addr;
-	zeroed = addr;
-	len = addr - base;
+	ctx->brk_cur = addr;
+	ctx->zeroed = addr;
+	ctx->len = addr - ctx->base;
 
-	uk_pr_debug("brk @ %p (brk heap region: %p-%p)\n", addr, base, base + HEAP_LEN);
+	uk_pr_debug("brk @ %p (brk heap region: %p-%p)\n",
+		    addr, ctx->base, ctx->base + HEAP_LEN);
 
 	return addr;
 }
 
+void brk_release(int pid)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct brk_ctx **prev, *ctx = NULL;
+
+	uk_spin_lock(&brk_lock);
+	for (prev = &brk_ctxs; *prev; prev = &(*prev)->next) {
+		if ((*prev)->pid == pid) {
+			ctx = *prev;
+			*prev = ctx->next;
+			break;
+		}
+	}
+	uk_spin_unlock(&brk_lock);
+
+	if (!ctx)
+		return;
+	uk_pfree(a, ctx->base, HEAP_PAGES);
+	uk_free(a, ctx);
+}
+
+int brk_region(int pid, void **base, __sz *len)
+{
+	struct brk_ctx *ctx;
+
+	ctx = brk_ctx_find(pid);
+	if (!ctx)
+		return -ENOENT;
+	*base = ctx->base;
+	*len = (__sz)ctx->len;
+	return 0;
+}
+
 #if LIBC_SYSCALLS
 #include <unistd.h>
 #include <uk/errptr.h>
@@ -118,19 +218,23 @@ int brk(void *addr)
 
 void *sbrk(intptr_t inc)
 {
+	struct brk_ctx *ctx;
 	long ret;
-	void *prev_base = base;
+	void *prev_brk;
 
-	if (!base) {
+	ctx = brk_ctx_find(elf_exit_pid_current());
+	if (!ctx) {
 		/* Case when we do not have any memory allocated yet */
 		if (inc > HEAP_LEN) {
 			errno = ENOMEM;
 			return (void *) -1;
 		}
 		ret = uk_syscall_r_brk(NULL);
+		prev_brk = (void *) ret;
 	} else {
 		/* We are increasing or reducing our range */
-		ret = uk_syscall_r_brk((long)base + len + inc);
+		prev_brk = ctx->base + ctx->len;
+		ret = uk_syscall_r_brk((long)prev_brk + inc);
 	}
 
 	if (ret == 0) {
@@ -142,8 +246,6 @@ void *sbrk(intptr_t inc)
 		return (void *) -1;
 	}
 
-	if (!prev_base)
-		return base;
-	return prev_base;
+	return prev_brk;
 }
 #endif /* LIBC_SYSCALLS */
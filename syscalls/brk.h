@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_BRK_H
+#define APPELFLOADER_BRK_H
+
+#include <uk/config.h>
+#include <errno.h>
+#include <uk/essentials.h>
+
+#if CONFIG_APPELFLOADER_BRK
+/**
+ * Releases the brk heap of a terminated process, so that a restarted
+ * application finds an empty heap
+ *
+ * @param pid:
+ *   Process ID, see elf_exit_pid_current()
+ */
+void brk_release(int pid);
+
+/**
+ * Returns the brk heap of a process
+ *
+ * @param pid:
+ *   Process ID, see elf_exit_pid_current()
+ * @param base:
+ *   Set to the start of the heap
+ * @param len:
+ *   Set to the number of bytes in use (current break - start)
+ * @return:
+ *   0 on success, -ENOENT if the process did not use brk yet
+ */
+int brk_region(int pid, void **base, __sz *len);
+#else /* !CONFIG_APPELFLOADER_BRK */
+#define brk_release(pid) do { (void)(pid); } while (0)
+#define brk_region(pid, base, len) (-ENOENT)
+#endif /* !CONFIG_APPELFLOADER_BRK */
+
+#endif /* APPELFLOADER_BRK_H */
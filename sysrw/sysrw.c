@@ -0,0 +1,553 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <uk/alloc.h>
+#include <uk/arch/ctx.h>
+#include <uk/arch/limits.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/syscall.h>
+#include <uk/thread.h>
+#include <uk/plat/syscall.h>
+#include <sys/mman.h>
+
+#include "sysrw.h"
+#include "../syscall_entry.h"
+
+#ifndef CONFIG_ARCH_X86_64
+#error "System call rewriting is only supported on x86_64"
+#endif /* !CONFIG_ARCH_X86_64 */
+
+/*
+ * A rewritable call site consists of a 5-byte `mov $nr, %eax` (b8 imm32)
+ * followed by the 2-byte `syscall` instruction (0f 05). Only the `mov` is
+ * replaced with a `jmp rel32` (e9 rel32) to a trampoline that is placed within
+ * +/-2 GiB of the site. The `syscall` instruction is kept so that any branch
+ * that targets it still executes a regular (trapping) system call.
+ *
+ * glibc also loads the system call number with 2-byte instructions:
+ * `xor %eax, %eax` (31 c0) for `read`, and `mov %r32, %eax` (89 /r), e.g.,
+ * for `exit_group` in `_exit()`. This leaves no room for the jump in front of
+ * `syscall`. Such a site is only accepted if it is followed by one of the
+ * patterns below. The jump then covers the whole sequence, and the
+ * instructions following `syscall` (none of them is position-dependent) are
+ * relocated into the trampoline.
+ *
+ * Sites are found by matching raw bytes, without decoding the instructions
+ * in front of them. A site is skipped if a direct branch within
+ * SYSRW_BRANCH_WINDOW bytes targets a byte that the jump overwrites, other
+ * than the start of the site: Either the site is not an instruction boundary,
+ * or the branch would land in the middle of the jump. Indirect branches
+ * (e.g., jump tables) and branches from further away are not detected.
+ */
+#define SYSRW_OP_MOVEAX		0xb8
+#define SYSRW_OP_MOVR32		0x89
+#define SYSRW_OP_JMP		0xe9
+#define SYSRW_MOV_LEN		5
+#define SYSRW_SITE_LEN		7
+#define SYSRW_SHORT_LEN		4	/* 2-byte load and `syscall` */
+
+/* Range around a short site that is searched for branches into it */
+#define SYSRW_BRANCH_WINDOW	4096
+
+/* Highest system call number that we consider for rewriting */
+#define SYSRW_NR_MAX		512
+
+/*
+ * Trampoline layout (one slot per site):
+ *   0: 48 8d 64 24 80           lea  -0x80(%rsp), %rsp  (skip red zone)
+ *   5: b8 <nr>                  mov  $nr, %eax
+ *      89 <r32> 0f 1f 00        mov  %r32, %eax; nop
+ *  10: ff 15 <rel32>            call *sysrw_entry_ptr(%rip)
+ *  16: 48 8d a4 24 80 00 00 00  lea  0x80(%rsp), %rsp
+ *  24: 85 c9                    test %ecx, %ecx
+ *  26: 74 02                    jz   30
+ *  28: 0f 05                    syscall
+ *  30: <relocated instructions> (0 to 6 bytes)
+ *  30+n: e9 <rel32>             jmp  <end of site>
+ *  (padding with cc)
+ * The first slot of a trampoline area holds the address of `sysrw_entry`
+ * that is referenced by the indirect call of all other slots. The entry
+ * returns with a non-zero %ecx and the system call number in %rax for system
+ * calls that have to be issued as trapping system call.
+ */
+#define SYSRW_SLOT_LEN		48
+#define SYSRW_SLOT_LOAD		5
+#define SYSRW_SLOT_CALL		10
+#define SYSRW_SLOT_CALL_END	16
+#define SYSRW_SLOT_RELOC	30
+#define SYSRW_RELOC_MAX		6
+
+static const __u8 sysrw_slot_tmpl[SYSRW_SLOT_RELOC] = {
+	0x48, 0x8d, 0x64, 0x24, 0x80,
+	0xb8, 0x00, 0x00, 0x00, 0x00,
+	0xff, 0x15, 0x00, 0x00, 0x00, 0x00,
+	0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00,
+	0x85, 0xc9,
+	0x74, 0x02,
+	0x0f, 0x05
+};
+
+/* Fills the load of a `mov %r32, %eax` site to 5 bytes */
+static const __u8 sysrw_nop3[3] = { 0x0f, 0x1f, 0x00 };
+
+/*
+ * Verified-safe patterns
+ *
+ * Scanning raw bytes of executable segments could also match bytes that are
+ * not an instruction boundary (e.g., immediates or embedded data). To avoid
+ * rewriting such false positives, a site is only accepted if the bytes
+ * following the `syscall` instruction match a sequence that libc system call
+ * stubs are known to emit. Together with the 7-byte site and the upper
+ * immediate bytes being zero, this results in a 9 to 13 byte signature.
+ */
+struct sysrw_pattern {
+	const char *desc;
+	__u8 len;
+	__u8 post[SYSRW_RELOC_MAX];
+};
+
+static const struct sysrw_pattern sysrw_patterns[] = {
+	/* glibc: syscall wrappers checking for errors */
+	{ "cmp $-4095, %rax",	6, { 0x48, 0x3d, 0x01, 0xf0, 0xff, 0xff } },
+	{ "cmp $-4096, %rax",	6, { 0x48, 0x3d, 0x00, 0xf0, 0xff, 0xff } },
+	/* glibc: wrappers returning int (e.g., fstatat in ld.so) */
+	{ "cmp $-4095, %eax",	5, { 0x3d, 0x01, 0xf0, 0xff, 0xff } },
+	{ "cmp $-4096, %eax",	5, { 0x3d, 0x00, 0xf0, 0xff, 0xff } },
+	/* glibc, musl: wrappers returning the raw result (e.g., getpid) */
+	{ "ret",		1, { 0xc3 } },
+	/* musl: result handed over to __syscall_ret() */
+	{ "mov %rax, %rdi",	3, { 0x48, 0x89, 0xc7 } },
+};
+
+/* A matched call site */
+struct sysrw_site {
+	long nr;	/* -1 if loaded from a register */
+	__u8 movreg;	/* ModRM byte of `mov %r32, %eax`, 0 for `mov $nr` */
+	__u8 len;	/* length of the site, execution resumes after it */
+	__u8 reloc;	/* number of bytes at the end relocated to the slot */
+};
+
+/*
+ * System calls that must not be served by the direct entry because they
+ * require the register state of a trapping system call (execution
+ * environment) or the user-land TLS pointer. Sites with these numbers are
+ * not rewritten, except for exit_group: Its status is recorded by the
+ * direct entry before the trampoline issues the trapping system call.
+ * The same happens for sites that load the number from a register.
+ */
+static const long sysrw_nr_deny[] = {
+	15,	/* rt_sigreturn */
+	56,	/* clone */
+	57,	/* fork */
+	58,	/* vfork */
+	59,	/* execve */
+	60,	/* exit */
+	130,	/* rt_sigsuspend */
+	131,	/* sigaltstack */
+	158,	/* arch_prctl */
+	231,	/* exit_group */
+	322,	/* execveat */
+	435,	/* clone3 */
+};
+
+#define SYSRW_NR_MMAP		9
+#define SYSRW_NR_MPROTECT	10
+#define SYSRW_NR_EXIT_GROUP	231
+
+extern void sysrw_entry(void);
+__uptr sysrw_auxsp(void);
+long sysrw_dispatch(long nr, long *args, long *trap);
+
+static struct sysrw_stats sysrw_stats;
+
+const struct sysrw_stats *sysrw_stats_get(void)
+{
+	return &sysrw_stats;
+}
+
+static bool sysrw_nr_allowed(long nr)
+{
+	unsigned int i;
+
+	if (nr < 0 || nr >= SYSRW_NR_MAX)
+		return false;
+	for (i = 0; i < ARRAY_SIZE(sysrw_nr_deny); ++i)
+		if (sysrw_nr_deny[i] == nr)
+			return false;
+	return true;
+}
+
+/* Sites of denied system calls that still go through the trampoline */
+static inline bool sysrw_site_allowed(const struct sysrw_site *site)
+{
+	return site->nr < 0 || site->nr == SYSRW_NR_EXIT_GROUP ||
+	       sysrw_nr_allowed(site->nr);
+}
+
+static bool sysrw_match_post(const __u8 *p, const __u8 *end,
+			     const struct sysrw_pattern **post)
+{
+	const struct sysrw_pattern *pat;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(sysrw_patterns); ++i) {
+		pat = &sysrw_patterns[i];
+		if (p + pat->len > end)
+			continue;
+		if (memcmp(p, pat->post, pat->len) == 0) {
+			*post = pat;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Returns true if a byte sequence near a site decodes as a direct jump or
+ * call into (p, p + len), except to the kept `syscall` of a 7-byte site.
+ * Bytes that are not an instruction boundary may match as well, which only
+ * leaves the site unmodified.
+ */
+static bool sysrw_branch_into(const __u8 *base, const __u8 *p,
+			      const __u8 *end, __u8 len, __u8 reloc)
+{
+	const __u8 *keep = reloc ? NULL : p + SYSRW_MOV_LEN;
+	const __u8 *q, *lo, *hi, *t;
+	__s32 rel;
+
+	lo = (p - base > SYSRW_BRANCH_WINDOW) ? p - SYSRW_BRANCH_WINDOW : base;
+	hi = (end - p > SYSRW_BRANCH_WINDOW) ? p + SYSRW_BRANCH_WINDOW : end;
+	for (q = lo; q + 2 <= hi; ++q) {
+		t = NULL;
+		if ((q[0] >= 0x70 && q[0] <= 0x7f) || q[0] == 0xeb) {
+			/* jcc rel8, jmp rel8 */
+			t = q + 2 + (__s8)q[1];
+		} else if ((q[0] == 0xe8 || q[0] == 0xe9) && q + 5 <= hi) {
+			/* call rel32, jmp rel32 */
+			memcpy(&rel, q + 1, sizeof(rel));
+			t = q + 5 + rel;
+		} else if (q[0] == 0x0f && (q[1] & 0xf0) == 0x80 &&
+			   q + 6 <= hi) {
+			/* jcc rel32 */
+			memcpy(&rel, q + 2, sizeof(rel));
+			t = q + 6 + rel;
+		}
+		if (t > p && t < p + len && t != keep)
+			return true;
+	}
+	return false;
+}
+
+static bool sysrw_match(const __u8 *base, const __u8 *p, const __u8 *end,
+			struct sysrw_site *site)
+{
+	const struct sysrw_pattern *post;
+
+	if (p + SYSRW_SHORT_LEN > end)
+		return false;
+
+	if (p + SYSRW_SITE_LEN <= end &&
+	    p[0] == SYSRW_OP_MOVEAX && p[3] == 0x00 && p[4] == 0x00 &&
+	    p[5] == 0x0f && p[6] == 0x05) {
+		if (!sysrw_match_post(p + SYSRW_SITE_LEN, end, &post))
+			return false;
+		site->nr = (long)p[1] | ((long)p[2] << 8);
+		site->movreg = 0;
+		site->len = SYSRW_SITE_LEN;
+		site->reloc = 0;
+		return !sysrw_branch_into(base, p, end, site->len, site->reloc);
+	}
+
+	/*
+	 * `xor %eax, %eax; syscall` or `mov %r32, %eax; syscall` (without
+	 * %eax and %esp as source)
+	 */
+	if (p[2] != 0x0f || p[3] != 0x05)
+		return false;
+	if (p[0] == 0x31 && p[1] == 0xc0) {
+		site->nr = 0;
+		site->movreg = 0;
+	} else if (p[0] == SYSRW_OP_MOVR32 && (p[1] & 0xc7) == 0xc0 &&
+		   p[1] != 0xc0 && p[1] != 0xe0) {
+		site->nr = -1;
+		site->movreg = p[1];
+	} else {
+		return false;
+	}
+	if (!sysrw_match_post(p + SYSRW_SHORT_LEN, end, &post))
+		return false;
+	site->len = SYSRW_SHORT_LEN + post->len;
+	site->reloc = post->len;
+	return !sysrw_branch_into(base, p, end, site->len, site->reloc);
+}
+
+static inline bool sysrw_rel32_ok(__uptr from, __uptr to)
+{
+	__sptr rel = (__sptr)(to - from);
+
+	return rel >= INT32_MIN && rel <= INT32_MAX;
+}
+
+static inline void sysrw_put_rel32(__u8 *dst, __uptr from, __uptr to)
+{
+	__s32 rel = (__s32)(__sptr)(to - from);
+
+	memcpy(dst, &rel, sizeof(rel));
+}
+
+/*
+ * Allocate a trampoline area that is reachable with a rel32 jump from any
+ * address within [base, base + len). We try right after and right before the
+ * range.
+ */
+static void *sysrw_tramp_alloc(__uptr base, size_t len, size_t tlen)
+{
+	__uptr hints[2] = { PAGE_ALIGN_UP(base + len),
+			    PAGE_ALIGN_DOWN(base) - tlen };
+	__uptr tramp;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(hints); ++i) {
+#if CONFIG_LIBPOSIX_MMAP
+		tramp = (__uptr)mmap((void *)hints[i], tlen,
+				     PROT_READ | PROT_WRITE,
+				     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (unlikely(tramp == (__uptr)MAP_FAILED))
+			continue;
+#else /* !CONFIG_LIBPOSIX_MMAP */
+		tramp = (__uptr)uk_palloc(uk_alloc_get_default(),
+					  tlen >> __PAGE_SHIFT);
+		if (unlikely(!tramp))
+			return NULL;
+#endif /* !CONFIG_LIBPOSIX_MMAP */
+		if (sysrw_rel32_ok(base, tramp + tlen) &&
+		    sysrw_rel32_ok(tramp, base + len))
+			return (void *)tramp;
+
+		/* Not reachable, try next hint */
+#if CONFIG_LIBPOSIX_MMAP
+		munmap((void *)tramp, tlen);
+#else /* !CONFIG_LIBPOSIX_MMAP */
+		uk_pfree(uk_alloc_get_default(), (void *)tramp,
+			 tlen >> __PAGE_SHIFT);
+		/* The allocator does not take placement hints */
+		break;
+#endif /* !CONFIG_LIBPOSIX_MMAP */
+	}
+	return NULL;
+}
+
+int sysrw_patch(const char *name, void *base, size_t len, int prot)
+{
+	const __u8 *end = (const __u8 *)base + len;
+	size_t nsites = 0, skipped = 0;
+	struct sysrw_site site;
+	__u8 *tramp, *slot, *q;
+	size_t tlen;
+	__u8 *p;
+	int rc __maybe_unused;
+
+	UK_ASSERT(base);
+
+	/* First pass: count sites to size the trampoline area */
+	for (p = (__u8 *)base; p < end; ++p) {
+		if (!sysrw_match(base, p, end, &site))
+			continue;
+		if (sysrw_site_allowed(&site))
+			++nsites;
+		else
+			++skipped;
+		p += site.len - 1;
+	}
+	if (!nsites) {
+		uk_pr_debug("%s: No system call sites to rewrite at %p-%p\n",
+			    name, base, (void *)end);
+		return 0;
+	}
+
+	tlen = PAGE_ALIGN_UP((nsites + 1) * SYSRW_SLOT_LEN);
+	tramp = sysrw_tramp_alloc((__uptr)base, len, tlen);
+	if (unlikely(!tramp)) {
+		uk_pr_warn("%s: Failed to allocate reachable trampolines, skipping %"__PRIsz" system call sites\n",
+			   name, nsites);
+		__atomic_add_fetch(&sysrw_stats.skipped, nsites + skipped,
+				  __ATOMIC_RELAXED);
+		return -ENOMEM;
+	}
+	*((__uptr *)tramp) = (__uptr)sysrw_entry;
+
+#if CONFIG_LIBPOSIX_MMAP
+	if (prot >= 0) {
+		rc = mprotect((void *)PAGE_ALIGN_DOWN((__uptr)base),
+			      PAGE_ALIGN_UP((__uptr)end) -
+			      PAGE_ALIGN_DOWN((__uptr)base),
+			      PROT_READ | PROT_WRITE | PROT_EXEC);
+		if (unlikely(rc < 0)) {
+			uk_pr_warn("%s: Failed to unprotect %p-%p for rewriting system call sites\n",
+				   name, base, (void *)end);
+			munmap(tramp, tlen);
+			return -errno;
+		}
+	}
+#endif /* CONFIG_LIBPOSIX_MMAP */
+
+	/* Second pass: generate trampolines and patch sites */
+	slot = tramp + SYSRW_SLOT_LEN;
+	nsites = 0;
+	for (p = (__u8 *)base; p < end; ++p) {
+		if (!sysrw_match(base, p, end, &site))
+			continue;
+		if (!sysrw_site_allowed(&site)) {
+			p += site.len - 1;
+			continue;
+		}
+
+		memset(slot, 0xcc, SYSRW_SLOT_LEN);
+		memcpy(slot, sysrw_slot_tmpl, sizeof(sysrw_slot_tmpl));
+		if (site.movreg) {
+			slot[SYSRW_SLOT_LOAD]     = SYSRW_OP_MOVR32;
+			slot[SYSRW_SLOT_LOAD + 1] = site.movreg;
+			memcpy(slot + SYSRW_SLOT_LOAD + 2, sysrw_nop3,
+			       sizeof(sysrw_nop3));
+		} else {
+			slot[SYSRW_SLOT_LOAD + 1] = (__u8)site.nr;
+			slot[SYSRW_SLOT_LOAD + 2] = (__u8)(site.nr >> 8);
+		}
+		sysrw_put_rel32(slot + SYSRW_SLOT_CALL + 2,
+				(__uptr)slot + SYSRW_SLOT_CALL_END,
+				(__uptr)tramp);
+		q = slot + SYSRW_SLOT_RELOC;
+		memcpy(q, p + site.len - site.reloc, site.reloc);
+		q += site.reloc;
+		q[0] = SYSRW_OP_JMP;
+		sysrw_put_rel32(q + 1, (__uptr)q + SYSRW_MOV_LEN,
+				(__uptr)p + site.len);
+
+		/* Relocated bytes are unreachable now, trap if not */
+		if (site.reloc)
+			memset(p + SYSRW_MOV_LEN, 0xcc,
+			       site.len - SYSRW_MOV_LEN);
+		p[0] = SYSRW_OP_JMP;
+		sysrw_put_rel32(p + 1, (__uptr)p + SYSRW_MOV_LEN,
+				(__uptr)slot);
+
+		slot += SYSRW_SLOT_LEN;
+		++nsites;
+		p += site.len - 1;
+	}
+
+#if CONFIG_LIBPOSIX_MMAP
+	if (prot >= 0)
+		mprotect((void *)PAGE_ALIGN_DOWN((__uptr)base),
+			 PAGE_ALIGN_UP((__uptr)end) -
+			 PAGE_ALIGN_DOWN((__uptr)base),
+			 prot);
+	rc = mprotect(tramp, tlen, PROT_READ | PROT_EXEC);
+	if (unlikely(rc < 0))
+		uk_pr_warn("%s: Failed to protect trampolines at %p\n",
+			   name, tramp);
+#endif /* CONFIG_LIBPOSIX_MMAP */
+
+	uk_pr_info("%s: Rewrote %"__PRIsz" system call sites (%"__PRIsz" skipped), trampolines at %p\n",
+		   name, nsites, skipped, tramp);
+	__atomic_add_fetch(&sysrw_stats.sites, nsites, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&sysrw_stats.skipped, skipped, __ATOMIC_RELAXED);
+	return (int)nsites;
+}
+
+size_t sysrw_count_trapping(const void *base, size_t len,
+			    const long *nrs, unsigned int count)
+{
+	const __u8 *end = (const __u8 *)base + len;
+	struct sysrw_site site;
+	const __u8 *p;
+	size_t found = 0;
+	unsigned int i;
+
+	/*
+	 * Rewritten sites start with a jump and no longer match, so the same
+	 * matcher as for rewriting only finds sites that still trap.
+	 */
+	for (p = (const __u8 *)base; p < end; ++p) {
+		if (!sysrw_match(base, p, end, &site))
+			continue;
+
+		for (i = 0; site.nr >= 0 && i < count; ++i) {
+			if (nrs[i] == site.nr) {
+				uk_pr_debug("Trapping system call %ld at %p\n",
+					    site.nr, p);
+				++found;
+				break;
+			}
+		}
+		p += site.len - 1;
+	}
+	return found;
+}
+
+/*
+ * Called from `sysrw_entry` on the application stack: Returns the top of the
+ * auxiliary stack of the current thread, 0 if it has none
+ */
+__uptr sysrw_auxsp(void)
+{
+	struct uk_thread *t = uk_thread_current();
+
+	return t ? t->auxsp : 0;
+}
+
+/*
+ * Called from `sysrw_entry` on the auxiliary stack of the thread with the
+ * Unikraft TLS pointer not yet active. System calls that the direct entry
+ * must not serve are only observed; `*trap` tells the trampoline to issue
+ * them as trapping system call.
+ */
+long sysrw_dispatch(long nr, long *args, long *trap)
+{
+	__u8 ectxbuf[ukarch_ectx_size() + ukarch_ectx_align()];
+	struct ukarch_ectx *ectx;
+	struct ukarch_sysregs sysregs;
+	long ret;
+
+	/* Preserve extended registers like a trapping system call does */
+	ectx = (struct ukarch_ectx *)ALIGN_UP((__uptr)ectxbuf,
+					      ukarch_ectx_align());
+	ukarch_ectx_store(ectx);
+	ukarch_sysregs_switch_uk_tls(&sysregs);
+
+	if (unlikely(!sysrw_nr_allowed(nr))) {
+		elf_syscall_observe(nr, args);
+		*trap = 1;
+		ret = nr;
+		goto out;
+	}
+
+	__atomic_add_fetch(&sysrw_stats.calls, 1, __ATOMIC_RELAXED);
+	ret = elf_syscall6(nr, args);
+
+	/*
+	 * Rewrite libraries that the dynamic loader maps later on. Shared
+	 * mappings are left alone, the rewritten code would reach the file.
+	 */
+	if (nr == SYSRW_NR_MMAP && ret >= 0 && (args[2] & PROT_EXEC) &&
+	    !(args[3] & MAP_SHARED))
+		sysrw_patch("<mmap>", (void *)ret, (size_t)args[1],
+			    (int)args[2]);
+	else if (nr == SYSRW_NR_MPROTECT && ret == 0 &&
+		 (args[2] & PROT_EXEC))
+		sysrw_patch("<mprotect>", (void *)args[0], (size_t)args[1],
+			    (int)args[2]);
+
+out:
+	ukarch_sysregs_switch_ul_tls(&sysregs);
+	ukarch_ectx_load(ectx);
+	return ret;
+}
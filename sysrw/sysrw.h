@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_SYSRW_H
+#define APPELFLOADER_SYSRW_H
+
+#include <uk/config.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Load-time rewriting of `syscall` instructions into direct calls
+ *
+ * Recognized libc system call stubs (`mov $nr, %eax; syscall`) are redirected
+ * with a `jmp` to a per-site trampoline that calls into the system call
+ * handler directly instead of trapping. The original `syscall` instruction
+ * stays in place so that branches targeting it still behave correctly.
+ */
+
+struct sysrw_stats {
+	size_t sites;	/* number of rewritten call sites */
+	size_t skipped;	/* matching sites that could not be rewritten */
+	size_t calls;	/* system calls served by the direct entry */
+};
+
+/**
+ * Rewrites all known system call stubs within a range of executable memory
+ *
+ * @param name
+ *   Name of the image used for kernel messages
+ * @param base
+ *   Start of the executable range
+ * @param len
+ *   Length of the executable range in bytes
+ * @param prot
+ *   Memory protection (`PROT_*`) that the range is restored to after
+ *   patching. If negative, the range is expected to be writable already and
+ *   protections are not touched.
+ * @return
+ *   Number of rewritten call sites (>= 0), a negative errno value in case
+ *   of errors
+ */
+int sysrw_patch(const char *name, void *base, size_t len, int prot);
+
+/**
+ * Counts the system call sites within a range of executable memory that load
+ * one of the given system call numbers and were not rewritten, i.e., still
+ * trap into the system call handler. Sites are matched like for rewriting.
+ *
+ * @param base
+ *   Start of the executable range
+ * @param len
+ *   Length of the executable range in bytes
+ * @param nrs
+ *   System call numbers to look for
+ * @param count
+ *   Number of entries in `nrs`
+ * @return
+ *   Number of trapping call sites
+ */
+size_t sysrw_count_trapping(const void *base, size_t len,
+			    const long *nrs, unsigned int count);
+
+/**
+ * Returns the accumulated rewriting statistics
+ */
+const struct sysrw_stats *sysrw_stats_get(void);
+
+#endif /* APPELFLOADER_SYSRW_H */
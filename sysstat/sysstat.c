@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <uk/essentials.h>
+#include <uk/plat/console.h>
+#include <uk/syscall.h>
+
+#include "sysstat.h"
+
+static struct sysstat_entry sysstat_tab[SYSSTAT_NR_MAX];
+
+static inline unsigned int sysstat_bucket(__nsec dt)
+{
+	unsigned int b;
+
+	if (dt == 0)
+		return 0;
+	b = 63 - (unsigned int)__builtin_clzll((unsigned long long)dt);
+	return MIN(b, SYSSTAT_HIST_BUCKETS - 1);
+}
+
+void sysstat_account(long nr, long ret, __nsec dt)
+{
+	struct sysstat_entry *e;
+
+	if (unlikely(nr < 0 || nr >= SYSSTAT_NR_MAX))
+		return;
+
+	e = &sysstat_tab[nr];
+	__atomic_add_fetch(&e->calls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&e->nsec, dt, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&e->hist[sysstat_bucket(dt)], 1, __ATOMIC_RELAXED);
+	if (ret < 0 && ret > -4096)
+		__atomic_add_fetch(&e->errors, 1, __ATOMIC_RELAXED);
+}
+
+const struct sysstat_entry *sysstat_get(long nr)
+{
+	if (unlikely(nr < 0 || nr >= SYSSTAT_NR_MAX))
+		return NULL;
+	return &sysstat_tab[nr];
+}
+
+void sysstat_reset(void)
+{
+	memset(sysstat_tab, 0, sizeof(sysstat_tab));
+}
+
+static void __printf(1, 2) sysstat_coutk(const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len <= 0)
+		return;
+	ukplat_coutk(buf, MIN((unsigned int)len, sizeof(buf) - 1));
+}
+
+void sysstat_dump(void)
+{
+	const struct sysstat_entry *e;
+	const char *name;
+	unsigned int b;
+	long nr;
+
+	sysstat_coutk("%-4s %-20s %12s %10s %14s %10s  %s\n",
+		      "nr", "syscall", "calls", "errors", "total ns",
+		      "avg ns", "log2(ns):calls");
+	for (nr = 0; nr < SYSSTAT_NR_MAX; ++nr) {
+		e = &sysstat_tab[nr];
+		if (!e->calls)
+			continue;
+
+		name = uk_syscall_name(nr);
+		sysstat_coutk("%-4ld %-20s %12"PRIu64" %10"PRIu64" %14"PRIu64" %10"PRIu64" ",
+			      nr, name ? name : "?",
+			      e->calls, e->errors, e->nsec,
+			      e->nsec / e->calls);
+		for (b = 0; b < SYSSTAT_HIST_BUCKETS; ++b)
+			if (e->hist[b])
+				sysstat_coutk(" %u:%"PRIu64, b, e->hist[b]);
+		sysstat_coutk("\n");
+	}
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_SYSSTAT_H
+#define APPELFLOADER_SYSSTAT_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+
+/*
+ * Per-system call statistics of the ELF application
+ *
+ * Counters are collected at the system call entries that are provided by
+ * elfloader (direct system calls, vDSO). The histogram uses log2 buckets of
+ * the latency in nanoseconds: bucket `i` counts calls that took
+ * [2^i, 2^(i+1)) ns, the last bucket also counts all slower calls.
+ */
+#define SYSSTAT_NR_MAX		512
+#define SYSSTAT_HIST_BUCKETS	24
+
+struct sysstat_entry {
+	__u64 calls;
+	__u64 errors;
+	__u64 nsec;
+	__u64 hist[SYSSTAT_HIST_BUCKETS];
+};
+
+#if CONFIG_APPELFLOADER_SYSSTAT
+/**
+ * Accounts a completed system call
+ *
+ * @param nr System call number
+ * @param ret Raw return value (negative errno on errors)
+ * @param dt Time spent in the system call handler
+ */
+void sysstat_account(long nr, long ret, __nsec dt);
+
+/**
+ * Returns the statistics of a system call, NULL if `nr` is out of range
+ */
+const struct sysstat_entry *sysstat_get(long nr);
+
+/**
+ * Prints the statistics of all called system calls to the kernel console.
+ * Called by the launcher after the application exited.
+ */
+void sysstat_dump(void);
+
+/**
+ * Resets all counters
+ */
+void sysstat_reset(void);
+#else /* !CONFIG_APPELFLOADER_SYSSTAT */
+#define sysstat_account(nr, ret, dt) do {} while (0)
+#define sysstat_dump() do {} while (0)
+#define sysstat_reset() do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_SYSSTAT */
+
+#endif /* APPELFLOADER_SYSSTAT_H */
@@ -0,0 +1,311 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <uk/alloc.h>
+#include <uk/arch/limits.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#include <uk/sched.h>
+#include <uk/syscall.h>
+#include <uk/thread.h>
+#include <uk/plat/console.h>
+#include <uk/plat/time.h>
+#if CONFIG_HAVE_SMP
+#include <uk/plat/lcpu.h>
+#endif /* CONFIG_HAVE_SMP */
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+#include <uk/process.h>
+#endif /* CONFIG_LIBPOSIX_PROCESS_PIDS */
+
+#include "systrace.h"
+
+#define SYSTRACE_NRECS		(1UL << CONFIG_APPELFLOADER_SYSTRACE_ORDER)
+#define SYSTRACE_MASK		(SYSTRACE_NRECS - 1)
+
+#if CONFIG_HAVE_SMP
+#define SYSTRACE_MAXCPUS	CONFIG_UKPLAT_LCPU_MAXCOUNT
+#define systrace_cpu()		((unsigned int)ukplat_lcpu_id())
+#define systrace_ncpus()	((unsigned int)ukplat_lcpu_count())
+#else /* !CONFIG_HAVE_SMP */
+#define SYSTRACE_MAXCPUS	1
+#define systrace_cpu()		0U
+#define systrace_ncpus()	1U
+#endif /* !CONFIG_HAVE_SMP */
+
+/*
+ * Single-producer/single-consumer ring: Only the CPU owning the ring
+ * produces records (system calls are not issued from interrupt context),
+ * only the drain path consumes them. `head` and `tail` are free-running
+ * counters.
+ */
+struct systrace_ring {
+	__u64 head __align(CACHE_LINE_SIZE);
+	__u64 dropped;
+	__u64 tail __align(CACHE_LINE_SIZE);
+	struct systrace_rec *recs;
+};
+
+/* Ring buffers are only allocated for the CPUs that are present */
+static struct systrace_ring systrace_rings[SYSTRACE_MAXCPUS];
+static unsigned int systrace_nrings;
+static int systrace_fd = -1;
+static int systrace_draining;
+
+static inline __u32 systrace_tid(void)
+{
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+	return (__u32)ukthread2tid(uk_thread_current());
+#else /* !CONFIG_LIBPOSIX_PROCESS_PIDS */
+	return (__u32)(__uptr)uk_thread_current();
+#endif /* !CONFIG_LIBPOSIX_PROCESS_PIDS */
+}
+
+/* Returns the index of the path argument of a system call, -1 if it has none */
+static inline int systrace_path_arg(long nr)
+{
+	switch (nr) {
+#ifdef SYS_open
+	case SYS_open:
+	case SYS_stat:
+	case SYS_lstat:
+	case SYS_access:
+	case SYS_creat:
+	case SYS_mkdir:
+	case SYS_rmdir:
+	case SYS_unlink:
+	case SYS_readlink:
+	case SYS_chmod:
+	case SYS_rename:
+#endif /* SYS_open */
+	case SYS_execve:
+	case SYS_chdir:
+	case SYS_truncate:
+	case SYS_statfs:
+		return 0;
+	case SYS_openat:
+	case SYS_newfstatat:
+	case SYS_faccessat:
+	case SYS_mkdirat:
+	case SYS_unlinkat:
+	case SYS_readlinkat:
+	case SYS_renameat:
+	case SYS_statx:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+void systrace_record(long nr, const long args[6], long ret,
+		     __nsec tstart, __nsec tend)
+{
+	unsigned int cpu = systrace_cpu();
+	struct systrace_ring *ring;
+	struct systrace_rec *rec;
+	__u64 head, tail;
+	int idx;
+
+	if (unlikely(cpu >= systrace_nrings))
+		return;
+	ring = &systrace_rings[cpu];
+	if (unlikely(!ring->recs))
+		return;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (unlikely(head - tail >= SYSTRACE_NRECS)) {
+		ring->dropped++;
+		return;
+	}
+
+	rec = &ring->recs[head & SYSTRACE_MASK];
+	rec->nr       = (__u16)nr;
+	rec->cpu      = (__u16)cpu;
+	rec->tid      = systrace_tid();
+	memcpy(rec->args, args, sizeof(rec->args));
+	rec->ret      = ret;
+	rec->ts_start = tstart;
+	rec->ts_end   = tend;
+
+	/*
+	 * The system call already dereferenced the path, so it can be read
+	 * unless the call failed with EFAULT
+	 */
+	idx = systrace_path_arg(nr);
+	if (idx >= 0 && args[idx] && ret != -EFAULT)
+		strncpy(rec->path, (const char *)args[idx], SYSTRACE_PATHLEN);
+	else
+		rec->path[0] = '\0';
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void systrace_coutk_hex(const void *buf, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const __u8 *p = (const __u8 *)buf;
+	char line[10 + 2 * sizeof(struct systrace_rec) + 1];
+	size_t i;
+
+	UK_ASSERT(len <= sizeof(struct systrace_rec));
+
+	memcpy(line, "systrace: ", 10);
+	for (i = 0; i < len; ++i) {
+		line[10 + 2 * i]     = hex[p[i] >> 4];
+		line[10 + 2 * i + 1] = hex[p[i] & 0xf];
+	}
+	line[10 + 2 * len] = '\n';
+	ukplat_coutk(line, 10 + 2 * len + 1);
+}
+
+static int systrace_out(const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	ssize_t rc;
+
+	if (systrace_fd < 0) {
+		/* Console output: one hex-encoded line per record */
+		for (; len >= sizeof(struct systrace_rec);
+		     len -= sizeof(struct systrace_rec),
+		     p += sizeof(struct systrace_rec))
+			systrace_coutk_hex(p, sizeof(struct systrace_rec));
+		if (len)
+			systrace_coutk_hex(p, len);
+		return 0;
+	}
+
+	while (len) {
+		rc = write(systrace_fd, p, len);
+		if (unlikely(rc < 0)) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+		len -= rc;
+		p   += rc;
+	}
+	return 0;
+}
+
+void systrace_flush(void)
+{
+	struct systrace_ring *ring;
+	__u64 head, tail, n;
+	unsigned int cpu;
+	int rc;
+
+	/* Only a single consumer at a time */
+	if (__atomic_exchange_n(&systrace_draining, 1, __ATOMIC_ACQUIRE))
+		return;
+
+	for (cpu = 0; cpu < systrace_nrings; ++cpu) {
+		ring = &systrace_rings[cpu];
+		if (!ring->recs)
+			continue;
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+		while (tail != head) {
+			/* Contiguous chunk up to the end of the buffer */
+			n = MIN(head - tail,
+				SYSTRACE_NRECS - (tail & SYSTRACE_MASK));
+			rc = systrace_out(&ring->recs[tail & SYSTRACE_MASK],
+					  n * sizeof(struct systrace_rec));
+			if (unlikely(rc < 0)) {
+				uk_pr_err("systrace: Failed to write trace: %s (%d)\n",
+					  strerror(-rc), -rc);
+				/* Drop the chunk to keep the producers going */
+			}
+			tail += n;
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+
+	__atomic_store_n(&systrace_draining, 0, __ATOMIC_RELEASE);
+}
+
+static void systrace_drain(void *arg __unused)
+{
+	for (;;) {
+		systrace_flush();
+		uk_sched_thread_sleep(ukarch_time_msec_to_nsec(
+				CONFIG_APPELFLOADER_SYSTRACE_INTERVAL));
+	}
+}
+
+static int systrace_init(struct uk_init_ctx *ictx __unused)
+{
+	const char *path = CONFIG_APPELFLOADER_SYSTRACE_PATH;
+	struct systrace_hdr hdr = {
+		.magic   = SYSTRACE_MAGIC,
+		.version = SYSTRACE_VERSION,
+		.recsize = sizeof(struct systrace_rec),
+	};
+	struct uk_thread *t;
+	unsigned int cpu;
+	int rc;
+
+	if (path[0] != '\0') {
+		systrace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (unlikely(systrace_fd < 0)) {
+			uk_pr_warn("systrace: Failed to open %s: %s (%d), tracing to console\n",
+				   path, strerror(errno), errno);
+		}
+	}
+	rc = systrace_out(&hdr, sizeof(hdr));
+	if (unlikely(rc < 0))
+		return rc;
+
+	systrace_nrings = MIN(systrace_ncpus(), SYSTRACE_MAXCPUS);
+	for (cpu = 0; cpu < systrace_nrings; ++cpu) {
+		systrace_rings[cpu].recs =
+			uk_malloc(uk_alloc_get_default(),
+				  SYSTRACE_NRECS * sizeof(struct systrace_rec));
+		if (unlikely(!systrace_rings[cpu].recs)) {
+			uk_pr_err("systrace: Failed to allocate ring buffer for CPU %u\n",
+				  cpu);
+			return -ENOMEM;
+		}
+	}
+
+	t = uk_sched_thread_create(uk_sched_current(), systrace_drain, NULL,
+				   "systrace");
+	if (unlikely(!t)) {
+		uk_pr_err("systrace: Failed to create drain thread\n");
+		return -ENOMEM;
+	}
+
+	uk_pr_info("systrace: Tracing %lu records on %u CPUs to %s\n",
+		   SYSTRACE_NRECS, systrace_nrings,
+		   systrace_fd >= 0 ? path : "console");
+	return 0;
+}
+
+static void systrace_term(const struct uk_term_ctx *tctx __unused)
+{
+	__u64 dropped = 0;
+	unsigned int cpu;
+
+	systrace_flush();
+	for (cpu = 0; cpu < systrace_nrings; ++cpu)
+		dropped += systrace_rings[cpu].dropped;
+	if (dropped)
+		uk_pr_warn("systrace: %"PRIu64" records dropped\n", dropped);
+
+	if (systrace_fd >= 0) {
+		close(systrace_fd);
+		systrace_fd = -1;
+	}
+}
+
+uk_late_initcall(systrace_init, systrace_term);
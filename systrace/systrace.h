@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_SYSTRACE_H
+#define APPELFLOADER_SYSTRACE_H
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+
+/*
+ * Binary system call trace
+ *
+ * Every system call served by an elfloader-provided entry is recorded as a
+ * fixed-size record into a per-CPU ring buffer. A background thread drains
+ * the buffers to a file on the VFS or, hex-encoded, to the kernel console.
+ * `support/systrace-decode.py` renders the output as strace-like text.
+ *
+ * Output stream layout (little endian):
+ *   struct systrace_hdr, followed by any number of struct systrace_rec
+ *
+ * For system calls that take a path, the beginning of the path is copied
+ * into the record. Longer paths are truncated.
+ */
+#define SYSTRACE_MAGIC		"UKSYSTR1"
+#define SYSTRACE_VERSION	2
+#define SYSTRACE_PATHLEN	48
+
+struct systrace_hdr {
+	char magic[8];
+	__u32 version;
+	__u32 recsize;
+} __packed;
+
+struct systrace_rec {
+	__u16 nr;
+	__u16 cpu;
+	__u32 tid;
+	__u64 args[6];
+	__s64 ret;
+	__u64 ts_start;	/* monotonic clock, ns */
+	__u64 ts_end;	/* monotonic clock, ns */
+	char path[SYSTRACE_PATHLEN];	/* not NUL-terminated if truncated */
+} __packed;
+
+#if CONFIG_APPELFLOADER_SYSTRACE
+/**
+ * Records a completed system call into the ring buffer of the current CPU.
+ * The record is dropped if the buffer is full.
+ */
+void systrace_record(long nr, const long args[6], long ret,
+		     __nsec tstart, __nsec tend);
+
+/**
+ * Drains all ring buffers to the trace output synchronously
+ */
+void systrace_flush(void);
+#else /* !CONFIG_APPELFLOADER_SYSTRACE */
+#define systrace_record(nr, args, ret, tstart, tend) do {} while (0)
+#define systrace_flush() do {} while (0)
+#endif /* !CONFIG_APPELFLOADER_SYSTRACE */
+
+#endif /* APPELFLOADER_SYSTRACE_H */
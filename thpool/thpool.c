@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <errno.h>
+#include <string.h>
+#include <uk/alloc_impl.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#include <uk/sched.h>
+#include <uk/spinlock.h>
+#include <uk/thread.h>
+
+#include "thpool.h"
+
+/* Number of distinct block sizes that are recycled */
+#define THPOOL_NCLASSES		8
+/* Alignment of uk_malloc() */
+#define THPOOL_MINALIGN		16
+
+/* Precedes every block that the pool hands out */
+struct thpool_hdr {
+	struct thpool_hdr *next;	/* free list */
+	void *base;			/* block of the backing allocator */
+	__sz size;
+	__sz align;
+};
+
+struct thpool_class {
+	__sz size;			/* 0 if unused */
+	__sz align;
+	unsigned int count;
+	struct thpool_hdr *free;
+};
+
+static struct uk_alloc thpool_a;
+static struct uk_alloc *thpool_backing;
+static struct thpool_class thpool_classes[THPOOL_NCLASSES];
+static __spinlock thpool_lock = UK_SPINLOCK_INITIALIZER();
+
+/* Returns the class of a block size, claims an unused one if `add` is set */
+static struct thpool_class *thpool_class(__sz size, __sz align, int add)
+{
+	struct thpool_class *c, *unused = NULL;
+	unsigned int i;
+
+	for (i = 0; i < THPOOL_NCLASSES; ++i) {
+		c = &thpool_classes[i];
+		if (c->size == size && c->align == align)
+			return c;
+		if (!c->size && !unused)
+			unused = c;
+	}
+	if (!add || !unused)
+		return NULL;
+	unused->size = size;
+	unused->align = align;
+	return unused;
+}
+
+static void *thpool_get(__sz size, __sz align)
+{
+	struct thpool_hdr *hdr = NULL;
+	struct thpool_class *c;
+	__sz off;
+	void *base;
+
+	uk_spin_lock(&thpool_lock);
+	c = thpool_class(size, align, 0);
+	if (c && c->free) {
+		hdr = c->free;
+		c->free = hdr->next;
+		c->count--;
+	}
+	uk_spin_unlock(&thpool_lock);
+	if (hdr)
+		return hdr + 1;
+
+	off = ALIGN_UP(sizeof(*hdr), align);
+	base = uk_memalign(thpool_backing, align, off + size);
+	if (unlikely(!base))
+		return NULL;
+	hdr = (struct thpool_hdr *)((__u8 *)base + off) - 1;
+	hdr->base = base;
+	hdr->size = size;
+	hdr->align = align;
+	return hdr + 1;
+}
+
+static void thpool_free(struct uk_alloc *a __unused, void *ptr)
+{
+	struct thpool_hdr *hdr;
+	struct thpool_class *c;
+
+	if (!ptr)
+		return;
+	hdr = (struct thpool_hdr *)ptr - 1;
+
+	uk_spin_lock(&thpool_lock);
+	c = thpool_class(hdr->size, hdr->align, 1);
+	if (c && c->count < CONFIG_APPELFLOADER_THPOOL_SIZE) {
+		hdr->next = c->free;
+		c->free = hdr;
+		c->count++;
+		hdr = NULL;
+	}
+	uk_spin_unlock(&thpool_lock);
+	if (hdr)
+		uk_free(thpool_backing, hdr->base);
+}
+
+static void *thpool_malloc(struct uk_alloc *a __unused, __sz size)
+{
+	return thpool_get(size, THPOOL_MINALIGN);
+}
+
+static int thpool_posix_memalign(struct uk_alloc *a __unused, void **memptr,
+				 __sz align, __sz size)
+{
+	void *ptr;
+
+	if (unlikely(!align || (align & (align - 1))))
+		return EINVAL;
+
+	ptr = thpool_get(size, MAX(align, (__sz)THPOOL_MINALIGN));
+	if (unlikely(!ptr))
+		return ENOMEM;
+	*memptr = ptr;
+	return 0;
+}
+
+static void *thpool_realloc(struct uk_alloc *a, void *ptr, __sz size)
+{
+	struct thpool_hdr *hdr;
+	void *nptr;
+
+	if (!ptr)
+		return thpool_malloc(a, size);
+	if (!size) {
+		thpool_free(a, ptr);
+		return NULL;
+	}
+
+	hdr = (struct thpool_hdr *)ptr - 1;
+	if (size <= hdr->size)
+		return ptr;
+	nptr = thpool_get(size, hdr->align);
+	if (unlikely(!nptr))
+		return NULL;
+	memcpy(nptr, ptr, hdr->size);
+	thpool_free(a, ptr);
+	return nptr;
+}
+
+struct uk_alloc *thpool_alloc(void)
+{
+	return thpool_backing ? &thpool_a : uk_alloc_get_default();
+}
+
+static int thpool_init(struct uk_init_ctx *ictx __unused)
+{
+	struct uk_thread *t[CONFIG_APPELFLOADER_THPOOL_SIZE];
+	struct uk_sched *s;
+	unsigned int i, n;
+
+	thpool_backing = uk_alloc_get_default();
+	if (unlikely(!thpool_backing))
+		return -ENOMEM;
+	uk_alloc_init_malloc(&thpool_a, thpool_malloc, uk_calloc_compat,
+			     thpool_realloc, thpool_free,
+			     thpool_posix_memalign, uk_memalign_compat,
+			     NULL, NULL, NULL);
+
+	/* Thread containers of cloned threads */
+	uk_sched_foreach(s) {
+		s->a = &thpool_a;
+		s->a_auxstack = &thpool_a;
+		s->a_uktls = &thpool_a;
+	}
+
+	/*
+	 * Fill the pool with the blocks of a thread container, so that the
+	 * first threads do not need the default allocator either
+	 */
+	for (n = 0; n < ARRAY_SIZE(t); ++n) {
+		t[n] = uk_thread_create_container(&thpool_a,
+						  NULL, 0,
+						  &thpool_a, 0,
+						  &thpool_a,
+						  false,
+						  NULL,
+						  NULL, NULL);
+		if (unlikely(!t[n]))
+			break;
+	}
+	for (i = 0; i < n; ++i)
+		uk_thread_release(t[i]);
+
+	uk_pr_info("Thread container pool: %u containers preallocated\n", n);
+	return 0;
+}
+uk_late_initcall(thpool_init, 0x0);
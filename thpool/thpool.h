@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef APPELFLOADER_THPOOL_H
+#define APPELFLOADER_THPOOL_H
+
+#include <uk/config.h>
+#include <uk/alloc.h>
+#include <uk/essentials.h>
+
+/*
+ * Recycling allocator for thread containers
+ *
+ * Thread creation allocates blocks of a few fixed sizes: the `struct
+ * uk_thread`, the auxiliary stack and the TLS area (and, without virtual
+ * memory, the main stack). The pool is an allocator that keeps released
+ * blocks on a free list per size and alignment and hands them out again
+ * without a round-trip to the default allocator. It is installed as the
+ * allocator of all schedulers, which posix-process uses for the threads
+ * that the application creates with clone(), and elfloader uses it for the
+ * main threads of applications. Recycled blocks are not cleared, callers
+ * that need zeroed memory use uk_calloc().
+ */
+
+#if CONFIG_APPELFLOADER_THPOOL
+/**
+ * Returns the allocator for thread containers
+ */
+struct uk_alloc *thpool_alloc(void);
+#else /* !CONFIG_APPELFLOADER_THPOOL */
+#define thpool_alloc() uk_alloc_get_default()
+#endif /* !CONFIG_APPELFLOADER_THPOOL */
+
+#endif /* APPELFLOADER_THPOOL_H */
@@ -3,16 +3,17 @@
 #include <uk/assert.h>
 #include <uk/essentials.h>
 
+#include "../syscall_entry.h"
+
 long __kernel_vsyscall(long syscall_nr, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5)
 {
+	const long args[6] = { arg0, arg1, arg2, arg3, arg4, arg5 };
 	struct ukarch_sysregs sysregs;
 	long ret;
 
 	ukarch_sysregs_switch_uk_tls(&sysregs);
 
-	ret = uk_syscall6_r(syscall_nr,
-			    arg0, arg1, arg2,
-			    arg3, arg4, arg5);
+	ret = elf_syscall6(syscall_nr, args);
 
 	ukarch_sysregs_switch_ul_tls(&sysregs);
 